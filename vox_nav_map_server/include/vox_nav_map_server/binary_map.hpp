@@ -0,0 +1,168 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_MAP_SERVER__BINARY_MAP_HPP_
+#define VOX_NAV_MAP_SERVER__BINARY_MAP_HPP_
+
+#include <Eigen/Geometry>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace vox_nav_map_server
+{
+
+/**
+ * @brief Fixed size header at the start of a binary map file. Offsets are in bytes from the start
+ * of file and aligned to BinaryMap::ALIGNMENT, so arrays can be used in place once mapped.
+ * All values are in host byte order.
+ *
+ */
+struct BinaryMapHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t num_points;
+  // float arrays of num_points
+  uint64_t x_offset;
+  uint64_t y_offset;
+  uint64_t z_offset;
+  // uint32 packed rgba, same as pcl::PointXYZRGB::rgba. Regressed costs are encoded in colors
+  // the same way as in regressed clouds, see traversability_cost_from_color
+  uint64_t rgba_offset;
+  // voxel size points were downsampled with, 0 if they were not
+  double downsample_voxel_size;
+  uint64_t file_size;
+};
+
+static_assert(
+  std::is_trivially_copyable<BinaryMapHeader>::value,
+  "BinaryMapHeader is written and mapped as raw bytes");
+
+/**
+ * @brief Versioned binary map, a memory mapped file of point arrays. Opening a map only
+ * validates the header, nothing is parsed and arrays are read directly from the mapping.
+ * The octree is built by map_manager after georeferencing, so it is not stored here. map_manager works on pcl clouds, so it copies points out once
+ * with toPointCloud().
+ *
+ */
+class BinaryMap
+{
+public:
+  static constexpr uint32_t VERSION = 3;
+  static constexpr size_t ALIGNMENT = 64;
+
+  // points were regressed already, their colors encode traversability
+  static constexpr uint32_t REGRESSED = 1 << 0;
+  // points were downsampled and filtered already
+  static constexpr uint32_t PREPROCESSED = 1 << 1;
+
+  BinaryMap() = default;
+
+  /**
+   * @brief Unmaps the file
+   *
+   */
+  ~BinaryMap();
+
+  BinaryMap(const BinaryMap &) = delete;
+  BinaryMap & operator=(const BinaryMap &) = delete;
+
+  /**
+   * @brief true if filename has the binary map extension ".vnm"
+   *
+   * @param filename
+   * @return true
+   * @return false
+   */
+  static bool isBinaryMapFilename(const std::string & filename);
+
+  /**
+   * @brief Write cloud to filename in binary map format.
+   *  File is written next to filename and renamed, an interrupted write never leaves a valid map
+   *
+   * @param filename
+   * @param cloud
+   * @param flags REGRESSED and PREPROCESSED
+   * @param downsample_voxel_size
+   * @return true
+   * @return false
+   */
+  static bool write(
+    const std::string & filename,
+    const pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+    uint32_t flags,
+    double downsample_voxel_size);
+
+  /**
+   * @brief Map filename read only, returns false if it is not a valid binary map
+   *
+   * @param filename
+   * @return true
+   * @return false
+   */
+  bool open(const std::string & filename);
+
+  /**
+   * @brief Unmap the file, arrays returned before are invalid afterwards
+   *
+   */
+  void close();
+
+  inline bool isOpen() const {return data_ != nullptr;}
+
+  inline const BinaryMapHeader & header() const
+  {
+    return *reinterpret_cast<const BinaryMapHeader *>(data_);
+  }
+
+  inline bool hasFlag(uint32_t flag) const {return (header().flags & flag) != 0;}
+
+  inline size_t numPoints() const {return header().num_points;}
+
+  inline const float * x() const {return array<float>(header().x_offset);}
+  inline const float * y() const {return array<float>(header().y_offset);}
+  inline const float * z() const {return array<float>(header().z_offset);}
+  inline const uint32_t * rgba() const {return array<uint32_t>(header().rgba_offset);}
+
+  /**
+   * @brief Copy points into a pcl cloud, transformed on the way, a single pass over the
+   *  mapped arrays
+   *
+   * @param cloud
+   * @param transform applied to each point, e.g. pcd_map_transform
+   */
+  void toPointCloud(
+    pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+    const Eigen::Affine3f & transform = Eigen::Affine3f::Identity()) const;
+
+private:
+  template<typename T>
+  inline const T * array(uint64_t offset) const
+  {
+    return reinterpret_cast<const T *>(data_ + offset);
+  }
+
+  const uint8_t * data_ {nullptr};
+  size_t size_ {0};
+};
+
+}  // namespace vox_nav_map_server
+
+#endif  // VOX_NAV_MAP_SERVER__BINARY_MAP_HPP_
@@ -23,6 +23,9 @@
 #include <pcl/ModelCoefficients.h>
 #include <pcl/segmentation/sac_segmentation.h>
 
+#include <Eigen/Dense>
+
+#include <cstdint>
 #include <utility>
 #include <vector>
 
@@ -30,19 +33,103 @@ namespace vox_nav_map_server
 {
 
 /**
- * @brief Given a pointcloud, denoise it with use of K- neighbour points and return a pointer to denoised cloud
+ * @brief Range of a single cell inside DecomposedCells::indices
+ *
+ */
+struct CellSpan
+{
+  uint32_t offset;
+  uint32_t length;
+};
+
+/**
+ * @brief Compact result of cell decomposition. Instead of copying points of each cell into its own
+ * cloud, all cells share one flat buffer of indices into the decomposed cloud.
+ * Points of cell c are indices[spans[c].offset, spans[c].offset + spans[c].length).
+ *
+ */
+struct DecomposedCells
+{
+  // center of each cell, uniformly sampled nodes
+  std::vector<pcl::PointXYZRGB> centers;
+  // indices into decomposed cloud, cell by cell
+  std::vector<int> indices;
+  // range of each cell in indices
+  std::vector<CellSpan> spans;
+};
+
+/**
+ * @brief Tunable parameters of cost regression, see MapManager::regressCosts
+ *
+ */
+struct CostRegressionParams
+{
+  // radius of cells that the traversable cloud is decomposed into
+  double cell_radius {0.8};
+  // degrees, cells with steeper slope are marked as non traversable
+  double max_allowed_tilt {40.0};
+  double max_allowed_point_deviation {0.2};
+  double max_allowed_energy_gap {0.2};
+  // elevated nodes are placed this far above cell centers along plane normal
+  double node_elevation_distance {0.5};
+  double plane_fit_threshold {0.2};
+  bool include_node_centers_in_cloud {true};
+  // fit planes with RANSAC instead of least squares
+  bool robust_plane_fit {false};
+  // derive cell features from a MomentGrid instead of kNN decomposition, cells are then
+  // boxes of half width cell_radius and point deviation is RMS instead of mean absolute,
+  // see MomentGrid::cellFeatures
+  bool use_moment_grid {false};
+  double moment_grid_resolution {0.2};
+};
+
+/**
+ * @brief Reusable structure of arrays buffers that compute_cell_features gathers points of a cell into.
+ * Keep one per thread to avoid allocating per cell.
+ *
+ */
+struct CellPointBuffer
+{
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+};
+
+/**
+ * @brief Geometric features of a cell, see compute_cell_features
+ *
+ */
+struct CellFeatures
+{
+  // a, b, c, d of plane ax + by + cz + d = 0, normal is unit length
+  pcl::ModelCoefficients plane_model;
+  // same as absolute_rpy_from_plane(plane_model)
+  double roll;
+  double pitch;
+  double yaw;
+  // same as average_point_deviation_from_plane(plane_model)
+  double average_point_deviation;
+  // height difference between highest and lowest point of cell
+  double z_range;
+};
+
+/**
+ * @brief Given a pointcloud, denoise it with use of neighbour points within radius and return a pointer to denoised cloud.
+ * Neighbours are counted with a VoxelNeighbourIndex, points are processed in parallel.
  *
  * @param cloud
  * @param radius
  * @param tolerated_divergence_rate
  * @param min_num_neighbours
+ * @param num_threads 0 means use all cores
  * @return pcl::PointCloud<pcl::PointXYZRGB>::Ptr
  */
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr denoise_segmented_cloud(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const double radius,
   const double tolerated_divergence_rate,
-  const int min_num_neighbours);
+  const int min_num_neighbours,
+  const int num_threads = 0);
 
 /**
  * @brief Get the traversable points object,
@@ -96,6 +183,20 @@ std::vector<std::pair<pcl::PointXYZRGB,
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr uniformly_sampled_nodes,
   const double radius);
 
+/**
+ * @brief Same as decompose_traversability_cloud, but cells are returned as index spans
+ * into pure_traversable_pcl, so that no point is copied.
+ *
+ * @param pure_traversable_pcl
+ * @param uniformly_sampled_nodes
+ * @param radius
+ * @return DecomposedCells
+ */
+DecomposedCells decompose_traversability_cloud_into_spans(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr pure_traversable_pcl,
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr uniformly_sampled_nodes,
+  const double radius);
+
 /**
  * @brief This function is used o fit a plane model to each cell of traversability cloud.
  *
@@ -107,6 +208,21 @@ pcl::ModelCoefficients fit_plane_to_cloud(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const double dist_thes);
 
+/**
+ * @brief fit_plane_to_cloud overload that uses only the points of given cell span.
+ *
+ * @param cloud
+ * @param indices
+ * @param span
+ * @param dist_thes
+ * @return pcl::ModelCoefficients
+ */
+pcl::ModelCoefficients fit_plane_to_cloud(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const double dist_thes);
+
 /**
  * @brief Set the cloud color object. Paints clouds color to given colors.
  * Colors must be a vector with size of 3. Incrementally values corresponds to
@@ -120,6 +236,23 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr set_cloud_color(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const std::vector<double> colors);
 
+/**
+ * @brief set_cloud_color overload for a cell span. Points of the span are painted to given colors
+ * and appended to colored_cloud, source cloud is left untouched.
+ *
+ * @param cloud
+ * @param indices
+ * @param span
+ * @param colors
+ * @param colored_cloud
+ */
+void set_cloud_color(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const std::vector<double> colors,
+  pcl::PointCloud<pcl::PointXYZRGB> & colored_cloud);
+
 /**
  * @brief given plane model, calculate yaw pitch roll from this plane
  *
@@ -142,6 +275,21 @@ double average_point_deviation_from_plane(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const pcl::ModelCoefficients plane_model);
 
+/**
+ * @brief average_point_deviation_from_plane overload that uses only the points of given cell span.
+ *
+ * @param cloud
+ * @param indices
+ * @param span
+ * @param plane_model
+ * @return double
+ */
+double average_point_deviation_from_plane(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const pcl::ModelCoefficients plane_model);
+
 /**
  * @brief Finds min and max height differnce between edge points.
  * Perfroms a simple physics based energy differnce.
@@ -155,6 +303,122 @@ double max_energy_gap_in_cloud(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const double m,
   const double v);
+
+/**
+ * @brief max_energy_gap_in_cloud overload that uses only the points of given cell span.
+ *
+ * @param cloud
+ * @param indices
+ * @param span
+ * @param m
+ * @param v
+ * @return double
+ */
+double max_energy_gap_in_cloud(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const double m,
+  const double v);
+
+/**
+ * @brief Computes all geometric features of a cell in two passes over structure of arrays buffers.
+ * First pass accumulates centered moments and z range, plane is then the least squares (PCA) fit
+ * through the moments. Second pass accumulates the absolute deviations from that plane.
+ * If robust_plane_fit is true, RANSAC plane of fit_plane_to_cloud is used instead of PCA plane.
+ * Cells with less than 3 points get a horizontal plane through their mean.
+ *
+ * @param cloud
+ * @param indices
+ * @param span
+ * @param buffer
+ * @param robust_plane_fit
+ * @param dist_thes RANSAC distance threshold, only used if robust_plane_fit is true
+ * @return CellFeatures
+ */
+CellFeatures compute_cell_features(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  CellPointBuffer & buffer,
+  const bool robust_plane_fit = false,
+  const double dist_thes = 0.2);
+
+/**
+ * @brief Least squares plane normal given covariance of points, pointing upwards (positive z).
+ *
+ * @param covariance
+ * @param smallest_eigenvalue if not null, set to variance of points along the normal
+ * @return Eigen::Vector3d
+ */
+Eigen::Vector3d plane_normal_from_covariance(
+  const Eigen::Matrix3d & covariance,
+  double * smallest_eigenvalue = nullptr);
+
+/**
+ * @brief Energy gap of max_energy_gap_in_cloud, given height range of cloud
+ *
+ * @param z_range
+ * @param m
+ * @param v
+ * @return double
+ */
+double max_energy_gap_from_height_range(
+  const double z_range,
+  const double m,
+  const double v);
+
+/**
+ * @brief Color that encodes traversability cost of a cell with given features.
+ * Too steep cells are red, otherwise green fades to blue as cost increases.
+ *
+ * @param features
+ * @param params
+ * @return std::vector<double>
+ */
+std::vector<double> cost_color_from_cell_features(
+  const CellFeatures & features,
+  const CostRegressionParams & params);
+
+/**
+ * @brief Decode traversability cost that octomap nodes store from color of a regressed point.
+ * Traversable points range in [0, 1] from green to blue, non traversable (red) points are 2
+ * and elevated nodes (yellow) are 3.
+ *
+ * @param point
+ * @return double
+ */
+double traversability_cost_from_color(const pcl::PointXYZRGB & point);
+
+/**
+ * @brief Node elevated above the cell center along the plane normal of cell.
+ *
+ * @param cell_center
+ * @param features
+ * @param params
+ * @return pcl::PointXYZRGB
+ */
+pcl::PointXYZRGB elevated_node_from_cell_features(
+  const pcl::PointXYZRGB & cell_center,
+  const CellFeatures & features,
+  const CostRegressionParams & params);
+
+/**
+ * @brief Regress traversability costs of decomposed cells and merge them in cell order.
+ * Cells are regressed concurrently, each into its own slot, and merged afterwards in a fixed
+ * order, so the result is identical for any number of threads.
+ *
+ * @param cloud traversable cloud that cells index into
+ * @param decomposed_cells
+ * @param params
+ * @param num_threads
+ * @return pcl::PointCloud<pcl::PointXYZRGB> colored cell points followed by elevated nodes
+ */
+pcl::PointCloud<pcl::PointXYZRGB> regress_decomposed_cells(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const DecomposedCells & decomposed_cells,
+  const CostRegressionParams & params,
+  const int num_threads);
 }  // namespace vox_nav_map_server
 
 #endif  // VOX_NAV_MAP_SERVER__COST_REGRESSION_UTILS_HPP_
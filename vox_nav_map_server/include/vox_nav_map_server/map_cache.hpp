@@ -0,0 +1,164 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_MAP_SERVER__MAP_CACHE_HPP_
+#define VOX_NAV_MAP_SERVER__MAP_CACHE_HPP_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <vox_nav_utilities/traversability_octree.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace vox_nav_map_server
+{
+
+/**
+ * @brief expands a leading ~ in path to $HOME
+ *
+ */
+std::string expand_home_directory(const std::string & path);
+
+/**
+ * @brief Incremental 64 bit FNV-1a hash, used to build cache keys
+ *
+ */
+class CacheKeyHasher
+{
+public:
+  /**
+   * @brief hash raw bytes
+   *
+   */
+  void add(const void * data, size_t size);
+
+  /**
+   * @brief hash a double, values are rounded to 1e-9 so that tiny parsing
+   * differences do not invalidate the cache
+   *
+   */
+  void add(double value);
+
+  /**
+   * @brief hash an integral value
+   *
+   */
+  void add(int64_t value);
+
+  /**
+   * @brief hash a string
+   *
+   */
+  void add(const std::string & value);
+
+  /**
+   * @brief hash absolute path, size and modification time of a file, so a changed file gets a
+   * new key without reading it. Returns false if file does not exist
+   *
+   */
+  bool addFileIdentity(const std::string & filename);
+
+  /**
+   * @brief current hash as 16 hex digits
+   *
+   */
+  std::string hex() const;
+
+private:
+  uint64_t state_ {14695981039346656037ULL};
+};
+
+/**
+ * @brief Directory of regressed clouds and finished octrees, named after the hash of everything
+ * that was used to create them. Regressed clouds are stored as binary PCD, octrees in .ot format.
+ *
+ */
+class MapCache
+{
+public:
+  /**
+   * @brief Construct a new Map Cache object, directory is created if it does not exist.
+   * A leading ~ in directory is expanded to $HOME
+   *
+   * @param directory
+   */
+  explicit MapCache(const std::string & directory);
+
+  /**
+   * @brief Load a regressed cloud with given key, returns false on cache miss
+   *
+   * @param key
+   * @param cloud
+   * @return true
+   * @return false
+   */
+  bool loadCloud(const std::string & key, pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud) const;
+
+  /**
+   * @brief Store a regressed cloud with given key
+   *
+   * @param key
+   * @param cloud
+   * @return true
+   * @return false
+   */
+  bool saveCloud(const std::string & key, const pcl::PointCloud<pcl::PointXYZRGB> & cloud) const;
+
+  /**
+   * @brief Load an octree with given key, returns nullptr on cache miss
+   *
+   * @param key
+   * @return std::shared_ptr<vox_nav_utilities::TraversabilityOcTree>
+   */
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> loadOctree(
+    const std::string & key) const;
+
+  /**
+   * @brief Store an octree with given key
+   *
+   * @param key
+   * @param tree
+   * @return true
+   * @return false
+   */
+  bool saveOctree(
+    const std::string & key,
+    vox_nav_utilities::TraversabilityOcTree & tree) const;
+
+  /**
+   * @brief Remove all cached files, which are the files path() names and their temporaries.
+   * Other files in the directory are left alone.
+   *
+   */
+  void clear() const;
+
+private:
+  std::string path(const std::string & key, const std::string & extension) const;
+
+  /**
+   * @brief true if filename is a key of CacheKeyHasher::hex() followed by .pcd or .ot,
+   * optionally with the .tmp suffix of an interrupted write
+   *
+   * @param filename name without directory
+   */
+  static bool isCacheFilename(const std::string & filename);
+
+  std::string directory_;
+};
+
+}  // namespace vox_nav_map_server
+
+#endif  // VOX_NAV_MAP_SERVER__MAP_CACHE_HPP_
@@ -32,11 +32,25 @@
 
 #include <visualization_msgs/msg/marker_array.hpp>
 #include <sensor_msgs/msg/point_cloud2.hpp>
+#include <sensor_msgs/msg/nav_sat_fix.hpp>
+#include <std_msgs/msg/u_int64.hpp>
 #include <nav_msgs/msg/odometry.hpp>
 #include <robot_localization/srv/from_ll.hpp>
 #include <vox_nav_map_server/cost_regression_utils.hpp>
+#include <vox_nav_map_server/moment_grid.hpp>
+#include <vox_nav_map_server/map_cache.hpp>
+#include <vox_nav_map_server/binary_map.hpp>
+#include <vox_nav_map_server/tiled_map_store.hpp>
+#include <vox_nav_msgs/msg/map_pipeline_status.hpp>
 #include <vox_nav_msgs/msg/oriented_nav_sat_fix.hpp>
+#include <vox_nav_msgs/srv/get_cell_statistics.hpp>
+#include <vox_nav_msgs/srv/get_octomap.hpp>
+#include <vox_nav_msgs/srv/get_point_cloud.hpp>
+#include <vox_nav_utilities/geodetic_conversions.hpp>
 #include <vox_nav_utilities/pcl_helpers.hpp>
+#include <vox_nav_utilities/pcd_stream_reader.hpp>
+#include <vox_nav_utilities/tf_helpers.hpp>
+#include <vox_nav_utilities/traversability_octree.hpp>
 
 #include <octomap_msgs/msg/octomap.hpp>
 #include <octomap_msgs/conversions.h>
@@ -44,15 +58,20 @@
 #include <octomap/octomap_utils.h>
 
 #include <pcl/common/common.h>
+#include <pcl/common/io.h>
+#include <pcl/filters/crop_box.h>
 #include <pcl/common/transforms.h>
 #include <pcl/conversions.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/kdtree/kdtree_flann.h>
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl_ros/transforms.hpp>
 
 #include <vector>
 #include <string>
+#include <future>
+#include <unordered_map>
 #include <memory>
 #include <mutex>
 
@@ -65,6 +84,8 @@
  */
 namespace vox_nav_map_server
 {
+using MapPipelineStatus = vox_nav_msgs::msg::MapPipelineStatus;
+
 /**
  * @brief
  *
@@ -85,35 +106,199 @@ public:
   ~MapManager();
 
   /**
-  * @brief periodically called function to publish octomap and its pointcloud data
+  * @brief periodically called function to publish octomap and its pointcloud data.
+  *  Never blocks, it polls the map preparation worker and georeference request,
+  *  starts building the octree once both are done and publishes the map once it is built
   *
   */
   void timerCallback();
 
+  /**
+   * @brief Runs on a worker thread started by constructor: loads the map from cache, tiles
+   *  or disk, filters and regresses it. Progress is published on map_pipeline_status
+   *
+   * @return true if a map is ready to be georeferenced
+   * @return false if map could not be loaded
+   */
+  bool prepareMap();
+
+  /**
+   * @brief Loads pcd map from disk, downsamples, filters and applies pcd_map_transform to it.
+   *  PCD files are streamed through a voxel accumulator, so peak memory is bounded by the
+   *  downsampled map.
+   *  Files with .vnm extension are memory mapped binary maps, downsampling and filters are
+   *  skipped if the map was preprocessed and the map is used as it is if it was regressed.
+   *  Points of those are transformed while they are copied out of the mapping
+   *
+   * @return true
+   * @return false if map could not be read
+   */
+  bool preprocessPcdMap();
+
+  /**
+   * @brief Cuts regressed pcd_map_pointcloud_ into tiles of tiled_map_store_ and drops the
+   *  whole map, keeps serving the whole map if tiles could not be written
+   *
+   */
+  void writeMapTiles();
+
+  /**
+   * @brief Downsamples and filters pcd_map_pointcloud_
+   *
+   * @param is_downsampled true if cloud was downsampled while reading already
+   */
+  void preprocessLoadedCloud(bool is_downsampled);
+
+  /**
+   * @brief Key of the regressed cloud in map cache and tiled map store,
+   *  hash of pcd file path, size, modification time and every parameter that changes the
+   *  regressed cloud
+   *
+   * @return std::string
+   */
+  std::string regressedCloudCacheKey();
+
+  /**
+   * @brief In tiled mode, requests tiles around robot from tiled_map_store_ and rebuilds the
+   *  served map from resident tiles whenever a tile was loaded or evicted.
+   *  Tiles within tiled_map.resident_radius are requested first,
+   *  a ring of one more tile around them is prefetched. The map is rebuilt off the executor
+   *  by buildResidentMap() and swapped in once ready, starting a new map epoch.
+   *
+   */
+  void updateResidentTiles();
+
+  // Everything served that is built from resident tiles, see buildResidentMap()
+  struct ResidentMap
+  {
+    size_t num_tiles {0};
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud;
+    sensor_msgs::msg::PointCloud2::SharedPtr cloud_msg;
+    std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> octree;
+    octomap_msgs::msg::Octomap::SharedPtr octomap_msg;
+    visualization_msgs::msg::MarkerArray markers;
+    std::shared_ptr<MomentGrid> moment_grid;
+  };
+
+  /**
+   * @brief Merges resident tiles, aligns them to map frame and builds octree, messages and
+   *  cell statistics from them. Runs on resident_map_future_, touches no served member
+   *
+   * @param static_map_to_map_transfrom
+   * @return std::shared_ptr<ResidentMap>
+   */
+  std::shared_ptr<ResidentMap> buildResidentMap(
+    const tf2::Transform & static_map_to_map_transfrom);
+
   /**
    * @brief once map is georefnced, this function
-   *  is called from timerCallback to publish map
+   *  is called from timerCallback to publish map.
+   *  In "latched" mode map is only published when map epoch has changed since last publish
    *
    */
   void publishAlignedMap();
 
   /**
-   * @brief publishes octomap as visualization msgs
+   * @brief Increments map epoch, call this whenever contents of the published map change.
+   *  Published messages are stamped with time of the epoch, not with time of publishing,
+   *  so subscribers can tell a new map from a repeated one
    *
-   * @param tree
    */
-  void fillOctomapMarkers(const octomap::ColorOcTree & tree);
+  void markMapChanged();
+
+  /**
+   * @brief Serves the part of octomap within requested axis aligned box. A leaf_size coarser than
+   *  octomap_voxel_size selects a shallower octree depth, whose nodes carry max cost and union
+   *  of classes of the leafs below them. Only nodes inside the box are visited.
+   *
+   * @param request
+   * @param response
+   */
+  void getOctomapCallback(
+    const std::shared_ptr<vox_nav_msgs::srv::GetOctomap::Request> request,
+    std::shared_ptr<vox_nav_msgs::srv::GetOctomap::Response> response);
+
+  /**
+   * @brief Serves points of the regressed map within requested axis aligned box,
+   *  downsampled to leaf_size if it is coarser than octomap_voxel_size
+   *
+   * @param request
+   * @param response
+   */
+  void getPointCloudCallback(
+    const std::shared_ptr<vox_nav_msgs::srv::GetPointCloud::Request> request,
+    std::shared_ptr<vox_nav_msgs::srv::GetPointCloud::Response> response);
 
   /**
-   * @brief given GPS lat long alt coordinates uses
-   *        robot_localization service to georefence this map
+   * @brief Serves plane, slope, roughness and height range of traversable map points within
+   *  square cells of requested radius, read from moment_grid_ without touching the cloud
    *
    * @param request
    * @param response
    */
-  void fromGPSPoseToMapPose(
-    const robot_localization::srv::FromLL::Request::SharedPtr request,
-    robot_localization::srv::FromLL::Response::SharedPtr response);
+  void getCellStatisticsCallback(
+    const std::shared_ptr<vox_nav_msgs::srv::GetCellStatistics::Request> request,
+    std::shared_ptr<vox_nav_msgs::srv::GetCellStatistics::Response> response);
+
+  /**
+   * @brief Copy nodes of octomap_octree_ within [min, max] into a new tree,
+   *  nodes are taken at given depth of octomap_octree_
+   *
+   * @param min
+   * @param max
+   * @param depth
+   * @return std::shared_ptr<vox_nav_utilities::TraversabilityOcTree>
+   */
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> cropOctomap(
+    const octomap::point3d & min,
+    const octomap::point3d & max,
+    unsigned int depth);
+
+  /**
+   * @brief publishes octomap as visualization msgs
+   *
+   * @param tree
+   * @param markers
+   */
+  void fillOctomapMarkers(
+    const vox_nav_utilities::TraversabilityOcTree & tree,
+    visualization_msgs::msg::MarkerArray & markers);
+
+  /**
+   * @brief Sets static_map_to_map_transform_ from map_coordinates, returns right away if
+   *        that is not possible yet. map_coordinates are converted in process, in the utm zone
+   *        of navsat fixes, once the utm frame broadcast by navsat_transform_node is available.
+   *        Without it, robot_localization's /fromLL service is asked once navsat odometry is
+   *        published. Its response is handled by the executor, the service is asked again if
+   *        the response is invalid or does not come within georeference_request_timeout
+   *
+   */
+  void requestGeoreference();
+
+  /**
+   * @brief Marks static map as georeferenced and drops the navsat subscriptions
+   *
+   * @param message for georeference stage of pipeline status
+   */
+  void onGeoreferenced(const std::string & message);
+
+  /**
+   * @brief Set state of one stage and publish the pipeline status, callable from any thread
+   *
+   * @param stage member of MapPipelineStatus, e.g. &MapPipelineStatus::regress
+   * @param state MapPipelineStatus::PENDING, RUNNING, DONE, SKIPPED or FAILED
+   * @param message kept from before if empty
+   */
+  void setPipelineStage(
+    uint8_t MapPipelineStatus::* stage, uint8_t state,
+    const std::string & message);
+
+  /**
+   * @brief Mark stages of map preparation that are running as failed
+   *
+   * @param message
+   */
+  void failRunningPipelineStages(const std::string & message);
 
   /**
    * @brief
@@ -122,8 +307,129 @@ public:
    */
   void alignStaticMapToMap(const tf2::Transform & static_map_to_map_transfrom);
 
+  /**
+   * @brief tf2 transform as an Eigen transform for transformCloudInPlace()
+   *
+   * @param transform
+   * @return Eigen::Affine3f
+   */
+  static Eigen::Affine3f toAffine3f(const tf2::Transform & transform);
+
+  /**
+   * @brief Fills octree from cloud, cost and class of each node are
+   *        decoded from point colors. In "occupied_only" mode, each leaf is inserted once with the
+   *        max or mean cost of its points and without ray casting, in "raycast" mode
+   *        free space between origin and points is carved as well.
+   *
+   */
+  void buildOctomapFromCloud(
+    const pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+    vox_nav_utilities::TraversabilityOcTree & octree);
+
+  /**
+   * @brief Regresses a traversability cost for each cell of the pcd map and recolors
+   *        the points accordingly. Cells are processed in parallel with
+   *        cost_regression_num_threads_ threads, the result does not depend on thread count.
+   *        Features of each cell are computed by compute_cell_features.
+   *
+   */
   void regressCosts();
 
+  /**
+   * @brief Regresses costs of traversable points from a MomentGrid, used instead of
+   *        cell decomposition when cost_regression.use_moment_grid is true.
+   *        Features of a cell are summed from moments of its columns, so this is fast enough to
+   *        re-regress costs while tuning the cost_regression parameters.
+   *
+   * @param pure_traversable_pcl
+   * @param uniformly_sampled_nodes
+   * @return pcl::PointCloud<pcl::PointXYZRGB> colored traversable points and elevated nodes
+   */
+  pcl::PointCloud<pcl::PointXYZRGB> regressCostsWithMomentGrid(
+    const pcl::PointCloud<pcl::PointXYZRGB>::Ptr pure_traversable_pcl,
+    const pcl::PointCloud<pcl::PointXYZRGB>::Ptr uniformly_sampled_nodes);
+
+  /**
+   * @brief Takes a labelled sensor cloud, green points are traversable, and updates costs of the
+   *  octree leaves it touches, see applyLiveCloud(). Changed leaves are published right away as
+   *  an octree delta on octomap_updates, the full map, its point cloud and markers are
+   *  republished at most every live_updates.full_map_period seconds.
+   *  Clouds in other frames are transformed into map frame.
+   *
+   * @param msg
+   */
+  void liveCloudCallback(const sensor_msgs::msg::PointCloud2::ConstSharedPtr msg);
+
+  /**
+   * @brief Indexes static traversable points of pcd_map_pointcloud_ and centers of its cells,
+   *  sampled the same way as regressCosts does, for applyLiveCloud(). Rebuilt once per map epoch
+   *
+   */
+  void updateLiveCellIndex();
+
+  /**
+   * @brief Regresses costs of cloud, which is in map frame, into octomap_octree_.
+   *  Cells are those of the static map, spheres of cost_regression.cell_radius around its
+   *  sampled centers, and new points on terrain the static map lacks get cells sampled from
+   *  them. Each touched cell is regressed from its static points together with the new points,
+   *  in parallel, the same way regressCosts does.
+   *  Work per cloud is bounded, at most live_updates.max_cells_per_message cells are
+   *  regressed. Cells left over by earlier clouds go first, then the most populated new ones,
+   *  new points of the remaining cells are queued in pending_live_points_ for the next clouds.
+   *  Non traversable points are inserted as they are.
+   *  Only inner nodes above changed leaves are updated. Each changed leaf is kept in
+   *  live_leaves_ together with what the static map had there.
+   *
+   * @param cloud
+   * @return std::vector<octomap::OcTreeKey> keys of changed leaves
+   */
+  std::vector<octomap::OcTreeKey> applyLiveCloud(const pcl::PointCloud<pcl::PointXYZRGB> & cloud);
+
+  /**
+   * @brief Reverts live leaves that were not observed for live_updates.decay_time seconds to
+   *  the static map, so obstacles that went away are cleared. Leaves the static map did not
+   *  have are deleted. Reverted leaves are published as a delta on octomap_updates
+   *
+   */
+  void decayLiveLeaves();
+
+  /**
+   * @brief Publishes final state of leaves at keys as a TraversabilityOcTree delta on
+   *  octomap_updates. Leaves that were deleted go out as free leaves.
+   *  Deltas are stamped when published, a full map carries all deltas stamped before it
+   *
+   * @param keys
+   */
+  void publishOctomapUpdate(const std::vector<octomap::OcTreeKey> & keys);
+
+  /**
+   * @brief Rebuilds octomap_pointcloud_ros_msg_ from the static map, points within live leaves
+   *  are replaced with one point at the center of each leaf, colored like its costliest point
+   *
+   */
+  void updateLiveCloudMsg();
+
+  /**
+   * @brief Packs a key into 48 bits, to index leaves in hash maps and sort them
+   *
+   */
+  static inline uint64_t packKey(const octomap::OcTreeKey & key)
+  {
+    return static_cast<uint64_t>(key[0]) |
+           (static_cast<uint64_t>(key[1]) << 16) |
+           (static_cast<uint64_t>(key[2]) << 32);
+  }
+
+  /**
+   * @brief Serialize octree into msg, e.g. octomap_octree_ into octomap_ros_msg_
+   *
+   * @param octree
+   * @param msg
+   */
+  void updateOctomapMsg(
+    const vox_nav_utilities::TraversabilityOcTree & octree,
+    octomap_msgs::msg::Octomap & msg);
+
 protected:
   // Used to creted a periodic callback function IOT publish transfrom/octomap/cloud etc.
   rclcpp::TimerBase::SharedPtr timer_;
@@ -131,11 +437,18 @@ protected:
   rclcpp::Publisher<octomap_msgs::msg::Octomap>::SharedPtr octomap_publisher_;
   // publishes octomap in form of a point cloud message
   rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr octomap_pointloud_publisher_;
+  // publishes current map epoch, latched as well
+  rclcpp::Publisher<std_msgs::msg::UInt64>::SharedPtr map_epoch_publisher_;
+  // region of interest queries on map
+  rclcpp::Service<vox_nav_msgs::srv::GetOctomap>::SharedPtr get_octomap_service_;
+  rclcpp::Service<vox_nav_msgs::srv::GetPointCloud>::SharedPtr get_pointcloud_service_;
+  rclcpp::Service<vox_nav_msgs::srv::GetCellStatistics>::SharedPtr get_cell_statistics_service_;
+  // publishes results of region of interest queries if requested, full map topics are not touched
+  rclcpp::Publisher<octomap_msgs::msg::Octomap>::SharedPtr roi_octomap_publisher_;
+  rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr roi_pointcloud_publisher_;
   // robot_localization package provides a service to convert
   // lat,long,al GPS cooordinates to x,y,z map points
   rclcpp::Client<robot_localization::srv::FromLL>::SharedPtr robot_localization_fromLL_client_;
-  // clint node used for spinning the service callback of robot_localization_fromLL_client_
-  rclcpp::Node::SharedPtr robot_localization_fromLL_client_node_;
   // reusable octomap point loud message, dont need to recreate each time we publish
   sensor_msgs::msg::PointCloud2::SharedPtr octomap_pointcloud_ros_msg_;
   // reusable octomp message, dont need to recreate each time we publish
@@ -143,7 +456,7 @@ protected:
   // we read gps coordinates of map from yaml
   vox_nav_msgs::msg::OrientedNavSatFix::SharedPtr static_map_gps_pose_;
   // otree object to read and store binary octomap from disk
-  std::shared_ptr<octomap::ColorOcTree> octomap_octree_;
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> octomap_octree_;
   // rclcpp parameters from yaml file: full path to octomap file in disk
   std::string pcd_map_filename_;
   // Pointcloud map is stroed here
@@ -155,6 +468,17 @@ protected:
   // rclcpp parameters from yaml file: frame id for map typicall: "map"
   std::string map_frame_id_;
   std::string utm_frame_id_;
+  // rclcpp parameters from yaml file: topics navsat_transform_node takes fixes from and
+  // publishes odometry on, until georeferenced
+  std::string navsat_fix_topic_;
+  std::string navsat_odometry_topic_;
+  rclcpp::Subscription<sensor_msgs::msg::NavSatFix>::SharedPtr navsat_fix_subscriber_;
+  rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr navsat_odometry_subscriber_;
+  // utm zone of latest navsat fix, 0 until one is received
+  int navsat_utm_zone_ {0};
+  bool navsat_is_north_ {true};
+  // set once navsat odometry is published, /fromLL answers are meaningful afterwards
+  bool is_navsat_ready_ {false};
   // rclcpp parameters from yaml file: vxel size for octomap
   double octomap_voxel_size_;
   // see navsat_transform_node from robot_localization
@@ -165,8 +489,30 @@ protected:
   // rclcpp parameters from yaml file: if true, a cloud will be published which represents octomap
   bool publish_octomap_as_pointcloud_;
   bool publish_octomap_markers_;
+  // rclcpp parameters from yaml file: "latched" publishes once per map epoch with
+  // transient local durability, "periodic" republishes at octomap_publish_frequency
+  std::string map_publish_mode_;
+  // incremented each time map changes, 0 means no map is available yet
+  uint64_t map_epoch_ {0};
+  // epoch that was published last
+  uint64_t published_map_epoch_ {0};
+  // time at which current map epoch started
+  rclcpp::Time map_epoch_stamp_;
   // we need to align static map to map only once, since it is static !
-  std::once_flag align_static_map_once_;
+  bool is_georeference_requested_ {false};
+  // rclcpp parameters from yaml file: seconds to wait for a /fromLL response before asking again
+  double georeference_request_timeout_;
+  rclcpp::Time georeference_request_stamp_;
+  // id of the /fromLL request in flight, responses to earlier requests are ignored
+  uint64_t georeference_request_id_ {0};
+  bool is_georeferenced_ {false};
+  // set once map preparation worker finished successfully
+  bool is_map_prepared_ {false};
+  bool is_octree_build_started_ {false};
+  // progress of map preparation, published latched on each change
+  rclcpp::Publisher<MapPipelineStatus>::SharedPtr pipeline_status_publisher_;
+  MapPipelineStatus pipeline_status_;
+  std::mutex pipeline_status_mutex_;
   // tf buffer to get access to transfroms
   std::shared_ptr<tf2_ros::Buffer> tf_buffer_;
   std::shared_ptr<tf2_ros::TransformListener> tf_listener_;
@@ -181,8 +527,88 @@ protected:
   double remove_outlier_radius_search_;
   int remove_outlier_min_neighbors_in_radius_;
   bool apply_filters_;
+  // number of threads reading and downsampling pcd map, 0 means use all cores
+  int pcd_map_reader_num_threads_;
+  // number of threads used while regressing costs, 0 means use all cores
+  int cost_regression_num_threads_;
+  // rclcpp parameters from yaml file: constants used in cost regression
+  CostRegressionParams cost_regression_params_;
+  // rclcpp parameters from yaml file: statistics of map cells are served to planners
+  bool cell_statistics_enabled_;
+  double cell_statistics_resolution_;
+  // moments of traversable points of the served map in map frame, rebuilt with the octree
+  std::shared_ptr<MomentGrid> moment_grid_;
+  // rclcpp parameters from yaml file: "occupied_only" or "raycast"
+  std::string octomap_build_mode_;
+  // rclcpp parameters from yaml file: "max" or "mean" cost of points that fall into same node
+  std::string octomap_cost_aggregation_;
+  // rclcpp parameters from yaml file: regressed cloud and octomap can be cached on disk
+  bool map_cache_enabled_;
+  std::string map_cache_directory_;
+  // clear cache on startup, forcing the map to be regressed again
+  bool map_cache_invalidate_;
+  std::shared_ptr<MapCache> map_cache_;
+  std::string regressed_cloud_cache_key_;
+  // if true, pcd_map_pointcloud_ was loaded already regressed from cache
+  bool is_regressed_cloud_cached_ {false};
+  // rclcpp parameters from yaml file: regressed map can be split into tiles on disk,
+  // only tiles around robot are then kept in memory and served
+  bool tiled_map_enabled_;
+  std::string tiled_map_directory_;
+  double tiled_map_tile_size_;
+  double tiled_map_resident_radius_;
+  int tiled_map_max_resident_tiles_;
+  std::string robot_frame_id_;
+  std::shared_ptr<TiledMapStore> tiled_map_store_;
+  // if true, tiles on disk were cut from current regressed map and need not be written again
+  bool is_tiled_map_stored_ {false};
+  // set once georeferenced, resident tiles are aligned with it each time they change
+  tf2::Transform static_map_to_map_transform_;
+  // rclcpp parameters from yaml file: labelled sensor clouds update costs of the served octree
+  bool live_updates_enabled_;
+  std::string live_updates_topic_;
+  int live_updates_max_cells_per_message_;
+  double live_updates_full_map_period_;
+  double live_updates_decay_time_;
+  // A leaf changed by live updates, with what the static map had there to revert to
+  struct LiveLeaf
+  {
+    octomap::OcTreeKey key;
+    // false if static map had no leaf there, the leaf is deleted once it decays
+    bool is_static {false};
+    float log_odds {0.0f};
+    uint8_t cost {0};
+    uint8_t class_bits {0};
+    rclcpp::Time last_observed;
+    // center of the leaf, colored like its costliest point of the last observation
+    pcl::PointXYZRGB point;
+  };
+  // indexed by packKey()
+  std::unordered_map<uint64_t, LiveLeaf> live_leaves_;
+  // traversable points of cells that live clouds had no room for, in arrival order. Holds at
+  // most kMaxPendingLiveMessages times live_updates.max_cells_per_message cells
+  pcl::PointCloud<pcl::PointXYZRGB> pending_live_points_;
+  static constexpr size_t kMaxPendingLiveMessages = 4;
+  // static traversable points and centers of their cells, see updateLiveCellIndex()
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr live_static_traversable_;
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr live_cell_centers_;
+  pcl::KdTreeFLANN<pcl::PointXYZRGB> live_static_kdtree_;
+  pcl::KdTreeFLANN<pcl::PointXYZRGB> live_cell_centers_kdtree_;
+  // map epoch the index was built for
+  uint64_t live_cell_index_epoch_ {0};
+  rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr live_cloud_subscriber_;
+  // changed leaves of each live update, as a TraversabilityOcTree
+  rclcpp::Publisher<octomap_msgs::msg::Octomap>::SharedPtr octomap_updates_publisher_;
+  // set when live updates changed octomap_octree_ since octomap_ros_msg_ was last serialized
+  bool is_live_map_changed_ {false};
+  rclcpp::Time last_full_map_update_stamp_;
   rclcpp::Publisher<visualization_msgs::msg::MarkerArray>::SharedPtr octomap_markers_publisher_;
   visualization_msgs::msg::MarkerArray octomap_markers_;
+  // Workers of the map pipeline, declared last so they are waited for before anything they use
+  // is destroyed. Members they write are read by the executor only once they are ready
+  std::future<bool> map_preparation_future_;
+  std::future<void> octree_build_future_;
+  std::future<std::shared_ptr<ResidentMap>> resident_map_future_;
 };
 }  // namespace vox_nav_map_server
 
@@ -0,0 +1,233 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_MAP_SERVER__MOMENT_GRID_HPP_
+#define VOX_NAV_MAP_SERVER__MOMENT_GRID_HPP_
+
+#include <vox_nav_map_server/cost_regression_utils.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+/**
+ * @brief First and second moments of a set of points
+ *
+ */
+struct PointMoments
+{
+  double n {0.0};
+  double sx {0.0}, sy {0.0}, sz {0.0};
+  double sxx {0.0}, syy {0.0}, szz {0.0};
+  double sxy {0.0}, sxz {0.0}, syz {0.0};
+
+  void add(double x, double y, double z);
+  PointMoments & operator+=(const PointMoments & other);
+  PointMoments & operator-=(const PointMoments & other);
+
+  /**
+   * @brief Moments of the same points moved by dx, dy, dz
+   *
+   */
+  void translate(double dx, double dy, double dz);
+};
+
+/**
+ * @brief Grid of point moments over the x-y plane.
+ * Each grid voxel is a vertical column of size resolution x resolution, accumulating
+ * count, sums and sums of products of coordinates of points falling in it.
+ * Columns are stored in square tiles and only tiles with points are allocated, so memory
+ * follows the area covered by points rather than their bounding box. A column takes 48 bytes,
+ * its sums are kept in float relative to the column center and its lowest point, where they
+ * stay small. Each tile keeps the moments of all its columns as well, so moments of a box are
+ * summed from whole tiles inside it and from all columns of the tiles its border crosses.
+ * This is not a constant time prefix sum lookup: a box w columns wide costs about
+ * (w / tile_size)^2 tile additions plus 4 * w * tile_size column additions at most.
+ * Covariance, least squares plane and slope of a cell follow from its moments.
+ * This lets costs be regressed again with new parameters without a kNN search or RANSAC.
+ * Columns merge everything above each other, so multi level structures are averaged.
+ * Features are not identical to those of the kNN decomposition, see cellFeatures().
+ */
+class MomentGrid
+{
+public:
+  /**
+   * @brief Construct a new Moment Grid object
+   *
+   * @param cloud
+   * @param resolution size of each column in x and y
+   * @param tile_size columns per side of a tile
+   */
+  MomentGrid(
+    const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+    const double resolution,
+    const int tile_size = 32);
+
+  /**
+   * @brief Moments of points within the columns that overlap given box, empty if the box lies
+   * outside of the grid. Coordinates of moments are relative to origin()
+   *
+   * @param min_x
+   * @param min_y
+   * @param max_x
+   * @param max_y
+   * @return PointMoments
+   */
+  PointMoments query(double min_x, double min_y, double max_x, double max_y) const;
+
+  /**
+   * @brief Features of the square cell of given radius centered at x, y.
+   * Plane and slope are derived from the moments,
+   * average_point_deviation is the RMS distance to plane which bounds mean absolute deviation,
+   * z_range is the height difference of the column extremes of the cell.
+   * Differences to compute_cell_features on kNN cells, which the cost_regression thresholds
+   * were tuned for:
+   * - the cell is the box of whole columns overlapping x +- radius, y +- radius, which covers
+   *   about 4 / pi times the area of the disc of same radius, more near column borders
+   * - average_point_deviation is RMS rather than mean absolute distance to plane, about
+   *   1.25 times larger for gaussian noise and more with outliers, so the same
+   *   max_allowed_point_deviation marks more cells as rough
+   *
+   * @param x
+   * @param y
+   * @param radius
+   * @param moments if not nullptr, set to moments of the cell, relative to origin()
+   * @return CellFeatures
+   */
+  CellFeatures cellFeatures(
+    double x, double y, double radius,
+    PointMoments * moments = nullptr) const;
+
+  /**
+   * @brief number of columns of the bounding box of points, columns are indexed row major in y
+   *
+   */
+  int64_t numColumns() const;
+
+  /**
+   * @brief indices of columns that points have fallen into, in ascending order
+   *
+   */
+  std::vector<int64_t> nonEmptyColumns() const;
+
+  /**
+   * @brief index of column that includes x, y, clamped to grid
+   *
+   */
+  int64_t columnIndex(double x, double y) const;
+
+  /**
+   * @brief x, y coordinates of center of column
+   *
+   */
+  Eigen::Vector2d columnCenter(int64_t column) const;
+
+  /**
+   * @brief true if no point has fallen into column
+   *
+   */
+  bool isColumnEmpty(int64_t column) const;
+
+  /**
+   * @brief Coordinates of moments are relative to this point
+   *
+   */
+  Eigen::Vector3d origin() const;
+
+  /**
+   * @brief bytes used by tiles and their index
+   *
+   */
+  size_t memoryUsage() const;
+
+private:
+  // Moments of the points of one column, 48 bytes
+  struct Column
+  {
+    uint32_t n {0};
+    // height extremes, relative to origin_
+    float z_min {std::numeric_limits<float>::max()};
+    float z_max {std::numeric_limits<float>::lowest()};
+    // x, y relative to column center, z relative to z_min
+    float sx {0.0f}, sy {0.0f}, sz {0.0f};
+    float sxx {0.0f}, syy {0.0f}, szz {0.0f};
+    float sxy {0.0f}, sxz {0.0f}, syz {0.0f};
+  };
+
+  struct Tile
+  {
+    // tile_size_ x tile_size_ columns, row major in y
+    std::vector<Column> columns;
+    // moments of all columns, relative to origin_
+    PointMoments moments;
+    float z_min {std::numeric_limits<float>::max()};
+    float z_max {std::numeric_limits<float>::lowest()};
+  };
+
+  /**
+   * @brief clamped column index of coordinate along one axis
+   *
+   */
+  int columnCoord(double v, double origin, int size) const;
+
+  /**
+   * @brief columns i0 to i1, j0 to j1 overlapping given box, false if it lies outside of grid
+   *
+   */
+  bool columnRange(
+    double min_x, double min_y, double max_x, double max_y,
+    int & i0, int & j0, int & i1, int & j1) const;
+
+  /**
+   * @brief column i, j, nullptr if its tile has no points
+   *
+   */
+  const Column * findColumn(int i, int j) const;
+
+  /**
+   * @brief moments of column i, j relative to origin_
+   *
+   */
+  PointMoments columnMoments(const Column & column, int i, int j) const;
+
+  /**
+   * @brief Adds moments and height extremes of columns i0 to i1, j0 to j1, both inclusive
+   *
+   */
+  void accumulate(
+    int i0, int j0, int i1, int j1,
+    PointMoments & moments, float & z_min, float & z_max) const;
+
+  double resolution_;
+  Eigen::Vector3d origin_;
+  int size_x_;
+  int size_y_;
+  int tile_size_;
+  int tiles_x_;
+  int tiles_y_;
+  // index into tiles_ of each tile of the bounding box, row major in y, -1 for empty tiles
+  std::vector<int32_t> tile_index_;
+  std::vector<Tile> tiles_;
+};
+
+}  // namespace vox_nav_map_server
+
+#endif  // VOX_NAV_MAP_SERVER__MOMENT_GRID_HPP_
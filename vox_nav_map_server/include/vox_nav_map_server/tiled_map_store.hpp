@@ -0,0 +1,215 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_MAP_SERVER__TILED_MAP_STORE_HPP_
+#define VOX_NAV_MAP_SERVER__TILED_MAP_STORE_HPP_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+/**
+ * @brief x, y index of a tile, tile (i, j) covers
+ * [i * tile_size, (i + 1) * tile_size) x [j * tile_size, (j + 1) * tile_size)
+ *
+ */
+struct TileKey
+{
+  int32_t x;
+  int32_t y;
+
+  bool operator==(const TileKey & other) const
+  {
+    return x == other.x && y == other.y;
+  }
+};
+
+struct TileKeyHash
+{
+  size_t operator()(const TileKey & key) const
+  {
+    return std::hash<uint64_t>()(
+      (static_cast<uint64_t>(static_cast<uint32_t>(key.x)) << 32) |
+      static_cast<uint32_t>(key.y));
+  }
+};
+
+/**
+ * @brief Regressed map split into fixed size square tiles over x-y in the static map frame.
+ * Each tile is a binary PCD file, an index file lists tile size, the key of the regressed map
+ * and the tiles with their point counts. Tiles are georeferenced through the static map origin,
+ * the same way the whole map is.
+ *
+ * Only a bounded number of tiles are kept in memory, least recently requested tiles are evicted
+ * first. Tiles are loaded by a background thread so that requesting tiles never blocks.
+ */
+class TiledMapStore
+{
+public:
+  /**
+   * @brief Construct a new Tiled Map Store object, nothing is read until open()
+   *
+   * @param directory a leading ~ is expanded to $HOME
+   * @param max_resident_tiles
+   */
+  TiledMapStore(const std::string & directory, size_t max_resident_tiles);
+
+  /**
+   * @brief Stops background loading
+   *
+   */
+  ~TiledMapStore();
+
+  /**
+   * @brief Split cloud into tiles and write them together with the index to directory.
+   * Existing tiles in directory are removed, index is written last so that an interrupted
+   * write does not leave a valid index behind
+   *
+   * @param directory
+   * @param cloud
+   * @param tile_size
+   * @param key
+   * @return true
+   * @return false
+   */
+  static bool write(
+    const std::string & directory,
+    const pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+    double tile_size,
+    const std::string & key);
+
+  /**
+   * @brief Read index, returns false if there is no valid index in directory
+   *
+   * @return true
+   * @return false
+   */
+  bool open();
+
+  /**
+   * @brief key of the regressed map that tiles were cut from
+   *
+   */
+  std::string key() const;
+
+  double tileSize() const;
+
+  size_t numTiles() const;
+
+  /**
+   * @brief Upper bound of the number of tiles tilesWithinRadius() returns for any x, y.
+   * Tiles that overlap the disc lie within its bounding square, which spans at most
+   * floor(2 * radius / tile_size) + 2 tiles per side.
+   *
+   * @param tile_size
+   * @param radius
+   * @return size_t
+   */
+  static size_t maxTilesWithinRadius(double tile_size, double radius);
+
+  /**
+   * @brief Existing tiles that are within radius of x, y, nearest first
+   *
+   * @param x
+   * @param y
+   * @param radius
+   * @return std::vector<TileKey>
+   */
+  std::vector<TileKey> tilesWithinRadius(double x, double y, double radius) const;
+
+  /**
+   * @brief Marks tiles as recently used and queues the ones that are not resident for loading.
+   * Tiles are loaded in given order
+   *
+   * @param tiles
+   */
+  void requestTiles(const std::vector<TileKey> & tiles);
+
+  /**
+   * @brief true if a tile was loaded or evicted since last call
+   *
+   */
+  bool hasResidentSetChanged();
+
+  /**
+   * @brief All resident tiles merged into one cloud
+   *
+   * @return pcl::PointCloud<pcl::PointXYZRGB>::Ptr
+   */
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr residentCloud() const;
+
+  /**
+   * @brief number of tiles currently in memory
+   *
+   */
+  size_t numResidentTiles() const;
+
+private:
+  struct ResidentTile
+  {
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud;
+    // position in lru_, front is most recently used
+    std::list<TileKey>::iterator lru_position;
+  };
+
+  static std::string tileFilename(const std::string & directory, const TileKey & key);
+
+  /**
+   * @brief background thread, loads queued tiles one at a time
+   *
+   */
+  void loadTiles();
+
+  /**
+   * @brief drop least recently used tiles until max_resident_tiles_ are left,
+   * caller must hold mutex_
+   *
+   */
+  void evictTiles();
+
+  std::string directory_;
+  size_t max_resident_tiles_;
+  std::string key_;
+  double tile_size_ {0.0};
+  // number of points of each tile on disk
+  std::unordered_map<TileKey, uint64_t, TileKeyHash> tile_index_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable load_condition_;
+  std::unordered_map<TileKey, ResidentTile, TileKeyHash> resident_tiles_;
+  std::list<TileKey> lru_;
+  std::deque<TileKey> load_queue_;
+  std::unordered_set<TileKey, TileKeyHash> queued_tiles_;
+  bool is_resident_set_changed_ {false};
+  bool stop_ {false};
+  std::thread loader_thread_;
+};
+
+}  // namespace vox_nav_map_server
+
+#endif  // VOX_NAV_MAP_SERVER__TILED_MAP_STORE_HPP_
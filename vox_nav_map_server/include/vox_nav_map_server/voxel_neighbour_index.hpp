@@ -0,0 +1,101 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_MAP_SERVER__VOXEL_NEIGHBOUR_INDEX_HPP_
+#define VOX_NAV_MAP_SERVER__VOXEL_NEIGHBOUR_INDEX_HPP_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+/**
+ * @brief Spatial hash of a traversability cloud, used to answer fixed radius
+ * "how many (traversable) neighbours" queries without a KdTree.
+ * Space is split into cubic voxels of size radius / voxels_per_radius.
+ * Points are stored voxel by voxel, and each voxel keeps a counter of its points
+ * and of its traversable (G > 0) points. During a query, voxels that are entirely inside
+ * the search sphere are answered from their counters, only voxels crossing
+ * the sphere boundary need a distance test per point. Queries do not allocate and
+ * are safe to call concurrently.
+ */
+class VoxelNeighbourIndex
+{
+public:
+  /**
+   * @brief Construct a new Voxel Neighbour Index object
+   *
+   * @param cloud
+   * @param radius fixed search radius that all queries use
+   * @param voxels_per_radius how many voxels span the radius, higher means more counter hits
+   */
+  VoxelNeighbourIndex(
+    const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+    const double radius,
+    const int voxels_per_radius = 2);
+
+  /**
+   * @brief Count the points within radius of query, including query itself if it is in cloud.
+   *
+   * @param query
+   * @param num_neighbours
+   * @param num_traversable_neighbours
+   */
+  void countNeighbours(
+    const pcl::PointXYZRGB & query,
+    int & num_neighbours,
+    int & num_traversable_neighbours) const;
+
+private:
+  struct Voxel
+  {
+    // points of this voxel are [begin, end) in the sorted point arrays
+    uint32_t begin;
+    uint32_t end;
+    uint32_t num_traversable;
+  };
+
+  /**
+   * @brief pack integer voxel coordinates into one hash key
+   *
+   */
+  static uint64_t voxelKey(int64_t vx, int64_t vy, int64_t vz);
+
+  /**
+   * @brief integer coordinate of voxel that includes this coordinate
+   *
+   */
+  int64_t voxelCoord(float v) const;
+
+  float radius_;
+  float voxel_size_;
+  int voxels_per_radius_;
+  // voxel key to index in voxels_
+  std::unordered_map<uint64_t, uint32_t> voxel_lookup_;
+  std::vector<Voxel> voxels_;
+  // points sorted by voxel, structure of arrays
+  std::vector<float> xs_;
+  std::vector<float> ys_;
+  std::vector<float> zs_;
+  std::vector<uint8_t> traversable_;
+};
+
+}  // namespace vox_nav_map_server
+
+#endif  // VOX_NAV_MAP_SERVER__VOXEL_NEIGHBOUR_INDEX_HPP_
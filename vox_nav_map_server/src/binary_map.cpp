@@ -0,0 +1,185 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vox_nav_map_server/binary_map.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+namespace
+{
+const char kMagic[8] = {'V', 'O', 'X', 'N', 'A', 'V', 'M', 'P'};
+
+uint64_t alignOffset(uint64_t offset)
+{
+  return (offset + BinaryMap::ALIGNMENT - 1) / BinaryMap::ALIGNMENT * BinaryMap::ALIGNMENT;
+}
+
+template<typename T>
+void writeArray(std::ofstream & file, uint64_t offset, const std::vector<T> & values)
+{
+  const auto position = static_cast<uint64_t>(file.tellp());
+  const std::vector<char> padding(offset - position, 0);
+  file.write(padding.data(), padding.size());
+  file.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+}  // namespace
+
+BinaryMap::~BinaryMap()
+{
+  close();
+}
+
+bool BinaryMap::isBinaryMapFilename(const std::string & filename)
+{
+  return std::filesystem::path(filename).extension() == ".vnm";
+}
+
+bool BinaryMap::write(
+  const std::string & filename,
+  const pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+  uint32_t flags,
+  double downsample_voxel_size)
+{
+  const size_t num_points = cloud.points.size();
+  std::vector<float> x(num_points), y(num_points), z(num_points);
+  std::vector<uint32_t> rgba(num_points);
+  for (size_t i = 0; i < num_points; i++) {
+    const auto & point = cloud.points[i];
+    x[i] = point.x;
+    y[i] = point.y;
+    z[i] = point.z;
+    rgba[i] = point.rgba;
+  }
+
+  BinaryMapHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = VERSION;
+  header.flags = flags;
+  header.num_points = num_points;
+  header.x_offset = alignOffset(sizeof(BinaryMapHeader));
+  header.y_offset = alignOffset(header.x_offset + num_points * sizeof(float));
+  header.z_offset = alignOffset(header.y_offset + num_points * sizeof(float));
+  header.rgba_offset = alignOffset(header.z_offset + num_points * sizeof(float));
+  header.downsample_voxel_size = downsample_voxel_size;
+  header.file_size = header.rgba_offset + num_points * sizeof(uint32_t);
+
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+      return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeArray(file, header.x_offset, x);
+    writeArray(file, header.y_offset, y);
+    writeArray(file, header.z_offset, z);
+    writeArray(file, header.rgba_offset, rgba);
+    if (!file) {
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_filename, filename, error);
+  return !error;
+}
+
+bool BinaryMap::open(const std::string & filename)
+{
+  close();
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+    static_cast<size_t>(file_stat.st_size) < sizeof(BinaryMapHeader))
+  {
+    ::close(fd);
+    return false;
+  }
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+  void * data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after closing the descriptor
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  // Points are read front to back right after opening
+  madvise(data, size, MADV_WILLNEED);
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = size;
+
+  // Reject anything whose arrays would not fit into the mapped file
+  const auto & h = header();
+  auto fits = [&](uint64_t offset, uint64_t element_size) {
+      return offset % ALIGNMENT == 0 && offset <= size_ &&
+             h.num_points <= (size_ - offset) / element_size;
+    };
+  const bool is_valid = std::memcmp(h.magic, kMagic, sizeof(kMagic)) == 0 &&
+    h.version == VERSION &&
+    h.file_size == size_ &&
+    fits(h.x_offset, sizeof(float)) &&
+    fits(h.y_offset, sizeof(float)) &&
+    fits(h.z_offset, sizeof(float)) &&
+    fits(h.rgba_offset, sizeof(uint32_t));
+  if (!is_valid) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void BinaryMap::close()
+{
+  if (data_) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+
+void BinaryMap::toPointCloud(
+  pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+  const Eigen::Affine3f & transform) const
+{
+  const size_t num_points = numPoints();
+  const float * px = x();
+  const float * py = y();
+  const float * pz = z();
+  const uint32_t * prgba = rgba();
+  cloud.points.resize(num_points);
+  for (size_t i = 0; i < num_points; i++) {
+    auto & point = cloud.points[i];
+    point.getVector3fMap() = transform * Eigen::Vector3f(px[i], py[i], pz[i]);
+    point.rgba = prgba[i];
+  }
+  cloud.width = num_points;
+  cloud.height = 1;
+}
+
+}  // namespace vox_nav_map_server
@@ -0,0 +1,87 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vox_nav_map_server/binary_map.hpp>
+#include <vox_nav_utilities/pcd_stream_reader.hpp>
+
+#include <pcl/io/pcd_io.h>
+
+#include <iostream>
+#include <string>
+
+namespace
+{
+void printUsage()
+{
+  std::cerr <<
+    "Converts a PCD map to the binary map format read by map_manager\n"
+    "usage: binary_map_converter <input.pcd> <output.vnm> [options]\n"
+    "  --downsample <voxel_size>  downsample points, map_manager then skips downsampling\n"
+    "                             and filtering of this map\n"
+    "  --regressed                points are colored with regressed costs already,\n"
+    "                             map_manager then uses them as they are\n";
+}
+}  // namespace
+
+int main(int argc, char const * argv[])
+{
+  if (argc < 3) {
+    printUsage();
+    return 1;
+  }
+  const std::string input_filename = argv[1];
+  const std::string output_filename = argv[2];
+  double downsample_voxel_size = 0.0;
+  uint32_t flags = 0;
+  for (int i = 3; i < argc; i++) {
+    const std::string option = argv[i];
+    if (option == "--downsample" && i + 1 < argc) {
+      downsample_voxel_size = std::stod(argv[++i]);
+      flags |= vox_nav_map_server::BinaryMap::PREPROCESSED;
+    } else if (option == "--regressed") {
+      flags |= vox_nav_map_server::BinaryMap::REGRESSED;
+    } else {
+      printUsage();
+      return 1;
+    }
+  }
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  if (downsample_voxel_size > 0.0) {
+    // Downsampled while reading, so maps larger than memory can be converted
+    std::string error;
+    cloud = vox_nav_utilities::loadDownsampledPointcloudFromPcd(
+      input_filename, downsample_voxel_size, 0, &error);
+    if (!error.empty()) {
+      std::cerr << "Could not read " << input_filename << ": " << error << "\n";
+      return 1;
+    }
+  } else if (pcl::io::loadPCDFile<pcl::PointXYZRGB>(input_filename, *cloud) != 0) {
+    cloud->points.clear();
+  }
+  if (cloud->points.empty()) {
+    std::cerr << "Could not read any points from " << input_filename << "\n";
+    return 1;
+  }
+  std::cout << "Read " << cloud->points.size() << " points from " << input_filename << "\n";
+
+  if (!vox_nav_map_server::BinaryMap::write(
+      output_filename, *cloud, flags, downsample_voxel_size))
+  {
+    std::cerr << "Could not write " << output_filename << "\n";
+    return 1;
+  }
+  std::cout << "Wrote " << output_filename << "\n";
+  return 0;
+}
@@ -13,7 +13,10 @@
 // limitations under the License.
 
 #include <vox_nav_map_server/cost_regression_utils.hpp>
+#include <vox_nav_map_server/voxel_neighbour_index.hpp>
 
+#include <algorithm>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -24,33 +27,28 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr denoise_segmented_cloud(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const double radius,
   const double tolerated_divergence_rate,
-  const int min_num_neighbours)
+  const int min_num_neighbours,
+  const int num_threads)
 {
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr denoised_cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
-  pcl::KdTreeFLANN<pcl::PointXYZRGB> kdtree;
-  kdtree.setInputCloud(cloud);
+  denoised_cloud->points.resize(cloud->points.size());
 
-  for (size_t i = 0; i < cloud->points.size(); i++) {
+  // Neighbour counts come from a voxel hash instead of a KdTree radius search per point
+  VoxelNeighbourIndex neighbour_index(cloud, radius);
+
+  const int threads = num_threads > 0 ?
+    num_threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  #pragma omp parallel for schedule(dynamic, 1024) num_threads(threads)
+  for (int64_t i = 0; i < static_cast<int64_t>(cloud->points.size()); i++) {
     pcl::PointXYZRGB searchPoint = cloud->points[i];
-    std::vector<int> pointIdxRadiusSearch;
-    std::vector<float> pointRadiusSquaredDistance;
-    if (kdtree.radiusSearch(
-        searchPoint, radius, pointIdxRadiusSearch,
-        pointRadiusSquaredDistance) > min_num_neighbours)
-    {
-      pcl::PointCloud<pcl::PointXYZRGB>::Ptr neighbours(new pcl::PointCloud<pcl::PointXYZRGB>);
-      for (std::size_t j = 0; j < pointIdxRadiusSearch.size(); ++j) {
-        neighbours->points.push_back(cloud->points[pointIdxRadiusSearch[j]]);
-      }
-      int num_traversable_neighbours = 0;
-      for (std::size_t j = 0; j < neighbours->points.size(); ++j) {
-        if (neighbours->points[j].g) {
-          num_traversable_neighbours++;
-        }
-      }
+    int num_neighbours = 0;
+    int num_traversable_neighbours = 0;
+    neighbour_index.countNeighbours(searchPoint, num_neighbours, num_traversable_neighbours);
+    if (num_neighbours > min_num_neighbours) {
       double proportion_of_traversable_neighbours =
         static_cast<double>(num_traversable_neighbours) /
-        static_cast<double>(neighbours->points.size());
+        static_cast<double>(num_neighbours);
       if (proportion_of_traversable_neighbours >
         (1.0 - tolerated_divergence_rate) &&
         searchPoint.r)
@@ -64,7 +62,7 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr denoise_segmented_cloud(
         searchPoint.g = 0;
       }
     }
-    denoised_cloud->points.push_back(searchPoint);
+    denoised_cloud->points[i] = searchPoint;
   }
   denoised_cloud->height = 1;
   denoised_cloud->width = denoised_cloud->points.size();
@@ -159,6 +157,38 @@ std::vector<std::pair<pcl::PointXYZRGB,
   return decomposed_cells;
 }
 
+DecomposedCells decompose_traversability_cloud_into_spans(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr pure_traversable_pcl,
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr uniformly_sampled_nodes,
+  const double radius)
+{
+  // Neighbors within radius search
+  std::vector<int> pointIdxRadiusSearch;
+  std::vector<float> pointRadiusSquaredDistance;
+  pcl::KdTreeFLANN<pcl::PointXYZRGB> kdtree;
+  kdtree.setInputCloud(pure_traversable_pcl);
+
+  DecomposedCells decomposed_cells;
+  decomposed_cells.centers.reserve(uniformly_sampled_nodes->points.size());
+  decomposed_cells.spans.reserve(uniformly_sampled_nodes->points.size());
+
+  for (auto && searchPoint : uniformly_sampled_nodes->points) {
+    CellSpan span{static_cast<uint32_t>(decomposed_cells.indices.size()), 0};
+    if (kdtree.radiusSearch(
+        searchPoint, radius, pointIdxRadiusSearch,
+        pointRadiusSquaredDistance) > 0)
+    {
+      decomposed_cells.indices.insert(
+        decomposed_cells.indices.end(),
+        pointIdxRadiusSearch.begin(), pointIdxRadiusSearch.end());
+      span.length = static_cast<uint32_t>(pointIdxRadiusSearch.size());
+    }
+    decomposed_cells.centers.push_back(searchPoint);
+    decomposed_cells.spans.push_back(span);
+  }
+  return decomposed_cells;
+}
+
 pcl::ModelCoefficients fit_plane_to_cloud(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const double dist_thes)
@@ -188,6 +218,41 @@ pcl::ModelCoefficients fit_plane_to_cloud(
   return *coefficients;
 }
 
+pcl::ModelCoefficients fit_plane_to_cloud(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const double dist_thes)
+{
+  pcl::ModelCoefficients::Ptr coefficients(new pcl::ModelCoefficients);
+  if (span.length > 2) {
+    // Segmentation samples from the cell indices, which is equivalent to
+    // segmenting a copy of the cell points in the same order
+    pcl::PointIndices::Ptr cell_indices(new pcl::PointIndices);
+    cell_indices->indices.assign(
+      indices.begin() + span.offset,
+      indices.begin() + span.offset + span.length);
+    pcl::PointIndices::Ptr inliers(new pcl::PointIndices);
+    pcl::SACSegmentation<pcl::PointXYZRGB> seg;
+    seg.setOptimizeCoefficients(true);
+    seg.setModelType(pcl::SACMODEL_PLANE);
+    seg.setMethodType(pcl::SAC_RANSAC);
+    seg.setDistanceThreshold(dist_thes);
+    seg.setInputCloud(cloud);
+    seg.setIndices(cell_indices);
+    seg.segment(*inliers, *coefficients);
+    if (inliers->indices.size() == 0) {
+      PCL_ERROR("Could not estimate a planar model for the given dataset.");
+    }
+  } else {
+    coefficients->values.push_back(0.0);
+    coefficients->values.push_back(0.0);
+    coefficients->values.push_back(0.0);
+    coefficients->values.push_back(0.0);
+  }
+  return *coefficients;
+}
+
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr set_cloud_color(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const std::vector<double> colors)
@@ -206,6 +271,24 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr set_cloud_color(
   return new_colored_cloud;
 }
 
+void set_cloud_color(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const std::vector<double> colors,
+  pcl::PointCloud<pcl::PointXYZRGB> & colored_cloud)
+{
+  for (uint32_t i = span.offset; i < span.offset + span.length; i++) {
+    pcl::PointXYZRGB point = cloud->points[indices[i]];
+    point.r = colors[0];
+    point.g = colors[1];
+    point.b = colors[2];
+    colored_cloud.points.push_back(point);
+  }
+  colored_cloud.height = 1;
+  colored_cloud.width = colored_cloud.points.size();
+}
+
 std::vector<double> absolute_rpy_from_plane(
   const pcl::ModelCoefficients plane_model)
 {
@@ -248,6 +331,30 @@ double average_point_deviation_from_plane(
   return average_point_deviation_from_plane;
 }
 
+double average_point_deviation_from_plane(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const pcl::ModelCoefficients plane_model)
+{
+  double total_dist = 0.0;
+  for (uint32_t i = span.offset; i < span.offset + span.length; i++) {
+    const auto & point = cloud->points[indices[i]];
+    double curr_point_dist_to_plane = std::abs(
+      plane_model.values[0] * point.x +
+      plane_model.values[1] * point.y +
+      plane_model.values[2] * point.z + plane_model.values[3]) /
+      std::sqrt(
+      std::pow(plane_model.values[0], 2) +
+      std::pow(plane_model.values[1], 2) +
+      std::pow(plane_model.values[2], 2));
+    total_dist += curr_point_dist_to_plane;
+  }
+  double average_point_deviation_from_plane = total_dist /
+    static_cast<double>(span.length);
+  return average_point_deviation_from_plane;
+}
+
 double max_energy_gap_in_cloud(
   const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
   const double m,
@@ -267,4 +374,267 @@ double max_energy_gap_in_cloud(
     0.5 * m * std::pow(v, 2);
   return max_energy_gap;
 }
+
+double max_energy_gap_in_cloud(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  const double m,
+  const double v)
+{
+  if (span.length == 0) {
+    return 0.5 * m * std::pow(v, 2);
+  }
+  float lower_bound_z = cloud->points[indices[span.offset]].z;
+  float upper_bound_z = lower_bound_z;
+  for (uint32_t i = span.offset; i < span.offset + span.length; i++) {
+    const float z = cloud->points[indices[i]].z;
+    if (z < lower_bound_z) {
+      lower_bound_z = z;
+    }
+    if (z > upper_bound_z) {
+      upper_bound_z = z;
+    }
+  }
+  double max_energy_gap = m * 9.82 * std::abs(upper_bound_z - lower_bound_z) +
+    0.5 * m * std::pow(v, 2);
+  return max_energy_gap;
+}
+
+CellFeatures compute_cell_features(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const std::vector<int> & indices,
+  const CellSpan & span,
+  CellPointBuffer & buffer,
+  const bool robust_plane_fit,
+  const double dist_thes)
+{
+  CellFeatures features;
+  features.plane_model.values = {0.0, 0.0, 1.0, 0.0};
+  features.average_point_deviation = 0.0;
+  features.z_range = 0.0;
+
+  const int n = static_cast<int>(span.length);
+  if (n == 0) {
+    auto rpy = absolute_rpy_from_plane(features.plane_model);
+    features.roll = rpy[0];
+    features.pitch = rpy[1];
+    features.yaw = rpy[2];
+    return features;
+  }
+
+  // Gather the cell into SoA buffers, shifted to first point of cell so that
+  // moments stay well conditioned for large map coordinates
+  buffer.x.resize(n);
+  buffer.y.resize(n);
+  buffer.z.resize(n);
+  const auto & origin = cloud->points[indices[span.offset]];
+  for (int i = 0; i < n; i++) {
+    const auto & point = cloud->points[indices[span.offset + i]];
+    buffer.x[i] = point.x - origin.x;
+    buffer.y[i] = point.y - origin.y;
+    buffer.z[i] = point.z - origin.z;
+  }
+  const float * xs = buffer.x.data();
+  const float * ys = buffer.y.data();
+  const float * zs = buffer.z.data();
+
+  // FIRST PASS: MOMENTS AND Z RANGE
+  double sx = 0.0, sy = 0.0, sz = 0.0;
+  double sxx = 0.0, syy = 0.0, szz = 0.0, sxy = 0.0, sxz = 0.0, syz = 0.0;
+  float z_min = zs[0], z_max = zs[0];
+  #pragma omp simd reduction(+:sx,sy,sz,sxx,syy,szz,sxy,sxz,syz) reduction(min:z_min) \
+  reduction(max:z_max)
+  for (int i = 0; i < n; i++) {
+    const double x = xs[i], y = ys[i], z = zs[i];
+    sx += x;
+    sy += y;
+    sz += z;
+    sxx += x * x;
+    syy += y * y;
+    szz += z * z;
+    sxy += x * y;
+    sxz += x * z;
+    syz += y * z;
+    z_min = std::min(z_min, zs[i]);
+    z_max = std::max(z_max, zs[i]);
+  }
+  features.z_range = static_cast<double>(z_max) - static_cast<double>(z_min);
+
+  const Eigen::Vector3d mean = Eigen::Vector3d(sx, sy, sz) / n;
+  const Eigen::Vector3d local_origin(origin.x, origin.y, origin.z);
+  Eigen::Vector3d normal(0.0, 0.0, 1.0);
+  // plane offset in the shifted frame of buffers
+  double local_d = -normal.dot(mean);
+
+  if (n > 2 && robust_plane_fit) {
+    auto ransac_plane = fit_plane_to_cloud(cloud, indices, span, dist_thes);
+    Eigen::Vector3d ransac_normal(
+      ransac_plane.values[0], ransac_plane.values[1], ransac_plane.values[2]);
+    const double norm = ransac_normal.norm();
+    if (norm > 0.0) {
+      normal = ransac_normal / norm;
+      local_d = (ransac_plane.values[3] + ransac_normal.dot(local_origin)) / norm;
+    }
+  } else if (n > 2) {
+    Eigen::Matrix3d covariance;
+    covariance(0, 0) = sxx / n - mean.x() * mean.x();
+    covariance(1, 1) = syy / n - mean.y() * mean.y();
+    covariance(2, 2) = szz / n - mean.z() * mean.z();
+    covariance(0, 1) = covariance(1, 0) = sxy / n - mean.x() * mean.y();
+    covariance(0, 2) = covariance(2, 0) = sxz / n - mean.x() * mean.z();
+    covariance(1, 2) = covariance(2, 1) = syz / n - mean.y() * mean.z();
+    normal = plane_normal_from_covariance(covariance);
+    local_d = -normal.dot(mean);
+  }
+
+  features.plane_model.values = {
+    static_cast<float>(normal.x()),
+    static_cast<float>(normal.y()),
+    static_cast<float>(normal.z()),
+    static_cast<float>(local_d - normal.dot(local_origin))};
+
+  // SECOND PASS: MEAN ABSOLUTE DEVIATION FROM PLANE, normal is already unit length
+  const double a = normal.x(), b = normal.y(), c = normal.z();
+  double total_dist = 0.0;
+  #pragma omp simd reduction(+:total_dist)
+  for (int i = 0; i < n; i++) {
+    total_dist += std::abs(a * xs[i] + b * ys[i] + c * zs[i] + local_d);
+  }
+  features.average_point_deviation = total_dist / n;
+
+  auto rpy = absolute_rpy_from_plane(features.plane_model);
+  features.roll = rpy[0];
+  features.pitch = rpy[1];
+  features.yaw = rpy[2];
+  return features;
+}
+
+Eigen::Vector3d plane_normal_from_covariance(
+  const Eigen::Matrix3d & covariance,
+  double * smallest_eigenvalue)
+{
+  // Eigenvalues are sorted increasingly, normal is the direction of least variance
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+  Eigen::Vector3d normal = solver.eigenvectors().col(0);
+  if (normal.z() < 0.0) {
+    normal = -normal;
+  }
+  if (smallest_eigenvalue) {
+    *smallest_eigenvalue = std::max(0.0, solver.eigenvalues()(0));
+  }
+  return normal;
+}
+
+double max_energy_gap_from_height_range(
+  const double z_range,
+  const double m,
+  const double v)
+{
+  return m * 9.82 * std::abs(z_range) + 0.5 * m * std::pow(v, 2);
+}
+
+std::vector<double> cost_color_from_cell_features(
+  const CellFeatures & features,
+  const CostRegressionParams & params)
+{
+  const double kMAX_COLOR_RANGE = 255.0;
+
+  double max_tilt = std::max(features.roll, features.pitch);
+
+  double max_energy_gap = max_energy_gap_from_height_range(features.z_range, 0.1, 1.0);
+
+  double slope_cost = std::min(
+    max_tilt / params.max_allowed_tilt, 1.0) * kMAX_COLOR_RANGE;
+
+  double energy_gap_cost = std::min(
+    max_energy_gap / params.max_allowed_energy_gap, 1.0) * kMAX_COLOR_RANGE;
+
+  double deviation_of_points_cost = std::min(
+    features.average_point_deviation / params.max_allowed_point_deviation, 1.0) *
+    kMAX_COLOR_RANGE;
+
+  double total_cost = 0.8 * slope_cost + 0.1 * deviation_of_points_cost + 0.1 * energy_gap_cost;
+
+  if (max_tilt > params.max_allowed_tilt) {
+    return std::vector<double>({255.0, 0, 0});
+  }
+  return std::vector<double>({0.0, kMAX_COLOR_RANGE - total_cost, total_cost});
+}
+
+double traversability_cost_from_color(const pcl::PointXYZRGB & point)
+{
+  double value = static_cast<double>(point.b / 255.0) -
+    static_cast<double>(point.g / 255.0);
+  if (point.r == 255) {
+    value = 2.0;
+  }
+  if (point.r == 255 && point.g == 255) {
+    value = 3.0;
+  }
+  return std::max(0.0, value);
+}
+
+pcl::PointXYZRGB elevated_node_from_cell_features(
+  const pcl::PointXYZRGB & cell_center,
+  const CellFeatures & features,
+  const CostRegressionParams & params)
+{
+  const double kMAX_COLOR_RANGE = 255.0;
+  const auto & plane_model = features.plane_model;
+  pcl::PointXYZRGB elevated_node;
+  elevated_node.x = cell_center.x + params.node_elevation_distance * plane_model.values[0];
+  elevated_node.y = cell_center.y + params.node_elevation_distance * plane_model.values[1];
+  elevated_node.z = cell_center.z + params.node_elevation_distance * plane_model.values[2];
+  elevated_node.r = kMAX_COLOR_RANGE;
+  elevated_node.g = kMAX_COLOR_RANGE;
+  return elevated_node;
+}
+pcl::PointCloud<pcl::PointXYZRGB> regress_decomposed_cells(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const DecomposedCells & decomposed_cells,
+  const CostRegressionParams & params,
+  const int num_threads)
+{
+  // Each cell writes only into its own slot, so cells can be regressed concurrently.
+  // The slots are merged afterwards in cell order, which keeps the result identical to serial
+  // regression regardless of the number of threads.
+  const int num_cells = static_cast<int>(decomposed_cells.spans.size());
+  std::vector<std::vector<double>> cell_colors(num_cells);
+  std::vector<pcl::PointXYZRGB> elevated_nodes(num_cells);
+
+  const int threads = num_threads > 0 ?
+    num_threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  #pragma omp parallel num_threads(threads)
+  {
+    // SoA buffers are reused by all cells of this thread
+    CellPointBuffer cell_point_buffer;
+
+    #pragma omp for schedule(dynamic, 16)
+    for (int c = 0; c < num_cells; c++) {
+      // PLANE, SLOPE, DEVIATION AND HEIGHT RANGE OF CELL IN ONE KERNEL
+      auto features = compute_cell_features(
+        cloud, decomposed_cells.indices, decomposed_cells.spans[c],
+        cell_point_buffer, params.robust_plane_fit, params.plane_fit_threshold);
+      cell_colors[c] = cost_color_from_cell_features(features, params);
+      elevated_nodes[c] = elevated_node_from_cell_features(
+        decomposed_cells.centers[c], features, params);
+    }
+  }
+
+  // MERGE THE CELLS IN A FIXED ORDER
+  pcl::PointCloud<pcl::PointXYZRGB> cld;
+  cld.points.reserve(decomposed_cells.indices.size() + elevated_nodes.size());
+  for (int c = 0; c < num_cells; c++) {
+    set_cloud_color(
+      cloud, decomposed_cells.indices, decomposed_cells.spans[c], cell_colors[c], cld);
+  }
+  if (params.include_node_centers_in_cloud) {
+    cld.points.insert(cld.points.end(), elevated_nodes.begin(), elevated_nodes.end());
+  }
+  cld.height = 1;
+  cld.width = cld.points.size();
+  return cld;
+}
 }  // namespace vox_nav_map_server
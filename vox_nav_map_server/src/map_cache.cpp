@@ -0,0 +1,193 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vox_nav_map_server/map_cache.hpp>
+
+#include <pcl/io/pcd_io.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+std::string expand_home_directory(const std::string & path)
+{
+  if (!path.empty() && path[0] == '~') {
+    const char * home = std::getenv("HOME");
+    return std::string(home ? home : "") + path.substr(1);
+  }
+  return path;
+}
+
+void CacheKeyHasher::add(const void * data, size_t size)
+{
+  const uint64_t kPrime = 1099511628211ULL;
+  const auto * bytes = static_cast<const unsigned char *>(data);
+  size_t i = 0;
+  // Mix 8 bytes at a time, large files are hashed as well
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(uint64_t));
+    state_ = (state_ ^ word) * kPrime;
+  }
+  for (; i < size; i++) {
+    state_ = (state_ ^ bytes[i]) * kPrime;
+  }
+}
+
+void CacheKeyHasher::add(double value)
+{
+  add(static_cast<int64_t>(std::llround(value * 1e9)));
+}
+
+void CacheKeyHasher::add(int64_t value)
+{
+  add(&value, sizeof(value));
+}
+
+void CacheKeyHasher::add(const std::string & value)
+{
+  add(static_cast<int64_t>(value.size()));
+  add(value.data(), value.size());
+}
+
+bool CacheKeyHasher::addFileIdentity(const std::string & filename)
+{
+  std::error_code error;
+  const auto path = std::filesystem::absolute(filename, error);
+  const auto size = std::filesystem::file_size(path, error);
+  if (error) {
+    return false;
+  }
+  const auto write_time = std::filesystem::last_write_time(path, error);
+  if (error) {
+    return false;
+  }
+  add(path.string());
+  add(static_cast<int64_t>(size));
+  add(static_cast<int64_t>(write_time.time_since_epoch().count()));
+  return true;
+}
+
+std::string CacheKeyHasher::hex() const
+{
+  char buffer[17];
+  std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(state_));
+  return std::string(buffer);
+}
+
+MapCache::MapCache(const std::string & directory)
+: directory_(expand_home_directory(directory))
+{
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+}
+
+std::string MapCache::path(const std::string & key, const std::string & extension) const
+{
+  return (std::filesystem::path(directory_) / (key + extension)).string();
+}
+
+bool MapCache::loadCloud(
+  const std::string & key,
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud) const
+{
+  const std::string filename = path(key, ".pcd");
+  if (!std::filesystem::exists(filename)) {
+    return false;
+  }
+  return pcl::io::loadPCDFile<pcl::PointXYZRGB>(filename, *cloud) == 0;
+}
+
+bool MapCache::saveCloud(
+  const std::string & key,
+  const pcl::PointCloud<pcl::PointXYZRGB> & cloud) const
+{
+  // Write next to the final file and rename, so that an interrupted write is never a cache hit
+  const std::string filename = path(key, ".pcd");
+  const std::string tmp_filename = filename + ".tmp";
+  if (pcl::io::savePCDFileBinary(tmp_filename, cloud) != 0) {
+    return false;
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_filename, filename, error);
+  return !error;
+}
+
+std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> MapCache::loadOctree(
+  const std::string & key) const
+{
+  const std::string filename = path(key, ".ot");
+  if (!std::filesystem::exists(filename)) {
+    return nullptr;
+  }
+  std::unique_ptr<octomap::AbstractOcTree> tree(octomap::AbstractOcTree::read(filename));
+  // Trees of another type, e.g. written by an older version, are a cache miss
+  auto traversability_tree = dynamic_cast<vox_nav_utilities::TraversabilityOcTree *>(tree.get());
+  if (!traversability_tree) {
+    return nullptr;
+  }
+  tree.release();
+  return std::shared_ptr<vox_nav_utilities::TraversabilityOcTree>(traversability_tree);
+}
+
+bool MapCache::saveOctree(
+  const std::string & key,
+  vox_nav_utilities::TraversabilityOcTree & tree) const
+{
+  const std::string filename = path(key, ".ot");
+  const std::string tmp_filename = filename + ".tmp";
+  if (!tree.write(tmp_filename)) {
+    return false;
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_filename, filename, error);
+  return !error;
+}
+
+bool MapCache::isCacheFilename(const std::string & filename)
+{
+  // Keys are 16 lower case hex digits, see CacheKeyHasher::hex()
+  const size_t kKeyLength = 16;
+  if (filename.size() <= kKeyLength) {
+    return false;
+  }
+  for (size_t i = 0; i < kKeyLength; i++) {
+    const char c = filename[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+      return false;
+    }
+  }
+  const std::string extension = filename.substr(kKeyLength);
+  return extension == ".pcd" || extension == ".ot" ||
+         extension == ".pcd.tmp" || extension == ".ot.tmp";
+}
+
+void MapCache::clear() const
+{
+  std::error_code error;
+  for (auto && entry : std::filesystem::directory_iterator(directory_, error)) {
+    if (entry.is_regular_file(error) && isCacheFilename(entry.path().filename().string())) {
+      std::filesystem::remove(entry.path(), error);
+    }
+  }
+}
+
+}  // namespace vox_nav_map_server
@@ -19,6 +19,13 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 namespace vox_nav_map_server
 {
@@ -36,9 +43,13 @@ MapManager::MapManager()
   declare_parameter("octomap_publish_frequency", 10);
   declare_parameter("publish_octomap_as_pointcloud", true);
   declare_parameter("publish_octomap_markers", true);
+  declare_parameter("map_publish_mode", "latched");
   declare_parameter("octomap_point_cloud_publish_topic", "octomap_pointcloud");
   declare_parameter("map_frame_id", "map");
   declare_parameter("utm_frame_id", "utm");
+  declare_parameter("navsat_fix_topic", "gps/fix");
+  declare_parameter("navsat_odometry_topic", "odometry/gps");
+  declare_parameter("georeference_request_timeout", 5.0);
   declare_parameter("yaw_offset", 1.57);
   declare_parameter("map_coordinates.latitude", 49.0);
   declare_parameter("map_coordinates.longitude", 3.0);
@@ -55,10 +66,40 @@ MapManager::MapManager()
   declare_parameter("pcd_map_transform.rotation.y", 0.0);
   declare_parameter("apply_filters", true);
   declare_parameter("pcd_map_downsample_voxel_size", 0.1);
+  declare_parameter("pcd_map_reader_num_threads", 0);
   declare_parameter("remove_outlier_mean_K", 10);
   declare_parameter("remove_outlier_stddev_threshold", 1.0);
   declare_parameter("remove_outlier_radius_search", 0.1);
   declare_parameter("remove_outlier_min_neighbors_in_radius", 1);
+  declare_parameter("cost_regression.num_threads", 0);
+  declare_parameter("cost_regression.cell_radius", 0.8);
+  declare_parameter("cost_regression.max_allowed_tilt", 40.0);
+  declare_parameter("cost_regression.max_allowed_point_deviation", 0.2);
+  declare_parameter("cost_regression.max_allowed_energy_gap", 0.2);
+  declare_parameter("cost_regression.node_elevation_distance", 0.5);
+  declare_parameter("cost_regression.plane_fit_threshold", 0.2);
+  declare_parameter("cost_regression.include_node_centers_in_cloud", true);
+  declare_parameter("cost_regression.robust_plane_fit", false);
+  declare_parameter("cost_regression.use_moment_grid", false);
+  declare_parameter("cost_regression.moment_grid_resolution", 0.2);
+  declare_parameter("cell_statistics.enabled", true);
+  declare_parameter("cell_statistics.resolution", 0.2);
+  declare_parameter("octomap_build_mode", "occupied_only");
+  declare_parameter("octomap_cost_aggregation", "max");
+  declare_parameter("map_cache.enabled", true);
+  declare_parameter("map_cache.directory", "~/.ros/vox_nav_map_cache");
+  declare_parameter("map_cache.invalidate", false);
+  declare_parameter("tiled_map.enabled", false);
+  declare_parameter("tiled_map.directory", "~/.ros/vox_nav_tiled_map");
+  declare_parameter("tiled_map.tile_size", 50.0);
+  declare_parameter("tiled_map.resident_radius", 50.0);
+  declare_parameter("tiled_map.max_resident_tiles", 0);
+  declare_parameter("robot_frame_id", "base_link");
+  declare_parameter("live_updates.enabled", false);
+  declare_parameter("live_updates.topic", "traversability_cloud");
+  declare_parameter("live_updates.max_cells_per_message", 512);
+  declare_parameter("live_updates.full_map_period", 10.0);
+  declare_parameter("live_updates.decay_time", 30.0);
 
   // get this node's parameters
   get_parameter("pcd_map_filename", pcd_map_filename_);
@@ -67,9 +108,13 @@ MapManager::MapManager()
   get_parameter("octomap_publish_frequency", octomap_publish_frequency_);
   get_parameter("publish_octomap_as_pointcloud", publish_octomap_as_pointcloud_);
   get_parameter("publish_octomap_markers", publish_octomap_markers_);
+  get_parameter("map_publish_mode", map_publish_mode_);
   get_parameter("octomap_point_cloud_publish_topic", octomap_point_cloud_publish_topic_);
   get_parameter("map_frame_id", map_frame_id_);
   get_parameter("utm_frame_id", utm_frame_id_);
+  get_parameter("navsat_fix_topic", navsat_fix_topic_);
+  get_parameter("navsat_odometry_topic", navsat_odometry_topic_);
+  get_parameter("georeference_request_timeout", georeference_request_timeout_);
   get_parameter("yaw_offset", yaw_offset_);
   get_parameter("map_coordinates.latitude", static_map_gps_pose_->position.latitude);
   get_parameter("map_coordinates.longitude", static_map_gps_pose_->position.longitude);
@@ -86,272 +131,1129 @@ MapManager::MapManager()
   get_parameter("pcd_map_transform.rotation.y", pcd_map_transform_matrix_.rpyIntrinsic_.z());
   get_parameter("apply_filters", apply_filters_);
   get_parameter("pcd_map_downsample_voxel_size", pcd_map_downsample_voxel_size_);
+  get_parameter("pcd_map_reader_num_threads", pcd_map_reader_num_threads_);
   get_parameter("remove_outlier_mean_K", remove_outlier_mean_K_);
   get_parameter("remove_outlier_stddev_threshold", remove_outlier_stddev_threshold_);
   get_parameter("remove_outlier_radius_search", remove_outlier_radius_search_);
   get_parameter("remove_outlier_min_neighbors_in_radius", remove_outlier_min_neighbors_in_radius_);
+  get_parameter("cost_regression.num_threads", cost_regression_num_threads_);
+  get_parameter("cost_regression.cell_radius", cost_regression_params_.cell_radius);
+  get_parameter("cost_regression.max_allowed_tilt", cost_regression_params_.max_allowed_tilt);
+  get_parameter(
+    "cost_regression.max_allowed_point_deviation",
+    cost_regression_params_.max_allowed_point_deviation);
+  get_parameter(
+    "cost_regression.max_allowed_energy_gap", cost_regression_params_.max_allowed_energy_gap);
+  get_parameter(
+    "cost_regression.node_elevation_distance", cost_regression_params_.node_elevation_distance);
+  get_parameter(
+    "cost_regression.plane_fit_threshold", cost_regression_params_.plane_fit_threshold);
+  get_parameter(
+    "cost_regression.include_node_centers_in_cloud",
+    cost_regression_params_.include_node_centers_in_cloud);
+  get_parameter("cost_regression.robust_plane_fit", cost_regression_params_.robust_plane_fit);
+  get_parameter("cost_regression.use_moment_grid", cost_regression_params_.use_moment_grid);
+  get_parameter(
+    "cost_regression.moment_grid_resolution", cost_regression_params_.moment_grid_resolution);
+  get_parameter("cell_statistics.enabled", cell_statistics_enabled_);
+  get_parameter("cell_statistics.resolution", cell_statistics_resolution_);
+  get_parameter("octomap_build_mode", octomap_build_mode_);
+  get_parameter("octomap_cost_aggregation", octomap_cost_aggregation_);
+  get_parameter("map_cache.enabled", map_cache_enabled_);
+  get_parameter("map_cache.directory", map_cache_directory_);
+  get_parameter("map_cache.invalidate", map_cache_invalidate_);
+  get_parameter("tiled_map.enabled", tiled_map_enabled_);
+  get_parameter("tiled_map.directory", tiled_map_directory_);
+  get_parameter("tiled_map.tile_size", tiled_map_tile_size_);
+  get_parameter("tiled_map.resident_radius", tiled_map_resident_radius_);
+  get_parameter("tiled_map.max_resident_tiles", tiled_map_max_resident_tiles_);
+  get_parameter("robot_frame_id", robot_frame_id_);
+  get_parameter("live_updates.enabled", live_updates_enabled_);
+  get_parameter("live_updates.topic", live_updates_topic_);
+  get_parameter("live_updates.max_cells_per_message", live_updates_max_cells_per_message_);
+  get_parameter("live_updates.full_map_period", live_updates_full_map_period_);
+  get_parameter("live_updates.decay_time", live_updates_decay_time_);
+
+  // 0 means use all available cores, 1 falls back to serial regression
+  if (cost_regression_num_threads_ <= 0) {
+    cost_regression_num_threads_ = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Resident disc and the prefetch ring around it have to fit, or near tiles would be evicted
+  // to make room for far ones. 0 picks the smallest cap that fits them
+  const int min_resident_tiles = static_cast<int>(
+    TiledMapStore::maxTilesWithinRadius(
+      tiled_map_tile_size_, tiled_map_resident_radius_ + tiled_map_tile_size_));
+  if (tiled_map_max_resident_tiles_ <= 0) {
+    tiled_map_max_resident_tiles_ = min_resident_tiles;
+  } else if (tiled_map_max_resident_tiles_ < min_resident_tiles) {
+    RCLCPP_WARN(
+      get_logger(),
+      "tiled_map.max_resident_tiles %d cannot hold the tiles within resident_radius %.1f and "
+      "the prefetch ring of %.1f m tiles, using %d",
+      tiled_map_max_resident_tiles_, tiled_map_resident_radius_, tiled_map_tile_size_,
+      min_resident_tiles);
+    tiled_map_max_resident_tiles_ = min_resident_tiles;
+  }
 
-  octomap_octree_ = std::make_shared<octomap::ColorOcTree>(octomap_voxel_size_);
+  octomap_octree_ =
+    std::make_shared<vox_nav_utilities::TraversabilityOcTree>(octomap_voxel_size_);
   octomap_ros_msg_ = std::make_shared<octomap_msgs::msg::Octomap>();
   octomap_pointcloud_ros_msg_ = std::make_shared<sensor_msgs::msg::PointCloud2>();
 
-  robot_localization_fromLL_client_node_ = std::make_shared<rclcpp::Node>(
-    "map_manager_fromll_client_node");
+  // Map topics are transient local in both publish modes, late joiners get the last map
+  // right away and volatile subscribers stay compatible
+  auto map_qos = rclcpp::QoS(rclcpp::KeepLast(1)).reliable().transient_local();
   octomap_publisher_ = this->create_publisher<octomap_msgs::msg::Octomap>(
-    octomap_publish_topic_name_, rclcpp::SystemDefaultsQoS());
+    octomap_publish_topic_name_, map_qos);
   octomap_pointloud_publisher_ = this->create_publisher<sensor_msgs::msg::PointCloud2>(
-    octomap_point_cloud_publish_topic_, rclcpp::SystemDefaultsQoS());
+    octomap_point_cloud_publish_topic_, map_qos);
+  map_epoch_publisher_ = this->create_publisher<std_msgs::msg::UInt64>(
+    "map_epoch", map_qos);
+  pipeline_status_publisher_ = this->create_publisher<MapPipelineStatus>(
+    "map_pipeline_status", map_qos);
+  pipeline_status_.header.frame_id = map_frame_id_;
   timer_ = this->create_wall_timer(
     std::chrono::milliseconds(static_cast<int>(1000 / octomap_publish_frequency_)),
     std::bind(&MapManager::timerCallback, this));
   robot_localization_fromLL_client_ =
-    robot_localization_fromLL_client_node_->
-    create_client<robot_localization::srv::FromLL>("/fromLL");
+    this->create_client<robot_localization::srv::FromLL>("/fromLL");
+  // navsat_transform_node works in the utm zone of the fixes it gets, and publishes
+  // odometry only once its utm to map transform is set, both are needed to georeference
+  navsat_fix_subscriber_ = this->create_subscription<sensor_msgs::msg::NavSatFix>(
+    navsat_fix_topic_, rclcpp::SensorDataQoS(),
+    [this](const sensor_msgs::msg::NavSatFix::ConstSharedPtr msg) {
+      if (msg->status.status >= sensor_msgs::msg::NavSatStatus::STATUS_FIX &&
+      std::isfinite(msg->latitude) && std::isfinite(msg->longitude))
+      {
+        navsat_utm_zone_ = vox_nav_utilities::utmZone(msg->latitude, msg->longitude);
+        navsat_is_north_ = msg->latitude >= 0.0;
+      }
+    });
+  navsat_odometry_subscriber_ = this->create_subscription<nav_msgs::msg::Odometry>(
+    navsat_odometry_topic_, rclcpp::SensorDataQoS(),
+    [this](const nav_msgs::msg::Odometry::ConstSharedPtr) {is_navsat_ready_ = true;});
   // setup TF buffer and listerner to read transforms
   tf_buffer_ = std::make_shared<tf2_ros::Buffer>(this->get_clock());
   tf_listener_ = std::make_shared<tf2_ros::TransformListener>(*tf_buffer_);
   octomap_markers_publisher_ = this->create_publisher<visualization_msgs::msg::MarkerArray>(
-    "octomap_markers", rclcpp::SystemDefaultsQoS());
+    "octomap_markers", map_qos);
+  roi_octomap_publisher_ = this->create_publisher<octomap_msgs::msg::Octomap>(
+    "octomap_roi", map_qos);
+  roi_pointcloud_publisher_ = this->create_publisher<sensor_msgs::msg::PointCloud2>(
+    "octomap_roi_pointcloud", map_qos);
+  get_octomap_service_ = this->create_service<vox_nav_msgs::srv::GetOctomap>(
+    "get_octomap",
+    std::bind(
+      &MapManager::getOctomapCallback, this, std::placeholders::_1,
+      std::placeholders::_2));
+  get_pointcloud_service_ = this->create_service<vox_nav_msgs::srv::GetPointCloud>(
+    "get_pointcloud",
+    std::bind(
+      &MapManager::getPointCloudCallback, this, std::placeholders::_1,
+      std::placeholders::_2));
+  if (cell_statistics_enabled_) {
+    get_cell_statistics_service_ = this->create_service<vox_nav_msgs::srv::GetCellStatistics>(
+      "get_cell_statistics",
+      std::bind(
+        &MapManager::getCellStatisticsCallback, this, std::placeholders::_1,
+        std::placeholders::_2));
+  }
 
-  pcd_map_pointcloud_ = vox_nav_utilities::loadPointcloudFromPcd(pcd_map_filename_.c_str());
+  if (live_updates_enabled_) {
+    if (tiled_map_enabled_) {
+      // Octrees of tiled maps are rebuilt from tiles on disk, updates would be lost
+      RCLCPP_WARN(get_logger(), "live_updates are not supported with tiled_map, ignoring them");
+    } else {
+      octomap_updates_publisher_ = this->create_publisher<octomap_msgs::msg::Octomap>(
+        "octomap_updates", rclcpp::QoS(rclcpp::KeepLast(10)).reliable());
+      last_full_map_update_stamp_ = this->now();
+      live_cloud_subscriber_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(
+        live_updates_topic_, rclcpp::SensorDataQoS(),
+        std::bind(&MapManager::liveCloudCallback, this, std::placeholders::_1));
+    }
+  }
 
-  RCLCPP_INFO(
-    this->get_logger(), "Loading a PCD map with %d points",
-    pcd_map_pointcloud_->points.size());
+  // Map is loaded, filtered and regressed off the executor, georeference is resolved meanwhile
+  setPipelineStage(&MapPipelineStatus::load, MapPipelineStatus::RUNNING, "Loading map");
+  map_preparation_future_ = std::async(std::launch::async, [this]() {return prepareMap();});
 
-  pcd_map_pointcloud_ = vox_nav_utilities::downsampleInputCloud(
-    pcd_map_pointcloud_,
-    pcd_map_downsample_voxel_size_);
+  RCLCPP_INFO(
+    this->get_logger(),
+    "Created an Instance of MapManager");
+}
 
+MapManager::~MapManager()
+{
+  // Workers use members of this node, they have to finish before it is destroyed
+  if (map_preparation_future_.valid()) {
+    map_preparation_future_.wait();
+  }
+  if (octree_build_future_.valid()) {
+    octree_build_future_.wait();
+  }
+  if (resident_map_future_.valid()) {
+    resident_map_future_.wait();
+  }
   RCLCPP_INFO(
-    this->get_logger(), "PCD Map downsampled, it now has %d points",
-    pcd_map_pointcloud_->points.size());
+    this->get_logger(),
+    "Destroyed an Instance of MapManager");
+}
+
+bool MapManager::prepareMap()
+{
+  try {
+    if (map_cache_enabled_ || tiled_map_enabled_) {
+      regressed_cloud_cache_key_ = regressedCloudCacheKey();
+      pcd_map_pointcloud_ = pcl::PointCloud<pcl::PointXYZRGB>::Ptr(
+        new pcl::PointCloud<pcl::PointXYZRGB>);
+    }
+
+    if (tiled_map_enabled_) {
+      tiled_map_store_ = std::make_shared<TiledMapStore>(
+        tiled_map_directory_, static_cast<size_t>(tiled_map_max_resident_tiles_));
+      // Tiles cut from the same regressed map are used as they are, whole map is never loaded
+      is_tiled_map_stored_ = tiled_map_store_->open() &&
+        tiled_map_store_->key() == regressed_cloud_cache_key_ &&
+        tiled_map_store_->tileSize() == tiled_map_tile_size_;
+      if (is_tiled_map_stored_) {
+        RCLCPP_INFO(
+          get_logger(), "Using %zu map tiles of %.1f m from %s, key %s",
+          tiled_map_store_->numTiles(), tiled_map_store_->tileSize(),
+          tiled_map_directory_.c_str(), regressed_cloud_cache_key_.c_str());
+        is_regressed_cloud_cached_ = true;
+      }
+    }
+
+    if (map_cache_enabled_) {
+      map_cache_ = std::make_shared<MapCache>(map_cache_directory_);
+      if (map_cache_invalidate_) {
+        RCLCPP_INFO(get_logger(), "Clearing map cache at %s", map_cache_directory_.c_str());
+        map_cache_->clear();
+      }
+      if (!is_tiled_map_stored_) {
+        is_regressed_cloud_cached_ =
+          map_cache_->loadCloud(regressed_cloud_cache_key_, pcd_map_pointcloud_);
+      }
+    }
+
+    if (is_tiled_map_stored_) {
+      // Nothing to load here, tiles around robot are loaded once map is georeferenced
+    } else if (is_regressed_cloud_cached_) {
+      RCLCPP_INFO(
+        get_logger(), "Loaded regressed map with %zu points from cache, key %s",
+        pcd_map_pointcloud_->points.size(), regressed_cloud_cache_key_.c_str());
+    } else if (!preprocessPcdMap()) {
+      return false;
+    }
+    if (is_regressed_cloud_cached_) {
+      // A regressed map from cache or a binary map still has to be cut into tiles
+      if (!is_tiled_map_stored_) {
+        writeMapTiles();
+      }
+      setPipelineStage(&MapPipelineStatus::load, MapPipelineStatus::DONE, "Loaded regressed map");
+      setPipelineStage(&MapPipelineStatus::filter, MapPipelineStatus::SKIPPED, "");
+      setPipelineStage(&MapPipelineStatus::regress, MapPipelineStatus::SKIPPED, "");
+      return true;
+    }
+
+    RCLCPP_INFO(this->get_logger(), "Regressing costs");
+    setPipelineStage(&MapPipelineStatus::regress, MapPipelineStatus::RUNNING, "Regressing costs");
+    regressCosts();
+    if (map_cache_) {
+      map_cache_->saveCloud(regressed_cloud_cache_key_, *pcd_map_pointcloud_);
+    }
+
+    writeMapTiles();
+    setPipelineStage(
+      &MapPipelineStatus::regress, MapPipelineStatus::DONE,
+      "Regressed costs of " + std::to_string(pcd_map_pointcloud_->points.size()) + " points");
+    return true;
+  } catch (const std::exception & e) {
+    RCLCPP_ERROR(get_logger(), "Exception while preparing map: %s", e.what());
+    failRunningPipelineStages(e.what());
+    return false;
+  }
+}
+
+void MapManager::writeMapTiles()
+{
+  if (!tiled_map_store_) {
+    return;
+  }
+  // Tiles are cut in static map frame, the same way the whole map is georeferenced
+  is_tiled_map_stored_ = TiledMapStore::write(
+    tiled_map_directory_, *pcd_map_pointcloud_, tiled_map_tile_size_,
+    regressed_cloud_cache_key_) && tiled_map_store_->open();
+  if (!is_tiled_map_stored_) {
+    RCLCPP_ERROR(
+      get_logger(), "Could not write map tiles to %s, serving the whole map",
+      tiled_map_directory_.c_str());
+    tiled_map_store_.reset();
+  } else {
+    RCLCPP_INFO(
+      get_logger(), "Wrote %zu map tiles to %s", tiled_map_store_->numTiles(),
+      tiled_map_directory_.c_str());
+    // Whole map is not needed anymore, resident tiles replace it
+    pcd_map_pointcloud_ = pcl::PointCloud<pcl::PointXYZRGB>::Ptr(
+      new pcl::PointCloud<pcl::PointXYZRGB>);
+  }
+}
+
+bool MapManager::preprocessPcdMap()
+{
+  bool is_preprocessed = false;
+  bool is_downsampled = false;
+  bool is_transformed = false;
+  const Eigen::Affine3f pcd_map_transform = vox_nav_utilities::getRigidBodyTransform(
+    pcd_map_transform_matrix_.translation_,
+    pcd_map_transform_matrix_.rpyIntrinsic_,
+    get_logger());
+  if (BinaryMap::isBinaryMapFilename(pcd_map_filename_)) {
+    pcd_map_pointcloud_ = pcl::PointCloud<pcl::PointXYZRGB>::Ptr(
+      new pcl::PointCloud<pcl::PointXYZRGB>);
+    BinaryMap binary_map;
+    if (!binary_map.open(pcd_map_filename_)) {
+      RCLCPP_ERROR(
+        get_logger(), "%s is not a valid binary map of version %d", pcd_map_filename_.c_str(),
+        BinaryMap::VERSION);
+      failRunningPipelineStages(pcd_map_filename_ + " is not a valid binary map");
+      return false;
+    }
+    // Filters are not rigid transform invariant, points they still run on are transformed after
+    is_preprocessed = binary_map.hasFlag(BinaryMap::PREPROCESSED);
+    // Regressed maps are used as they are, the same way as a cache hit
+    is_regressed_cloud_cached_ = binary_map.hasFlag(BinaryMap::REGRESSED);
+    is_transformed = is_preprocessed || is_regressed_cloud_cached_;
+    binary_map.toPointCloud(
+      *pcd_map_pointcloud_,
+      is_transformed ? pcd_map_transform : Eigen::Affine3f::Identity());
+    RCLCPP_INFO(
+      this->get_logger(), "Mapped a binary map with %zu points",
+      pcd_map_pointcloud_->points.size());
+  } else {
+    // Points are downsampled while reading, full resolution map is never in memory
+    std::string error;
+    pcd_map_pointcloud_ = vox_nav_utilities::loadDownsampledPointcloudFromPcd(
+      pcd_map_filename_, pcd_map_downsample_voxel_size_, pcd_map_reader_num_threads_, &error);
+    if (!error.empty()) {
+      RCLCPP_ERROR(
+        get_logger(), "Could not read %s: %s", pcd_map_filename_.c_str(), error.c_str());
+      failRunningPipelineStages("Could not read " + pcd_map_filename_ + ": " + error);
+      return false;
+    }
+    is_downsampled = true;
+    RCLCPP_INFO(
+      this->get_logger(), "Loaded a PCD map downsampled to %zu points",
+      pcd_map_pointcloud_->points.size());
+  }
+
+  if (pcd_map_pointcloud_->points.empty()) {
+    failRunningPipelineStages("Could not read any points from " + pcd_map_filename_);
+    return false;
+  }
+  if (is_regressed_cloud_cached_) {
+    return true;
+  }
+  setPipelineStage(
+    &MapPipelineStatus::load, MapPipelineStatus::DONE,
+    "Loaded " + std::to_string(pcd_map_pointcloud_->points.size()) + " points");
+
+  if (!is_preprocessed) {
+    setPipelineStage(&MapPipelineStatus::filter, MapPipelineStatus::RUNNING, "");
+    preprocessLoadedCloud(is_downsampled);
+    setPipelineStage(
+      &MapPipelineStatus::filter, MapPipelineStatus::DONE,
+      "Filtered map has " + std::to_string(pcd_map_pointcloud_->points.size()) + " points");
+  } else {
+    setPipelineStage(&MapPipelineStatus::filter, MapPipelineStatus::SKIPPED, "");
+  }
+
+  if (!is_transformed) {
+    vox_nav_utilities::transformCloudInPlace(
+      *pcd_map_pointcloud_, {pcd_map_transform}, cost_regression_num_threads_);
+  }
+  return true;
+}
+
+void MapManager::preprocessLoadedCloud(bool is_downsampled)
+{
+  if (!is_downsampled) {
+    pcd_map_pointcloud_ = vox_nav_utilities::downsampleInputCloud(
+      pcd_map_pointcloud_,
+      pcd_map_downsample_voxel_size_,
+      cost_regression_num_threads_);
+
+    RCLCPP_INFO(
+      this->get_logger(), "PCD Map downsampled, it now has %zu points",
+      pcd_map_pointcloud_->points.size());
+  }
 
   if (apply_filters_) {
-    pcd_map_pointcloud_ = vox_nav_utilities::removeOutliersFromInputCloud(
+    pcd_map_pointcloud_ = vox_nav_utilities::removeStatisticalAndRadiusOutliers(
       pcd_map_pointcloud_,
       remove_outlier_mean_K_,
       remove_outlier_stddev_threshold_,
-      vox_nav_utilities::OutlierRemovalType::StatisticalOutlierRemoval);
-    pcd_map_pointcloud_ = vox_nav_utilities::removeOutliersFromInputCloud(
-      pcd_map_pointcloud_,
       remove_outlier_min_neighbors_in_radius_,
       remove_outlier_radius_search_,
-      vox_nav_utilities::OutlierRemovalType::RadiusOutlierRemoval);
+      cost_regression_num_threads_);
   }
+}
 
-  pcd_map_pointcloud_ = vox_nav_utilities::transformCloud(
-    pcd_map_pointcloud_,
-    vox_nav_utilities::getRigidBodyTransform(
-      pcd_map_transform_matrix_.translation_,
-      pcd_map_transform_matrix_.rpyIntrinsic_,
-      get_logger()));
+std::string MapManager::regressedCloudCacheKey()
+{
+  // Everything that changes the regressed cloud must be part of the key. The map is identified
+  // by path, size and modification time, hashing its contents would read all of it every boot
+  const int64_t kCacheFormatVersion = 2;
+  CacheKeyHasher hasher;
+  hasher.add(kCacheFormatVersion);
+  if (!hasher.addFileIdentity(pcd_map_filename_)) {
+    RCLCPP_WARN(get_logger(), "Could not stat %s to hash it", pcd_map_filename_.c_str());
+  }
+  hasher.add(pcd_map_downsample_voxel_size_);
+  hasher.add(static_cast<int64_t>(apply_filters_));
+  hasher.add(static_cast<int64_t>(remove_outlier_mean_K_));
+  hasher.add(remove_outlier_stddev_threshold_);
+  hasher.add(remove_outlier_radius_search_);
+  hasher.add(static_cast<int64_t>(remove_outlier_min_neighbors_in_radius_));
+  for (int i = 0; i < 3; i++) {
+    hasher.add(pcd_map_transform_matrix_.translation_[i]);
+    hasher.add(pcd_map_transform_matrix_.rpyIntrinsic_[i]);
+  }
+  const auto & params = cost_regression_params_;
+  hasher.add(params.cell_radius);
+  hasher.add(params.max_allowed_tilt);
+  hasher.add(params.max_allowed_point_deviation);
+  hasher.add(params.max_allowed_energy_gap);
+  hasher.add(params.node_elevation_distance);
+  hasher.add(params.plane_fit_threshold);
+  hasher.add(static_cast<int64_t>(params.include_node_centers_in_cloud));
+  hasher.add(static_cast<int64_t>(params.robust_plane_fit));
+  hasher.add(static_cast<int64_t>(params.use_moment_grid));
+  hasher.add(params.moment_grid_resolution);
+  return hasher.hex();
+}
 
-  bool is_octomap_successfully_converted(false);
-  try {
-    is_octomap_successfully_converted = octomap_msgs::fullMapToMsg<octomap::ColorOcTree>(
-      *octomap_octree_, *octomap_ros_msg_);
-  } catch (const std::exception & e) {
-    std::cerr << e.what() << '\n';
-    RCLCPP_ERROR(
-      get_logger(),
-      "Exception while converting octomap %s:", e.what());
+void MapManager::timerCallback()
+{
+  auto is_ready = [](const auto & future) {
+      return future.valid() &&
+             future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+
+  // Static map is georeferenced once, the request is sent as soon as navsat is up
+  // and again if /fromLL does not answer in time
+  if (!is_georeferenced_) {
+    requestGeoreference();
   }
 
-  RCLCPP_INFO(
-    this->get_logger(),
-    "Created an Instance of MapManager");
+  if (is_ready(map_preparation_future_)) {
+    is_map_prepared_ = map_preparation_future_.get();
+  }
+
+  // Both branches are done, octree of the whole map is built off the executor as well.
+  // In tiled mode octrees are built from resident tiles instead
+  if (is_map_prepared_ && is_georeferenced_ && !tiled_map_store_ && !is_octree_build_started_) {
+    is_octree_build_started_ = true;
+    setPipelineStage(
+      &MapPipelineStatus::build_octree, MapPipelineStatus::RUNNING, "Building octomap");
+    octree_build_future_ = std::async(
+      std::launch::async, [this]() {
+        alignStaticMapToMap(static_map_to_map_transform_);
+        fillOctomapMarkers(*octomap_octree_, octomap_markers_);
+      });
+  }
+
+  if (is_ready(octree_build_future_)) {
+    octree_build_future_.get();
+    markMapChanged();
+    setPipelineStage(
+      &MapPipelineStatus::build_octree, MapPipelineStatus::DONE,
+      "Built octomap with " + std::to_string(octomap_octree_->size()) + " nodes");
+    RCLCPP_INFO(get_logger(), "Georeferenced given map");
+  }
+
+  if (is_map_prepared_ && is_georeferenced_ && tiled_map_store_) {
+    updateResidentTiles();
+  }
+
+  // Live leaves that were not observed lately fall back to the static map
+  decayLiveLeaves();
+
+  // Live updates are published as deltas right away, the full map only follows now and then
+  if (is_live_map_changed_ &&
+    (this->now() - last_full_map_update_stamp_).seconds() >= live_updates_full_map_period_)
+  {
+    updateOctomapMsg(*octomap_octree_, *octomap_ros_msg_);
+    if (publish_octomap_as_pointcloud_) {
+      updateLiveCloudMsg();
+    }
+    if (publish_octomap_markers_) {
+      fillOctomapMarkers(*octomap_octree_, octomap_markers_);
+    }
+    markMapChanged();
+    is_live_map_changed_ = false;
+    last_full_map_update_stamp_ = this->now();
+  }
+
+  publishAlignedMap();
 }
 
-MapManager::~MapManager()
+void MapManager::requestGeoreference()
 {
+  if (is_georeference_requested_) {
+    if ((this->now() - georeference_request_stamp_).seconds() < georeference_request_timeout_) {
+      return;
+    }
+    // A late response is ignored, the request is sent again below
+    RCLCPP_WARN(
+      get_logger(), "/fromLL did not answer in %.1f seconds, asking again",
+      georeference_request_timeout_);
+    is_georeference_requested_ = false;
+    setPipelineStage(
+      &MapPipelineStatus::georeference, MapPipelineStatus::FAILED,
+      "/fromLL did not answer in time, retrying");
+  }
+
+  const auto & position = static_map_gps_pose_->position;
+  tf2::Quaternion static_map_quaternion;
+  tf2::fromMsg(static_map_gps_pose_->orientation, static_map_quaternion);
+
+  // navsat_transform_node broadcasts utm frame, the same transform /fromLL applies.
+  // With it map_coordinates are converted in process and no service call is needed
+  if (tf_buffer_->canTransform(map_frame_id_, utm_frame_id_, rclcpp::Time(0))) {
+    // Eastings and northings of utm frame are only meaningful in navsat's zone
+    if (navsat_utm_zone_ == 0) {
+      RCLCPP_INFO_THROTTLE(
+        get_logger(), *get_clock(), 5000, "Waiting for a fix on %s to get the utm zone.",
+        navsat_fix_topic_.c_str());
+      return;
+    }
+    const int map_utm_zone = vox_nav_utilities::utmZone(position.latitude, position.longitude);
+    if (map_utm_zone != navsat_utm_zone_) {
+      RCLCPP_WARN(
+        get_logger(), "map_coordinates are in utm zone %d, converting them in zone %d of %s",
+        map_utm_zone, navsat_utm_zone_, navsat_fix_topic_.c_str());
+    }
+    tf2::Transform utm_to_map;
+    tf2::fromMsg(
+      tf_buffer_->lookupTransform(map_frame_id_, utm_frame_id_, rclcpp::Time(0)).transform,
+      utm_to_map);
+    vox_nav_utilities::GeodeticConverter geodetic_converter;
+    geodetic_converter.seed(utm_to_map, navsat_utm_zone_, navsat_is_north_);
+    static_map_to_map_transform_ = vox_nav_utilities::staticMapToMapTransform(
+      geodetic_converter.toMap(position.latitude, position.longitude, position.altitude),
+      yaw_offset_, static_map_quaternion);
+    onGeoreferenced("Resolved map_coordinates from " + utm_frame_id_ + " transform");
+    return;
+  }
+
+  // Without the utm transform /fromLL is asked, its answer is only meaningful once navsat
+  // published odometry. The response is handled by the executor
+  if (!is_navsat_ready_ || !robot_localization_fromLL_client_->service_is_ready()) {
+    RCLCPP_INFO_THROTTLE(
+      get_logger(), *get_clock(), 5000,
+      "Waiting for %s to %s Transform, or %s and /fromLL service to be available.",
+      utm_frame_id_.c_str(), map_frame_id_.c_str(), navsat_odometry_topic_.c_str());
+    return;
+  }
   RCLCPP_INFO(
-    this->get_logger(),
-    "Destroyed an Instance of MapManager");
+    get_logger(), "%s to %s Transform is not available, falling back to /fromLL",
+    utm_frame_id_.c_str(), map_frame_id_.c_str());
+  is_georeference_requested_ = true;
+  georeference_request_stamp_ = this->now();
+  const uint64_t request_id = ++georeference_request_id_;
+  setPipelineStage(
+    &MapPipelineStatus::georeference, MapPipelineStatus::RUNNING, "Requested /fromLL");
+
+  auto request = std::make_shared<robot_localization::srv::FromLL::Request>();
+  request->ll_point.latitude = position.latitude;
+  request->ll_point.longitude = position.longitude;
+  request->ll_point.altitude = position.altitude;
+  robot_localization_fromLL_client_->async_send_request(
+    request,
+    [this, static_map_quaternion, request_id](
+      rclcpp::Client<robot_localization::srv::FromLL>::SharedFuture future) {
+      // Responses to requests that timed out are stale
+      if (is_georeferenced_ || request_id != georeference_request_id_) {
+        return;
+      }
+      const auto & map_point = future.get()->map_point;
+      if (!std::isfinite(map_point.x) || !std::isfinite(map_point.y) ||
+      !std::isfinite(map_point.z))
+      {
+        // Asked again on next timer tick
+        RCLCPP_WARN(get_logger(), "/fromLL returned an invalid map point, asking again");
+        is_georeference_requested_ = false;
+        setPipelineStage(
+          &MapPipelineStatus::georeference, MapPipelineStatus::FAILED,
+          "/fromLL returned an invalid map point, retrying");
+        return;
+      }
+      static_map_to_map_transform_ = vox_nav_utilities::staticMapToMapTransform(
+        tf2::Vector3(map_point.x, map_point.y, map_point.z), yaw_offset_,
+        static_map_quaternion);
+      onGeoreferenced("Resolved map_coordinates");
+    });
 }
 
-void MapManager::timerCallback()
+void MapManager::onGeoreferenced(const std::string & message)
 {
-  // Since this is static map we need to georefence this only once not each time
-  std::call_once(
-    align_static_map_once_, [this]() {
-      while (!tf_buffer_->canTransform(utm_frame_id_, map_frame_id_, rclcpp::Time(0))) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        RCLCPP_INFO(
-          this->get_logger(), "Waiting for %s to %s Transform to be available.",
-          utm_frame_id_.c_str(), map_frame_id_.c_str() );
-      }
-      RCLCPP_INFO(
-        get_logger(), "Going to align the static map to map frames once,"
-        " But the map and octomap will be published at %i frequncy rate",
-        octomap_publish_frequency_);
-      RCLCPP_INFO(get_logger(), "Depending on the size of map , this might tke a while..");
-      auto request = std::make_shared<robot_localization::srv::FromLL::Request>();
-      auto response = std::make_shared<robot_localization::srv::FromLL::Response>();
-      request->ll_point.latitude = static_map_gps_pose_->position.latitude;
-      request->ll_point.longitude = static_map_gps_pose_->position.longitude;
-      request->ll_point.altitude = static_map_gps_pose_->position.altitude;
-      fromGPSPoseToMapPose(request, response);
-
-      // "/fromLL" service only accounts for translational transform
-      // we still need to rotate the points according to yaw_offset
-      // yaw_offset determines rotation between utm and map frame
-      // Normally utm and map frmaes are aligned rotationally, but if there is yaw_offset set in
-      // navsat_transfrom_node we have to account for that yaw_offset here as well
-      // use classic rotation formula https://en.wikipedia.org/wiki/Rotation_matrix#In_two_dimensions;
-      // The rotation only happens in x and y since it is round the z axis(yaw)
-      double x = response->map_point.x;
-      double y = response->map_point.y;
-      double x_dot = x * std::cos(yaw_offset_) - y * std::sin(yaw_offset_);
-      double y_dot = x * std::sin(yaw_offset_) + y * std::cos(yaw_offset_);
-
-      // The translation from static_map origin to map is basically inverse of this transform
-      tf2::Transform static_map_translation;
-      static_map_translation.setOrigin(
-        tf2::Vector3(x_dot, y_dot, response->map_point.z));
-
-      // this is identity because map and utm frames are rotationally aligned
-      static_map_translation.setRotation(tf2::Quaternion::getIdentity());
-
-      tf2::Transform static_map_rotation;
-      tf2::Quaternion static_map_quaternion;
-      tf2::fromMsg(static_map_gps_pose_->orientation, static_map_quaternion);
-      // First align the static map origin to map in translation
-      // and then rotate the static map with its correct rotation
-      static_map_rotation.setOrigin(tf2::Vector3(0, 0, 0));
-      static_map_rotation.setRotation(static_map_quaternion);
-
-      tf2::Transform static_map_to_map_transfrom = static_map_rotation *
-      static_map_translation.inverse();
-
-
-      RCLCPP_INFO(this->get_logger(), "Regressing costs");
-
-      regressCosts();
-      alignStaticMapToMap(static_map_to_map_transfrom);
-      fillOctomapMarkers(*octomap_octree_);
-
-      RCLCPP_INFO(get_logger(), "Georeferenced given map");
+  is_georeference_requested_ = true;
+  is_georeferenced_ = true;
+  // Static map is georeferenced once, navsat is not needed anymore
+  navsat_fix_subscriber_.reset();
+  navsat_odometry_subscriber_.reset();
+  setPipelineStage(&MapPipelineStatus::georeference, MapPipelineStatus::DONE, message);
+}
+
+void MapManager::setPipelineStage(
+  uint8_t MapPipelineStatus::* stage, uint8_t state,
+  const std::string & message)
+{
+  std::lock_guard<std::mutex> lock(pipeline_status_mutex_);
+  pipeline_status_.*stage = state;
+  if (!message.empty()) {
+    pipeline_status_.message = message;
+  }
+  pipeline_status_.header.stamp = now();
+  pipeline_status_publisher_->publish(pipeline_status_);
+}
+
+void MapManager::failRunningPipelineStages(const std::string & message)
+{
+  for (auto stage : {&MapPipelineStatus::load, &MapPipelineStatus::filter,
+      &MapPipelineStatus::regress})
+  {
+    bool is_running;
+    {
+      std::lock_guard<std::mutex> lock(pipeline_status_mutex_);
+      is_running = pipeline_status_.*stage == MapPipelineStatus::RUNNING;
+    }
+    if (is_running) {
+      setPipelineStage(stage, MapPipelineStatus::FAILED, message);
+    }
+  }
+}
+
+void MapManager::updateResidentTiles()
+{
+  // Tiles live in static map frame, bring robot position there.
+  // Until robot pose is available tiles around map origin are served
+  geometry_msgs::msg::PoseStamped robot_pose;
+  tf2::Vector3 robot_position(0, 0, 0);
+  if (tf_buffer_->canTransform(map_frame_id_, robot_frame_id_, rclcpp::Time(0)) &&
+    vox_nav_utilities::getCurrentPose(
+      robot_pose, *tf_buffer_, map_frame_id_, robot_frame_id_, 0.0))
+  {
+    robot_position = tf2::Vector3(
+      robot_pose.pose.position.x, robot_pose.pose.position.y, robot_pose.pose.position.z);
+  }
+  const tf2::Vector3 static_map_position = static_map_to_map_transform_.inverse() * robot_position;
+
+  auto tiles = tiled_map_store_->tilesWithinRadius(
+    static_map_position.x(), static_map_position.y(), tiled_map_resident_radius_);
+  const auto prefetch_tiles = tiled_map_store_->tilesWithinRadius(
+    static_map_position.x(), static_map_position.y(),
+    tiled_map_resident_radius_ + tiled_map_store_->tileSize());
+  for (auto && tile : prefetch_tiles) {
+    if (std::find(tiles.begin(), tiles.end(), tile) == tiles.end()) {
+      tiles.push_back(tile);
+    }
+  }
+  // Requesting more than fits would evict near tiles to load far ones
+  if (tiles.size() > static_cast<size_t>(tiled_map_max_resident_tiles_)) {
+    tiles.resize(tiled_map_max_resident_tiles_);
+  }
+  tiled_map_store_->requestTiles(tiles);
+
+  // Everything served is swapped in at once on the executor, so services and publishers
+  // never see a half built map
+  if (resident_map_future_.valid() &&
+    resident_map_future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    auto resident_map = resident_map_future_.get();
+    pcd_map_pointcloud_ = resident_map->cloud;
+    octomap_pointcloud_ros_msg_ = resident_map->cloud_msg;
+    octomap_octree_ = resident_map->octree;
+    octomap_ros_msg_ = resident_map->octomap_msg;
+    octomap_markers_ = std::move(resident_map->markers);
+    moment_grid_ = resident_map->moment_grid;
+    markMapChanged();
+    setPipelineStage(
+      &MapPipelineStatus::build_octree, MapPipelineStatus::DONE,
+      "Built octomap of " + std::to_string(resident_map->num_tiles) + " resident tiles");
+    RCLCPP_INFO(
+      get_logger(), "Serving %zu resident map tiles with %zu points",
+      resident_map->num_tiles, pcd_map_pointcloud_->points.size());
+  }
+
+  // One rebuild at a time, tiles that change meanwhile are picked up by the next one
+  if (resident_map_future_.valid() || !tiled_map_store_->hasResidentSetChanged()) {
+    return;
+  }
+  setPipelineStage(
+    &MapPipelineStatus::build_octree, MapPipelineStatus::RUNNING,
+    "Building octomap of resident tiles");
+  resident_map_future_ = std::async(
+    std::launch::async, [this, static_map_to_map = static_map_to_map_transform_]() {
+      return buildResidentMap(static_map_to_map);
     });
+}
 
-  publishAlignedMap();
+std::shared_ptr<MapManager::ResidentMap> MapManager::buildResidentMap(
+  const tf2::Transform & static_map_to_map_transfrom)
+{
+  auto resident_map = std::make_shared<ResidentMap>();
+  resident_map->num_tiles = tiled_map_store_->numResidentTiles();
+  resident_map->cloud = tiled_map_store_->residentCloud();
+  vox_nav_utilities::transformCloudInPlace(
+    *resident_map->cloud, {toAffine3f(static_map_to_map_transfrom)},
+    cost_regression_num_threads_);
+  resident_map->cloud_msg = std::make_shared<sensor_msgs::msg::PointCloud2>();
+  pcl::toROSMsg(*resident_map->cloud, *resident_map->cloud_msg);
+
+  resident_map->octree =
+    std::make_shared<vox_nav_utilities::TraversabilityOcTree>(octomap_voxel_size_);
+  buildOctomapFromCloud(*resident_map->cloud, *resident_map->octree);
+  resident_map->octomap_msg = std::make_shared<octomap_msgs::msg::Octomap>();
+  updateOctomapMsg(*resident_map->octree, *resident_map->octomap_msg);
+  fillOctomapMarkers(*resident_map->octree, resident_map->markers);
+  if (cell_statistics_enabled_) {
+    resident_map->moment_grid = std::make_shared<MomentGrid>(
+      get_traversable_points(resident_map->cloud), cell_statistics_resolution_);
+  }
+  return resident_map;
 }
 
 void MapManager::publishAlignedMap()
 {
-  octomap_ros_msg_->header.stamp = this->now();
+  if (map_epoch_ == 0) {
+    return;
+  }
+  // Nothing has changed since last publish, transient local durability serves late joiners
+  if (map_publish_mode_ == "latched" && published_map_epoch_ == map_epoch_) {
+    return;
+  }
+
+  octomap_ros_msg_->header.stamp = map_epoch_stamp_;
   octomap_ros_msg_->header.frame_id = map_frame_id_;
   octomap_publisher_->publish(*octomap_ros_msg_);
 
   if (publish_octomap_as_pointcloud_) {
     octomap_pointcloud_ros_msg_->header.frame_id = map_frame_id_;
-    octomap_pointcloud_ros_msg_->header.stamp = this->now();
+    octomap_pointcloud_ros_msg_->header.stamp = map_epoch_stamp_;
     octomap_pointloud_publisher_->publish(*octomap_pointcloud_ros_msg_);
   }
 
   if (publish_octomap_markers_) {
     octomap_markers_publisher_->publish(octomap_markers_);
   }
+
+  if (published_map_epoch_ != map_epoch_) {
+    std_msgs::msg::UInt64 epoch;
+    epoch.data = map_epoch_;
+    map_epoch_publisher_->publish(epoch);
+    RCLCPP_INFO(
+      get_logger(), "Published map epoch %llu", static_cast<unsigned long long>(map_epoch_));
+  }
+  published_map_epoch_ = map_epoch_;
 }
 
-void MapManager::fromGPSPoseToMapPose(
-  const robot_localization::srv::FromLL::Request::SharedPtr request,
-  robot_localization::srv::FromLL::Response::SharedPtr response)
+void MapManager::markMapChanged()
 {
-  while (!robot_localization_fromLL_client_->wait_for_service(std::chrono::seconds(1))) {
-    if (!rclcpp::ok()) {
-      RCLCPP_ERROR(
-        this->get_logger(),
-        "Interrupted while waiting for the /fromLL service.Exiting");
-      return;
+  map_epoch_++;
+  map_epoch_stamp_ = this->now();
+}
+
+void MapManager::getOctomapCallback(
+  const std::shared_ptr<vox_nav_msgs::srv::GetOctomap::Request> request,
+  std::shared_ptr<vox_nav_msgs::srv::GetOctomap::Response> response)
+{
+  if (map_epoch_ == 0) {
+    RCLCPP_WARN(get_logger(), "Map is not georeferenced yet, cannot serve octomap request");
+    return;
+  }
+
+  const auto & c = request->bounding_box_origin;
+  const auto & l = request->bounding_box_lengths;
+  const octomap::point3d min(c.x - l.x / 2.0, c.y - l.y / 2.0, c.z - l.z / 2.0);
+  const octomap::point3d max(c.x + l.x / 2.0, c.y + l.y / 2.0, c.z + l.z / 2.0);
+
+  // Each level up the octree doubles node size
+  unsigned int depth = octomap_octree_->getTreeDepth();
+  if (request->leaf_size > octomap_octree_->getResolution()) {
+    const int levels = static_cast<int>(
+      std::ceil(std::log2(request->leaf_size / octomap_octree_->getResolution()) - 1e-9));
+    depth = static_cast<unsigned int>(std::max(1, static_cast<int>(depth) - levels));
+  }
+
+  auto roi_octree = cropOctomap(min, max, depth);
+
+  octomap_msgs::fullMapToMsg<vox_nav_utilities::TraversabilityOcTree>(
+    *roi_octree, response->map);
+  response->map.binary = false;
+  response->map.resolution = roi_octree->getResolution();
+  response->map.header.frame_id = map_frame_id_;
+  response->map.header.stamp = map_epoch_stamp_;
+  response->origin_latitude = static_map_gps_pose_->position.latitude;
+  response->origin_longitude = static_map_gps_pose_->position.longitude;
+  response->origin_altitude = static_map_gps_pose_->position.altitude;
+
+  if (request->publish_octomap) {
+    roi_octomap_publisher_->publish(response->map);
+  }
+  if (!request->filename.empty() && !roi_octree->write(request->filename)) {
+    RCLCPP_WARN(get_logger(), "Could not write octomap to %s", request->filename.c_str());
+  }
+
+  RCLCPP_INFO(
+    get_logger(), "Served octomap with %zu nodes at %.2f resolution",
+    roi_octree->size(), roi_octree->getResolution());
+}
+
+std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> MapManager::cropOctomap(
+  const octomap::point3d & min,
+  const octomap::point3d & max,
+  unsigned int depth)
+{
+  const double node_size = octomap_octree_->getNodeSize(depth);
+  auto roi_octree = std::make_shared<vox_nav_utilities::TraversabilityOcTree>(node_size);
+
+  // Clamp the box to the tree, keys outside of it cannot be computed
+  double tree_min[3], tree_max[3];
+  octomap_octree_->getMetricMin(tree_min[0], tree_min[1], tree_min[2]);
+  octomap_octree_->getMetricMax(tree_max[0], tree_max[1], tree_max[2]);
+  octomap::point3d clamped_min, clamped_max;
+  for (int i = 0; i < 3; i++) {
+    clamped_min(i) = std::max(min(i), static_cast<float>(tree_min[i]));
+    clamped_max(i) = std::min(max(i), static_cast<float>(tree_max[i]));
+    if (clamped_min(i) > clamped_max(i)) {
+      return roi_octree;
     }
-    RCLCPP_INFO(
-      this->get_logger(), "/fromLL service not available, waiting and trying again");
   }
 
-  auto result_future = robot_localization_fromLL_client_->async_send_request(request);
-  if (rclcpp::spin_until_future_complete(
-      robot_localization_fromLL_client_node_,
-      result_future) !=
-    rclcpp::FutureReturnCode::SUCCESS)
+  octomap::OcTreeKey min_key, max_key;
+  if (!octomap_octree_->coordToKeyChecked(clamped_min, min_key) ||
+    !octomap_octree_->coordToKeyChecked(clamped_max, max_key))
   {
-    RCLCPP_ERROR(this->get_logger(), "/fromLL service call failed");
+    return roi_octree;
+  }
+
+  // Nodes at given depth have the size of roi_octree leafs and are aligned to its grid,
+  // pruned nodes above that depth are split into several roi_octree leafs
+  for (auto it = octomap_octree_->begin_leafs_bbx(min_key, max_key, depth),
+    end = octomap_octree_->end_leafs_bbx(); it != end; ++it)
+  {
+    const unsigned int leafs_per_side = 1u << (depth - it.getDepth());
+    const double it_size = it.getSize();
+    const octomap::point3d corner = it.getCoordinate() - octomap::point3d(
+      it_size / 2.0, it_size / 2.0, it_size / 2.0);
+    for (unsigned int dx = 0; dx < leafs_per_side; dx++) {
+      for (unsigned int dy = 0; dy < leafs_per_side; dy++) {
+        for (unsigned int dz = 0; dz < leafs_per_side; dz++) {
+          const octomap::point3d center(
+            corner.x() + (dx + 0.5) * node_size,
+            corner.y() + (dy + 0.5) * node_size,
+            corner.z() + (dz + 0.5) * node_size);
+          bool is_in_box = true;
+          for (int i = 0; i < 3; i++) {
+            is_in_box &= center(i) + node_size / 2.0 >= clamped_min(i) &&
+              center(i) - node_size / 2.0 <= clamped_max(i);
+          }
+          octomap::OcTreeKey key;
+          if (!is_in_box || !roi_octree->coordToKeyChecked(center, key)) {
+            continue;
+          }
+          auto node = roi_octree->setNodeValue(key, it->getLogOdds(), true);
+          node->setCost(it->getCost());
+          node->setClassBits(it->getClassBits());
+        }
+      }
+    }
+  }
+  roi_octree->updateInnerOccupancy();
+  return roi_octree;
+}
+
+void MapManager::getPointCloudCallback(
+  const std::shared_ptr<vox_nav_msgs::srv::GetPointCloud::Request> request,
+  std::shared_ptr<vox_nav_msgs::srv::GetPointCloud::Response> response)
+{
+  if (map_epoch_ == 0) {
+    RCLCPP_WARN(get_logger(), "Map is not georeferenced yet, cannot serve point cloud request");
+    return;
+  }
+
+  const auto & c = request->bounding_box_origin;
+  const auto & l = request->bounding_box_lengths;
+
+  // Crop by indices, so that only points within the box are copied
+  pcl::CropBox<pcl::PointXYZRGB> crop_box;
+  crop_box.setInputCloud(pcd_map_pointcloud_);
+  crop_box.setMin(
+    Eigen::Vector4f(c.x - l.x / 2.0, c.y - l.y / 2.0, c.z - l.z / 2.0, 1.0));
+  crop_box.setMax(
+    Eigen::Vector4f(c.x + l.x / 2.0, c.y + l.y / 2.0, c.z + l.z / 2.0, 1.0));
+  pcl::Indices indices;
+  crop_box.filter(indices);
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr roi_cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  pcl::copyPointCloud(*pcd_map_pointcloud_, indices, *roi_cloud);
+  if (request->leaf_size > octomap_voxel_size_) {
+    roi_cloud = vox_nav_utilities::downsampleInputCloud(roi_cloud, request->leaf_size);
+  }
+
+  pcl::toROSMsg(*roi_cloud, response->cloud);
+  response->cloud.header.frame_id = map_frame_id_;
+  response->cloud.header.stamp = map_epoch_stamp_;
+  response->origin_latitude = static_map_gps_pose_->position.latitude;
+  response->origin_longitude = static_map_gps_pose_->position.longitude;
+  response->origin_altitude = static_map_gps_pose_->position.altitude;
+
+  if (request->publish_pointcloud) {
+    roi_pointcloud_publisher_->publish(response->cloud);
+  }
+  if (!request->filename.empty() &&
+    pcl::io::savePCDFileBinary(request->filename, *roi_cloud) != 0)
+  {
+    RCLCPP_WARN(get_logger(), "Could not write point cloud to %s", request->filename.c_str());
+  }
+
+  RCLCPP_INFO(get_logger(), "Served point cloud with %zu points", roi_cloud->points.size());
+}
+
+void MapManager::getCellStatisticsCallback(
+  const std::shared_ptr<vox_nav_msgs::srv::GetCellStatistics::Request> request,
+  std::shared_ptr<vox_nav_msgs::srv::GetCellStatistics::Response> response)
+{
+  if (map_epoch_ == 0 || !moment_grid_) {
+    RCLCPP_WARN(get_logger(), "Map is not georeferenced yet, cannot serve cell statistics");
+    return;
   }
 
-  auto result = result_future.get();
-  response->map_point = result->map_point;
+  const Eigen::Vector3d origin = moment_grid_->origin();
+  response->statistics.reserve(request->centers.size());
+  for (auto && center : request->centers) {
+    PointMoments moments;
+    const CellFeatures features =
+      moment_grid_->cellFeatures(center.x, center.y, request->radius, &moments);
+    vox_nav_msgs::msg::CellStatistics statistics;
+    statistics.num_points = static_cast<uint32_t>(moments.n);
+    if (moments.n > 0.0) {
+      statistics.centroid.x = origin.x() + moments.sx / moments.n;
+      statistics.centroid.y = origin.y() + moments.sy / moments.n;
+      statistics.centroid.z = origin.z() + moments.sz / moments.n;
+    }
+    statistics.normal.x = features.plane_model.values[0];
+    statistics.normal.y = features.plane_model.values[1];
+    statistics.normal.z = features.plane_model.values[2];
+    statistics.roll = features.roll;
+    statistics.pitch = features.pitch;
+    statistics.average_point_deviation = features.average_point_deviation;
+    statistics.z_range = features.z_range;
+    response->statistics.push_back(statistics);
+  }
+  response->header.frame_id = map_frame_id_;
+  response->header.stamp = map_epoch_stamp_;
 }
 
 void MapManager::alignStaticMapToMap(const tf2::Transform & static_map_to_map_transfrom)
 {
-  pcl_ros::transformPointCloud(
-    *pcd_map_pointcloud_, *pcd_map_pointcloud_, static_map_to_map_transfrom
-  );
+  // Costs are regressed in static map frame, so pcd_map_transform was applied at load time
+  // and only georeference is left. The whole map is aligned in place so no second cloud is
+  // allocated, resident tiles are aligned by buildResidentMap() instead
+  vox_nav_utilities::transformCloudInPlace(
+    *pcd_map_pointcloud_, {toAffine3f(static_map_to_map_transfrom)},
+    cost_regression_num_threads_);
   pcl::toROSMsg(*pcd_map_pointcloud_, *octomap_pointcloud_ros_msg_);
 
-  octomap::Pointcloud octocloud;
-  octomap::point3d sensorOrigin(0, 0, 0);
+  // The finished octree depends on georeference as well, so extend the cloud key with it
+  std::string octree_cache_key;
+  bool is_octree_cached = false;
+  if (map_cache_) {
+    CacheKeyHasher hasher;
+    hasher.add(regressed_cloud_cache_key_);
+    hasher.add(octomap_voxel_size_);
+    hasher.add(octomap_build_mode_);
+    hasher.add(octomap_cost_aggregation_);
+    const auto & origin = static_map_to_map_transfrom.getOrigin();
+    const auto rotation = static_map_to_map_transfrom.getRotation();
+    for (int i = 0; i < 3; i++) {
+      hasher.add(static_cast<double>(origin[i]));
+    }
+    for (int i = 0; i < 4; i++) {
+      hasher.add(static_cast<double>(rotation[i]));
+    }
+    octree_cache_key = hasher.hex();
+    auto cached_octree = map_cache_->loadOctree(octree_cache_key);
+    if (cached_octree) {
+      RCLCPP_INFO(get_logger(), "Loaded octomap from cache, key %s", octree_cache_key.c_str());
+      octomap_octree_ = cached_octree;
+      is_octree_cached = true;
+    }
+  }
+
+  if (!is_octree_cached) {
+    buildOctomapFromCloud(*pcd_map_pointcloud_, *octomap_octree_);
+    if (map_cache_) {
+      map_cache_->saveOctree(octree_cache_key, *octomap_octree_);
+    }
+  }
 
-  for (auto && i : pcd_map_pointcloud_->points) {
-    octocloud.push_back(octomap::point3d(i.x, i.y, i.z));
+  // Statistics served to planners are taken over the same points, in map frame
+  if (cell_statistics_enabled_) {
+    moment_grid_ = std::make_shared<MomentGrid>(
+      get_traversable_points(pcd_map_pointcloud_), cell_statistics_resolution_);
+    RCLCPP_INFO(
+      get_logger(), "Built cell statistics using %zu bytes", moment_grid_->memoryUsage());
   }
 
-  octomap_octree_->insertPointCloud(octocloud, sensorOrigin);
+  updateOctomapMsg(*octomap_octree_, *octomap_ros_msg_);
+}
 
-  for (auto && i : pcd_map_pointcloud_->points) {
-    double value = static_cast<double>(i.b / 255.0) -
-      static_cast<double>(i.g / 255.0);
-    if (i.r == 255) {
-      value = 2.0;
-    }
-    if (i.r == 255 && i.g == 255) {
-      value = 3.0;
+Eigen::Affine3f MapManager::toAffine3f(const tf2::Transform & transform)
+{
+  Eigen::Affine3f affine = Eigen::Affine3f::Identity();
+  const auto & basis = transform.getBasis();
+  const auto & translation = transform.getOrigin();
+  for (int row = 0; row < 3; row++) {
+    for (int col = 0; col < 3; col++) {
+      affine.matrix()(row, col) = basis[row][col];
     }
-    octomap_octree_->setNodeValue(i.x, i.y, i.z, std::max(0.0, value));
+    affine.matrix()(row, 3) = translation[row];
   }
+  return affine;
+}
 
+void MapManager::updateOctomapMsg(
+  const vox_nav_utilities::TraversabilityOcTree & octree,
+  octomap_msgs::msg::Octomap & msg)
+{
   try {
-    octomap_msgs::fullMapToMsg<octomap::ColorOcTree>(*octomap_octree_, *octomap_ros_msg_);
-    octomap_ros_msg_->binary = false;
-    octomap_ros_msg_->resolution = octomap_voxel_size_;
+    octomap_msgs::fullMapToMsg<vox_nav_utilities::TraversabilityOcTree>(octree, msg);
+    msg.binary = false;
+    msg.resolution = octomap_voxel_size_;
   } catch (const std::exception & e) {
     std::cerr << e.what() << '\n';
     RCLCPP_ERROR(
       get_logger(),
       "Exception while converting binary octomap %s:", e.what());
   }
+}
+
+void MapManager::buildOctomapFromCloud(
+  const pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+  vox_nav_utilities::TraversabilityOcTree & octree)
+{
+  auto start = std::chrono::steady_clock::now();
+  // Map may be rebuilt, e.g. when resident tiles change
+  octree.clear();
+
+  if (octomap_build_mode_ == "raycast") {
+    octomap::Pointcloud octocloud;
+    octomap::point3d sensorOrigin(0, 0, 0);
+
+    for (auto && i : cloud.points) {
+      octocloud.push_back(octomap::point3d(i.x, i.y, i.z));
+    }
+
+    octree.insertPointCloud(octocloud, sensorOrigin);
+
+    for (auto && i : cloud.points) {
+      octomap::OcTreeKey key;
+      if (octree.coordToKeyChecked(i.x, i.y, i.z, key)) {
+        octree.setNodeCostValue(key, traversability_cost_from_color(i), true);
+      }
+    }
+    octree.updateInnerOccupancy();
+  } else {
+    // Occupancy only, no ray casting. Keys are computed in parallel, sorted so that points of
+    // the same leaf are adjacent and then each leaf is inserted exactly once with aggregated cost
+    const int64_t num_points = static_cast<int64_t>(cloud.points.size());
+    const uint64_t kInvalidKey = std::numeric_limits<uint64_t>::max();
+    std::vector<std::pair<uint64_t, float>> keyed_costs(num_points);
+
+    #pragma omp parallel for num_threads(cost_regression_num_threads_)
+    for (int64_t i = 0; i < num_points; i++) {
+      const auto & point = cloud.points[i];
+      octomap::OcTreeKey key;
+      if (octree.coordToKeyChecked(point.x, point.y, point.z, key)) {
+        keyed_costs[i] = std::make_pair(
+          static_cast<uint64_t>(key[0]) |
+          (static_cast<uint64_t>(key[1]) << 16) |
+          (static_cast<uint64_t>(key[2]) << 32),
+          static_cast<float>(traversability_cost_from_color(point)));
+      } else {
+        keyed_costs[i] = std::make_pair(kInvalidKey, 0.0f);
+      }
+    }
+
+    std::sort(keyed_costs.begin(), keyed_costs.end());
+
+    const bool aggregate_mean = octomap_cost_aggregation_ == "mean";
+    size_t group_begin = 0;
+    while (group_begin < keyed_costs.size() && keyed_costs[group_begin].first != kInvalidKey) {
+      const uint64_t packed_key = keyed_costs[group_begin].first;
+      size_t group_end = group_begin;
+      double cost_sum = 0.0;
+      float cost_max = 0.0f;
+      while (group_end < keyed_costs.size() && keyed_costs[group_end].first == packed_key) {
+        cost_sum += keyed_costs[group_end].second;
+        cost_max = std::max(cost_max, keyed_costs[group_end].second);
+        group_end++;
+      }
+      const float cost = aggregate_mean ?
+        static_cast<float>(cost_sum / (group_end - group_begin)) : cost_max;
+      octomap::OcTreeKey key(
+        static_cast<octomap::key_type>(packed_key & 0xFFFF),
+        static_cast<octomap::key_type>((packed_key >> 16) & 0xFFFF),
+        static_cast<octomap::key_type>((packed_key >> 32) & 0xFFFF));
+      // lazy_eval, inner nodes are updated once after all leafs are in
+      octree.setNodeCostValue(key, cost, true);
+      group_begin = group_end;
+    }
+    octree.updateInnerOccupancy();
+  }
 
+  RCLCPP_INFO(
+    get_logger(), "Built octomap with %zu nodes in %.3f seconds using %s mode",
+    octree.size(),
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+    octomap_build_mode_.c_str());
 }
 
-void MapManager::fillOctomapMarkers(const octomap::ColorOcTree & tree)
+void MapManager::fillOctomapMarkers(
+  const vox_nav_utilities::TraversabilityOcTree & tree,
+  visualization_msgs::msg::MarkerArray & markers)
 {
   auto tree_depth = tree.getTreeDepth();
-  octomap_markers_.markers.resize(tree_depth + 1);
+  markers.markers.clear();
+  markers.markers.resize(tree_depth + 1);
   // now, traverse all leafs in the tree:
   for (auto it = tree.begin(tree_depth),
     end = tree.end(); it != end; ++it)
   {
     unsigned idx = it.getDepth();
-    assert(idx < octomap_markers_.markers.size());
+    assert(idx < markers.markers.size());
     geometry_msgs::msg::Point cubeCenter;
     cubeCenter.x = it.getCoordinate().x();
     cubeCenter.y = it.getCoordinate().y();
     cubeCenter.z = it.getCoordinate().z();
-    octomap_markers_.markers[idx].points.push_back(cubeCenter);
+    markers.markers[idx].points.push_back(cubeCenter);
 
     std_msgs::msg::ColorRGBA color;
 
-    color.g = 1.0 - it->getValue();
-    color.b = it->getValue();
+    color.g = 1.0 - it->getNormalizedCost();
+    color.b = it->getNormalizedCost();
     color.a = 1.0;
 
-    if (it->getValue() == 2.0) {
+    if (it->hasClass(vox_nav_utilities::TraversabilityOcTreeNode::NON_TRAVERSABLE)) {
       color.r = 1.0;
       color.g = 0.0;
       color.b = 0.0;
     }
 
-    if (it->getValue() == 3.0) {
+    if (it->hasClass(vox_nav_utilities::TraversabilityOcTreeNode::ELEVATED_NODE)) {
       color.r = 1.0;
       color.g = 1.0;
       color.b = 0.0;
@@ -364,27 +1266,27 @@ void MapManager::fillOctomapMarkers(const octomap::ColorOcTree & tree)
       color.a = 0.04;
     }
 
-    octomap_markers_.markers[idx].colors.push_back(color);
+    markers.markers[idx].colors.push_back(color);
   }
 
-  for (unsigned i = 0; i < octomap_markers_.markers.size(); ++i) {
+  for (unsigned i = 0; i < markers.markers.size(); ++i) {
     double size = tree.getNodeSize(i);
 
-    octomap_markers_.markers[i].header.frame_id = map_frame_id_;
-    octomap_markers_.markers[i].header.stamp = this->now();
-    octomap_markers_.markers[i].ns = map_frame_id_;
-    octomap_markers_.markers[i].id = i;
-    octomap_markers_.markers[i].type =
+    markers.markers[i].header.frame_id = map_frame_id_;
+    markers.markers[i].header.stamp = this->now();
+    markers.markers[i].ns = map_frame_id_;
+    markers.markers[i].id = i;
+    markers.markers[i].type =
       visualization_msgs::msg::Marker::CUBE_LIST;
-    octomap_markers_.markers[i].scale.x = size;
-    octomap_markers_.markers[i].scale.y = size;
-    octomap_markers_.markers[i].scale.z = size;
+    markers.markers[i].scale.x = size;
+    markers.markers[i].scale.y = size;
+    markers.markers[i].scale.z = size;
 
-    if (octomap_markers_.markers[i].points.size() > 0) {
-      octomap_markers_.markers[i].action =
+    if (markers.markers[i].points.size() > 0) {
+      markers.markers[i].action =
         visualization_msgs::msg::Marker::ADD;
     } else {
-      octomap_markers_.markers[i].action =
+      markers.markers[i].action =
         visualization_msgs::msg::Marker::DELETE;
     }
   }
@@ -392,19 +1294,22 @@ void MapManager::fillOctomapMarkers(const octomap::ColorOcTree & tree)
 
 void MapManager::regressCosts()
 {
-  // PARAMETERS
-  double CELL_RADIUS = 0.8;
-  double MAX_ALLOWED_TILT = 40.0; // degrees
-  double MAX_ALLOWED_POINT_DEVIATION = 0.2;
-  double MAX_ALLOWED_ENERGY_GAP = 0.2;
-  double NODE_ELEVATION_DISTANCE = 0.5;
-  double PLANE_FIT_THRES = 0.2;
-  bool INCLUDE_NODE_CENTERS_IN_CLOUD = true;
-  const double kMAX_COLOR_RANGE = 255.0;
+  const auto & params = cost_regression_params_;
+
+  // Used to report how long each stage of regression took
+  auto stage_start = std::chrono::steady_clock::now();
+  auto log_stage_duration = [this, &stage_start](const char * stage_name) {
+      auto stage_end = std::chrono::steady_clock::now();
+      RCLCPP_INFO(
+        get_logger(), "Cost regression stage \"%s\" took %.3f seconds", stage_name,
+        std::chrono::duration<double>(stage_end - stage_start).count());
+      stage_start = stage_end;
+    };
 
   // DENOISE THE CLOUD IF HAVENT ALREADY
   auto denoised_cloud =
-    denoise_segmented_cloud(pcd_map_pointcloud_, 0.8, 0.3, 10);
+    denoise_segmented_cloud(pcd_map_pointcloud_, 0.8, 0.3, 10, cost_regression_num_threads_);
+  log_stage_duration("denoise");
 
   // REMOVE NON TRAVERSABLE POINTS(RED POINTS)
   auto pure_traversable_pcl = get_traversable_points(denoised_cloud);
@@ -413,75 +1318,461 @@ void MapManager::regressCosts()
   // UNIFORMLY SAMPLE NODES ON TOP OF TRAVERSABLE CLOUD
   auto uniformly_sampled_nodes = uniformly_sample_cloud(
     pure_traversable_pcl,
-    CELL_RADIUS);
+    params.cell_radius);
+  log_stage_duration("sample");
 
-  // THIS IS BASICALLY VECTOR OF CLOUD SEGMENTS, EACH SEGMENT INCLUDES POINTS REPRESENTING CELL,
-  // THE FIRST ELEMNET OF PAIR IS CENTROID WHILE SECOND IS THE POINTCLOUD ITSELF
-  std::vector<std::pair<pcl::PointXYZRGB,
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr>> decomposed_cells =
-    decompose_traversability_cloud(
-    pure_traversable_pcl,
-    uniformly_sampled_nodes, CELL_RADIUS);
+  pcl::PointCloud<pcl::PointXYZRGB> cld;
+  if (params.use_moment_grid) {
+    cld = regressCostsWithMomentGrid(pure_traversable_pcl, uniformly_sampled_nodes);
+    log_stage_duration("regress");
+  } else {
+    // CELLS ARE INDEX SPANS INTO TRAVERSABLE CLOUD, POINTS ARE ONLY COPIED ONCE WHILE MERGING
+    DecomposedCells decomposed_cells =
+      decompose_traversability_cloud_into_spans(
+      pure_traversable_pcl,
+      uniformly_sampled_nodes, params.cell_radius);
+    log_stage_duration("decompose");
+
+    RCLCPP_INFO(
+      get_logger(), "Regressing costs of %zu cells with %d threads",
+      decomposed_cells.spans.size(), cost_regression_num_threads_);
+    cld = regress_decomposed_cells(
+      pure_traversable_pcl, decomposed_cells, params, cost_regression_num_threads_);
+    log_stage_duration("regress");
+  }
+
+  cld.points.insert(
+    cld.points.end(),
+    pure_non_traversable_pcl->points.begin(), pure_non_traversable_pcl->points.end());
+  cld.height = 1;
+  cld.width = cld.points.size();
+
+  *pcd_map_pointcloud_ = cld;
+  log_stage_duration("merge");
+}
+
+pcl::PointCloud<pcl::PointXYZRGB> MapManager::regressCostsWithMomentGrid(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr pure_traversable_pcl,
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr uniformly_sampled_nodes)
+{
+  const auto & params = cost_regression_params_;
+  const MomentGrid moment_grid(pure_traversable_pcl, params.moment_grid_resolution);
+
+  // Cost of each column is regressed from the cell centered at that column,
+  // so each point is colored exactly once. Only columns with points are regressed
+  const std::vector<int64_t> columns = moment_grid.nonEmptyColumns();
+  const int64_t num_columns = static_cast<int64_t>(columns.size());
+  std::vector<std::vector<double>> column_colors(num_columns);
+
+  RCLCPP_INFO(
+    get_logger(), "Regressing costs of %ld grid columns with %d threads",
+    static_cast<long>(num_columns), cost_regression_num_threads_);
+
+  #pragma omp parallel for schedule(dynamic, 256) num_threads(cost_regression_num_threads_)
+  for (int64_t c = 0; c < num_columns; c++) {
+    auto center = moment_grid.columnCenter(columns[c]);
+    auto features = moment_grid.cellFeatures(center.x(), center.y(), params.cell_radius);
+    column_colors[c] = cost_color_from_cell_features(features, params);
+  }
 
   pcl::PointCloud<pcl::PointXYZRGB> cld;
-  pcl::PointCloud<pcl::PointXYZRGB> elevated_nodes_cloud;
-  for (auto && i : decomposed_cells) {
+  cld.points.resize(pure_traversable_pcl->points.size());
+  #pragma omp parallel for num_threads(cost_regression_num_threads_)
+  for (int64_t i = 0; i < static_cast<int64_t>(pure_traversable_pcl->points.size()); i++) {
+    pcl::PointXYZRGB point = pure_traversable_pcl->points[i];
+    // Column of every point has points, so it is found
+    const auto column = std::lower_bound(
+      columns.begin(), columns.end(), moment_grid.columnIndex(point.x, point.y));
+    const auto & color = column_colors[column - columns.begin()];
+    point.r = color[0];
+    point.g = color[1];
+    point.b = color[2];
+    cld.points[i] = point;
+  }
 
-    auto plane_model = fit_plane_to_cloud(i.second, PLANE_FIT_THRES);
-    auto rpy_from_plane_model = absolute_rpy_from_plane(plane_model);
+  if (params.include_node_centers_in_cloud) {
+    for (auto && node : uniformly_sampled_nodes->points) {
+      auto features = moment_grid.cellFeatures(node.x, node.y, params.cell_radius);
+      cld.points.push_back(elevated_node_from_cell_features(node, features, params));
+    }
+  }
+  return cld;
+}
 
-    auto pitch = rpy_from_plane_model[0];
-    auto roll = rpy_from_plane_model[1];
-    auto yaw = rpy_from_plane_model[2];
+void MapManager::liveCloudCallback(const sensor_msgs::msg::PointCloud2::ConstSharedPtr msg)
+{
+  // Updates go into the octree that is served, which exists once a map epoch was started
+  if (map_epoch_ == 0) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  pcl::fromROSMsg(*msg, *cloud);
+  if (msg->header.frame_id != map_frame_id_) {
+    geometry_msgs::msg::TransformStamped cloud_to_map;
+    try {
+      cloud_to_map = tf_buffer_->lookupTransform(
+        map_frame_id_, msg->header.frame_id, msg->header.stamp);
+    } catch (tf2::TransformException & ex) {
+      RCLCPP_WARN_THROTTLE(
+        get_logger(), *get_clock(), 5000, "Dropping live cloud, %s", ex.what());
+      return;
+    }
+    const Eigen::Affine3f cloud_to_map_affine(
+      tf2::transformToEigen(cloud_to_map).cast<float>().matrix());
+    vox_nav_utilities::transformCloudInPlace(
+      *cloud, {cloud_to_map_affine}, cost_regression_num_threads_);
+  }
 
-    double average_point_deviation =
-      average_point_deviation_from_plane(i.second, plane_model);
+  const auto changed_keys = applyLiveCloud(*cloud);
+  if (changed_keys.empty()) {
+    return;
+  }
+  publishOctomapUpdate(changed_keys);
 
-    double max_energy_gap =
-      max_energy_gap_in_cloud(i.second, 0.1, 1.0);
+  RCLCPP_INFO_THROTTLE(
+    get_logger(), *get_clock(), 5000,
+    "Live update of %zu points changed %zu leaves in %.3f seconds",
+    cloud->points.size(), changed_keys.size(),
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
 
-    double slope_cost = std::min(
-      std::max(pitch, roll) / MAX_ALLOWED_TILT, 1.0) * kMAX_COLOR_RANGE;
+void MapManager::updateLiveCellIndex()
+{
+  const auto & params = cost_regression_params_;
+  live_static_traversable_.reset(new pcl::PointCloud<pcl::PointXYZRGB>);
+  // Regressed traversable points range from green to blue, red and yellow ones are not cells
+  for (auto && point : pcd_map_pointcloud_->points) {
+    if (point.r != 255) {
+      live_static_traversable_->points.push_back(point);
+    }
+  }
+  live_static_traversable_->width = live_static_traversable_->points.size();
+  live_static_traversable_->height = 1;
+  // Same sampling as regressCosts, so live cells are the cells of the static map
+  live_cell_centers_ = uniformly_sample_cloud(live_static_traversable_, params.cell_radius);
+  if (!live_static_traversable_->points.empty()) {
+    live_static_kdtree_.setInputCloud(live_static_traversable_);
+    live_cell_centers_kdtree_.setInputCloud(live_cell_centers_);
+  }
+  live_cell_index_epoch_ = map_epoch_;
+  RCLCPP_INFO(
+    get_logger(), "Live updates index %zu cells of %zu static traversable points",
+    live_cell_centers_->points.size(), live_static_traversable_->points.size());
+}
 
-    double energy_gap_cost = std::min(
-      max_energy_gap / MAX_ALLOWED_ENERGY_GAP, 1.0) * kMAX_COLOR_RANGE;
+std::vector<octomap::OcTreeKey> MapManager::applyLiveCloud(
+  const pcl::PointCloud<pcl::PointXYZRGB> & cloud)
+{
+  const auto & params = cost_regression_params_;
+  if (live_cell_index_epoch_ != map_epoch_) {
+    updateLiveCellIndex();
+  }
+  const bool has_static_cells = !live_cell_centers_->points.empty();
 
-    double deviation_of_points_cost = std::min(
-      average_point_deviation / MAX_ALLOWED_POINT_DEVIATION, 1.0) * kMAX_COLOR_RANGE;
+  // cost value of each touched leaf, aggregated the same way as buildOctomapFromCloud
+  struct LeafCost
+  {
+    double sum {0.0};
+    double max {0.0};
+    int count {0};
+    // color of the costliest point, for the published cloud
+    pcl::PointXYZRGB colored;
+  };
+  std::unordered_map<uint64_t, LeafCost> leaf_costs;
+  auto add_leaf_cost = [&](
+    const pcl::PointXYZRGB & point, double cost, const pcl::PointXYZRGB & colored) {
+      octomap::OcTreeKey key;
+      if (octomap_octree_->coordToKeyChecked(point.x, point.y, point.z, key)) {
+        auto & leaf = leaf_costs[packKey(key)];
+        leaf.sum += cost;
+        if (!leaf.count || cost >= leaf.max) {
+          leaf.max = cost;
+          leaf.colored = colored;
+        }
+        leaf.count++;
+      }
+    };
+
+  // Points of cells that earlier clouds had no room for come first, oldest first
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr traversable(new pcl::PointCloud<pcl::PointXYZRGB>);
+  const size_t num_pending_points = pending_live_points_.points.size();
+  traversable->points.swap(pending_live_points_.points);
+  for (auto && point : cloud.points) {
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) {
+      continue;
+    }
+    // Same labelling as get_traversable_points, non traversable points need no regression
+    if (!point.g) {
+      add_leaf_cost(point, 2.0, point);
+      continue;
+    }
+    traversable->points.push_back(point);
+  }
+  traversable->width = traversable->points.size();
+  traversable->height = 1;
 
+  // A cell of the static map is touched by the new points within cell_radius of its center,
+  // like decompose_traversability_cloud_into_spans. Points on terrain the static map did not
+  // have get new cells, sampled from them the same way the static map was
+  struct LiveCell
+  {
+    pcl::PointXYZRGB center;
+    // new points of this cell, ascending, so the first one tells the age of the cell
+    std::vector<int> points;
+  };
+  std::vector<LiveCell> cells;
+  {
+    std::unordered_map<int, size_t> cell_of_center;
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr uncovered(new pcl::PointCloud<pcl::PointXYZRGB>);
+    std::vector<int> uncovered_points;
+    std::vector<int> neighbours;
+    std::vector<float> sqr_distances;
+    for (int i = 0; i < static_cast<int>(traversable->points.size()); i++) {
+      if (!has_static_cells ||
+        live_cell_centers_kdtree_.radiusSearch(
+          traversable->points[i], params.cell_radius, neighbours, sqr_distances) == 0)
+      {
+        uncovered->points.push_back(traversable->points[i]);
+        uncovered_points.push_back(i);
+        continue;
+      }
+      for (auto && center : neighbours) {
+        auto inserted = cell_of_center.emplace(center, cells.size());
+        if (inserted.second) {
+          cells.push_back({live_cell_centers_->points[center], {}});
+        }
+        cells[inserted.first->second].points.push_back(i);
+      }
+    }
+    if (!uncovered->points.empty()) {
+      uncovered->width = uncovered->points.size();
+      uncovered->height = 1;
+      auto new_centers = uniformly_sample_cloud(uncovered, params.cell_radius);
+      const size_t first_new_cell = cells.size();
+      for (auto && center : new_centers->points) {
+        cells.push_back({center, {}});
+      }
+      // Each uncovered point waits with the new cell it is closest to
+      pcl::KdTreeFLANN<pcl::PointXYZRGB> new_centers_kdtree;
+      new_centers_kdtree.setInputCloud(new_centers);
+      for (size_t i = 0; i < uncovered_points.size(); i++) {
+        if (new_centers_kdtree.nearestKSearch(
+            uncovered->points[i], 1, neighbours, sqr_distances) > 0)
+        {
+          cells[first_new_cell + neighbours[0]].points.push_back(uncovered_points[i]);
+        }
+      }
+    }
+  }
 
-    double total_cost = 0.8 * slope_cost + 0.1 * deviation_of_points_cost + 0.1 * energy_gap_cost;
+  // Bounded work per message. Cells that waited are regressed first, oldest first, then the
+  // best observed new ones. New points of the rest wait for later clouds, so no cell is lost
+  const size_t max_cells =
+    static_cast<size_t>(std::max(1, live_updates_max_cells_per_message_));
+  if (cells.size() > max_cells) {
+    auto first_point = [](const LiveCell & cell) {
+        return cell.points.empty() ?
+               std::numeric_limits<size_t>::max() : static_cast<size_t>(cell.points.front());
+      };
+    auto first_new = std::partition(
+      cells.begin(), cells.end(),
+      [&](const LiveCell & cell) {return first_point(cell) < num_pending_points;});
+    std::sort(
+      cells.begin(), first_new,
+      [&](const LiveCell & a, const LiveCell & b) {return first_point(a) < first_point(b);});
+    const auto cut = cells.begin() + max_cells;
+    if (first_new < cut) {
+      std::nth_element(
+        first_new, cut, cells.end(),
+        [](const LiveCell & a, const LiveCell & b) {return a.points.size() > b.points.size();});
+    }
 
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr plane_fitted_cell(
-      new pcl::PointCloud<pcl::PointXYZRGB>);
+    // Backlog is bounded too, if regression cannot keep up the oldest cells are dropped.
+    // A point shared by several waiting cells waits once
+    const size_t max_pending_cells = kMaxPendingLiveMessages * max_cells;
+    const size_t num_left = cells.size() - max_cells;
+    const size_t num_dropped = num_left > max_pending_cells ? num_left - max_pending_cells : 0;
+    std::vector<bool> is_pending(traversable->points.size(), false);
+    for (auto it = cut + num_dropped; it != cells.end(); ++it) {
+      for (auto && i : it->points) {
+        is_pending[i] = true;
+      }
+    }
+    for (size_t i = 0; i < is_pending.size(); i++) {
+      if (is_pending[i]) {
+        pending_live_points_.points.push_back(traversable->points[i]);
+      }
+    }
+    RCLCPP_WARN_THROTTLE(
+      get_logger(), *get_clock(), 5000,
+      "Live cloud touches %zu cells, regressing %zu, %zu wait for next clouds, %zu dropped",
+      cells.size(), max_cells, num_left - num_dropped, num_dropped);
+    cells.resize(max_cells);
+  }
 
-    if (std::max(pitch, roll) > MAX_ALLOWED_TILT) {
-      plane_fitted_cell = set_cloud_color(
-        i.second, std::vector<double>({255.0, 0, 0}));
-    } else {
-      plane_fitted_cell = set_cloud_color(
-        i.second, std::vector<double>({0.0, kMAX_COLOR_RANGE - total_cost, total_cost}));
+  // Each touched cell is regressed from the static points in it together with the new ones
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr centers(new pcl::PointCloud<pcl::PointXYZRGB>);
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cell_points(new pcl::PointCloud<pcl::PointXYZRGB>);
+  {
+    std::vector<bool> is_static_point_used(live_static_traversable_->points.size(), false);
+    std::vector<int> neighbours;
+    std::vector<float> sqr_distances;
+    for (auto && cell : cells) {
+      centers->points.push_back(cell.center);
+      if (!has_static_cells) {
+        continue;
+      }
+      live_static_kdtree_.radiusSearch(
+        cell.center, params.cell_radius, neighbours, sqr_distances);
+      for (auto && i : neighbours) {
+        if (!is_static_point_used[i]) {
+          is_static_point_used[i] = true;
+          cell_points->points.push_back(live_static_traversable_->points[i]);
+        }
+      }
+    }
+    cell_points->points.insert(
+      cell_points->points.end(), traversable->points.begin(), traversable->points.end());
+    centers->width = centers->points.size();
+    centers->height = 1;
+    cell_points->width = cell_points->points.size();
+    cell_points->height = 1;
+  }
+  if (!centers->points.empty()) {
+    DecomposedCells decomposed_cells =
+      decompose_traversability_cloud_into_spans(cell_points, centers, params.cell_radius);
+    // Points come out colored with the cost of their cell, elevated nodes with their own
+    auto regressed = regress_decomposed_cells(
+      cell_points, decomposed_cells, params, cost_regression_num_threads_);
+    for (auto && point : regressed.points) {
+      add_leaf_cost(point, traversability_cost_from_color(point), point);
     }
+  }
 
-    pcl::PointXYZRGB elevated_node;
-    elevated_node.x = i.first.x + NODE_ELEVATION_DISTANCE * plane_model.values[0];
-    elevated_node.y = i.first.y + NODE_ELEVATION_DISTANCE * plane_model.values[1];
-    elevated_node.z = i.first.z + NODE_ELEVATION_DISTANCE * plane_model.values[2];
-    elevated_node.r = kMAX_COLOR_RANGE;
-    elevated_node.g = kMAX_COLOR_RANGE;
-    elevated_nodes_cloud.points.push_back(elevated_node);
+  const bool aggregate_mean = octomap_cost_aggregation_ == "mean";
+  const rclcpp::Time now = this->now();
+  std::vector<octomap::OcTreeKey> changed_keys;
+  changed_keys.reserve(leaf_costs.size());
+  for (auto && leaf : leaf_costs) {
+    octomap::OcTreeKey key(
+      static_cast<octomap::key_type>(leaf.first & 0xFFFF),
+      static_cast<octomap::key_type>((leaf.first >> 16) & 0xFFFF),
+      static_cast<octomap::key_type>((leaf.first >> 32) & 0xFFFF));
+    // What the static map had is kept the first time a leaf changes, to revert to it
+    auto live_leaf = live_leaves_.find(leaf.first);
+    if (live_leaf == live_leaves_.end()) {
+      LiveLeaf static_leaf;
+      static_leaf.key = key;
+      if (auto node = octomap_octree_->search(key)) {
+        static_leaf.is_static = true;
+        static_leaf.log_odds = node->getLogOdds();
+        static_leaf.cost = node->getCost();
+        static_leaf.class_bits = node->getClassBits();
+      }
+      live_leaf = live_leaves_.emplace(leaf.first, static_leaf).first;
+    }
+    const octomap::point3d center = octomap_octree_->keyToCoord(key);
+    auto & point = live_leaf->second.point;
+    point = leaf.second.colored;
+    point.x = center.x();
+    point.y = center.y();
+    point.z = center.z();
+    live_leaf->second.last_observed = now;
+
+    const double cost = aggregate_mean ? leaf.second.sum / leaf.second.count : leaf.second.max;
+    octomap_octree_->setNodeCostValue(key, cost, true);
+    changed_keys.push_back(key);
+  }
+  // Only paths above changed leaves, a full updateInnerOccupancy would visit the whole map
+  for (auto && key : changed_keys) {
+    octomap_octree_->updateInnerNodes(key);
+  }
+  return changed_keys;
+}
 
-    cld += *plane_fitted_cell;
+void MapManager::decayLiveLeaves()
+{
+  if (live_updates_decay_time_ <= 0.0 || live_leaves_.empty()) {
+    return;
+  }
+  const rclcpp::Time now = this->now();
+  std::vector<octomap::OcTreeKey> reverted_keys;
+  for (auto it = live_leaves_.begin(); it != live_leaves_.end(); ) {
+    const auto & leaf = it->second;
+    if ((now - leaf.last_observed).seconds() < live_updates_decay_time_) {
+      ++it;
+      continue;
+    }
+    if (leaf.is_static) {
+      auto node = octomap_octree_->setNodeValue(leaf.key, leaf.log_odds, true);
+      if (node) {
+        node->setCost(leaf.cost);
+        node->setClassBits(leaf.class_bits);
+      }
+    } else {
+      octomap_octree_->deleteNode(leaf.key);
+    }
+    reverted_keys.push_back(leaf.key);
+    it = live_leaves_.erase(it);
+  }
+  if (reverted_keys.empty()) {
+    return;
+  }
+  for (auto && key : reverted_keys) {
+    octomap_octree_->updateInnerNodes(key);
   }
+  publishOctomapUpdate(reverted_keys);
+  RCLCPP_INFO_THROTTLE(
+    get_logger(), *get_clock(), 5000,
+    "Reverted %zu live leaves that were not observed for %.1f seconds",
+    reverted_keys.size(), live_updates_decay_time_);
+}
 
-  if (INCLUDE_NODE_CENTERS_IN_CLOUD) {
-    elevated_nodes_cloud.height = 1;
-    elevated_nodes_cloud.width = elevated_nodes_cloud.points.size();
-    cld += elevated_nodes_cloud;
+void MapManager::publishOctomapUpdate(const std::vector<octomap::OcTreeKey> & keys)
+{
+  // Delta holds final state of changed leaves, subscribers overwrite their leaves with it
+  // and delete the free ones, see TraversabilityOcTree::applyUpdate
+  vox_nav_utilities::TraversabilityOcTree delta(octomap_voxel_size_);
+  for (auto && key : keys) {
+    auto node = octomap_octree_->search(key);
+    if (node && octomap_octree_->isNodeOccupied(node)) {
+      delta.setNodeTraversability(key, node->getCost(), node->getClassBits(), true);
+    } else {
+      delta.setNodeValue(key, delta.getClampingThresMinLog(), true);
+    }
   }
-  cld += *pure_non_traversable_pcl;
+  delta.updateInnerOccupancy();
+  octomap_msgs::msg::Octomap delta_msg;
+  octomap_msgs::fullMapToMsg<vox_nav_utilities::TraversabilityOcTree>(delta, delta_msg);
+  delta_msg.binary = false;
+  delta_msg.resolution = octomap_voxel_size_;
+  delta_msg.header.frame_id = map_frame_id_;
+  // Full map is stamped after it is serialized, so it carries every delta stamped before it
+  delta_msg.header.stamp = this->now();
+  octomap_updates_publisher_->publish(delta_msg);
+  is_live_map_changed_ = true;
+}
 
-  *pcd_map_pointcloud_ = cld;
+void MapManager::updateLiveCloudMsg()
+{
+  pcl::PointCloud<pcl::PointXYZRGB> cloud;
+  cloud.points.reserve(pcd_map_pointcloud_->points.size() + live_leaves_.size());
+  for (auto && point : pcd_map_pointcloud_->points) {
+    octomap::OcTreeKey key;
+    if (!octomap_octree_->coordToKeyChecked(point.x, point.y, point.z, key) ||
+      !live_leaves_.count(packKey(key)))
+    {
+      cloud.points.push_back(point);
+    }
+  }
+  for (auto && leaf : live_leaves_) {
+    cloud.points.push_back(leaf.second.point);
+  }
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  pcl::toROSMsg(cloud, *octomap_pointcloud_ros_msg_);
 }
 }   // namespace vox_nav_map_server
 
@@ -0,0 +1,381 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vox_nav_map_server/moment_grid.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+void PointMoments::add(double x, double y, double z)
+{
+  n += 1.0;
+  sx += x;
+  sy += y;
+  sz += z;
+  sxx += x * x;
+  syy += y * y;
+  szz += z * z;
+  sxy += x * y;
+  sxz += x * z;
+  syz += y * z;
+}
+
+PointMoments & PointMoments::operator+=(const PointMoments & other)
+{
+  n += other.n;
+  sx += other.sx;
+  sy += other.sy;
+  sz += other.sz;
+  sxx += other.sxx;
+  syy += other.syy;
+  szz += other.szz;
+  sxy += other.sxy;
+  sxz += other.sxz;
+  syz += other.syz;
+  return *this;
+}
+
+PointMoments & PointMoments::operator-=(const PointMoments & other)
+{
+  n -= other.n;
+  sx -= other.sx;
+  sy -= other.sy;
+  sz -= other.sz;
+  sxx -= other.sxx;
+  syy -= other.syy;
+  szz -= other.szz;
+  sxy -= other.sxy;
+  sxz -= other.sxz;
+  syz -= other.syz;
+  return *this;
+}
+
+void PointMoments::translate(double dx, double dy, double dz)
+{
+  // Second order sums first, they need the first order sums of the points before moving them
+  sxx += 2.0 * dx * sx + n * dx * dx;
+  syy += 2.0 * dy * sy + n * dy * dy;
+  szz += 2.0 * dz * sz + n * dz * dz;
+  sxy += dx * sy + dy * sx + n * dx * dy;
+  sxz += dx * sz + dz * sx + n * dx * dz;
+  syz += dy * sz + dz * sy + n * dy * dz;
+  sx += n * dx;
+  sy += n * dy;
+  sz += n * dz;
+}
+
+MomentGrid::MomentGrid(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const double resolution,
+  const int tile_size)
+: resolution_(resolution),
+  origin_(Eigen::Vector3d::Zero()),
+  size_x_(1),
+  size_y_(1),
+  tile_size_(std::max(1, tile_size))
+{
+  if (!cloud->points.empty()) {
+    pcl::PointXYZRGB min_pt, max_pt;
+    pcl::getMinMax3D(*cloud, min_pt, max_pt);
+    origin_ = Eigen::Vector3d(min_pt.x, min_pt.y, min_pt.z);
+    size_x_ = static_cast<int>(std::floor((max_pt.x - min_pt.x) / resolution_)) + 1;
+    size_y_ = static_cast<int>(std::floor((max_pt.y - min_pt.y) / resolution_)) + 1;
+  }
+  tiles_x_ = (size_x_ + tile_size_ - 1) / tile_size_;
+  tiles_y_ = (size_y_ + tile_size_ - 1) / tile_size_;
+  tile_index_.assign(static_cast<size_t>(tiles_x_) * tiles_y_, -1);
+
+  auto column_of = [this](const pcl::PointXYZRGB & point, int & i, int & j) -> Column & {
+      i = columnCoord(point.x, origin_.x(), size_x_);
+      j = columnCoord(point.y, origin_.y(), size_y_);
+      int32_t & index =
+        tile_index_[static_cast<size_t>(j / tile_size_) * tiles_x_ + i / tile_size_];
+      if (index < 0) {
+        index = static_cast<int32_t>(tiles_.size());
+        tiles_.emplace_back();
+        tiles_.back().columns.resize(static_cast<size_t>(tile_size_) * tile_size_);
+      }
+      return tiles_[index].columns[
+        static_cast<size_t>(j % tile_size_) * tile_size_ + i % tile_size_];
+    };
+
+  // Height extremes first, sums of each column are then taken relative to its lowest point
+  int i, j;
+  for (auto && point : cloud->points) {
+    Column & column = column_of(point, i, j);
+    const float z = static_cast<float>(point.z - origin_.z());
+    column.z_min = std::min(column.z_min, z);
+    column.z_max = std::max(column.z_max, z);
+  }
+  for (auto && point : cloud->points) {
+    Column & column = column_of(point, i, j);
+    const float x = static_cast<float>(point.x - origin_.x() - (i + 0.5) * resolution_);
+    const float y = static_cast<float>(point.y - origin_.y() - (j + 0.5) * resolution_);
+    const float z = static_cast<float>(point.z - origin_.z() - column.z_min);
+    column.n++;
+    column.sx += x;
+    column.sy += y;
+    column.sz += z;
+    column.sxx += x * x;
+    column.syy += y * y;
+    column.szz += z * z;
+    column.sxy += x * y;
+    column.sxz += x * z;
+    column.syz += y * z;
+  }
+
+  for (int tj = 0; tj < tiles_y_; tj++) {
+    for (int ti = 0; ti < tiles_x_; ti++) {
+      const int32_t index = tile_index_[static_cast<size_t>(tj) * tiles_x_ + ti];
+      if (index < 0) {
+        continue;
+      }
+      Tile & tile = tiles_[index];
+      for (int c = 0; c < tile_size_ * tile_size_; c++) {
+        const Column & column = tile.columns[c];
+        if (column.n == 0) {
+          continue;
+        }
+        tile.moments += columnMoments(
+          column, ti * tile_size_ + c % tile_size_, tj * tile_size_ + c / tile_size_);
+        tile.z_min = std::min(tile.z_min, column.z_min);
+        tile.z_max = std::max(tile.z_max, column.z_max);
+      }
+    }
+  }
+}
+
+int MomentGrid::columnCoord(double v, double origin, int size) const
+{
+  const int coord = static_cast<int>(std::floor((v - origin) / resolution_));
+  return std::min(std::max(coord, 0), size - 1);
+}
+
+bool MomentGrid::columnRange(
+  double min_x, double min_y, double max_x, double max_y,
+  int & i0, int & j0, int & i1, int & j1) const
+{
+  if (max_x < origin_.x() || max_y < origin_.y() ||
+    min_x >= origin_.x() + size_x_ * resolution_ || min_y >= origin_.y() + size_y_ * resolution_)
+  {
+    return false;
+  }
+  i0 = columnCoord(min_x, origin_.x(), size_x_);
+  j0 = columnCoord(min_y, origin_.y(), size_y_);
+  i1 = columnCoord(max_x, origin_.x(), size_x_);
+  j1 = columnCoord(max_y, origin_.y(), size_y_);
+  return true;
+}
+
+const MomentGrid::Column * MomentGrid::findColumn(int i, int j) const
+{
+  const int32_t index =
+    tile_index_[static_cast<size_t>(j / tile_size_) * tiles_x_ + i / tile_size_];
+  if (index < 0) {
+    return nullptr;
+  }
+  return &tiles_[index].columns[static_cast<size_t>(j % tile_size_) * tile_size_ + i % tile_size_];
+}
+
+PointMoments MomentGrid::columnMoments(const Column & column, int i, int j) const
+{
+  PointMoments moments;
+  moments.n = column.n;
+  moments.sx = column.sx;
+  moments.sy = column.sy;
+  moments.sz = column.sz;
+  moments.sxx = column.sxx;
+  moments.syy = column.syy;
+  moments.szz = column.szz;
+  moments.sxy = column.sxy;
+  moments.sxz = column.sxz;
+  moments.syz = column.syz;
+  moments.translate((i + 0.5) * resolution_, (j + 0.5) * resolution_, column.z_min);
+  return moments;
+}
+
+void MomentGrid::accumulate(
+  int i0, int j0, int i1, int j1,
+  PointMoments & moments, float & z_min, float & z_max) const
+{
+  for (int tj = j0 / tile_size_; tj <= j1 / tile_size_; tj++) {
+    for (int ti = i0 / tile_size_; ti <= i1 / tile_size_; ti++) {
+      const int32_t index = tile_index_[static_cast<size_t>(tj) * tiles_x_ + ti];
+      if (index < 0) {
+        continue;
+      }
+      const Tile & tile = tiles_[index];
+      const int tile_i0 = ti * tile_size_;
+      const int tile_j0 = tj * tile_size_;
+      const int tile_i1 = std::min(tile_i0 + tile_size_, size_x_) - 1;
+      const int tile_j1 = std::min(tile_j0 + tile_size_, size_y_) - 1;
+      const int ci0 = std::max(i0, tile_i0);
+      const int cj0 = std::max(j0, tile_j0);
+      const int ci1 = std::min(i1, tile_i1);
+      const int cj1 = std::min(j1, tile_j1);
+
+      // Tiles inside the box are taken as a whole, only border tiles are summed by column
+      if (ci0 == tile_i0 && cj0 == tile_j0 && ci1 == tile_i1 && cj1 == tile_j1) {
+        moments += tile.moments;
+        z_min = std::min(z_min, tile.z_min);
+        z_max = std::max(z_max, tile.z_max);
+        continue;
+      }
+      for (int j = cj0; j <= cj1; j++) {
+        for (int i = ci0; i <= ci1; i++) {
+          const Column & column =
+            tile.columns[static_cast<size_t>(j - tile_j0) * tile_size_ + i - tile_i0];
+          if (column.n == 0) {
+            continue;
+          }
+          moments += columnMoments(column, i, j);
+          z_min = std::min(z_min, column.z_min);
+          z_max = std::max(z_max, column.z_max);
+        }
+      }
+    }
+  }
+}
+
+PointMoments MomentGrid::query(double min_x, double min_y, double max_x, double max_y) const
+{
+  PointMoments moments;
+  float z_min = std::numeric_limits<float>::max();
+  float z_max = std::numeric_limits<float>::lowest();
+  int i0, j0, i1, j1;
+  if (columnRange(min_x, min_y, max_x, max_y, i0, j0, i1, j1)) {
+    accumulate(i0, j0, i1, j1, moments, z_min, z_max);
+  }
+  return moments;
+}
+
+CellFeatures MomentGrid::cellFeatures(
+  double x, double y, double radius,
+  PointMoments * moments) const
+{
+  CellFeatures features;
+  features.plane_model.values = {0.0, 0.0, 1.0, 0.0};
+  features.average_point_deviation = 0.0;
+  features.z_range = 0.0;
+
+  // Height extremes are not additive, they are gathered from the same columns and tiles
+  PointMoments m;
+  float z_min = std::numeric_limits<float>::max();
+  float z_max = std::numeric_limits<float>::lowest();
+  int i0, j0, i1, j1;
+  if (columnRange(x - radius, y - radius, x + radius, y + radius, i0, j0, i1, j1)) {
+    accumulate(i0, j0, i1, j1, m, z_min, z_max);
+  }
+  if (moments) {
+    *moments = m;
+  }
+
+  Eigen::Vector3d normal(0.0, 0.0, 1.0);
+  Eigen::Vector3d mean(Eigen::Vector3d::Zero());
+  if (m.n > 0.0) {
+    mean = Eigen::Vector3d(m.sx, m.sy, m.sz) / m.n;
+  }
+  if (m.n > 2.0) {
+    Eigen::Matrix3d covariance;
+    covariance(0, 0) = m.sxx / m.n - mean.x() * mean.x();
+    covariance(1, 1) = m.syy / m.n - mean.y() * mean.y();
+    covariance(2, 2) = m.szz / m.n - mean.z() * mean.z();
+    covariance(0, 1) = covariance(1, 0) = m.sxy / m.n - mean.x() * mean.y();
+    covariance(0, 2) = covariance(2, 0) = m.sxz / m.n - mean.x() * mean.z();
+    covariance(1, 2) = covariance(2, 1) = m.syz / m.n - mean.y() * mean.z();
+    double variance_along_normal = 0.0;
+    normal = plane_normal_from_covariance(covariance, &variance_along_normal);
+    features.average_point_deviation = std::sqrt(variance_along_normal);
+  }
+  features.plane_model.values = {
+    static_cast<float>(normal.x()),
+    static_cast<float>(normal.y()),
+    static_cast<float>(normal.z()),
+    static_cast<float>(-normal.dot(mean + origin_))};
+
+  auto rpy = absolute_rpy_from_plane(features.plane_model);
+  features.roll = rpy[0];
+  features.pitch = rpy[1];
+  features.yaw = rpy[2];
+
+  if (z_max >= z_min) {
+    features.z_range = static_cast<double>(z_max) - static_cast<double>(z_min);
+  }
+  return features;
+}
+
+int64_t MomentGrid::numColumns() const
+{
+  return static_cast<int64_t>(size_x_) * size_y_;
+}
+
+std::vector<int64_t> MomentGrid::nonEmptyColumns() const
+{
+  std::vector<int64_t> columns;
+  for (int tj = 0; tj < tiles_y_; tj++) {
+    for (int ti = 0; ti < tiles_x_; ti++) {
+      const int32_t index = tile_index_[static_cast<size_t>(tj) * tiles_x_ + ti];
+      if (index < 0) {
+        continue;
+      }
+      for (int c = 0; c < tile_size_ * tile_size_; c++) {
+        if (tiles_[index].columns[c].n > 0) {
+          columns.push_back(
+            static_cast<int64_t>(tj * tile_size_ + c / tile_size_) * size_x_ +
+            ti * tile_size_ + c % tile_size_);
+        }
+      }
+    }
+  }
+  std::sort(columns.begin(), columns.end());
+  return columns;
+}
+
+int64_t MomentGrid::columnIndex(double x, double y) const
+{
+  return static_cast<int64_t>(columnCoord(y, origin_.y(), size_y_)) * size_x_ +
+         columnCoord(x, origin_.x(), size_x_);
+}
+
+Eigen::Vector2d MomentGrid::columnCenter(int64_t column) const
+{
+  return Eigen::Vector2d(
+    origin_.x() + (column % size_x_ + 0.5) * resolution_,
+    origin_.y() + (column / size_x_ + 0.5) * resolution_);
+}
+
+bool MomentGrid::isColumnEmpty(int64_t column) const
+{
+  const Column * c = findColumn(
+    static_cast<int>(column % size_x_), static_cast<int>(column / size_x_));
+  return !c || c->n == 0;
+}
+
+Eigen::Vector3d MomentGrid::origin() const
+{
+  return origin_;
+}
+
+size_t MomentGrid::memoryUsage() const
+{
+  return tile_index_.size() * sizeof(int32_t) +
+         tiles_.size() * (sizeof(Tile) + sizeof(Column) * tile_size_ * tile_size_);
+}
+
+}  // namespace vox_nav_map_server
@@ -0,0 +1,344 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vox_nav_map_server/tiled_map_store.hpp>
+#include <vox_nav_map_server/map_cache.hpp>
+
+#include <pcl/io/pcd_io.h>
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+namespace
+{
+const char kIndexFilename[] = "tiles.index";
+const char kIndexMagic[] = "vox_nav_tiled_map";
+const int kIndexVersion = 1;
+}  // namespace
+
+TiledMapStore::TiledMapStore(const std::string & directory, size_t max_resident_tiles)
+: directory_(expand_home_directory(directory)),
+  max_resident_tiles_(std::max<size_t>(1, max_resident_tiles))
+{
+  loader_thread_ = std::thread(&TiledMapStore::loadTiles, this);
+}
+
+TiledMapStore::~TiledMapStore()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  load_condition_.notify_all();
+  if (loader_thread_.joinable()) {
+    loader_thread_.join();
+  }
+}
+
+std::string TiledMapStore::tileFilename(const std::string & directory, const TileKey & key)
+{
+  return (std::filesystem::path(directory) /
+         ("tile_" + std::to_string(key.x) + "_" + std::to_string(key.y) + ".pcd")).string();
+}
+
+bool TiledMapStore::write(
+  const std::string & directory,
+  const pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+  double tile_size,
+  const std::string & key)
+{
+  const std::string expanded_directory = expand_home_directory(directory);
+  std::error_code error;
+  std::filesystem::create_directories(expanded_directory, error);
+  if (error) {
+    return false;
+  }
+
+  // Remove the index first, tiles of an older map are never paired with a new index
+  std::filesystem::remove(
+    std::filesystem::path(expanded_directory) / kIndexFilename, error);
+  for (auto && entry : std::filesystem::directory_iterator(expanded_directory, error)) {
+    if (entry.path().extension() == ".pcd" &&
+      entry.path().filename().string().rfind("tile_", 0) == 0)
+    {
+      std::filesystem::remove(entry.path(), error);
+    }
+  }
+
+  std::unordered_map<TileKey, pcl::PointCloud<pcl::PointXYZRGB>, TileKeyHash> tiles;
+  for (auto && point : cloud.points) {
+    TileKey tile_key{
+      static_cast<int32_t>(std::floor(point.x / tile_size)),
+      static_cast<int32_t>(std::floor(point.y / tile_size))};
+    tiles[tile_key].push_back(point);
+  }
+
+  std::vector<std::pair<TileKey, uint64_t>> index;
+  for (auto && tile : tiles) {
+    const std::string filename = tileFilename(expanded_directory, tile.first);
+    const std::string tmp_filename = filename + ".tmp";
+    if (pcl::io::savePCDFileBinary(tmp_filename, tile.second) != 0) {
+      return false;
+    }
+    std::filesystem::rename(tmp_filename, filename, error);
+    if (error) {
+      return false;
+    }
+    index.emplace_back(tile.first, tile.second.points.size());
+  }
+  std::sort(
+    index.begin(), index.end(), [](const auto & a, const auto & b) {
+      return a.first.x < b.first.x || (a.first.x == b.first.x && a.first.y < b.first.y);
+    });
+
+  const std::string index_filename =
+    (std::filesystem::path(expanded_directory) / kIndexFilename).string();
+  const std::string tmp_index_filename = index_filename + ".tmp";
+  {
+    std::ofstream file(tmp_index_filename);
+    if (!file) {
+      return false;
+    }
+    file.precision(17);
+    file << kIndexMagic << " " << kIndexVersion << "\n";
+    file << "key " << key << "\n";
+    file << "tile_size " << tile_size << "\n";
+    file << "tiles " << index.size() << "\n";
+    for (auto && entry : index) {
+      file << entry.first.x << " " << entry.first.y << " " << entry.second << "\n";
+    }
+    if (!file) {
+      return false;
+    }
+  }
+  std::filesystem::rename(tmp_index_filename, index_filename, error);
+  return !error;
+}
+
+bool TiledMapStore::open()
+{
+  std::ifstream file((std::filesystem::path(directory_) / kIndexFilename).string());
+  if (!file) {
+    return false;
+  }
+  std::string magic, label;
+  int version = 0;
+  size_t num_tiles = 0;
+  file >> magic >> version;
+  if (magic != kIndexMagic || version != kIndexVersion) {
+    return false;
+  }
+  file >> label >> key_;
+  file >> label >> tile_size_;
+  file >> label >> num_tiles;
+  if (!file || tile_size_ <= 0.0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  tile_index_.clear();
+  for (size_t i = 0; i < num_tiles; i++) {
+    TileKey tile_key;
+    uint64_t num_points;
+    file >> tile_key.x >> tile_key.y >> num_points;
+    if (!file) {
+      tile_index_.clear();
+      return false;
+    }
+    tile_index_[tile_key] = num_points;
+  }
+  return true;
+}
+
+std::string TiledMapStore::key() const
+{
+  return key_;
+}
+
+double TiledMapStore::tileSize() const
+{
+  return tile_size_;
+}
+
+size_t TiledMapStore::numTiles() const
+{
+  return tile_index_.size();
+}
+
+size_t TiledMapStore::maxTilesWithinRadius(double tile_size, double radius)
+{
+  if (!(tile_size > 0.0)) {
+    return 1;
+  }
+  const size_t tiles_per_side =
+    static_cast<size_t>(std::floor(2.0 * std::max(0.0, radius) / tile_size)) + 2;
+  return tiles_per_side * tiles_per_side;
+}
+
+std::vector<TileKey> TiledMapStore::tilesWithinRadius(double x, double y, double radius) const
+{
+  std::vector<std::pair<double, TileKey>> tiles;
+  const int32_t min_i = static_cast<int32_t>(std::floor((x - radius) / tile_size_));
+  const int32_t max_i = static_cast<int32_t>(std::floor((x + radius) / tile_size_));
+  const int32_t min_j = static_cast<int32_t>(std::floor((y - radius) / tile_size_));
+  const int32_t max_j = static_cast<int32_t>(std::floor((y + radius) / tile_size_));
+  for (int32_t i = min_i; i <= max_i; i++) {
+    for (int32_t j = min_j; j <= max_j; j++) {
+      TileKey tile_key{i, j};
+      if (!tile_index_.count(tile_key)) {
+        continue;
+      }
+      // distance from x, y to nearest point of the tile
+      const double dx = std::max(0.0, std::max(i * tile_size_ - x, x - (i + 1) * tile_size_));
+      const double dy = std::max(0.0, std::max(j * tile_size_ - y, y - (j + 1) * tile_size_));
+      const double distance_sq = dx * dx + dy * dy;
+      if (distance_sq <= radius * radius) {
+        tiles.emplace_back(distance_sq, tile_key);
+      }
+    }
+  }
+  std::sort(
+    tiles.begin(), tiles.end(), [](const auto & a, const auto & b) {
+      if (a.first != b.first) {
+        return a.first < b.first;
+      }
+      return a.second.x < b.second.x || (a.second.x == b.second.x && a.second.y < b.second.y);
+    });
+
+  std::vector<TileKey> keys;
+  keys.reserve(tiles.size());
+  for (auto && tile : tiles) {
+    keys.push_back(tile.second);
+  }
+  return keys;
+}
+
+void TiledMapStore::requestTiles(const std::vector<TileKey> & tiles)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Requests replace the queue, tiles the robot moved away from are not loaded anymore
+    load_queue_.clear();
+    queued_tiles_.clear();
+    // Touch in reverse so that the first requested tile ends up most recently used
+    for (auto it = tiles.rbegin(); it != tiles.rend(); ++it) {
+      auto resident = resident_tiles_.find(*it);
+      if (resident != resident_tiles_.end()) {
+        lru_.splice(lru_.begin(), lru_, resident->second.lru_position);
+      }
+    }
+    for (auto && tile : tiles) {
+      if (!resident_tiles_.count(tile) && !queued_tiles_.count(tile)) {
+        load_queue_.push_back(tile);
+        queued_tiles_.insert(tile);
+      }
+    }
+  }
+  load_condition_.notify_one();
+}
+
+bool TiledMapStore::hasResidentSetChanged()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const bool is_changed = is_resident_set_changed_;
+  is_resident_set_changed_ = false;
+  return is_changed;
+}
+
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr TiledMapStore::residentCloud() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Merge in key order, so that same set of tiles always gives same cloud
+  std::vector<TileKey> keys;
+  size_t num_points = 0;
+  for (auto && tile : resident_tiles_) {
+    keys.push_back(tile.first);
+    num_points += tile.second.cloud->points.size();
+  }
+  std::sort(
+    keys.begin(), keys.end(), [](const TileKey & a, const TileKey & b) {
+      return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  cloud->points.reserve(num_points);
+  for (auto && key : keys) {
+    const auto & tile_cloud = resident_tiles_.at(key).cloud;
+    cloud->points.insert(
+      cloud->points.end(), tile_cloud->points.begin(), tile_cloud->points.end());
+  }
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  return cloud;
+}
+
+size_t TiledMapStore::numResidentTiles() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resident_tiles_.size();
+}
+
+void TiledMapStore::loadTiles()
+{
+  while (true) {
+    TileKey tile_key;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      load_condition_.wait(lock, [this]() {return stop_ || !load_queue_.empty();});
+      if (stop_) {
+        return;
+      }
+      tile_key = load_queue_.front();
+      load_queue_.pop_front();
+      queued_tiles_.erase(tile_key);
+      if (resident_tiles_.count(tile_key)) {
+        continue;
+      }
+    }
+
+    // Disk access happens without holding the lock
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+    const bool is_loaded =
+      pcl::io::loadPCDFile<pcl::PointXYZRGB>(tileFilename(directory_, tile_key), *cloud) == 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!is_loaded || resident_tiles_.count(tile_key)) {
+      continue;
+    }
+    lru_.push_front(tile_key);
+    resident_tiles_[tile_key] = ResidentTile{cloud, lru_.begin()};
+    is_resident_set_changed_ = true;
+    evictTiles();
+  }
+}
+
+void TiledMapStore::evictTiles()
+{
+  while (resident_tiles_.size() > max_resident_tiles_) {
+    resident_tiles_.erase(lru_.back());
+    lru_.pop_back();
+    is_resident_set_changed_ = true;
+  }
+}
+
+}  // namespace vox_nav_map_server
@@ -0,0 +1,155 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vox_nav_map_server/voxel_neighbour_index.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+namespace vox_nav_map_server
+{
+
+VoxelNeighbourIndex::VoxelNeighbourIndex(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const double radius,
+  const int voxels_per_radius)
+: radius_(static_cast<float>(radius)),
+  voxel_size_(static_cast<float>(radius / std::max(1, voxels_per_radius))),
+  voxels_per_radius_(std::max(1, voxels_per_radius))
+{
+  const size_t num_points = cloud->points.size();
+
+  std::vector<uint64_t> keys(num_points);
+  #pragma omp parallel for
+  for (int64_t i = 0; i < static_cast<int64_t>(num_points); i++) {
+    const auto & p = cloud->points[i];
+    keys[i] = voxelKey(voxelCoord(p.x), voxelCoord(p.y), voxelCoord(p.z));
+  }
+
+  // Sort the points by voxel so that each voxel is a contiguous range,
+  // ties are broken with point index to keep the layout deterministic
+  std::vector<uint32_t> order(num_points);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(
+    order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) {
+      return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+    });
+
+  xs_.resize(num_points);
+  ys_.resize(num_points);
+  zs_.resize(num_points);
+  traversable_.resize(num_points);
+
+  for (size_t i = 0; i < num_points; i++) {
+    const auto & p = cloud->points[order[i]];
+    xs_[i] = p.x;
+    ys_[i] = p.y;
+    zs_[i] = p.z;
+    traversable_[i] = p.g ? 1 : 0;
+
+    if (i == 0 || keys[order[i]] != keys[order[i - 1]]) {
+      voxel_lookup_.emplace(keys[order[i]], static_cast<uint32_t>(voxels_.size()));
+      voxels_.push_back(Voxel{static_cast<uint32_t>(i), static_cast<uint32_t>(i), 0});
+    }
+    auto & voxel = voxels_.back();
+    voxel.end = static_cast<uint32_t>(i + 1);
+    voxel.num_traversable += traversable_[i];
+  }
+}
+
+uint64_t VoxelNeighbourIndex::voxelKey(int64_t vx, int64_t vy, int64_t vz)
+{
+  // 21 bits per axis, biased so that negative coordinates pack as well
+  const int64_t kBias = 1 << 20;
+  const uint64_t kMask = (1 << 21) - 1;
+  return (static_cast<uint64_t>(vx + kBias) & kMask) |
+         ((static_cast<uint64_t>(vy + kBias) & kMask) << 21) |
+         ((static_cast<uint64_t>(vz + kBias) & kMask) << 42);
+}
+
+int64_t VoxelNeighbourIndex::voxelCoord(float v) const
+{
+  return static_cast<int64_t>(std::floor(v / voxel_size_));
+}
+
+void VoxelNeighbourIndex::countNeighbours(
+  const pcl::PointXYZRGB & query,
+  int & num_neighbours,
+  int & num_traversable_neighbours) const
+{
+  num_neighbours = 0;
+  num_traversable_neighbours = 0;
+  const float radius_sq = radius_ * radius_;
+
+  const int64_t qx = voxelCoord(query.x);
+  const int64_t qy = voxelCoord(query.y);
+  const int64_t qz = voxelCoord(query.z);
+  const int64_t reach = voxels_per_radius_ + 1;
+
+  // squared min and max distance along one axis between query coordinate and voxel [lo, hi)
+  auto axis_dist_sq = [this](float q, int64_t v, float & min_sq, float & max_sq) {
+      const float lo = v * voxel_size_;
+      const float hi = lo + voxel_size_;
+      const float min_d = std::max(0.0f, std::max(lo - q, q - hi));
+      const float max_d = std::max(std::abs(q - lo), std::abs(q - hi));
+      min_sq = min_d * min_d;
+      max_sq = max_d * max_d;
+    };
+
+  for (int64_t vx = qx - reach; vx <= qx + reach; vx++) {
+    float x_min_sq, x_max_sq;
+    axis_dist_sq(query.x, vx, x_min_sq, x_max_sq);
+    if (x_min_sq > radius_sq) {
+      continue;
+    }
+    for (int64_t vy = qy - reach; vy <= qy + reach; vy++) {
+      float y_min_sq, y_max_sq;
+      axis_dist_sq(query.y, vy, y_min_sq, y_max_sq);
+      if (x_min_sq + y_min_sq > radius_sq) {
+        continue;
+      }
+      for (int64_t vz = qz - reach; vz <= qz + reach; vz++) {
+        float z_min_sq, z_max_sq;
+        axis_dist_sq(query.z, vz, z_min_sq, z_max_sq);
+        if (x_min_sq + y_min_sq + z_min_sq > radius_sq) {
+          continue;
+        }
+        auto it = voxel_lookup_.find(voxelKey(vx, vy, vz));
+        if (it == voxel_lookup_.end()) {
+          continue;
+        }
+        const Voxel & voxel = voxels_[it->second];
+        if (x_max_sq + y_max_sq + z_max_sq <= radius_sq) {
+          // Whole voxel is inside the sphere, use the counters
+          num_neighbours += voxel.end - voxel.begin;
+          num_traversable_neighbours += voxel.num_traversable;
+          continue;
+        }
+        for (uint32_t i = voxel.begin; i < voxel.end; i++) {
+          const float dx = xs_[i] - query.x;
+          const float dy = ys_[i] - query.y;
+          const float dz = zs_[i] - query.z;
+          if (dx * dx + dy * dy + dz * dz <= radius_sq) {
+            num_neighbours++;
+            num_traversable_neighbours += traversable_[i];
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace vox_nav_map_server
@@ -0,0 +1,100 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <vox_nav_map_server/cost_regression_utils.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+using vox_nav_map_server::CostRegressionParams;
+
+namespace
+{
+/**
+ * @brief Traversable (green) cloud of a slope with a few bumps and some noise,
+ * so that cells get different colors and elevated nodes.
+ */
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr synthetic_traversable_cloud()
+{
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  std::mt19937 generator(42);
+  std::normal_distribution<float> noise(0.0f, 0.02f);
+  for (float x = 0.0f; x < 12.0f; x += 0.1f) {
+    for (float y = 0.0f; y < 12.0f; y += 0.1f) {
+      pcl::PointXYZRGB point;
+      point.x = x;
+      point.y = y;
+      point.z = 0.15f * x + 0.4f * std::sin(x) * std::cos(0.5f * y) + noise(generator);
+      point.r = 0;
+      point.g = 255;
+      point.b = 0;
+      cloud->points.push_back(point);
+    }
+  }
+  cloud->height = 1;
+  cloud->width = cloud->points.size();
+  return cloud;
+}
+
+pcl::PointCloud<pcl::PointXYZRGB> regress(
+  const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud,
+  const CostRegressionParams & params,
+  const int num_threads)
+{
+  auto nodes = vox_nav_map_server::uniformly_sample_cloud(cloud, params.cell_radius);
+  auto cells = vox_nav_map_server::decompose_traversability_cloud_into_spans(
+    cloud, nodes, params.cell_radius);
+  return vox_nav_map_server::regress_decomposed_cells(cloud, cells, params, num_threads);
+}
+
+void expect_identical(
+  const pcl::PointCloud<pcl::PointXYZRGB> & expected,
+  const pcl::PointCloud<pcl::PointXYZRGB> & actual)
+{
+  ASSERT_EQ(expected.points.size(), actual.points.size());
+  for (size_t i = 0; i < expected.points.size(); i++) {
+    const auto & e = expected.points[i];
+    const auto & a = actual.points[i];
+    // Compare bit patterns, regression must not differ even in the last bit
+    EXPECT_EQ(0, std::memcmp(&e.x, &a.x, sizeof(float))) << "x of point " << i;
+    EXPECT_EQ(0, std::memcmp(&e.y, &a.y, sizeof(float))) << "y of point " << i;
+    EXPECT_EQ(0, std::memcmp(&e.z, &a.z, sizeof(float))) << "z of point " << i;
+    EXPECT_EQ(e.r, a.r) << "r of point " << i;
+    EXPECT_EQ(e.g, a.g) << "g of point " << i;
+    EXPECT_EQ(e.b, a.b) << "b of point " << i;
+  }
+}
+}  // namespace
+
+TEST(CostRegression, IdenticalForAnyNumberOfThreads)
+{
+  auto cloud = synthetic_traversable_cloud();
+  CostRegressionParams params;
+
+  auto serial = regress(cloud, params, 1);
+  ASSERT_FALSE(serial.points.empty());
+  for (int num_threads : {2, 4, 8}) {
+    SCOPED_TRACE(num_threads);
+    expect_identical(serial, regress(cloud, params, num_threads));
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -32,6 +32,7 @@
 #include <message_filters/sync_policies/approximate_time.h>
 #include <geometry_msgs/msg/pose_stamped.hpp>
 #include <nav_msgs/msg/odometry.hpp>
+#include <sensor_msgs/msg/nav_sat_fix.hpp>
 #include <tf2_geometry_msgs/tf2_geometry_msgs.h>
 #include <tf2_ros/transform_broadcaster.h>
 #include <tf2_ros/transform_broadcaster.h>
@@ -40,6 +41,7 @@
 
 #include <robot_localization/srv/from_ll.hpp>
 #include <vox_nav_openvslam/gps_data_handler.hpp>
+#include <vox_nav_utilities/geodetic_conversions.hpp>
 #include <vox_nav_utilities/tf_helpers.hpp>
 #include <vox_nav_msgs/msg/oriented_nav_sat_fix.hpp>
 
@@ -106,6 +108,15 @@ public:
   void executeViewerPangolinThread();
 
 
+  /**
+   * @brief Finds transform from static map to map frame from map_coordinates once. Converted in
+   * process, in utm zone of navsat fixes, if utm frame is available. robot_localization's
+   * /fromLL is called otherwise, once navsat odometry is published, and again if it fails.
+   *
+   * @return true if static_map_to_map_transform_ is set
+   */
+  bool georeferenceStaticMap();
+
   void  poseOdomPublisher(Eigen::Matrix4d cam_pose);
 
   /**
@@ -152,6 +163,21 @@ private:
   vox_nav_msgs::msg::OrientedNavSatFix::SharedPtr static_map_gps_pose_;
   // see navsat_transform_node from robot_localization, this offset is needed to recorrect orientation of static map
   double yaw_offset_;
+  // frame navsat_transform_node broadcasts utm coordinates in
+  std::string utm_frame_id_;
+  // topics navsat_transform_node takes fixes from and publishes odometry on
+  std::string navsat_fix_topic_;
+  std::string navsat_odometry_topic_;
+  rclcpp::Subscription<sensor_msgs::msg::NavSatFix>::SharedPtr navsat_fix_subscriber_;
+  rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr navsat_odometry_subscriber_;
+  // utm zone of latest navsat fix, 0 until one is received
+  int navsat_utm_zone_ {0};
+  bool navsat_is_north_ {true};
+  // set once navsat odometry is published
+  bool is_navsat_ready_ {false};
+  // set once by georeferenceStaticMap, applied to each camera pose
+  tf2::Transform static_map_to_map_transform_;
+  bool is_static_map_georeferenced_ {false};
   // parameter to hold full path to vocab.dbow2 file
   std::string vocab_file_path_;
   // parameter to hold full path to slam_config.yaml file
@@ -20,6 +20,7 @@
 
 #include "vox_nav_openvslam/run_localization.hpp"
 
+#include <cmath>
 #include <memory>
 
 namespace vox_nav_openvslam
@@ -42,6 +43,9 @@ RunLocalization::RunLocalization()
   declare_parameter("enable_mapping_module", true);
   declare_parameter("enable_pangolin_viewer", true);
   declare_parameter("yaw_offset", 1.57);
+  declare_parameter("utm_frame_id", "utm");
+  declare_parameter("navsat_fix_topic", "gps/fix");
+  declare_parameter("navsat_odometry_topic", "odometry/gps");
   declare_parameter("map_coordinates.latitude", 49.0);
   declare_parameter("map_coordinates.longitude", 3.0);
   declare_parameter("map_coordinates.altitude", 0.5);
@@ -59,6 +63,9 @@ RunLocalization::RunLocalization()
   get_parameter("enable_mapping_module", enable_mapping_module_);
   get_parameter("enable_pangolin_viewer", enable_pangolin_viewer_);
   get_parameter("yaw_offset", yaw_offset_);
+  get_parameter("utm_frame_id", utm_frame_id_);
+  get_parameter("navsat_fix_topic", navsat_fix_topic_);
+  get_parameter("navsat_odometry_topic", navsat_odometry_topic_);
   get_parameter("map_coordinates.latitude", static_map_gps_pose_->position.latitude);
   get_parameter("map_coordinates.longitude", static_map_gps_pose_->position.longitude);
   get_parameter("map_coordinates.altitude", static_map_gps_pose_->position.altitude);
@@ -132,6 +139,20 @@ RunLocalization::RunLocalization()
     "run_localization_fromll_client_node");
   robot_localization_fromLL_client_ =
     robot_localization_fromLL_client_node_->create_client<robot_localization::srv::FromLL>("/fromLL");
+  // utm zone and readiness of navsat_transform_node, needed until static map is georeferenced
+  navsat_fix_subscriber_ = this->create_subscription<sensor_msgs::msg::NavSatFix>(
+    navsat_fix_topic_, rclcpp::SensorDataQoS(),
+    [this](const sensor_msgs::msg::NavSatFix::ConstSharedPtr msg) {
+      if (msg->status.status >= sensor_msgs::msg::NavSatStatus::STATUS_FIX &&
+      std::isfinite(msg->latitude) && std::isfinite(msg->longitude))
+      {
+        navsat_utm_zone_ = vox_nav_utilities::utmZone(msg->latitude, msg->longitude);
+        navsat_is_north_ = msg->latitude >= 0.0;
+      }
+    });
+  navsat_odometry_subscriber_ = this->create_subscription<nav_msgs::msg::Odometry>(
+    navsat_odometry_topic_, rclcpp::SensorDataQoS(),
+    [this](const nav_msgs::msg::Odometry::ConstSharedPtr) {is_navsat_ready_ = true;});
   // setup odom and pose pulishers
   robot_odom_publisher_ = this->create_publisher<nav_msgs::msg::Odometry>(
     "openvslam/odometry", rclcpp::SystemDefaultsQoS());
@@ -228,6 +249,75 @@ void RunLocalization::executeViewerPangolinThread()
   }
 }
 
+bool RunLocalization::georeferenceStaticMap()
+{
+  const auto & position = static_map_gps_pose_->position;
+  tf2::Vector3 map_point;
+  if (tf_buffer_->canTransform("map", utm_frame_id_, rclcpp::Time(0))) {
+    // Converted in process with the utm transform navsat_transform_node broadcasts,
+    // in the utm zone navsat works in
+    if (navsat_utm_zone_ == 0) {
+      RCLCPP_INFO_THROTTLE(
+        get_logger(), *get_clock(), 5000, "Waiting for a fix on %s to get the utm zone.",
+        navsat_fix_topic_.c_str());
+      return false;
+    }
+    const int map_utm_zone = vox_nav_utilities::utmZone(position.latitude, position.longitude);
+    if (map_utm_zone != navsat_utm_zone_) {
+      RCLCPP_WARN(
+        get_logger(), "map_coordinates are in utm zone %d, converting them in zone %d of %s",
+        map_utm_zone, navsat_utm_zone_, navsat_fix_topic_.c_str());
+    }
+    tf2::Transform utm_to_map;
+    tf2::fromMsg(
+      tf_buffer_->lookupTransform("map", utm_frame_id_, rclcpp::Time(0)).transform, utm_to_map);
+    vox_nav_utilities::GeodeticConverter geodetic_converter;
+    geodetic_converter.seed(utm_to_map, navsat_utm_zone_, navsat_is_north_);
+    map_point = geodetic_converter.toMap(
+      position.latitude, position.longitude, position.altitude);
+  } else if (is_navsat_ready_ && robot_localization_fromLL_client_->service_is_ready()) {
+    // Fallback when utm frame is not broadcast, /fromLL answers are only meaningful
+    // once navsat published odometry
+    auto request = std::make_shared<robot_localization::srv::FromLL::Request>();
+    request->ll_point.latitude = position.latitude;
+    request->ll_point.longitude = position.longitude;
+    request->ll_point.altitude = position.altitude;
+    auto result_future = robot_localization_fromLL_client_->async_send_request(request);
+    if (rclcpp::spin_until_future_complete(
+        robot_localization_fromLL_client_node_,
+        result_future, std::chrono::seconds(1)) !=
+      rclcpp::FutureReturnCode::SUCCESS)
+    {
+      RCLCPP_ERROR(this->get_logger(), "/fromLL service call failed, asking again");
+      return false;
+    }
+    const auto & result_point = result_future.get()->map_point;
+    if (!std::isfinite(result_point.x) || !std::isfinite(result_point.y) ||
+      !std::isfinite(result_point.z))
+    {
+      RCLCPP_WARN(get_logger(), "/fromLL returned an invalid map point, asking again");
+      return false;
+    }
+    map_point = tf2::Vector3(result_point.x, result_point.y, result_point.z);
+  } else {
+    RCLCPP_INFO_THROTTLE(
+      get_logger(), *get_clock(), 5000,
+      "Waiting for %s to map Transform, or %s and /fromLL service to be available.",
+      utm_frame_id_.c_str(), navsat_odometry_topic_.c_str());
+    return false;
+  }
+
+  tf2::Quaternion static_map_quaternion;
+  tf2::fromMsg(static_map_gps_pose_->orientation, static_map_quaternion);
+  static_map_to_map_transform_ = vox_nav_utilities::staticMapToMapTransform(
+    map_point, yaw_offset_, static_map_quaternion);
+  is_static_map_georeferenced_ = true;
+  navsat_fix_subscriber_.reset();
+  navsat_odometry_subscriber_.reset();
+  RCLCPP_INFO(get_logger(), "Georeferenced static map");
+  return true;
+}
+
 void RunLocalization::poseOdomPublisher(Eigen::Matrix4d cam_pose)
 {
   Eigen::Matrix3d rotation_matrix = cam_pose.block(0, 0, 3, 3);
@@ -257,60 +347,11 @@ void RunLocalization::poseOdomPublisher(Eigen::Matrix4d cam_pose)
   tf2::Transform transformB(rot_open_to_ros.inverse(), tf2::Vector3(0.0, 0.0, 0.0));
   tf2::Transform cam_pose_tf = transformA * transform_tf * transformB;
 
-  auto request = std::make_shared<robot_localization::srv::FromLL::Request>();
-  auto response = std::make_shared<robot_localization::srv::FromLL::Response>();
-  request->ll_point.latitude = static_map_gps_pose_->position.latitude;
-  request->ll_point.longitude = static_map_gps_pose_->position.longitude;
-  request->ll_point.altitude = static_map_gps_pose_->position.altitude;
-
-  while (!robot_localization_fromLL_client_->wait_for_service(std::chrono::seconds(1))) {
-    if (!rclcpp::ok()) {
-      RCLCPP_ERROR(
-        this->get_logger(),
-        "Interrupted while waiting for the /fromLL service. Exiting.");
-      return;
-    }
-    RCLCPP_INFO(this->get_logger(), "/fromLL service not available, waiting again...");
-  }
-  auto result_future = robot_localization_fromLL_client_->async_send_request(request);
-  if (rclcpp::spin_until_future_complete(
-      robot_localization_fromLL_client_node_,
-      result_future) !=
-    rclcpp::FutureReturnCode::SUCCESS)
-  {
-    RCLCPP_ERROR(this->get_logger(), "/fromLL service call failed :(");
+  // Static map is georeferenced once, each frame only applies the cached transform
+  if (!is_static_map_georeferenced_ && !georeferenceStaticMap()) {
+    return;
   }
-  auto result = result_future.get();
-  response->map_point = result->map_point;
-
-  // "/fromLL" service only accounts for translational transform, we still need to rotate the points according to yaw_offset
-  // yaw_offset determines rotation between utm and map frame
-  // Normally utm and map frmaes are aligned rotationally, but if there is yaw_offset set in
-  // navsat_transfrom_node we have to account for that yaw_offset here as well
-  // use classic rotation formula https://en.wikipedia.org/wiki/Rotation_matrix#In_two_dimensions;
-  // The rotation only happens in x and y since it is round the z axis(yaw)
-  double x = response->map_point.x;
-  double y = response->map_point.y;
-  double x_dot = x * std::cos(yaw_offset_) - y * std::sin(yaw_offset_);
-  double y_dot = x * std::sin(yaw_offset_) + y * std::cos(yaw_offset_);
-
-  // The translation from static_map origin to map is basically inverse of this transform
-  tf2::Transform static_map_translation;
-  static_map_translation.setOrigin(
-    tf2::Vector3(x_dot, y_dot, response->map_point.z));
-
-  // this is identity because map and utm frames are rotationally aligned
-  static_map_translation.setRotation(tf2::Quaternion::getIdentity());
-
-  tf2::Transform static_map_rotation;
-  tf2::Quaternion static_map_quaternion;
-  tf2::fromMsg(static_map_gps_pose_->orientation, static_map_quaternion);
-  // First align the static map origin to map in translation, and then rotate the static map with its correct rotation
-  static_map_rotation.setOrigin(tf2::Vector3(0, 0, 0));
-  static_map_rotation.setRotation(static_map_quaternion);
-
-  tf2::Transform cam_pose_to_map_transfrom = static_map_rotation *
-    static_map_translation.inverse() * cam_pose_tf;
+  tf2::Transform cam_pose_to_map_transfrom = static_map_to_map_transform_ * cam_pose_tf;
 
   rclcpp::Time now = this->now();
   // Create pose message and update it with current camera pose
@@ -22,8 +22,13 @@
 #include <geometry_msgs/msg/pose.hpp>
 #include <sensor_msgs/msg/point_cloud2.hpp>
 #include <visualization_msgs/msg/marker_array.hpp>
+#include <vox_nav_msgs/msg/planner_portfolio_statistics.hpp>
 #include <vox_nav_utilities/tf_helpers.hpp>
+#include <vox_nav_utilities/euclidean_distance_field.hpp>
+#include <vox_nav_utilities/footprint_kernels.hpp>
+#include <vox_nav_utilities/occupancy_bit_grid.hpp>
 #include <vox_nav_utilities/planner_helpers.hpp>
+#include <vox_nav_utilities/traversability_cost_pyramid.hpp>
 // PCL
 #include <pcl/common/common.h>
 #include <pcl/common/transforms.h>
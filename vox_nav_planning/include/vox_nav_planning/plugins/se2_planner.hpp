@@ -27,6 +27,26 @@
 namespace vox_nav_planning
 {
 
+class SE2Planner;
+
+/**
+ * @brief Validity checker reporting the footprint clearance of SE2Planner along with validity,
+ * so OMPL clearance objectives and samplers can use its distance field
+ *
+ */
+class SE2StateValidityChecker : public ompl::base::StateValidityChecker
+{
+public:
+  SE2StateValidityChecker(const ompl::base::SpaceInformationPtr & si, SE2Planner * planner);
+
+  bool isValid(const ompl::base::State * state) const override;
+
+  double clearance(const ompl::base::State * state) const override;
+
+private:
+  SE2Planner * planner_;
+};
+
 /**
  * @brief
  *
@@ -81,14 +101,107 @@ public:
   */
   virtual void octomapCallback(const octomap_msgs::msg::Octomap::ConstSharedPtr msg) override;
 
+  /**
+  * @brief Callback to queue octree deltas map_server publishes on live updates, they are
+  * applied to the latest octomap by the next plan
+  *
+  * @param msg
+  */
+  void octomapUpdatesCallback(const octomap_msgs::msg::Octomap::ConstSharedPtr msg);
+
+  /**
+  * @brief Count results of a Portfolio planner and publish win statistics of all requests
+  *
+  * @param planner
+  */
+  void publishPortfolioStatistics(const ompl::base::PlannerPtr & planner);
+
+  /**
+  * @brief Distance from the footprint circles at x, y, yaw to the nearest obstacle, a lower
+  * bound taken from the distance field. Negative if circles overlap an obstacle, 0 if the
+  * distance field is not built.
+  *
+  * @param x
+  * @param y
+  * @param yaw
+  * @return double
+  */
+  double getClearance(double x, double y, double yaw);
+
+  /**
+  * @brief getClearance() of an SE2 state
+  *
+  * @param state
+  * @return double
+  */
+  double getStateClearance(const ompl::base::State * state);
+
 protected:
+  /**
+  * @brief Rebuild FCL octree, occupancy slice and distance field when the latest octomap
+  * belongs to a new map epoch, then swap them in under octomap_mutex_. Deltas that arrived
+  * since the last plan of the same epoch are applied with applyOctomapUpdates()
+  *
+  * @return false if no octomap has been received yet
+  */
+  bool updateCollisionModels();
+
+  /**
+  * @brief Apply deltas to the kept traversability octree and copy changed leaves into the
+  * occupancy octree of FCL. Occupancy slice is recomputed over the changed leaves only and the
+  * distance field is rebuilt from it.
+  *
+  * @param octomap_updates
+  */
+  void applyOctomapUpdates(
+    const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & octomap_updates);
+
+  /**
+  * @brief Cover the robot body with circles along its longer side
+  *
+  * @param length body length along heading
+  * @param width body width
+  * @param num_circles 0 picks the fewest circles that keep the radius close to width / 2
+  */
+  void computeFootprintCircles(double length, double width, int num_circles);
+
+  // Circle centers of the footprint in robot frame
+  struct FootprintCircle
+  {
+    double x;
+    double y;
+  };
+
   rclcpp::Logger logger_{rclcpp::get_logger("se2_planner")};
+  // clock of the node this plugin is loaded into, stamps published statistics
+  rclcpp::Clock::SharedPtr clock_;
   rclcpp::Subscription<octomap_msgs::msg::Octomap>::SharedPtr octomap_subscriber_;
+  // Latest received octomap, collision models below are built from it
   octomap_msgs::msg::Octomap::ConstSharedPtr octomap_msg_;
+  // Stamp of the map epoch collision models were built from
+  builtin_interfaces::msg::Time collision_models_stamp_;
+  rclcpp::Subscription<octomap_msgs::msg::Octomap>::SharedPtr octomap_updates_subscriber_;
+  // Deltas newer than octomap_msg_, in order of arrival
+  std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> octomap_updates_;
+  // Number of octomap_updates_ collision models were built with
+  size_t collision_models_num_updates_ {0};
+  // Deserialized octomap of the epoch with deltas applied, nullptr for plain octrees
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> traversability_octree_;
+  // Occupancy of traversability_octree_, fcl_octree_ checks against it
+  std::shared_ptr<octomap::OcTree> octomap_octree_;
 
+  // Only the geometry of robot body is used, its transform is never set, so states can be
+  // checked from several threads
   std::shared_ptr<fcl::CollisionObject> robot_collision_object_;
   std::shared_ptr<fcl::OcTree> fcl_octree_;
   std::shared_ptr<fcl::CollisionObject> fcl_octree_collision_object_;
+  // Distance field of obstacles within the z band of robot body
+  std::shared_ptr<vox_nav_utilities::EuclideanDistanceField2D> esdf_;
+  std::vector<FootprintCircle> footprint_circles_;
+  double footprint_circle_radius_;
+  // Obstacles within the z band of robot body, bit packed for footprint masks
+  std::shared_ptr<vox_nav_utilities::OccupancySlice2D> occupancy_slice_;
+  std::shared_ptr<vox_nav_utilities::YawBinnedFootprintKernels> footprint_kernels_;
 
   std::shared_ptr<ompl::base::RealVectorBounds> se2_space_bounds_;
   // This can be DBINS,REEDS or pure SE2, set this through parameters
@@ -97,10 +210,14 @@ protected:
 
   // to ensure safety when accessing global var curr_frame_
   std::mutex global_mutex_;
+  // held by createPlan, models are not updated while they are in use
+  std::mutex plan_mutex_;
   // the topic to subscribe in order capture a frame
   std::string planner_name_;
   // The topic of octomap to subscribe, this octomap is published by map_server
   std::string octomap_topic_;
+  // The topic of octree deltas map_server publishes on live updates
+  std::string octomap_updates_topic_;
   // Better t keep this parameter consistent with map_server, 0.2 is a OK default fo this
   double octomap_voxel_size_;
   // whether plugin is enabled
@@ -109,15 +226,30 @@ protected:
   int interpolation_parameter_;
   // max time the planner can spend before coming up with a solution
   double planner_timeout_;
-  // whether otomap is recieved
-  volatile bool is_octomap_ready_;
-  // global mutex to guard octomap
+  // threads of parallel planners, 0 for all cores
+  int num_threads_;
+  // planners raced when planner_name is Portfolio
+  std::vector<std::string> portfolio_planner_names_;
+  // wins of raced planners over all requests
+  vox_nav_utilities::PortfolioStatistics portfolio_statistics_;
+  rclcpp::Publisher<vox_nav_msgs::msg::PlannerPortfolioStatistics>::SharedPtr
+    portfolio_statistics_publisher_;
+  // global mutex to guard octomap and swapping collision models
   std::mutex octomap_mutex_;
-  // We only need to creae a FLC cotomap collision from
-  // octomap once, because this is static map
-  std::once_flag fcl_tree_from_octomap_once_;
   // Which state space is slected ? REEDS,DUBINS, SE2
   std::string selected_se2_space_name_;
+  // Dimensions of robot body box
+  double robot_body_dimens_x_;
+  double robot_body_dimens_y_;
+  double robot_body_dimens_z_;
+  // Check states with footprint circles against distance field before FCL
+  bool use_esdf_;
+  // Check states with yaw binned footprint masks against occupancy slice before FCL
+  bool use_footprint_kernels_;
+  // Use FCL for states that circles and masks cannot tell free, otherwise they are invalid
+  bool exact_refinement_;
+  // Distances of the field are clamped to this, larger is slower to build but not to query
+  double esdf_max_distance_;
 };
 }  // namespace vox_nav_planning
 
@@ -78,6 +78,21 @@ public:
   */
   virtual void octomapCallback(const octomap_msgs::msg::Octomap::ConstSharedPtr msg) override;
 
+  /**
+  * @brief Callback to queue octree deltas map_server publishes on live updates, they are
+  * applied to the latest octomap by the next plan
+  *
+  * @param msg
+  */
+  void octomapUpdatesCallback(const octomap_msgs::msg::Octomap::ConstSharedPtr msg);
+
+  /**
+  * @brief Count results of a Portfolio planner and publish win statistics of all requests
+  *
+  * @param planner
+  */
+  void publishPortfolioStatistics(const ompl::base::PlannerPtr & planner);
+
   /**
    * @brief
    *
@@ -94,17 +109,45 @@ public:
   ompl::base::OptimizationObjectivePtr getOptimizationObjective();
 
 protected:
+  /**
+   * @brief Rebuild octree, cost pyramid and occupancy grid when the latest octomap belongs
+   * to a new map epoch, then swap them in under octomap_mutex_. Deltas that arrived since the
+   * last plan of the same epoch are applied with applyOctomapUpdates()
+   *
+   * @return false if no usable octomap has been received yet
+   */
+  bool updateMapModels();
+
+  /**
+   * @brief Apply deltas to the kept octree and update cells of the cost pyramid and voxels of
+   * the occupancy grid above changed leaves only
+   *
+   * @param octomap_updates
+   */
+  void applyOctomapUpdates(
+    const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & octomap_updates);
+
   rclcpp::Logger logger_{rclcpp::get_logger("se3_planner")};
+  // clock of the node this plugin is loaded into, stamps published statistics
+  rclcpp::Clock::SharedPtr clock_;
   rclcpp::Subscription<octomap_msgs::msg::Octomap>::SharedPtr octomap_subscriber_;
+  // Latest received octomap, models below are built from it
   octomap_msgs::msg::Octomap::ConstSharedPtr octomap_msg_;
+  // Stamp of the map epoch models were built from
+  builtin_interfaces::msg::Time map_models_stamp_;
+  rclcpp::Subscription<octomap_msgs::msg::Octomap>::SharedPtr octomap_updates_subscriber_;
+  // Deltas newer than octomap_msg_, in order of arrival
+  std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> octomap_updates_;
+  // Number of octomap_updates_ models were built with
+  size_t map_models_num_updates_ {0};
 
   std::shared_ptr<fcl::CollisionObject> robot_collision_object_;
-  std::shared_ptr<fcl::OcTree> fcl_octree_;
-  std::shared_ptr<fcl::CollisionObject> fcl_octree_collision_object_;
-  std::shared_ptr<octomap::ColorOcTree> color_octomap_octree_;
-  std::shared_ptr<octomap::OcTree> octomap_octree_;
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> octomap_octree_;
+  // occupancy and traversability of octomap_octree_ at all depths, updated with it
+  std::shared_ptr<vox_nav_utilities::TraversabilityCostPyramid> cost_pyramid_;
+  // occupied voxels of octomap_octree_ one bit each, used for state and motion validity
+  std::shared_ptr<vox_nav_utilities::OccupancyBitGrid> occupancy_grid_;
   std::shared_ptr<ompl::base::RealVectorBounds> state_space_bounds_;
-  std::shared_ptr<OctoCellValidStateSampler> octocell_state_sampler_;
 
   ompl::base::ScopedState<ompl::base::SE3StateSpace> * start_;
   ompl::base::ScopedState<ompl::base::SE3StateSpace> * goal_;
@@ -115,10 +158,14 @@ protected:
 
   // to ensure safety when accessing global var curr_frame_
   std::mutex global_mutex_;
+  // held by createPlan, models are not updated while they are in use
+  std::mutex plan_mutex_;
   // the topic to subscribe in order capture a frame
   std::string planner_name_;
   // The topic of octomap to subscribe, this octomap is published by map_server
   std::string octomap_topic_;
+  // The topic of octree deltas map_server publishes on live updates
+  std::string octomap_updates_topic_;
   // Better t keep this parameter consistent with map_server, 0.2 is a OK default fo this
   double octomap_voxel_size_;
   // whether plugin is enabled
@@ -127,9 +174,15 @@ protected:
   int interpolation_parameter_;
   // max time the planner can spend before coming up with a solution
   double planner_timeout_;
-  // whether otomap is recieved
-  volatile bool is_octomap_ready_;
-  // global mutex to guard octomap
+  // threads of parallel planners, 0 for all cores
+  int num_threads_;
+  // planners raced when planner_name is Portfolio
+  std::vector<std::string> portfolio_planner_names_;
+  // wins of raced planners over all requests
+  vox_nav_utilities::PortfolioStatistics portfolio_statistics_;
+  rclcpp::Publisher<vox_nav_msgs::msg::PlannerPortfolioStatistics>::SharedPtr
+    portfolio_statistics_publisher_;
+  // global mutex to guard octomap and swapping map models
   std::mutex octomap_mutex_;
 
 };
@@ -17,7 +17,7 @@
 
 #include "vox_nav_planning/planner_core.hpp"
 #include <pcl/octree/octree_search.h>
-#include <pcl/filters/random_sample.h>
+#include <ompl/util/RandomNumbers.h>
 
 /**
  * @brief
@@ -37,7 +37,7 @@ public:
   */
   OctoCostOptimizationObjective(
     const ompl::base::SpaceInformationPtr & si,
-    std::shared_ptr<octomap::ColorOcTree> tree);
+    std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> tree);
 
   /**
    * @brief Destroy the Octo Cost Optimization Objective object
@@ -54,7 +54,7 @@ public:
   ompl::base::Cost stateCost(const ompl::base::State * s) const override;
 
 private:
-  std::shared_ptr<octomap::ColorOcTree> color_octomap_octree_;
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> octomap_octree_;
 };
 
 
@@ -62,16 +62,19 @@ class OctoCellValidStateSampler : public ompl::base::ValidStateSampler
 {
 public:
   /**
-   * @brief Construct a new Octo Cell State Sampler object
+   * @brief Construct a new Octo Cell State Sampler object, samples are drawn from
+   * elevated voxels of the pyramid
    *
    * @param si
-   * @param tree
+   * @param start
+   * @param goal
+   * @param cost_pyramid
    */
   OctoCellValidStateSampler(
     const ompl::base::SpaceInformationPtr & si,
     const ompl::base::ScopedState<ompl::base::SE3StateSpace> * start,
     const ompl::base::ScopedState<ompl::base::SE3StateSpace> * goal,
-    const std::shared_ptr<octomap::ColorOcTree> & tree);
+    const std::shared_ptr<vox_nav_utilities::TraversabilityCostPyramid> & cost_pyramid);
 
   /**
    * @brief
@@ -96,7 +99,8 @@ public:
     const double distance) override;
 
   /**
-   * @brief
+   * @brief Collect elevated voxels within the sphere through start and goal, only
+   * pyramid cells overlapping its bounding box and holding elevated voxels are visited
    *
    * @param start
    * @param goal
@@ -106,8 +110,56 @@ public:
     const ompl::base::ScopedState<ompl::base::SE3StateSpace> * goal);
 
 protected:
+  std::shared_ptr<vox_nav_utilities::TraversabilityCostPyramid> cost_pyramid_;
   pcl::PointCloud<pcl::PointXYZ>::Ptr workspace_pcl_;
   pcl::PointCloud<pcl::PointXYZ>::Ptr search_area_pcl_;
+  ompl::RNG rng_;
+};
+
+/**
+ * @brief Checks motions between SE3 states with the same interpolation steps as
+ * ompl::base::DiscreteMotionValidator, but positions of all steps are checked against an
+ * OccupancyBitGrid in one batch instead of calling the state validity checker for each step.
+ * Validity of an SE3 state only depends on its position, which is interpolated linearly.
+ *
+ */
+class OccupancyGridMotionValidator : public ompl::base::MotionValidator
+{
+public:
+  /**
+   * @brief Construct a new Occupancy Grid Motion Validator object.
+   * Planners of a portfolio share this validator across threads, so the valid and invalid
+   * motion counters of ompl::base::MotionValidator are not updated; they stay at zero.
+   *
+   * @param si
+   * @param grid
+   */
+  OccupancyGridMotionValidator(
+    const ompl::base::SpaceInformationPtr & si,
+    const std::shared_ptr<vox_nav_utilities::OccupancyBitGrid> & grid);
+
+  bool checkMotion(
+    const ompl::base::State * s1,
+    const ompl::base::State * s2) const override;
+
+  bool checkMotion(
+    const ompl::base::State * s1, const ompl::base::State * s2,
+    std::pair<ompl::base::State *, double> & lastValid) const override;
+
+private:
+  /**
+   * @brief Positions of steps 1 to n between s1 and s2, s2 is the last one
+   *
+   * @param s1
+   * @param s2
+   * @param xyz
+   * @return size_t n
+   */
+  size_t interpolatePositions(
+    const ompl::base::State * s1, const ompl::base::State * s2,
+    std::vector<double> & xyz) const;
+
+  std::shared_ptr<vox_nav_utilities::OccupancyBitGrid> grid_;
 };
 
 }  // namespace vox_nav_planning
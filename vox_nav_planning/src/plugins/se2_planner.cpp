@@ -15,6 +15,9 @@
 #include "vox_nav_planning/plugins/se2_planner.hpp"
 #include <pluginlib/class_list_macros.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <string>
 #include <memory>
 #include <vector>
@@ -22,6 +25,25 @@
 namespace vox_nav_planning
 {
 
+SE2StateValidityChecker::SE2StateValidityChecker(
+  const ompl::base::SpaceInformationPtr & si, SE2Planner * planner)
+: ompl::base::StateValidityChecker(si),
+  planner_(planner)
+{
+  // clearance is a lower bound taken from the distance field
+  specs_.clearanceComputationType = ompl::base::StateValidityCheckerSpecs::BOUNDED_APPROXIMATE;
+}
+
+bool SE2StateValidityChecker::isValid(const ompl::base::State * state) const
+{
+  return planner_->isStateValid(state);
+}
+
+double SE2StateValidityChecker::clearance(const ompl::base::State * state) const
+{
+  return planner_->getStateClearance(state);
+}
+
 SE2Planner::SE2Planner()
 {
 }
@@ -35,14 +57,17 @@ void SE2Planner::initialize(
   const std::string & plugin_name)
 {
   se2_space_bounds_ = std::make_shared<ompl::base::RealVectorBounds>(2);
-  octomap_msg_ = std::make_shared<octomap_msgs::msg::Octomap>();
-  is_octomap_ready_ = false;
 
   parent->declare_parameter(plugin_name + ".enabled", true);
   parent->declare_parameter(plugin_name + ".planner_name", "PRMStar");
   parent->declare_parameter(plugin_name + ".planner_timeout", 5.0);
+  parent->declare_parameter(plugin_name + ".num_threads", 0);
+  parent->declare_parameter(
+    plugin_name + ".portfolio_planners",
+    std::vector<std::string>({"RRTstar", "InformedRRTstar", "BITstar", "PRMstar"}));
   parent->declare_parameter(plugin_name + ".interpolation_parameter", 50);
   parent->declare_parameter(plugin_name + ".octomap_topic", "octomap");
+  parent->declare_parameter(plugin_name + ".octomap_updates_topic", "octomap_updates");
   parent->declare_parameter(plugin_name + ".octomap_voxel_size", 0.2);
   parent->declare_parameter(plugin_name + ".se2_space", "REEDS");
   parent->declare_parameter(plugin_name + ".state_space_boundries.minx", -50.0);
@@ -54,14 +79,30 @@ void SE2Planner::initialize(
   parent->declare_parameter(plugin_name + ".robot_body_dimens.x", 1.5);
   parent->declare_parameter(plugin_name + ".robot_body_dimens.y", 1.5);
   parent->declare_parameter(plugin_name + ".robot_body_dimens.z", 0.4);
+  parent->declare_parameter(plugin_name + ".exact_refinement", true);
+  parent->declare_parameter(plugin_name + ".esdf.enabled", true);
+  parent->declare_parameter(plugin_name + ".esdf.max_distance", 2.0);
+  parent->declare_parameter(plugin_name + ".esdf.num_footprint_circles", 0);
+  parent->declare_parameter(plugin_name + ".footprint_kernels.enabled", true);
+  parent->declare_parameter(plugin_name + ".footprint_kernels.num_yaw_bins", 72);
 
   parent->get_parameter(plugin_name + ".enabled", is_enabled_);
   parent->get_parameter(plugin_name + ".planner_name", planner_name_);
   parent->get_parameter(plugin_name + ".planner_timeout", planner_timeout_);
+  parent->get_parameter(plugin_name + ".num_threads", num_threads_);
+  parent->get_parameter(plugin_name + ".portfolio_planners", portfolio_planner_names_);
   parent->get_parameter(plugin_name + ".interpolation_parameter", interpolation_parameter_);
   parent->get_parameter(plugin_name + ".octomap_topic", octomap_topic_);
+  parent->get_parameter(plugin_name + ".octomap_updates_topic", octomap_updates_topic_);
   parent->get_parameter(plugin_name + ".octomap_voxel_size", octomap_voxel_size_);
   parent->get_parameter(plugin_name + ".se2_space", selected_se2_space_name_);
+  parent->get_parameter(plugin_name + ".robot_body_dimens.x", robot_body_dimens_x_);
+  parent->get_parameter(plugin_name + ".robot_body_dimens.y", robot_body_dimens_y_);
+  parent->get_parameter(plugin_name + ".robot_body_dimens.z", robot_body_dimens_z_);
+  parent->get_parameter(plugin_name + ".exact_refinement", exact_refinement_);
+  parent->get_parameter(plugin_name + ".esdf.enabled", use_esdf_);
+  parent->get_parameter(plugin_name + ".esdf.max_distance", esdf_max_distance_);
+  parent->get_parameter(plugin_name + ".footprint_kernels.enabled", use_footprint_kernels_);
 
   se2_space_bounds_->setLow(
     0, parent->get_parameter(plugin_name + ".state_space_boundries.minx").as_double());
@@ -88,25 +129,72 @@ void SE2Planner::initialize(
 
   typedef std::shared_ptr<fcl::CollisionGeometry> CollisionGeometryPtr_t;
   CollisionGeometryPtr_t robot_body_box(new fcl::Box(
-      parent->get_parameter(plugin_name + ".robot_body_dimens.x").as_double(),
-      parent->get_parameter(plugin_name + ".robot_body_dimens.y").as_double(),
-      parent->get_parameter(plugin_name + ".robot_body_dimens.z").as_double()));
+      robot_body_dimens_x_, robot_body_dimens_y_, robot_body_dimens_z_));
   fcl::Transform3f tf2;
   fcl::CollisionObject robot_body_box_object(robot_body_box, tf2);
   robot_collision_object_ = std::make_shared<fcl::CollisionObject>(robot_body_box_object);
+  computeFootprintCircles(
+    robot_body_dimens_x_, robot_body_dimens_y_,
+    parent->get_parameter(plugin_name + ".esdf.num_footprint_circles").as_int());
+  esdf_ = std::make_shared<vox_nav_utilities::EuclideanDistanceField2D>();
+  occupancy_slice_ = std::make_shared<vox_nav_utilities::OccupancySlice2D>();
+  footprint_kernels_ = std::make_shared<vox_nav_utilities::YawBinnedFootprintKernels>();
+  if (use_footprint_kernels_) {
+    // masks are tested against slices of octomap, so they share its resolution
+    footprint_kernels_->build(
+      robot_body_dimens_x_, robot_body_dimens_y_, octomap_voxel_size_,
+      parent->get_parameter(plugin_name + ".footprint_kernels.num_yaw_bins").as_int());
+    RCLCPP_INFO(
+      logger_, "Built footprint masks for %d yaw bins, %zu bytes, conservative by at most %.2f",
+      footprint_kernels_->numYawBins(), footprint_kernels_->memoryUsage(),
+      footprint_kernels_->maxError());
+  }
+  clock_ = parent->get_clock();
+  portfolio_statistics_publisher_ =
+    parent->create_publisher<vox_nav_msgs::msg::PlannerPortfolioStatistics>(
+    "planner_portfolio_statistics", rclcpp::SystemDefaultsQoS());
   octomap_subscriber_ = parent->create_subscription<octomap_msgs::msg::Octomap>(
-    octomap_topic_, rclcpp::SystemDefaultsQoS(),
+    octomap_topic_, rclcpp::QoS(rclcpp::KeepLast(1)).reliable().transient_local(),
     std::bind(&SE2Planner::octomapCallback, this, std::placeholders::_1));
+  octomap_updates_subscriber_ = parent->create_subscription<octomap_msgs::msg::Octomap>(
+    octomap_updates_topic_, rclcpp::QoS(rclcpp::KeepLast(10)).reliable(),
+    std::bind(&SE2Planner::octomapUpdatesCallback, this, std::placeholders::_1));
 
   se2_state_space_information_ = std::make_shared<ompl::base::SpaceInformation>(se2_space_);
   se2_state_space_information_->setStateValidityChecker(
-    std::bind(&SE2Planner::isStateValid, this, std::placeholders::_1));
+    std::make_shared<SE2StateValidityChecker>(se2_state_space_information_, this));
 
   if (!is_enabled_) {
     RCLCPP_WARN(
       logger_, "SE2PlannerControlSpace plugin is disabled.");
   }
   RCLCPP_INFO(logger_, "Selected planner is: %s", planner_name_.c_str());
+  if (use_esdf_) {
+    RCLCPP_INFO(
+      logger_, "Robot footprint is covered with %zu circles of radius %.2f for collision checks",
+      footprint_circles_.size(), footprint_circle_radius_);
+  }
+}
+
+void SE2Planner::computeFootprintCircles(double length, double width, int num_circles)
+{
+  const double long_side = std::max(length, width);
+  const double short_side = std::min(length, width);
+  if (num_circles <= 0) {
+    num_circles = std::max(1, static_cast<int>(std::ceil(long_side / short_side - 1e-6)));
+  }
+  // Each circle covers a long_side / num_circles x short_side section of the body
+  const double section = long_side / num_circles;
+  footprint_circle_radius_ = std::hypot(0.5 * section, 0.5 * short_side);
+  footprint_circles_.clear();
+  for (int i = 0; i < num_circles; i++) {
+    const double offset = -0.5 * long_side + (i + 0.5) * section;
+    if (length >= width) {
+      footprint_circles_.push_back({offset, 0.0});
+    } else {
+      footprint_circles_.push_back({0.0, offset});
+    }
+  }
 }
 
 std::vector<geometry_msgs::msg::PoseStamped> SE2Planner::createPlan(
@@ -120,6 +208,13 @@ std::vector<geometry_msgs::msg::PoseStamped> SE2Planner::createPlan(
     );
     return std::vector<geometry_msgs::msg::PoseStamped>();
   }
+  // Collision models are updated in place by live updates, so plans run one at a time
+  const std::lock_guard<std::mutex> plan_lock(plan_mutex_);
+  if (!updateCollisionModels()) {
+    RCLCPP_WARN(
+      logger_, "A valid Octomap has not been recieved yet, returning an empty path");
+    return std::vector<geometry_msgs::msg::PoseStamped>();
+  }
 
   ompl::base::ScopedState<ompl::base::DubinsStateSpace>
   se2_start(se2_space_),
@@ -141,10 +236,7 @@ std::vector<geometry_msgs::msg::PoseStamped> SE2Planner::createPlan(
   // define a simple setup class
   ompl::geometric::SimpleSetup simple_setup(se2_space_);
   simple_setup.setStateValidityChecker(
-    [this](const ompl::base::State * state)
-    {
-      return isStateValid(state);
-    });
+    std::make_shared<SE2StateValidityChecker>(simple_setup.getSpaceInformation(), this));
   simple_setup.setStartAndGoalStates(se2_start, se2_goal);
 
 
@@ -154,7 +246,9 @@ std::vector<geometry_msgs::msg::PoseStamped> SE2Planner::createPlan(
     planner,
     planner_name_,
     simple_setup.getSpaceInformation(),
-    logger_);
+    logger_,
+    num_threads_,
+    portfolio_planner_names_);
 
   // objective is to minimize the planned path
   ompl::base::OptimizationObjectivePtr objective(
@@ -169,6 +263,7 @@ std::vector<geometry_msgs::msg::PoseStamped> SE2Planner::createPlan(
 
   // attempt to solve the problem within one second of planning time
   ompl::base::PlannerStatus solved = simple_setup.solve(planner_timeout_);
+  publishPortfolioStatistics(planner);
   std::vector<geometry_msgs::msg::PoseStamped> plan_poses;
 
   if (solved) {
@@ -210,23 +305,151 @@ std::vector<geometry_msgs::msg::PoseStamped> SE2Planner::createPlan(
   return plan_poses;
 }
 
-bool SE2Planner::isStateValid(const ompl::base::State * state)
+bool SE2Planner::updateCollisionModels()
 {
-  if (is_octomap_ready_) {
-    std::call_once(
-      fcl_tree_from_octomap_once_, [this]() {
-        std::shared_ptr<octomap::OcTree> octomap_octree =
-        std::make_shared<octomap::OcTree>(0.2);
-        octomap_msgs::readTree<octomap::OcTree>(octomap_octree.get(), *octomap_msg_);
-        fcl_octree_ = std::make_shared<fcl::OcTree>(octomap_octree);
-        fcl_octree_collision_object_ = std::make_shared<fcl::CollisionObject>(
-          std::shared_ptr<fcl::CollisionGeometry>(fcl_octree_));
-        RCLCPP_INFO(
-          logger_,
-          "Recieved a valid Octomap, A FCL collision tree will be created from this "
-          "octomap for state validity(aka collision check)");
-      });
+  octomap_msgs::msg::Octomap::ConstSharedPtr octomap_msg;
+  std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> octomap_updates;
+  {
+    const std::lock_guard<std::mutex> lock(octomap_mutex_);
+    octomap_msg = octomap_msg_;
+    octomap_updates = octomap_updates_;
+  }
+  if (!octomap_msg) {
+    return false;
+  }
+  // map_server stamps every message of a map epoch the same, periodic republishes are no-ops.
+  // Deltas are only appended until next epoch, so their count tells whether new ones arrived
+  const bool is_same_epoch = fcl_octree_collision_object_ &&
+    octomap_msg->header.stamp == collision_models_stamp_ &&
+    octomap_updates.size() >= collision_models_num_updates_;
+  if (is_same_epoch && octomap_updates.size() == collision_models_num_updates_) {
+    return true;
+  }
+  // Only deltas that arrived since the last plan are applied to the models of this epoch
+  if (is_same_epoch) {
+    applyOctomapUpdates(
+      std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr>(
+        octomap_updates.begin() + collision_models_num_updates_, octomap_updates.end()));
+    collision_models_num_updates_ = octomap_updates.size();
+    return true;
+  }
+
+  // Models are built aside and swapped in, so a failed or slow build never leaves them half done.
+  // Deltas of live updates apply to traversability octrees, plain octrees are used as they are
+  std::shared_ptr<octomap::OcTree> octomap_octree;
+  auto traversability_octree =
+    vox_nav_utilities::traversabilityOcTreeFromMsg(*octomap_msg, octomap_updates);
+  if (traversability_octree) {
+    octomap_octree = traversability_octree->toOccupancyOcTree();
   } else {
+    octomap_octree = vox_nav_utilities::occupancyOcTreeFromMsg(*octomap_msg);
+  }
+  auto fcl_octree = std::make_shared<fcl::OcTree>(octomap_octree);
+  auto fcl_octree_collision_object = std::make_shared<fcl::CollisionObject>(
+    std::shared_ptr<fcl::CollisionGeometry>(fcl_octree));
+  auto occupancy_slice = std::make_shared<vox_nav_utilities::OccupancySlice2D>();
+  auto footprint_kernels = footprint_kernels_;
+  auto esdf = std::make_shared<vox_nav_utilities::EuclideanDistanceField2D>();
+  RCLCPP_INFO(
+    logger_,
+    "Recieved a new Octomap epoch with %zu live updates, A FCL collision tree will be created "
+    "from this octomap for state validity(aka collision check)", octomap_updates.size());
+
+  if (use_esdf_ || use_footprint_kernels_) {
+    // Any obstacle a footprint circle or mask within state space bounds can see lies within
+    // padding
+    const double padding = footprint_circle_radius_ +
+      std::hypot(0.5 * robot_body_dimens_x_, 0.5 * robot_body_dimens_y_) + esdf_max_distance_;
+    // Robot body is centered at z = 0.5, same as in the FCL check
+    occupancy_slice->build(
+      *octomap_octree,
+      se2_space_bounds_->low[0] - padding, se2_space_bounds_->low[1] - padding,
+      se2_space_bounds_->high[0] + padding, se2_space_bounds_->high[1] + padding,
+      0.5 - 0.5 * robot_body_dimens_z_, 0.5 + 0.5 * robot_body_dimens_z_);
+    if (use_footprint_kernels_ &&
+      std::fabs(occupancy_slice->resolution() - footprint_kernels_->resolution()) > 1e-6)
+    {
+      RCLCPP_WARN(
+        logger_,
+        "Footprint mask resolution %.2f does not match octomap resolution %.2f, rebuilding them",
+        footprint_kernels_->resolution(), occupancy_slice->resolution());
+      footprint_kernels = std::make_shared<vox_nav_utilities::YawBinnedFootprintKernels>();
+      footprint_kernels->build(
+        robot_body_dimens_x_, robot_body_dimens_y_, occupancy_slice->resolution(),
+        footprint_kernels_->numYawBins());
+    }
+    if (use_esdf_) {
+      esdf->build(*occupancy_slice, esdf_max_distance_);
+      RCLCPP_INFO(
+        logger_,
+        "Built a %zu x %zu distance field with %zu obstacle cells for footprint collision checks",
+        esdf->sizeX(), esdf->sizeY(), esdf->numObstacles());
+    }
+  }
+
+  const std::lock_guard<std::mutex> lock(octomap_mutex_);
+  traversability_octree_ = traversability_octree;
+  octomap_octree_ = octomap_octree;
+  fcl_octree_ = fcl_octree;
+  fcl_octree_collision_object_ = fcl_octree_collision_object;
+  occupancy_slice_ = occupancy_slice;
+  footprint_kernels_ = footprint_kernels;
+  esdf_ = esdf;
+  collision_models_stamp_ = octomap_msg->header.stamp;
+  collision_models_num_updates_ = octomap_updates.size();
+  return true;
+}
+
+void SE2Planner::applyOctomapUpdates(
+  const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & octomap_updates)
+{
+  // Plain octrees of an epoch carry no traversability, deltas do not apply to them
+  if (!traversability_octree_) {
+    return;
+  }
+  std::vector<octomap::OcTreeKey> keys;
+  vox_nav_utilities::applyOctomapUpdates(*traversability_octree_, octomap_updates, &keys);
+  if (keys.empty()) {
+    return;
+  }
+
+  // Changed leaves are copied into the occupancy octree FCL checks against
+  double min_x = std::numeric_limits<double>::max();
+  double min_y = std::numeric_limits<double>::max();
+  double max_x = std::numeric_limits<double>::lowest();
+  double max_y = std::numeric_limits<double>::lowest();
+  for (auto && key : keys) {
+    auto node = traversability_octree_->search(key);
+    if (node && traversability_octree_->isNodeOccupied(node)) {
+      octomap_octree_->setNodeValue(key, node->getLogOdds());
+    } else {
+      octomap_octree_->deleteNode(key);
+    }
+    const octomap::point3d center = octomap_octree_->keyToCoord(key);
+    min_x = std::min(min_x, static_cast<double>(center.x()));
+    min_y = std::min(min_y, static_cast<double>(center.y()));
+    max_x = std::max(max_x, static_cast<double>(center.x()));
+    max_y = std::max(max_y, static_cast<double>(center.y()));
+  }
+  fcl_octree_->computeLocalAABB();
+  fcl_octree_collision_object_->computeAABB();
+
+  // Only cells of the slice over changed leaves are recomputed, distance field is rebuilt from
+  // the slice without visiting the octree
+  if (occupancy_slice_->isValid()) {
+    occupancy_slice_->update(*octomap_octree_, min_x, min_y, max_x, max_y);
+    if (use_esdf_) {
+      esdf_->build(*occupancy_slice_, esdf_max_distance_);
+    }
+  }
+  RCLCPP_INFO(
+    logger_, "Applied %zu live updates changing %zu leaves to collision models",
+    octomap_updates.size(), keys.size());
+}
+
+bool SE2Planner::isStateValid(const ompl::base::State * state)
+{
+  if (!fcl_octree_collision_object_) {
     RCLCPP_ERROR(
       logger_,
       "The Octomap has not been recieved correctly, Collision check "
@@ -236,29 +459,117 @@ bool SE2Planner::isStateValid(const ompl::base::State * state)
   // cast the abstract state type to the type we expect
   const ompl::base::SE2StateSpace::StateType * se2_state =
     state->as<ompl::base::SE2StateSpace::StateType>();
+
+  if (use_esdf_ && esdf_->isValid()) {
+    const double cos_yaw = std::cos(se2_state->getYaw());
+    const double sin_yaw = std::sin(se2_state->getYaw());
+    bool is_near_obstacle = false;
+    for (auto && circle : footprint_circles_) {
+      const double x = se2_state->getX() + cos_yaw * circle.x - sin_yaw * circle.y;
+      const double y = se2_state->getY() + sin_yaw * circle.x + cos_yaw * circle.y;
+      const double clearance = esdf_->clearance(x, y);
+      // Circle centers lie inside the body, an obstacle there is a collision for sure
+      if (clearance < 0.0) {
+        return false;
+      }
+      is_near_obstacle = is_near_obstacle || clearance <= footprint_circle_radius_;
+    }
+    // Circles cover the body, so far from obstacles it is free as well.
+    // Close to them circles are conservative, tighter masks or FCL have to tell
+    if (!is_near_obstacle) {
+      return true;
+    }
+  }
+  if (use_footprint_kernels_ && occupancy_slice_->isValid()) {
+    // Masks cover the body too, a miss means the state is free
+    if (!footprint_kernels_->collides(
+        *occupancy_slice_, se2_state->getX(), se2_state->getY(), se2_state->getYaw()))
+    {
+      return true;
+    }
+  }
+  if (!exact_refinement_ && (use_esdf_ || use_footprint_kernels_)) {
+    return false;
+  }
+
   // check validity of state Fdefined by pos & rot
   fcl::Vec3f translation(se2_state->getX(), se2_state->getY(), 0.5);
   tf2::Quaternion myQuaternion;
   myQuaternion.setRPY(0, 0, se2_state->getYaw());
   fcl::Quaternion3f rotation(myQuaternion.getX(), myQuaternion.getY(),
     myQuaternion.getZ(), myQuaternion.getW());
-  robot_collision_object_->setTransform(rotation, translation);
+  // A collision object per check shares the body geometry, so parallel planners can check
+  // states concurrently
+  fcl::CollisionObject robot_body(
+    robot_collision_object_->collisionGeometry(), fcl::Transform3f(rotation, translation));
   fcl::CollisionRequest requestType(1, false, 1, false);
   fcl::CollisionResult collisionResult;
   fcl::collide(
-    robot_collision_object_.get(),
+    &robot_body,
     fcl_octree_collision_object_.get(), requestType, collisionResult);
   return !collisionResult.isCollision();
 }
 
+double SE2Planner::getClearance(double x, double y, double yaw)
+{
+  if (!esdf_->isValid()) {
+    return 0.0;
+  }
+  const double cos_yaw = std::cos(yaw);
+  const double sin_yaw = std::sin(yaw);
+  double min_clearance = std::numeric_limits<double>::max();
+  for (auto && circle : footprint_circles_) {
+    const double clearance = esdf_->clearance(
+      x + cos_yaw * circle.x - sin_yaw * circle.y,
+      y + sin_yaw * circle.x + cos_yaw * circle.y);
+    // inside an obstacle, report how deep the circle center is
+    min_clearance = std::min(
+      min_clearance, clearance < 0.0 ? clearance : clearance - footprint_circle_radius_);
+  }
+  return min_clearance;
+}
+
+double SE2Planner::getStateClearance(const ompl::base::State * state)
+{
+  const ompl::base::SE2StateSpace::StateType * se2_state =
+    state->as<ompl::base::SE2StateSpace::StateType>();
+  return getClearance(se2_state->getX(), se2_state->getY(), se2_state->getYaw());
+}
+
 void SE2Planner::octomapCallback(
   const octomap_msgs::msg::Octomap::ConstSharedPtr msg)
+{
+  // Only the latest map is kept, collision models are rebuilt from it by the next plan
+  const std::lock_guard<std::mutex> lock(octomap_mutex_);
+  octomap_msg_ = msg;
+  // A full map carries every delta published before it
+  vox_nav_utilities::eraseOctomapUpdatesUpTo(octomap_updates_, msg->header.stamp);
+}
+
+void SE2Planner::octomapUpdatesCallback(
+  const octomap_msgs::msg::Octomap::ConstSharedPtr msg)
 {
   const std::lock_guard<std::mutex> lock(octomap_mutex_);
-  if (!is_octomap_ready_) {
-    is_octomap_ready_ = true;
-    octomap_msg_ = msg;
+  octomap_updates_.push_back(msg);
+  if (octomap_msg_) {
+    vox_nav_utilities::eraseOctomapUpdatesUpTo(octomap_updates_, octomap_msg_->header.stamp);
+  }
+}
+
+void SE2Planner::publishPortfolioStatistics(const ompl::base::PlannerPtr & planner)
+{
+  auto portfolio = std::dynamic_pointer_cast<vox_nav_utilities::PortfolioPlanner>(planner);
+  if (!portfolio) {
+    return;
+  }
+  portfolio_statistics_.update(*portfolio);
+  for (auto && result : portfolio->getLastResults()) {
+    RCLCPP_INFO(
+      logger_, "Portfolio member %s: %s, first exact solution after %.3f s, cost %.2f",
+      result.name.c_str(), result.status.asString().c_str(), result.time_to_exact_solution,
+      result.cost);
   }
+  portfolio_statistics_publisher_->publish(portfolio_statistics_.toMsg(clock_->now()));
 }
 
 }  // namespace vox_nav_planning
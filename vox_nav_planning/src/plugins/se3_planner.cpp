@@ -36,14 +36,17 @@ void SE3Planner::initialize(
   const std::string & plugin_name)
 {
   state_space_bounds_ = std::make_shared<ompl::base::RealVectorBounds>(3);
-  octomap_msg_ = std::make_shared<octomap_msgs::msg::Octomap>();
-  is_octomap_ready_ = false;
 
   parent->declare_parameter(plugin_name + ".enabled", true);
   parent->declare_parameter(plugin_name + ".planner_name", "PRMStar");
   parent->declare_parameter(plugin_name + ".planner_timeout", 5.0);
+  parent->declare_parameter(plugin_name + ".num_threads", 0);
+  parent->declare_parameter(
+    plugin_name + ".portfolio_planners",
+    std::vector<std::string>({"RRTstar", "InformedRRTstar", "BITstar", "PRMstar"}));
   parent->declare_parameter(plugin_name + ".interpolation_parameter", 50);
   parent->declare_parameter(plugin_name + ".octomap_topic", "octomap");
+  parent->declare_parameter(plugin_name + ".octomap_updates_topic", "octomap_updates");
   parent->declare_parameter(plugin_name + ".octomap_voxel_size", 0.2);
   parent->declare_parameter(plugin_name + ".state_space_boundries.minx", -10.0);
   parent->declare_parameter(plugin_name + ".state_space_boundries.maxx", 10.0);
@@ -58,8 +61,11 @@ void SE3Planner::initialize(
   parent->get_parameter(plugin_name + ".enabled", is_enabled_);
   parent->get_parameter(plugin_name + ".planner_name", planner_name_);
   parent->get_parameter(plugin_name + ".planner_timeout", planner_timeout_);
+  parent->get_parameter(plugin_name + ".num_threads", num_threads_);
+  parent->get_parameter(plugin_name + ".portfolio_planners", portfolio_planner_names_);
   parent->get_parameter(plugin_name + ".interpolation_parameter", interpolation_parameter_);
   parent->get_parameter(plugin_name + ".octomap_topic", octomap_topic_);
+  parent->get_parameter(plugin_name + ".octomap_updates_topic", octomap_updates_topic_);
   parent->get_parameter(plugin_name + ".octomap_voxel_size", octomap_voxel_size_);
 
   state_space_bounds_->setLow(
@@ -85,16 +91,21 @@ void SE3Planner::initialize(
   fcl::CollisionObject robot_body_box_object(robot_body_box, tf2);
   robot_collision_object_ = std::make_shared<fcl::CollisionObject>(robot_body_box_object);
 
+  clock_ = parent->get_clock();
+  portfolio_statistics_publisher_ =
+    parent->create_publisher<vox_nav_msgs::msg::PlannerPortfolioStatistics>(
+    "planner_portfolio_statistics", rclcpp::SystemDefaultsQoS());
   octomap_subscriber_ = parent->create_subscription<octomap_msgs::msg::Octomap>(
-    octomap_topic_, rclcpp::SystemDefaultsQoS(),
+    octomap_topic_, rclcpp::QoS(rclcpp::KeepLast(1)).reliable().transient_local(),
     std::bind(&SE3Planner::octomapCallback, this, std::placeholders::_1));
+  octomap_updates_subscriber_ = parent->create_subscription<octomap_msgs::msg::Octomap>(
+    octomap_updates_topic_, rclcpp::QoS(rclcpp::KeepLast(10)).reliable(),
+    std::bind(&SE3Planner::octomapUpdatesCallback, this, std::placeholders::_1));
 
   state_space_ = std::make_shared<ompl::base::SE3StateSpace>();
   state_space_->as<ompl::base::SE3StateSpace>()->setBounds(*state_space_bounds_);
   simple_setup_ = std::make_shared<ompl::geometric::SimpleSetup>(state_space_);
 
-  octomap_octree_ = std::make_shared<octomap::OcTree>(octomap_voxel_size_);
-
   if (!is_enabled_) {
     RCLCPP_WARN(
       logger_, "SE3Planner plugin is disabled.");
@@ -115,7 +126,9 @@ std::vector<geometry_msgs::msg::PoseStamped> SE3Planner::createPlan(
     return std::vector<geometry_msgs::msg::PoseStamped>();
   }
 
-  if (!is_octomap_ready_) {
+  // Map models are updated in place by live updates, so plans run one at a time
+  const std::lock_guard<std::mutex> plan_lock(plan_mutex_);
+  if (!updateMapModels()) {
     RCLCPP_WARN(
       logger_,
       "A valid Octomap has not been receievd yet, Try later again."
@@ -132,8 +145,8 @@ std::vector<geometry_msgs::msg::PoseStamped> SE3Planner::createPlan(
   se3_start(state_space_),
   se3_goal(state_space_);
 
-  auto nearest_node_to_start = vox_nav_utilities::getNearstNode(start, color_octomap_octree_);
-  auto nearest_node_to_goal = vox_nav_utilities::getNearstNode(goal, color_octomap_octree_);
+  auto nearest_node_to_start = vox_nav_utilities::getNearstNode(start, octomap_octree_);
+  auto nearest_node_to_goal = vox_nav_utilities::getNearstNode(goal, octomap_octree_);
 
   se3_start->setXYZ(
     nearest_node_to_start.pose.position.x,
@@ -164,7 +177,9 @@ std::vector<geometry_msgs::msg::PoseStamped> SE3Planner::createPlan(
     planner,
     planner_name_,
     simple_setup_->getSpaceInformation(),
-    logger_);
+    logger_,
+    num_threads_,
+    portfolio_planner_names_);
 
   simple_setup_->setPlanner(planner);
 
@@ -183,6 +198,7 @@ std::vector<geometry_msgs::msg::PoseStamped> SE3Planner::createPlan(
 
   // attempt to solve the problem within one second of planning time
   ompl::base::PlannerStatus solved = simple_setup_->solve(planner_timeout_);
+  publishPortfolioStatistics(planner);
   std::vector<geometry_msgs::msg::PoseStamped> plan_poses;
 
   if (solved) {
@@ -226,107 +242,170 @@ std::vector<geometry_msgs::msg::PoseStamped> SE3Planner::createPlan(
 
 bool SE3Planner::isStateValid(const ompl::base::State * state)
 {
-  if (is_octomap_ready_) {
-    // cast the abstract state type to the type we expect
-    const ompl::base::SE3StateSpace::StateType * se3state =
-      state->as<ompl::base::SE3StateSpace::StateType>();
-
-    /*// extract the second component of the state and cast it to what we expect
-    const ompl::base::SO3StateSpace::StateType * rot =
-      se3state->as<ompl::base::SO3StateSpace::StateType>(1);
-    // check validity of state Fdefined by pos & rot
-    fcl::Vec3f translation(se3state->getX(), se3state->getY(), se3state->getZ());
-    fcl::Quaternion3f rotation(rot->w, rot->x, rot->y, rot->z);
-    robot_collision_object_->setTransform(rotation, translation);
-    fcl::CollisionRequest requestType(1, false, 1, false);
-     fcl::CollisionResult collisionResult;
-     fcl::collide(
-       robot_collision_object_.get(),
-       fcl_octree_collision_object_.get(), requestType, collisionResult);
-    return !collisionResult.isCollision();
-    */
-
-    bool is_valid = false;
-    auto node = color_octomap_octree_->search(
-      octomap::point3d(se3state->getX(), se3state->getY(), se3state->getZ()));
-    if (node) {
-      if (color_octomap_octree_->isNodeOccupied(node)) {
-        is_valid = true;
-      }
-    }
-    return is_valid;
-
-  } else {
+  if (!occupancy_grid_) {
     RCLCPP_ERROR(
       logger_,
       "The Octomap has not been recieved correctly, Collision check "
       "cannot be processed without a valid Octomap!");
     return false;
   }
+  // cast the abstract state type to the type we expect
+  const ompl::base::SE3StateSpace::StateType * se3state =
+    state->as<ompl::base::SE3StateSpace::StateType>();
+
+  /*// extract the second component of the state and cast it to what we expect
+  const ompl::base::SO3StateSpace::StateType * rot =
+    se3state->as<ompl::base::SO3StateSpace::StateType>(1);
+  // check validity of state Fdefined by pos & rot
+  fcl::Vec3f translation(se3state->getX(), se3state->getY(), se3state->getZ());
+  fcl::Quaternion3f rotation(rot->w, rot->x, rot->y, rot->z);
+  robot_collision_object_->setTransform(rotation, translation);
+  fcl::CollisionRequest requestType(1, false, 1, false);
+   fcl::CollisionResult collisionResult;
+   fcl::collide(
+     robot_collision_object_.get(),
+     fcl_octree_collision_object_.get(), requestType, collisionResult);
+  return !collisionResult.isCollision();
+  */
+
+  // One block lookup and a bit test instead of descending the octree from its root
+  return occupancy_grid_->isOccupied(se3state->getX(), se3state->getY(), se3state->getZ());
 }
 
-void SE3Planner::octomapCallback(
-  const octomap_msgs::msg::Octomap::ConstSharedPtr msg)
+bool SE3Planner::updateMapModels()
 {
-  const std::lock_guard<std::mutex> lock(octomap_mutex_);
-
-  if (!is_octomap_ready_) {
-    octomap_msg_ = msg;
-    RCLCPP_INFO(logger_, "Octomap has been recieved!");
-    try {
-
-      auto raw_color_octomap_octree =
-        dynamic_cast<octomap::ColorOcTree *>(octomap_msgs::fullMsgToMap(*octomap_msg_));
-
-      color_octomap_octree_ = std::make_shared<octomap::ColorOcTree>(*raw_color_octomap_octree);
-      delete raw_color_octomap_octree;
-
-      for (auto it = color_octomap_octree_->begin(),
-        end = color_octomap_octree_->end(); it != end; ++it)
-      {
-        auto crr_point_node_key = color_octomap_octree_->coordToKey(it.getCoordinate());
-        octomap_octree_->setNodeValue(crr_point_node_key, it->getValue(), false);
-      }
-
-      fcl_octree_ = std::make_shared<fcl::OcTree>(octomap_octree_);
-      fcl_octree_collision_object_ = std::make_shared<fcl::CollisionObject>(
-        std::shared_ptr<fcl::CollisionGeometry>(fcl_octree_));
+  octomap_msgs::msg::Octomap::ConstSharedPtr octomap_msg;
+  std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> octomap_updates;
+  {
+    const std::lock_guard<std::mutex> lock(octomap_mutex_);
+    octomap_msg = octomap_msg_;
+    octomap_updates = octomap_updates_;
+  }
+  if (!octomap_msg) {
+    return false;
+  }
+  // map_server stamps every message of a map epoch the same, periodic republishes are no-ops.
+  // Deltas are only appended until next epoch, so their count tells whether new ones arrived
+  const bool is_same_epoch = occupancy_grid_ &&
+    octomap_msg->header.stamp == map_models_stamp_ &&
+    octomap_updates.size() >= map_models_num_updates_;
+  if (is_same_epoch && octomap_updates.size() == map_models_num_updates_) {
+    return true;
+  }
+  // Only deltas that arrived since the last plan are applied to the models of this epoch
+  if (is_same_epoch) {
+    applyOctomapUpdates(
+      std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr>(
+        octomap_updates.begin() + map_models_num_updates_, octomap_updates.end()));
+    map_models_num_updates_ = octomap_updates.size();
+    return true;
+  }
 
-      RCLCPP_INFO(
+  // Traversability is read straight from the nodes, no second tree is needed.
+  // Deltas that arrived before the epoch was received are applied to it once
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> octomap_octree;
+  try {
+    octomap_octree =
+      vox_nav_utilities::traversabilityOcTreeFromMsg(*octomap_msg, octomap_updates);
+    if (!octomap_octree) {
+      RCLCPP_ERROR(
         logger_,
-        "Recieved a valid Octomap with %d nodes, A FCL collision tree will be created from this "
-        "octomap for state validity (aka collision check)", color_octomap_octree_->size());
+        "Recieved Octomap is not a TraversabilityOcTree, it cannot be used for planning");
+      return static_cast<bool>(occupancy_grid_);
+    }
+  } catch (const std::exception & e) {
+    RCLCPP_ERROR(
+      logger_,
+      "Exception while converting octomap  %s:", e.what());
+    return static_cast<bool>(occupancy_grid_);
+  }
+  // Built aside and swapped in, so states are never checked against a half built model
+  auto cost_pyramid =
+    std::make_shared<vox_nav_utilities::TraversabilityCostPyramid>(*octomap_octree);
+  auto occupancy_grid =
+    std::make_shared<vox_nav_utilities::OccupancyBitGrid>(*octomap_octree);
+
+  RCLCPP_INFO(
+    logger_,
+    "Recieved a new Octomap epoch with %zu nodes and %zu live updates, it will be used for "
+    "state validity (aka collision check)", octomap_octree->size(), octomap_updates.size());
+  RCLCPP_INFO(
+    logger_,
+    "Built a cost pyramid with %u levels, %zu voxels and %zu cells at %.2f m",
+    cost_pyramid->numLevels(), cost_pyramid->numVoxels(),
+    cost_pyramid->numCells(4), cost_pyramid->cellSize(4));
+  RCLCPP_INFO(
+    logger_,
+    "Built an occupancy bit grid with %zu voxels in %zu blocks, %.2f MB",
+    occupancy_grid->numVoxels(), occupancy_grid->numBlocks(),
+    occupancy_grid->memoryUsage() / 1e6);
 
-      RCLCPP_INFO(
-        logger_,
-        "Collisison check Octomap with %d nodes", color_octomap_octree_->size());
-      is_octomap_ready_ = true;
+  const std::lock_guard<std::mutex> lock(octomap_mutex_);
+  octomap_octree_ = octomap_octree;
+  cost_pyramid_ = cost_pyramid;
+  occupancy_grid_ = occupancy_grid;
+  map_models_stamp_ = octomap_msg->header.stamp;
+  map_models_num_updates_ = octomap_updates.size();
+
+  simple_setup_->setOptimizationObjective(getOptimizationObjective());
+  simple_setup_->setStateValidityChecker(
+    std::bind(
+      &SE3Planner::
+      isStateValid, this, std::placeholders::_1));
+  // Steps of each motion are checked in one batch
+  simple_setup_->getSpaceInformation()->setMotionValidator(
+    std::make_shared<OccupancyGridMotionValidator>(
+      simple_setup_->getSpaceInformation(), occupancy_grid_));
+  return true;
+}
 
-      simple_setup_->setOptimizationObjective(getOptimizationObjective());
+void SE3Planner::applyOctomapUpdates(
+  const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & octomap_updates)
+{
+  std::vector<octomap::OcTreeKey> keys;
+  vox_nav_utilities::applyOctomapUpdates(*octomap_octree_, octomap_updates, &keys);
+  if (keys.empty()) {
+    return;
+  }
+  cost_pyramid_->update(*octomap_octree_, keys);
+  // Blocks of voxels outside of what the grid can index need a rebuild
+  if (!occupancy_grid_->update(*octomap_octree_, keys)) {
+    occupancy_grid_->build(*octomap_octree_);
+  }
+  RCLCPP_INFO(
+    logger_, "Applied %zu live updates changing %zu leaves to map models",
+    octomap_updates.size(), keys.size());
+}
 
-      simple_setup_->setStateValidityChecker(
-        std::bind(
-          &SE3Planner::
-          isStateValid, this, std::placeholders::_1));
+void SE3Planner::octomapCallback(
+  const octomap_msgs::msg::Octomap::ConstSharedPtr msg)
+{
+  // Only the latest map is kept, map models are rebuilt from it by the next plan
+  const std::lock_guard<std::mutex> lock(octomap_mutex_);
+  octomap_msg_ = msg;
+  // A full map carries every delta published before it
+  vox_nav_utilities::eraseOctomapUpdatesUpTo(octomap_updates_, msg->header.stamp);
+  RCLCPP_INFO(logger_, "Octomap has been recieved!");
+}
 
-    } catch (const std::exception & e) {
-      std::cerr << e.what() << "\n";
-      RCLCPP_ERROR(
-        logger_,
-        "Exception while converting octomap  %s:", e.what());
-    }
+void SE3Planner::octomapUpdatesCallback(
+  const octomap_msgs::msg::Octomap::ConstSharedPtr msg)
+{
+  const std::lock_guard<std::mutex> lock(octomap_mutex_);
+  octomap_updates_.push_back(msg);
+  if (octomap_msg_) {
+    vox_nav_utilities::eraseOctomapUpdatesUpTo(octomap_updates_, octomap_msg_->header.stamp);
   }
 }
 
 ompl::base::ValidStateSamplerPtr SE3Planner::allocValidStateSampler(
   const ompl::base::SpaceInformation * si)
 {
-  octocell_state_sampler_ = std::make_shared<OctoCellValidStateSampler>(
+  // Parallel planners allocate a sampler for each of their threads, nothing is shared
+  return std::make_shared<OctoCellValidStateSampler>(
     simple_setup_->getSpaceInformation(),
     start_, goal_,
-    color_octomap_octree_);
-
-  return octocell_state_sampler_;
+    cost_pyramid_);
 }
 
 ompl::base::OptimizationObjectivePtr SE3Planner::getOptimizationObjective()
@@ -337,13 +416,29 @@ ompl::base::OptimizationObjectivePtr SE3Planner::getOptimizationObjective()
 
   ompl::base::OptimizationObjectivePtr octocost_objective(
     new OctoCostOptimizationObjective(
-      simple_setup_->getSpaceInformation(), color_octomap_octree_));
+      simple_setup_->getSpaceInformation(), octomap_octree_));
 
   octocost_optimization_ = length_objective;
 
   return octocost_optimization_;
 }
 
+void SE3Planner::publishPortfolioStatistics(const ompl::base::PlannerPtr & planner)
+{
+  auto portfolio = std::dynamic_pointer_cast<vox_nav_utilities::PortfolioPlanner>(planner);
+  if (!portfolio) {
+    return;
+  }
+  portfolio_statistics_.update(*portfolio);
+  for (auto && result : portfolio->getLastResults()) {
+    RCLCPP_INFO(
+      logger_, "Portfolio member %s: %s, first exact solution after %.3f s, cost %.2f",
+      result.name.c_str(), result.status.asString().c_str(), result.time_to_exact_solution,
+      result.cost);
+  }
+  portfolio_statistics_publisher_->publish(portfolio_statistics_.toMsg(clock_->now()));
+}
+
 }  // namespace vox_nav_planning
 
 PLUGINLIB_EXPORT_CLASS(vox_nav_planning::SE3Planner, vox_nav_planning::PlannerCore)
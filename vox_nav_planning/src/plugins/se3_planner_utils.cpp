@@ -14,18 +14,24 @@
 
 #include "vox_nav_planning/plugins/se3_planner_utils.hpp"
 
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
 namespace vox_nav_planning
 {
 
 OctoCostOptimizationObjective::OctoCostOptimizationObjective(
   const ompl::base::SpaceInformationPtr & si,
-  std::shared_ptr<octomap::ColorOcTree> tree)
+  std::shared_ptr<vox_nav_utilities::TraversabilityOcTree> tree)
 : ompl::base::StateCostIntegralObjective(si, true)
 {
   description_ = "OctoCost Objective";
-  color_octomap_octree_ = tree;
+  octomap_octree_ = tree;
   std::cout << "OctoCost Optimization objective bases on an Octomap with " <<
-    color_octomap_octree_->size() << " nodes" << std::endl;
+    octomap_octree_->size() << " nodes" << std::endl;
 }
 
 OctoCostOptimizationObjective::~OctoCostOptimizationObjective()
@@ -42,12 +48,10 @@ ompl::base::Cost OctoCostOptimizationObjective::stateCost(const ompl::base::Stat
   double z = se3_state->getZ();
 
   float cost(0.0);
-  auto node_at_samppled_state = color_octomap_octree_->search(x, y, z, 0);
+  auto node_at_samppled_state = octomap_octree_->search(x, y, z, 0);
 
   if (node_at_samppled_state) {
-    if (!node_at_samppled_state->getColor().r) {
-      cost = 1.0 * static_cast<double>(node_at_samppled_state->getColor().b / 255.0);
-    }
+    cost = node_at_samppled_state->getNormalizedCost();
   } else {
     cost = 5.0;
   }
@@ -62,25 +66,23 @@ OctoCellValidStateSampler::OctoCellValidStateSampler(
   const ompl::base::SpaceInformationPtr & si,
   const ompl::base::ScopedState<ompl::base::SE3StateSpace> * start,
   const ompl::base::ScopedState<ompl::base::SE3StateSpace> * goal,
-  const std::shared_ptr<octomap::ColorOcTree> & tree)
+  const std::shared_ptr<vox_nav_utilities::TraversabilityCostPyramid> & cost_pyramid)
 : ValidStateSampler(si.get())
 {
   name_ = "OctoCellValidStateSampler";
+  cost_pyramid_ = cost_pyramid;
 
   workspace_pcl_ =
     pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
 
-  for (auto it = tree->begin(),
-    end = tree->end();
-    it != end; ++it)
-  {
-    if (it->getValue() > 2.0) {
-      pcl::PointXYZ node_as_point;
-      node_as_point.x = it.getCoordinate().x();
-      node_as_point.y = it.getCoordinate().y();
-      node_as_point.z = it.getCoordinate().z();
-      workspace_pcl_->points.push_back(node_as_point);
-    }
+  std::vector<octomap::point3d> elevated_voxels;
+  const double max_coordinate = std::numeric_limits<float>::max();
+  cost_pyramid_->collectVoxels(
+    octomap::point3d(-max_coordinate, -max_coordinate, -max_coordinate),
+    octomap::point3d(max_coordinate, max_coordinate, max_coordinate),
+    vox_nav_utilities::TraversabilityOcTreeNode::ELEVATED_NODE, elevated_voxels);
+  for (auto && voxel : elevated_voxels) {
+    workspace_pcl_->points.push_back(pcl::PointXYZ(voxel.x(), voxel.y(), voxel.z()));
   }
   workspace_pcl_->width = 1;
   workspace_pcl_->height = workspace_pcl_->points.size();
@@ -94,27 +96,22 @@ OctoCellValidStateSampler::OctoCellValidStateSampler(
 bool OctoCellValidStateSampler::sample(ompl::base::State * state)
 {
   auto se3_state = static_cast<ompl::base::SE3StateSpace::StateType *>(state);
+  if (search_area_pcl_->points.empty()) {
+    return false;
+  }
   unsigned int attempts = 0;
   bool valid = false;
   do {
-
-    pcl::PointCloud<pcl::PointXYZ>::Ptr out_sample(new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::RandomSample<pcl::PointXYZ> random_sample(true);
-    random_sample.setInputCloud(search_area_pcl_);
-    random_sample.setSample(1);
-    pcl::Indices indices;
-    random_sample.filter(indices);
-    random_sample.filter(*out_sample);
-
-    se3_state->setXYZ(
-      out_sample->points.front().x,
-      out_sample->points.front().y,
-      out_sample->points.front().z);
+    // pcl::RandomSample reseeds the global std::rand on every call, each sampler draws from
+    // its own generator instead, so samplers of parallel planners do not interfere
+    const auto & point = search_area_pcl_->points[
+      rng_.uniformInt(0, static_cast<int>(search_area_pcl_->points.size()) - 1)];
+    se3_state->setXYZ(point.x, point.y, point.z);
 
     valid = si_->isValid(state);
     ++attempts;
 
-  } while (!valid && attempts < attempts_ && search_area_pcl_->points.size());
+  } while (!valid && attempts < attempts_);
   return valid;
 }
 
@@ -142,21 +139,10 @@ void OctoCellValidStateSampler::updateSearchArea(
   search_area_pcl_ =
     pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>);
 
-  float resolution = 0.2;
-
-  pcl::octree::OctreePointCloudSearch<pcl::PointXYZ> octree(resolution);
-  octree.setInputCloud(workspace_pcl_);
-  octree.addPointsFromInputCloud();
-
-  pcl::PointXYZ searchPoint;
-  searchPoint.x = (goal->get()->getX() + start->get()->getX()) / 2.0;
-  searchPoint.y = (goal->get()->getY() + start->get()->getY()) / 2.0;
-  searchPoint.z = (goal->get()->getZ() + start->get()->getZ()) / 2.0;
-
-  // Neighbors within radius search
-
-  std::vector<int> pointIdxRadiusSearch;
-  std::vector<float> pointRadiusSquaredDistance;
+  octomap::point3d search_point(
+    (goal->get()->getX() + start->get()->getX()) / 2.0,
+    (goal->get()->getY() + start->get()->getY()) / 2.0,
+    (goal->get()->getZ() + start->get()->getZ()) / 2.0);
 
   float radius = std::sqrt(
     std::pow( (goal->get()->getX() - start->get()->getX()), 2) +
@@ -166,16 +152,72 @@ void OctoCellValidStateSampler::updateSearchArea(
 
   std::cout << "Adjusting a search area with radius of: " << radius << std::endl;
 
-  if (octree.radiusSearch(
-      searchPoint, radius, pointIdxRadiusSearch,
-      pointRadiusSquaredDistance) > 0)
-  {
-    for (std::size_t i = 0; i < pointIdxRadiusSearch.size(); ++i) {
-      search_area_pcl_->points.push_back(workspace_pcl_->points[pointIdxRadiusSearch[i]]);
+  // Bounding box of the sphere is collected from the pyramid, then cut down to the sphere
+  std::vector<octomap::point3d> elevated_voxels;
+  const octomap::point3d extent(radius, radius, radius);
+  cost_pyramid_->collectVoxels(
+    search_point - extent, search_point + extent,
+    vox_nav_utilities::TraversabilityOcTreeNode::ELEVATED_NODE, elevated_voxels);
+  for (auto && voxel : elevated_voxels) {
+    if ((voxel - search_point).norm() <= radius) {
+      search_area_pcl_->points.push_back(pcl::PointXYZ(voxel.x(), voxel.y(), voxel.z()));
     }
   }
   std::cout << "Updated search area nodes." << std::endl;
   std::cout << "Search area has nodes: " << search_area_pcl_->points.size() << std::endl;
 }
 
+OccupancyGridMotionValidator::OccupancyGridMotionValidator(
+  const ompl::base::SpaceInformationPtr & si,
+  const std::shared_ptr<vox_nav_utilities::OccupancyBitGrid> & grid)
+: ompl::base::MotionValidator(si),
+  grid_(grid)
+{
+}
+
+size_t OccupancyGridMotionValidator::interpolatePositions(
+  const ompl::base::State * s1, const ompl::base::State * s2,
+  std::vector<double> & xyz) const
+{
+  const auto * from = s1->as<ompl::base::SE3StateSpace::StateType>();
+  const auto * to = s2->as<ompl::base::SE3StateSpace::StateType>();
+  const size_t num_steps = std::max(1u, si_->getStateSpace()->validSegmentCount(s1, s2));
+  xyz.resize(3 * num_steps);
+  for (size_t j = 1; j <= num_steps; j++) {
+    const double t = static_cast<double>(j) / num_steps;
+    xyz[3 * (j - 1)] = from->getX() + (to->getX() - from->getX()) * t;
+    xyz[3 * (j - 1) + 1] = from->getY() + (to->getY() - from->getY()) * t;
+    xyz[3 * (j - 1) + 2] = from->getZ() + (to->getZ() - from->getZ()) * t;
+  }
+  return num_steps;
+}
+
+bool OccupancyGridMotionValidator::checkMotion(
+  const ompl::base::State * s1,
+  const ompl::base::State * s2) const
+{
+  // Reused by all motions checked on this thread
+  thread_local std::vector<double> xyz;
+  const size_t num_steps = interpolatePositions(s1, s2, xyz);
+  return grid_->firstFree(xyz.data(), num_steps) == num_steps;
+}
+
+bool OccupancyGridMotionValidator::checkMotion(
+  const ompl::base::State * s1, const ompl::base::State * s2,
+  std::pair<ompl::base::State *, double> & lastValid) const
+{
+  thread_local std::vector<double> xyz;
+  const size_t num_steps = interpolatePositions(s1, s2, xyz);
+  const size_t first_invalid = grid_->firstFree(xyz.data(), num_steps);
+  if (first_invalid == num_steps) {
+    return true;
+  }
+  // Step first_invalid + 1 is invalid, the one before it is the last valid one
+  lastValid.second = static_cast<double>(first_invalid) / num_steps;
+  if (lastValid.first != nullptr) {
+    si_->getStateSpace()->interpolate(s1, s2, lastValid.second, lastValid.first);
+  }
+  return false;
+}
+
 }  // namespace vox_nav_planning
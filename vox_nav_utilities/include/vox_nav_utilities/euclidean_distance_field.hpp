@@ -0,0 +1,153 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__EUCLIDEAN_DISTANCE_FIELD_HPP_
+#define VOX_NAV_UTILITIES__EUCLIDEAN_DISTANCE_FIELD_HPP_
+
+#include "vox_nav_utilities/occupancy_slice.hpp"
+
+#include <octomap/octomap.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief 2D Euclidean signed distance field over the x, y plane of an octomap.
+ * A cell is an obstacle if any occupied leaf within a z band covers it, so the field answers
+ * collision queries of a robot body moving within that band. Values are distances between
+ * cell centers, exact for the grid (Felzenszwalb & Huttenlocher), positive to the nearest
+ * obstacle cell for free cells and negative to the nearest free cell for obstacle cells.
+ *
+ */
+class EuclideanDistanceField2D
+{
+public:
+  EuclideanDistanceField2D() = default;
+
+  /**
+   * @brief (Re)build field over the box min_x, min_y, max_x, max_y with cells of the tree
+   * resolution. Occupied leaves overlapping z band min_z, max_z are obstacles, see
+   * OccupancySlice2D::build()
+   *
+   * @param tree
+   * @param min_x
+   * @param min_y
+   * @param max_x
+   * @param max_y
+   * @param min_z
+   * @param max_z
+   * @param max_distance distances are clamped to +-max_distance
+   */
+  void build(
+    const octomap::OcTree & tree,
+    double min_x, double min_y, double max_x, double max_y,
+    double min_z, double max_z, double max_distance);
+
+  /**
+   * @brief (Re)build field with the cells of slice, occupied cells are obstacles
+   *
+   * @param slice
+   * @param max_distance distances are clamped to +-max_distance
+   */
+  void build(const OccupancySlice2D & slice, double max_distance);
+
+  /**
+   * @brief signed distance of the cell containing x, y. Points outside of the field are
+   * reported max_distance away from any obstacle, so the field must cover every obstacle
+   * that can be reached.
+   *
+   */
+  inline double distance(double x, double y) const
+  {
+    const double cx = std::floor((x - origin_x_) * inverse_resolution_);
+    const double cy = std::floor((y - origin_y_) * inverse_resolution_);
+    if (!(cx >= 0.0 && cx < size_x_ && cy >= 0.0 && cy < size_y_)) {
+      return max_distance_;
+    }
+    return distances_[static_cast<size_t>(cy) * size_x_ + static_cast<size_t>(cx)];
+  }
+
+  /**
+   * @brief true if the cell containing x, y is an obstacle
+   *
+   */
+  inline bool isObstacle(double x, double y) const {return distance(x, y) < 0.0;}
+
+  /**
+   * @brief lower bound of the distance from any point of the cell containing x, y to any point
+   * of an obstacle cell, negative if the cell is an obstacle
+   *
+   */
+  inline double clearance(double x, double y) const
+  {
+    const double d = distance(x, y);
+    return d < 0.0 ? d : std::max(0.0, d - resolution_ * M_SQRT2);
+  }
+
+  inline double resolution() const {return resolution_;}
+  inline double maxDistance() const {return max_distance_;}
+  inline size_t sizeX() const {return size_x_;}
+  inline size_t sizeY() const {return size_y_;}
+
+  /**
+   * @brief number of obstacle cells
+   *
+   */
+  inline size_t numObstacles() const {return num_obstacles_;}
+
+  /**
+   * @brief true once build() created at least one cell
+   *
+   */
+  inline bool isValid() const {return !distances_.empty();}
+
+private:
+  /**
+   * @brief 1D squared distance transform of n samples of f, read and written with stride.
+   * v, z and d are scratch buffers of at least n, n + 1 and n elements.
+   *
+   */
+  static void distanceTransform1D(
+    float * f, size_t n, size_t stride,
+    int * v, float * z, float * d);
+
+  /**
+   * @brief squared distance to the nearest cell where is_source is true, inf if there is none
+   *
+   */
+  void squaredDistanceTransform(
+    const std::vector<uint8_t> & is_source,
+    std::vector<float> & squared_distances) const;
+
+  double resolution_ {0.0};
+  double inverse_resolution_ {0.0};
+  double origin_x_ {0.0};
+  double origin_y_ {0.0};
+  double max_distance_ {0.0};
+  size_t size_x_ {0};
+  size_t size_y_ {0};
+  size_t num_obstacles_ {0};
+  // row major, size_x_ * size_y_
+  std::vector<float> distances_;
+};
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__EUCLIDEAN_DISTANCE_FIELD_HPP_
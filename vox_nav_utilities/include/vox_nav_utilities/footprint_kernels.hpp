@@ -0,0 +1,101 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__FOOTPRINT_KERNELS_HPP_
+#define VOX_NAV_UTILITIES__FOOTPRINT_KERNELS_HPP_
+
+#include "vox_nav_utilities/occupancy_slice.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief Rasterized masks of a rectangular robot footprint, one per yaw bin, laid out in rows
+ * of 64 bit words like OccupancySlice2D. A mask covers the footprint for every yaw of its bin
+ * and every robot position within the cell the robot is in, so a collision check is the AND
+ * of mask rows against slice rows around that cell, never missing a collision.
+ * How much more than the footprint a mask covers is bounded by maxError().
+ *
+ */
+class YawBinnedFootprintKernels
+{
+public:
+  YawBinnedFootprintKernels() = default;
+
+  /**
+   * @brief (Re)build masks of all yaw bins
+   *
+   * @param length footprint length along heading
+   * @param width footprint width
+   * @param resolution cell size, must be the resolution of slices masks are tested against
+   * @param num_yaw_bins bins split [0, 2pi) evenly
+   */
+  void build(double length, double width, double resolution, int num_yaw_bins);
+
+  /**
+   * @brief true if the mask of yaw at the cell containing x, y hits an occupied cell of slice
+   *
+   */
+  bool collides(const OccupancySlice2D & slice, double x, double y, double yaw) const;
+
+  inline int numYawBins() const {return static_cast<int>(kernels_.size());}
+  inline double binWidth() const {return bin_width_;}
+  inline double resolution() const {return resolution_;}
+
+  /**
+   * @brief upper bound on the distance from any cell of a mask to the footprint it stands for,
+   * grows with the bin width by half the footprint diagonal per radian
+   *
+   */
+  inline double maxError() const {return max_error_;}
+
+  /**
+   * @brief bytes used by masks
+   *
+   */
+  size_t memoryUsage() const;
+
+private:
+  struct Kernel
+  {
+    // cell offset of first row and column relative to the cell of the robot
+    int64_t min_x;
+    int64_t min_y;
+    size_t num_rows;
+    size_t words_per_row;
+    std::vector<uint64_t> words;
+  };
+
+  /**
+   * @brief true if rectangle centered at origin with half extents half_length, half_width,
+   * rotated by yaw intersects axis aligned square centered at x, y
+   *
+   */
+  static bool intersects(
+    double half_length, double half_width, double yaw,
+    double x, double y, double half_size);
+
+  double resolution_ {0.0};
+  double bin_width_ {0.0};
+  double max_error_ {0.0};
+  std::vector<Kernel> kernels_;
+};
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__FOOTPRINT_KERNELS_HPP_
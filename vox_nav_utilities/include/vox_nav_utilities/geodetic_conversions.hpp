@@ -0,0 +1,196 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__GEODETIC_CONVERSIONS_HPP_
+#define VOX_NAV_UTILITIES__GEODETIC_CONVERSIONS_HPP_
+
+#include <tf2/LinearMath/Matrix3x3.h>
+#include <tf2/LinearMath/Quaternion.h>
+#include <tf2/LinearMath/Transform.h>
+#include <tf2/LinearMath/Vector3.h>
+
+namespace vox_nav_utilities
+{
+
+// WGS84 ellipsoid
+constexpr double WGS84_A = 6378137.0;
+constexpr double WGS84_F = 1.0 / 298.257223563;
+
+/**
+ * @brief A point in UTM coordinates, altitude is passed through unchanged
+ *
+ */
+struct UtmPoint
+{
+  double easting {0.0};
+  double northing {0.0};
+  double altitude {0.0};
+  int zone {0};
+  bool is_north {true};
+};
+
+/**
+ * @brief UTM zone of given position, including the Norway and Svalbard exceptions
+ *
+ * @param latitude degrees
+ * @param longitude degrees
+ * @return int in [1, 60]
+ */
+int utmZone(double latitude, double longitude);
+
+/**
+ * @brief WGS84 latitude, longitude to UTM with Krueger's series to 6th order, accurate to
+ *        a few nanometers within a zone and to millimeters several degrees beyond it
+ *
+ * @param latitude degrees
+ * @param longitude degrees
+ * @param altitude
+ * @param zone projected into this zone if in [1, 60], zone of the position otherwise
+ * @return UtmPoint
+ */
+UtmPoint latLonToUtm(double latitude, double longitude, double altitude, int zone = 0);
+
+/**
+ * @brief UTM to WGS84 latitude, longitude, inverse of latLonToUtm
+ *
+ * @param utm
+ * @param latitude degrees
+ * @param longitude degrees
+ * @param altitude
+ */
+void utmToLatLon(const UtmPoint & utm, double & latitude, double & longitude, double & altitude);
+
+/**
+ * @brief WGS84 latitude, longitude, altitude to earth centered earth fixed coordinates
+ *
+ * @param latitude degrees
+ * @param longitude degrees
+ * @param altitude meters above ellipsoid
+ * @return tf2::Vector3
+ */
+tf2::Vector3 geodeticToEcef(double latitude, double longitude, double altitude);
+
+/**
+ * @brief Earth centered earth fixed coordinates to WGS84 latitude, longitude, altitude
+ *
+ * @param ecef
+ * @param latitude degrees
+ * @param longitude degrees
+ * @param altitude meters above ellipsoid
+ */
+void ecefToGeodetic(
+  const tf2::Vector3 & ecef, double & latitude, double & longitude,
+  double & altitude);
+
+/**
+ * @brief East north up frame tangent to the ellipsoid at an origin, exact for any distance
+ *
+ */
+class LocalEnu
+{
+public:
+  /**
+   * @brief Construct a new Local Enu object
+   *
+   * @param latitude degrees
+   * @param longitude degrees
+   * @param altitude
+   */
+  LocalEnu(double latitude, double longitude, double altitude);
+
+  /**
+   * @brief Geodetic position to east, north, up relative to origin
+   *
+   */
+  tf2::Vector3 forward(double latitude, double longitude, double altitude) const;
+
+  /**
+   * @brief East, north, up relative to origin to geodetic position
+   *
+   */
+  void reverse(
+    const tf2::Vector3 & enu, double & latitude, double & longitude,
+    double & altitude) const;
+
+private:
+  tf2::Vector3 origin_ecef_;
+  // rows are east, north and up axes in ecef
+  tf2::Matrix3x3 ecef_to_enu_;
+};
+
+/**
+ * @brief Converts between WGS84 and map frame in process, the same conversion as
+ *        robot_localization's /fromLL and /toLL services. It is seeded once with the utm to map
+ *        transform that navsat_transform_node broadcasts, conversions take well under a
+ *        microsecond afterwards.
+ *
+ */
+class GeodeticConverter
+{
+public:
+  GeodeticConverter() = default;
+
+  /**
+   * @brief Seed with the transform taking utm coordinates into map frame, which is
+   *        tf_buffer.lookupTransform(map_frame, utm_frame, ...)
+   *
+   * @param utm_to_map
+   * @param zone UTM zone navsat_transform_node works in, zone of its datum
+   * @param is_north
+   */
+  void seed(const tf2::Transform & utm_to_map, int zone, bool is_north);
+
+  inline bool isSeeded() const {return is_seeded_;}
+
+  /**
+   * @brief Geodetic position in map frame, the map_point /fromLL would return
+   *
+   */
+  tf2::Vector3 toMap(double latitude, double longitude, double altitude) const;
+
+  /**
+   * @brief Map frame position to geodetic position, what /toLL would return
+   *
+   */
+  void fromMap(
+    const tf2::Vector3 & map_point, double & latitude, double & longitude,
+    double & altitude) const;
+
+private:
+  tf2::Transform utm_to_map_ {tf2::Transform::getIdentity()};
+  tf2::Transform map_to_utm_ {tf2::Transform::getIdentity()};
+  int zone_ {0};
+  bool is_north_ {true};
+  bool is_seeded_ {false};
+};
+
+/**
+ * @brief Transform from a static map to map frame, given map frame position of the static map
+ *        origin as returned by /fromLL or GeodeticConverter::toMap.
+ *        The position is rotated by yaw_offset of navsat_transform_node first,
+ *        since utm and map frames are not rotationally aligned if it is set,
+ *        then the static map is rotated by its own orientation.
+ *
+ * @param map_point
+ * @param yaw_offset
+ * @param static_map_orientation
+ * @return tf2::Transform
+ */
+tf2::Transform staticMapToMapTransform(
+  const tf2::Vector3 & map_point, double yaw_offset,
+  const tf2::Quaternion & static_map_orientation);
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__GEODETIC_CONVERSIONS_HPP_
@@ -0,0 +1,246 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__OCCUPANCY_BIT_GRID_HPP_
+#define VOX_NAV_UTILITIES__OCCUPANCY_BIT_GRID_HPP_
+
+#include "vox_nav_utilities/traversability_octree.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief Occupancy of an octree flattened into blocks of 8x8x8 voxels, one bit per voxel.
+ * Blocks are addressed through a dense index over their bounding box when it is small enough,
+ * through an open addressing hash table otherwise, so sparse maps spanning large areas stay
+ * small. A query is a floor per axis, one block lookup and a bit test.
+ *
+ */
+class OccupancyBitGrid
+{
+public:
+  OccupancyBitGrid() = default;
+
+  /**
+   * @brief Construct from tree, see build()
+   *
+   */
+  OccupancyBitGrid(
+    const TraversabilityOcTree & tree, uint8_t class_bits = 0,
+    size_t max_dense_blocks = size_t(1) << 22);
+
+  /**
+   * @brief (Re)build from occupied leaves of tree, pruned leaves are expanded to all voxels
+   * they cover
+   *
+   * @param tree
+   * @param class_bits if not 0, only leaves with any of these class bits are set
+   * @param max_dense_blocks dense block index is used if the bounding box of blocks has at most
+   * this many blocks, 4 bytes each
+   */
+  void build(
+    const TraversabilityOcTree & tree, uint8_t class_bits = 0,
+    size_t max_dense_blocks = size_t(1) << 22);
+
+  /**
+   * @brief Set or clear voxels of changed leaves from their state in tree, with the class_bits
+   * of the last build(). A voxel that needs a block the index has no room for is not set.
+   *
+   * @param tree tree the grid was built from, with the changes applied
+   * @param keys keys of changed leaves at full depth
+   * @return false if a block could not be added, build() has to be called then
+   */
+  bool update(const TraversabilityOcTree & tree, const std::vector<octomap::OcTreeKey> & keys);
+
+  /**
+   * @brief true if voxel containing x, y, z is set
+   *
+   */
+  inline bool isOccupied(double x, double y, double z) const
+  {
+    const int32_t vx = toVoxel(x);
+    const int32_t vy = toVoxel(y);
+    const int32_t vz = toVoxel(z);
+    const int32_t block = findBlock(vx >> 3, vy >> 3, vz >> 3);
+    return block >= 0 && testBit(blocks_[block], vx, vy, vz);
+  }
+
+  /**
+   * @brief Batch query, occupied[i] is set to 1 if point i is in a set voxel, 0 otherwise.
+   * Consecutive points in the same block, as along a motion, reuse the block lookup.
+   *
+   * @param xyz count points, x, y, z of each one after another
+   * @param count
+   * @param occupied count results
+   * @return size_t number of occupied points
+   */
+  size_t areOccupied(const double * xyz, size_t count, uint8_t * occupied) const;
+
+  /**
+   * @brief index of first point of batch that is not in a set voxel, count if all are
+   *
+   * @param xyz count points, x, y, z of each one after another
+   * @param count
+   * @return size_t
+   */
+  size_t firstFree(const double * xyz, size_t count) const;
+
+  /**
+   * @brief number of set voxels
+   *
+   */
+  inline size_t numVoxels() const {return num_voxels_;}
+
+  /**
+   * @brief number of 8x8x8 blocks with at least one set voxel
+   *
+   */
+  inline size_t numBlocks() const {return blocks_.size();}
+
+  /**
+   * @brief true if blocks are addressed through a dense index
+   *
+   */
+  inline bool isDense() const {return !dense_index_.empty();}
+
+  /**
+   * @brief bytes used by blocks and their index
+   *
+   */
+  size_t memoryUsage() const;
+
+private:
+  struct Block
+  {
+    // bit (x & 7) | (y & 7) << 3 of word z & 7
+    uint64_t words[8];
+  };
+
+  static constexpr uint64_t kEmptySlot = ~uint64_t(0);
+  // well beyond the 2^15 voxels a 16 level octree spans on each side of origin
+  static constexpr double kVoxelLimit = 1 << 20;
+
+  static inline uint64_t packBlockKey(int32_t bx, int32_t by, int32_t bz)
+  {
+    // Block coordinates of a 16 level octree fit into 13 bits, 21 leaves plenty of room
+    return (static_cast<uint64_t>(bx + (1 << 20)) << 42) |
+           (static_cast<uint64_t>(by + (1 << 20)) << 21) |
+           static_cast<uint64_t>(bz + (1 << 20));
+  }
+
+  static inline size_t hashBlockKey(uint64_t key, int shift)
+  {
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> shift);
+  }
+
+  /**
+   * @brief index of block in blocks_, -1 if there is none
+   *
+   */
+  inline int32_t findBlock(int32_t bx, int32_t by, int32_t bz) const
+  {
+    if (!dense_index_.empty()) {
+      const uint32_t dx = static_cast<uint32_t>(bx - block_min_[0]);
+      const uint32_t dy = static_cast<uint32_t>(by - block_min_[1]);
+      const uint32_t dz = static_cast<uint32_t>(bz - block_min_[2]);
+      if (dx >= block_dims_[0] || dy >= block_dims_[1] || dz >= block_dims_[2]) {
+        return -1;
+      }
+      return dense_index_[(static_cast<size_t>(dz) * block_dims_[1] + dy) * block_dims_[0] + dx];
+    }
+    if (hash_keys_.empty()) {
+      return -1;
+    }
+    const uint64_t key = packBlockKey(bx, by, bz);
+    const size_t mask = hash_keys_.size() - 1;
+    for (size_t slot = hashBlockKey(key, hash_shift_); ; slot = (slot + 1) & mask) {
+      if (hash_keys_[slot] == key) {
+        return hash_values_[slot];
+      }
+      if (hash_keys_[slot] == kEmptySlot) {
+        return -1;
+      }
+    }
+  }
+
+  /**
+   * @brief index of block at block coordinates, the block is added if there is none and the
+   * index has room for it
+   *
+   * @return int32_t -1 if the block could not be added
+   */
+  int32_t findOrAddBlock(int32_t bx, int32_t by, int32_t bz);
+
+  /**
+   * @brief voxel coordinate along one axis, coordinates beyond any octree and NaN are mapped
+   * to a voxel that is never set
+   *
+   */
+  inline int32_t toVoxel(double v) const
+  {
+    const double voxel = std::floor(v * inverse_resolution_);
+    return (voxel > -kVoxelLimit && voxel < kVoxelLimit) ?
+           static_cast<int32_t>(voxel) : static_cast<int32_t>(kVoxelLimit);
+  }
+
+  /**
+   * @brief test voxel of point i of a batch, block of previous point is reused if it is the same
+   *
+   */
+  inline bool testBatchPoint(
+    const double * xyz, size_t i, int32_t (& cached_block_coords)[3],
+    int32_t & cached_block) const
+  {
+    const int32_t x = toVoxel(xyz[3 * i]);
+    const int32_t y = toVoxel(xyz[3 * i + 1]);
+    const int32_t z = toVoxel(xyz[3 * i + 2]);
+    if ((x >> 3) != cached_block_coords[0] || (y >> 3) != cached_block_coords[1] ||
+      (z >> 3) != cached_block_coords[2])
+    {
+      cached_block_coords[0] = x >> 3;
+      cached_block_coords[1] = y >> 3;
+      cached_block_coords[2] = z >> 3;
+      cached_block = findBlock(x >> 3, y >> 3, z >> 3);
+    }
+    return cached_block >= 0 && testBit(blocks_[cached_block], x, y, z);
+  }
+
+  static inline bool testBit(const Block & block, int32_t x, int32_t y, int32_t z)
+  {
+    return (block.words[z & 7] >> ((x & 7) | ((y & 7) << 3))) & 1;
+  }
+
+  double resolution_ {0.0};
+  double inverse_resolution_ {0.0};
+  uint8_t class_bits_ {0};
+  size_t num_voxels_ {0};
+  std::vector<Block> blocks_;
+  // dense mode, block index for each block of the bounding box, -1 for empty blocks
+  int32_t block_min_[3] {0, 0, 0};
+  uint32_t block_dims_[3] {0, 0, 0};
+  std::vector<int32_t> dense_index_;
+  // hash mode, power of two slots with linear probing
+  std::vector<uint64_t> hash_keys_;
+  std::vector<int32_t> hash_values_;
+  int hash_shift_ {64};
+};
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__OCCUPANCY_BIT_GRID_HPP_
@@ -0,0 +1,176 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__OCCUPANCY_SLICE_HPP_
+#define VOX_NAV_UTILITIES__OCCUPANCY_SLICE_HPP_
+
+#include <octomap/octomap.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief 2D occupancy of an octomap within a z band, one bit per cell of the tree resolution.
+ * A cell is occupied if any occupied leaf overlapping the band covers it. Rows are packed
+ * into 64 bit words, bit i of word w is cell 64 * w + i, so 64 cells of a row are tested
+ * with one AND.
+ *
+ */
+class OccupancySlice2D
+{
+public:
+  OccupancySlice2D() = default;
+
+  /**
+   * @brief (Re)build slice over the box min_x, min_y, max_x, max_y from occupied leaves
+   * overlapping z band min_z, max_z, pruned leaves mark all cells they cover
+   *
+   * @param tree
+   * @param min_x
+   * @param min_y
+   * @param max_x
+   * @param max_y
+   * @param min_z
+   * @param max_z
+   */
+  void build(
+    const octomap::OcTree & tree,
+    double min_x, double min_y, double max_x, double max_y,
+    double min_z, double max_z);
+
+  /**
+   * @brief Recompute cells within the box min_x, min_y, max_x, max_y from tree, e.g. after
+   * leaves there changed. Uses the z band of the last build(), cells outside the slice are
+   * not added.
+   *
+   * @param tree
+   * @param min_x
+   * @param min_y
+   * @param max_x
+   * @param max_y
+   */
+  void update(
+    const octomap::OcTree & tree,
+    double min_x, double min_y, double max_x, double max_y);
+
+  /**
+   * @brief column of cell containing x, may lie outside of the slice
+   *
+   */
+  inline int64_t toCellX(double x) const
+  {
+    return static_cast<int64_t>(std::floor((x - origin_x_) * inverse_resolution_));
+  }
+
+  /**
+   * @brief row of cell containing y, may lie outside of the slice
+   *
+   */
+  inline int64_t toCellY(double y) const
+  {
+    return static_cast<int64_t>(std::floor((y - origin_y_) * inverse_resolution_));
+  }
+
+  /**
+   * @brief true if cell at column x, row y is occupied, cells outside of the slice are free
+   *
+   */
+  inline bool isCellOccupied(int64_t x, int64_t y) const
+  {
+    return (rowWindow(x, y) & 1) != 0;
+  }
+
+  /**
+   * @brief true if cell containing x, y is occupied
+   *
+   */
+  inline bool isOccupied(double x, double y) const
+  {
+    return isCellOccupied(toCellX(x), toCellY(y));
+  }
+
+  /**
+   * @brief 64 cells of row y starting at column x, bit i is cell x + i.
+   * Cells outside of the slice read as free.
+   *
+   */
+  inline uint64_t rowWindow(int64_t x, int64_t y) const
+  {
+    if (y < 0 || y >= static_cast<int64_t>(size_y_)) {
+      return 0;
+    }
+    const uint64_t * row = &bits_[static_cast<size_t>(y) * words_per_row_];
+    // floor division, so negative columns pick the word on their left
+    const int64_t word = (x >= 0) ? x / 64 : -((-x + 63) / 64);
+    const unsigned int shift = static_cast<unsigned int>(x - word * 64);
+    const uint64_t low = rowWord(row, word);
+    if (shift == 0) {
+      return low;
+    }
+    return (low >> shift) | (rowWord(row, word + 1) << (64 - shift));
+  }
+
+  inline double resolution() const {return resolution_;}
+  inline double originX() const {return origin_x_;}
+  inline double originY() const {return origin_y_;}
+  inline size_t sizeX() const {return size_x_;}
+  inline size_t sizeY() const {return size_y_;}
+
+  /**
+   * @brief number of occupied cells
+   *
+   */
+  inline size_t numOccupied() const {return num_occupied_;}
+
+  /**
+   * @brief true once build() created at least one cell
+   *
+   */
+  inline bool isValid() const {return !bits_.empty();}
+
+private:
+  /**
+   * @brief Set cells covered by occupied leaves overlapping the box bbx_min, bbx_max
+   *
+   */
+  void markLeaves(
+    const octomap::OcTree & tree,
+    const octomap::point3d & bbx_min, const octomap::point3d & bbx_max);
+
+  inline uint64_t rowWord(const uint64_t * row, int64_t word) const
+  {
+    return (word >= 0 && word < static_cast<int64_t>(words_per_row_)) ? row[word] : 0;
+  }
+
+  double resolution_ {0.0};
+  double inverse_resolution_ {0.0};
+  double origin_x_ {0.0};
+  double origin_y_ {0.0};
+  double min_z_ {0.0};
+  double max_z_ {0.0};
+  size_t size_x_ {0};
+  size_t size_y_ {0};
+  size_t words_per_row_ {0};
+  size_t num_occupied_ {0};
+  std::vector<uint64_t> bits_;
+};
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__OCCUPANCY_SLICE_HPP_
@@ -0,0 +1,182 @@
+// Copyright (c) 2020 Fetullah Atas, Norwegian University of Life Sciences
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__PCD_STREAM_READER_HPP_
+#define VOX_NAV_UTILITIES__PCD_STREAM_READER_HPP_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief Header of a PCD file, only what is needed to locate x, y, z and rgb of each point
+ *
+ */
+struct PcdHeader
+{
+  enum class DataType {ASCII, BINARY, BINARY_COMPRESSED};
+
+  struct Field
+  {
+    std::string name;
+    int size;
+    char type;
+    int count;
+    // byte offset within a point for binary data, first token index for ascii data
+    size_t offset;
+    size_t token;
+  };
+
+  std::vector<Field> fields;
+  uint64_t num_points {0};
+  DataType data_type {DataType::ASCII};
+  // bytes per point for binary data
+  size_t point_step {0};
+  // byte offset of the first point in file
+  uint64_t data_offset {0};
+
+  /**
+   * @brief Parse header of filename, returns false if it is not a PCD file this reader can read
+   *
+   * @param filename
+   * @param error optional, set to the reason if false is returned
+   * @return true
+   * @return false
+   */
+  bool read(const std::string & filename, std::string * error = nullptr);
+
+  /**
+   * @brief index of field with given name in fields, -1 if there is none
+   *
+   */
+  int fieldIndex(const std::string & name) const;
+};
+
+/**
+ * @brief Accumulates points into a sparse voxel grid, memory grows with the number of
+ * occupied voxels only. Each voxel yields the centroid and the mean color of its points,
+ * same as pcl::VoxelGrid with the same leaf size.
+ *
+ */
+class VoxelAccumulator
+{
+public:
+  /**
+   * @brief Construct a new Voxel Accumulator object
+   *
+   * @param voxel_size
+   */
+  explicit VoxelAccumulator(double voxel_size);
+
+  /**
+   * @brief add a point, points with non finite coordinates are skipped
+   *
+   */
+  void add(float x, float y, float z, uint32_t rgba);
+
+  /**
+   * @brief add all voxels of other into this one
+   *
+   */
+  void merge(const VoxelAccumulator & other);
+
+  /**
+   * @brief number of occupied voxels
+   *
+   */
+  size_t size() const;
+
+  /**
+   * @brief One point per voxel, sorted by voxel index so output does not depend on
+   * order points were added in
+   *
+   * @return pcl::PointCloud<pcl::PointXYZRGB>::Ptr
+   */
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr toPointCloud() const;
+
+private:
+  struct VoxelKey
+  {
+    int32_t x;
+    int32_t y;
+    int32_t z;
+
+    bool operator==(const VoxelKey & other) const
+    {
+      return x == other.x && y == other.y && z == other.z;
+    }
+  };
+
+  struct VoxelKeyHash
+  {
+    size_t operator()(const VoxelKey & key) const
+    {
+      return (static_cast<size_t>(key.x) * 73856093) ^
+             (static_cast<size_t>(key.y) * 19349663) ^
+             (static_cast<size_t>(key.z) * 83492791);
+    }
+  };
+
+  struct Voxel
+  {
+    double x {0.0};
+    double y {0.0};
+    double z {0.0};
+    uint64_t r {0};
+    uint64_t g {0};
+    uint64_t b {0};
+    uint64_t a {0};
+    uint64_t count {0};
+  };
+
+  double inverse_voxel_size_;
+  std::unordered_map<VoxelKey, Voxel, VoxelKeyHash> voxels_;
+};
+
+/**
+ * @brief Read a PCD file in chunks and voxel downsample it on the fly, the full resolution
+ *        cloud is never resident. ascii and binary files are read by num_threads threads,
+ *        each reading its own chunks of the file into one voxel grid shared by all threads,
+ *        so memory follows the number of output voxels.
+ *        binary_compressed files store each field for all points one after another,
+ *        so they are decompressed as one block and accumulated in parallel from there,
+ *        files whose block exceeds max_compressed_block_size are rejected.
+ *        Fields other than x, y, z and rgb/rgba are skipped.
+ *
+ * @param filename
+ * @param voxel_size if not positive, file is loaded with loadPointcloudFromPcd as it is
+ * @param num_threads 0 uses all cores
+ * @param error optional, set to the I/O or parse error if file could not be read
+ * @param max_compressed_block_size bytes of compressed plus decompressed data a
+ *        binary_compressed file may hold in memory at once
+ * @return pcl::PointCloud<pcl::PointXYZRGB>::Ptr empty cloud if file could not be read
+ */
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr loadDownsampledPointcloudFromPcd(
+  const std::string & filename,
+  double voxel_size,
+  int num_threads = 0,
+  std::string * error = nullptr,
+  uint64_t max_compressed_block_size = static_cast<uint64_t>(2) << 30);
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__PCD_STREAM_READER_HPP_
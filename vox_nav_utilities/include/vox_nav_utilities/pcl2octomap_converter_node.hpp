@@ -34,6 +34,7 @@
 #include "rclcpp/rclcpp.hpp"
 #include "visualization_msgs/msg/marker_array.hpp"
 #include "vox_nav_utilities/pcl_helpers.hpp"
+#include "vox_nav_utilities/pcd_stream_reader.hpp"
 
 
 namespace vox_nav_utilities
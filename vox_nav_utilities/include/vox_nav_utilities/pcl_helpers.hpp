@@ -81,6 +81,53 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr transformCloud(
   pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr inputCloud,
   const Eigen::Affine3f & transformMatrix);
 
+/**
+ * @brief Compose transforms into one, transforms[0] is applied first
+ *
+ * @param transforms
+ * @return Eigen::Affine3f identity if transforms is empty
+ */
+Eigen::Affine3f composeTransforms(const std::vector<Eigen::Affine3f> & transforms);
+
+/**
+ * @brief Transform cloud in place with the composition of transforms, points are visited
+ *        once regardless of the number of transforms. Uses AVX2 where the CPU supports it and
+ *        a scalar loop otherwise, large clouds are split among num_threads threads.
+ *        Only x, y and z are written, colors are kept as they are.
+ *
+ * @param cloud
+ * @param transforms transforms[0] is applied first
+ * @param num_threads 0 uses all cores
+ */
+void transformCloudInPlace(
+  pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+  const std::vector<Eigen::Affine3f> & transforms,
+  int num_threads = 0);
+
+namespace detail
+{
+/**
+ * @brief Scalar kernel of transformCloudInPlace, writes x, y and z of points only.
+ *
+ * @param points
+ * @param numPoints
+ * @param m
+ */
+void transformPointsScalar(
+  pcl::PointXYZRGB * points, size_t numPoints, const Eigen::Matrix4f & m);
+
+/**
+ * @brief AVX2 kernel of transformCloudInPlace, writes x, y and z of points only.
+ *
+ * @param points
+ * @param numPoints
+ * @param m
+ * @return false if the CPU or compiler lacks AVX2 and FMA, points are left untouched then
+ */
+bool transformPointsAvx2(
+  pcl::PointXYZRGB * points, size_t numPoints, const Eigen::Matrix4f & m);
+}  // namespace detail
+
 /**
  * @brief
  *
@@ -125,15 +172,19 @@ Eigen::Matrix3f getRotationMatrix(
   const rclcpp::Logger & node_logger);
 
 /*!
-* Downsample the point cloud using voxel grid method. Implementation is
-* based on the implementation from pcl. The explanation of the algorithm
+* Downsample the point cloud using voxel grid method. Each voxel yields the centroid and
+* the mean color of its points, same as pcl::VoxelGrid. The explanation of the algorithm
 * can be found here:
 * http://pointclouds.org/documentation/tutorials/voxel_grid.php
+* Space is split into slabs that are voxelized in parallel, so unlike pcl::VoxelGrid
+* large extents with small leaf sizes do not overflow the voxel index.
 * @param[in] Input point cloud
+* @param[in] num_threads 0 uses all cores
 * @return Downsampled point cloud
 */
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr downsampleInputCloud(
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud, double downsmaple_leaf_size);
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud, double downsmaple_leaf_size,
+  int num_threads = 0);
 
 /*!
 * Remove outliers from the point cloud. Function is based on
@@ -147,6 +198,28 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr removeOutliersFromInputCloud(
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud, int mean_K, double stddev_thres,
   OutlierRemovalType outlier_removal_type);
 
+/*!
+* Statistical and radius outlier removal fused into one stage, result equals
+* StatisticalOutlierRemoval followed by RadiusOutlierRemoval without keeping the cloud
+* organized. Both filters share one kd-tree and mark a single keep mask. One pass of kNN
+* searches on num_threads threads yields mean distances and the first few neighbours within
+* radius_search, a point is searched again by radius only if those do not settle it.
+* The filtered cloud is the only copy. Non finite points are removed.
+* @param[in] Input point cloud
+* @param[in] mean_K number of neighbours for the mean distance,
+*            statistical stage is skipped if not positive
+* @param[in] stddev_thres points further than mean + stddev_thres * stddev are outliers
+* @param[in] min_neighbors_in_radius points with this many neighbours or less are outliers
+* @param[in] radius_search radius stage is skipped if not positive
+* @param[in] num_threads 0 uses all cores
+* @return Point cloud where outliers have been removed.
+*/
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr removeStatisticalAndRadiusOutliers(
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud,
+  int mean_K, double stddev_thres,
+  int min_neighbors_in_radius, double radius_search,
+  int num_threads = 0);
+
 /**
 * @brief publish clustering objects' in one point cloud
 * @param publisher
@@ -27,6 +27,8 @@
 #include <nav_msgs/msg/path.hpp>
 #include <vox_nav_utilities/tf_helpers.hpp>
 #include <vox_nav_utilities/pcl_helpers.hpp>
+#include <vox_nav_utilities/traversability_octree.hpp>
+#include <vox_nav_utilities/footprint_kernels.hpp>
 // PCL
 #include <pcl/common/common.h>
 #include <pcl/common/transforms.h>
@@ -86,6 +88,8 @@
 #include <vector>
 #include <random>
 #include <map>
+#include <algorithm>
+#include <thread>
 
 namespace vox_nav_utilities
 {
@@ -141,6 +145,8 @@ private:
 
   double octomap_voxel_size_;
   double planner_timeout_;
+  // threads of parallel planners, 0 for all cores
+  int num_threads_;
   // Only used for REEDS or DUBINS
   double min_turning_radius_;
   double goal_tolerance_;
@@ -152,22 +158,28 @@ private:
   bool publish_a_sample_bencmark_;
   std::string sample_bencmark_plans_topic_;
 
-  // We only need to creae a FLC cotomap collision from
-  // octomap once, because this is static map
-  std::once_flag fcl_tree_from_octomap_once_;
-  // global mutex to guard octomap
+  // global mutex to guard octomap and swapping collision models
   std::mutex octomap_mutex_;
 
   GroundRobotPose start_;
   GroundRobotPose goal_;
   geometry_msgs::msg::Vector3 robot_body_dimensions_;
 
+  // Only the geometry of robot body is used, its transform is never set, so states can be
+  // checked from several threads
   std::shared_ptr<fcl::CollisionObject> robot_collision_object_;
   std::shared_ptr<fcl::OcTree> fcl_octree_;
   std::shared_ptr<fcl::CollisionObject> fcl_octree_collision_object_;
 
+  // SE2 states whose footprint mask misses all obstacles of the slice skip FCL
+  bool use_footprint_kernels_;
+  std::shared_ptr<OccupancySlice2D> occupancy_slice_;
+  std::shared_ptr<YawBinnedFootprintKernels> footprint_kernels_;
+
   rclcpp::Subscription<octomap_msgs::msg::Octomap>::SharedPtr octomap_subscriber_;
   octomap_msgs::msg::Octomap::ConstSharedPtr octomap_msg_;
+  // Stamp of the map epoch collision models were built from
+  builtin_interfaces::msg::Time collision_models_stamp_;
   // Publishers for the path
 
   rclcpp::Publisher<visualization_msgs::msg::MarkerArray>::SharedPtr plan_publisher_;
@@ -201,6 +213,13 @@ public:
   */
   void octomapCallback(const octomap_msgs::msg::Octomap::ConstSharedPtr msg);
 
+  /**
+  * @brief Rebuild FCL octree and occupancy slice when the latest octomap belongs to a new
+  * map epoch, then swap them in under octomap_mutex_
+  *
+  */
+  void updateCollisionModels();
+
   /**
   * @brief
   *
@@ -17,6 +17,7 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 #include "rclcpp/rclcpp.hpp"
 #include "tf2_ros/buffer.h"
 #include "geometry_msgs/msg/pose_stamped.hpp"
@@ -57,6 +58,8 @@
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
 #include <octomap/octomap_utils.h>
+#include "vox_nav_utilities/traversability_octree.hpp"
+#include "vox_nav_utilities/portfolio_planner.hpp"
 
 namespace vox_nav_utilities
 {
@@ -65,12 +68,12 @@ namespace vox_nav_utilities
  * @brief Get the Nearst Node to given state object
  *
  * @param state
- * @param color_octomap_octree
+ * @param octomap_octree
  * @return geometry_msgs::msg::PoseStamped
  */
 geometry_msgs::msg::PoseStamped getNearstNode(
   const geometry_msgs::msg::PoseStamped & state,
-  const std::shared_ptr<octomap::ColorOcTree> & color_octomap_octree);
+  const std::shared_ptr<TraversabilityOcTree> & octomap_octree);
 
 /**
  * @brief
@@ -79,12 +82,17 @@ geometry_msgs::msg::PoseStamped getNearstNode(
  * @param selected_planner_name
  * @param si
  * @param logger
+ * @param num_threads threads of parallel planners (CForest, AnytimePathShortening),
+ * 0 for all cores. State validity checking of si must be thread safe for these.
+ * @param portfolio_planner_names planners raced by "Portfolio", each in a thread of its own
  */
 void initializeSelectedPlanner(
   ompl::base::PlannerPtr & planner,
   const std::string & selected_planner_name,
   const ompl::base::SpaceInformationPtr & si,
-  const rclcpp::Logger logger);
+  const rclcpp::Logger logger,
+  int num_threads = 0,
+  const std::vector<std::string> & portfolio_planner_names = std::vector<std::string>());
 
 }  // namespace vox_nav_utilities
 
@@ -0,0 +1,162 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__PORTFOLIO_PLANNER_HPP_
+#define VOX_NAV_UTILITIES__PORTFOLIO_PLANNER_HPP_
+
+#include <ompl/base/Planner.h>
+#include <ompl/base/PlannerData.h>
+#include <rclcpp/time.hpp>
+#include <vox_nav_msgs/msg/planner_portfolio_statistics.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief Races several planners on the same problem, each in a thread of its own.
+ * As soon as one member has an exact solution all members are stopped and that solution is
+ * returned. If the deadline comes first, the cheapest exact solution members report when
+ * stopped is returned, or the approximate solution closest to goal if there is none.
+ * State validity checking of the space information must be thread safe.
+ *
+ */
+class PortfolioPlanner : public ompl::base::Planner
+{
+public:
+  /**
+   * @brief How one member did in the last solve()
+   *
+   */
+  struct MemberResult
+  {
+    std::string name;
+    ompl::base::PlannerStatus status;
+    // seconds from start of solve() to first exact solution, negative if there was none
+    double time_to_exact_solution {-1.0};
+    // cost of best solution of member, infinite if it has none
+    double cost {0.0};
+  };
+
+  /**
+   * @brief Construct a new Portfolio Planner object
+   *
+   * @param si shared by all members
+   */
+  explicit PortfolioPlanner(const ompl::base::SpaceInformationPtr & si);
+
+  /**
+   * @brief Add a member, it has to be allocated for the same space information
+   *
+   * @param planner
+   */
+  void addPlanner(const ompl::base::PlannerPtr & planner);
+
+  /**
+   * @brief Race all members until one has an exact solution or ptc is met
+   *
+   * @param ptc
+   * @return ompl::base::PlannerStatus
+   */
+  ompl::base::PlannerStatus solve(const ompl::base::PlannerTerminationCondition & ptc) override;
+
+  void clear() override;
+
+  /**
+   * @brief Data of the member whose solution was returned last, nothing if there is none
+   *
+   */
+  void getPlannerData(ompl::base::PlannerData & data) const override;
+
+  inline const std::vector<ompl::base::PlannerPtr> & getPlanners() const {return planners_;}
+
+  /**
+   * @brief Member results of the last solve(), in the order members were added
+   *
+   */
+  inline const std::vector<MemberResult> & getLastResults() const {return last_results_;}
+
+  /**
+   * @brief index of the member whose solution was returned last, -1 if there was none
+   *
+   */
+  inline int getLastWinner() const {return last_winner_;}
+
+private:
+  std::vector<ompl::base::PlannerPtr> planners_;
+  std::vector<MemberResult> last_results_;
+  int last_winner_ {-1};
+};
+
+/**
+ * @brief Wins of PortfolioPlanner members accumulated over requests, keyed by planner name
+ *
+ */
+class PortfolioStatistics
+{
+public:
+  struct Entry
+  {
+    // requests whose returned exact solution came from this planner
+    uint32_t wins {0};
+    // requests this planner had an exact solution for
+    uint32_t exact_solutions {0};
+    // sum of times to first exact solution of won requests
+    double win_time_sum {0.0};
+  };
+
+  /**
+   * @brief Count results of the last solve() of planner
+   *
+   * @param planner
+   */
+  void update(const PortfolioPlanner & planner);
+
+  inline const std::map<std::string, Entry> & getEntries() const {return entries_;}
+  inline uint32_t getRequests() const {return requests_;}
+
+  /**
+   * @brief requests without an exact solution from any member
+   *
+   */
+  inline uint32_t getUnsolved() const {return unsolved_;}
+
+  /**
+   * @brief name of the planner that won the last request, empty if it is unsolved
+   *
+   */
+  inline const std::string & getLastWinner() const {return last_winner_;}
+
+  /**
+   * @brief Statistics of all requests as a message, entries are ordered by planner name
+   *
+   * @param stamp
+   * @return vox_nav_msgs::msg::PlannerPortfolioStatistics
+   */
+  vox_nav_msgs::msg::PlannerPortfolioStatistics toMsg(const rclcpp::Time & stamp) const;
+
+private:
+  std::map<std::string, Entry> entries_;
+  uint32_t requests_ {0};
+  uint32_t unsolved_ {0};
+  std::string last_winner_;
+};
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__PORTFOLIO_PLANNER_HPP_
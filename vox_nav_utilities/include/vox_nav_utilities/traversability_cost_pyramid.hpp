@@ -0,0 +1,179 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__TRAVERSABILITY_COST_PYRAMID_HPP_
+#define VOX_NAV_UTILITIES__TRAVERSABILITY_COST_PYRAMID_HPP_
+
+#include "vox_nav_utilities/traversability_octree.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+/**
+ * @brief Traversability statistics of a TraversabilityOcTree at every octree depth above the
+ * finest, kept in one hash map per level next to the tree. A cell of level l covers 2^l voxels
+ * per side. Voxels themselves (level 0) are not stored again, level 1 cells keep the classes
+ * of their 8 voxels instead, and costs of single voxels are read from the tree.
+ * Only cells with occupied voxels exist, so region queries skip empty volumes at the coarsest
+ * level they fit in, and volumes without the queried classes are not descended into either.
+ *
+ */
+class TraversabilityCostPyramid
+{
+public:
+  struct Cell
+  {
+    // max cost and union of classes of occupied voxels, same as inner nodes of the tree
+    uint8_t max_cost {0};
+    uint8_t class_bits {0};
+    // occupied voxels of level 0 under this cell
+    uint64_t num_voxels {0};
+    uint64_t num_traversable {0};
+    // sum of quantized costs of traversable voxels
+    double traversable_cost_sum {0.0};
+    // level 1 only, classes of each of its 8 voxels indexed x + 2 y + 4 z, 0 if unoccupied
+    uint8_t voxel_class_bits[8] {};
+
+    /**
+     * @brief mean cost of traversable voxels in [0, 1], 0 if there are none
+     *
+     */
+    double meanCost() const;
+
+    /**
+     * @brief fraction of occupied voxels that are traversable
+     *
+     */
+    double traversableFraction() const;
+  };
+
+  TraversabilityCostPyramid() = default;
+
+  /**
+   * @brief Construct from tree, see build()
+   *
+   * @param tree
+   */
+  explicit TraversabilityCostPyramid(const TraversabilityOcTree & tree);
+
+  /**
+   * @brief (Re)build all levels from occupied leaves of tree. Pruned leaves are expanded to
+   * all voxels they cover, so inner node costs must be up to date only for the leaves.
+   *
+   * @param tree
+   */
+  void build(const TraversabilityOcTree & tree);
+
+  /**
+   * @brief Recompute cells above changed leaves from their state in tree. The level 1 cell of
+   * each key is read from its 8 voxels in the tree, cells of coarser levels are merged from
+   * their 8 children, so each key costs 8 tree lookups and 8 lookups per level.
+   *
+   * @param tree tree the pyramid was built from, with the changes applied
+   * @param keys keys of changed leaves at full depth
+   */
+  void update(const TraversabilityOcTree & tree, const std::vector<octomap::OcTreeKey> & keys);
+
+  /**
+   * @brief number of levels, tree depth + 1 after build(), 0 before
+   *
+   */
+  inline unsigned int numLevels() const {return static_cast<unsigned int>(levels_.size());}
+
+  /**
+   * @brief edge length of cells at level
+   *
+   */
+  inline double cellSize(unsigned int level) const {return resolution_ * (1u << level);}
+
+  /**
+   * @brief number of cells at level, 0 if level does not exist or is level 0
+   *
+   */
+  size_t numCells(unsigned int level) const;
+
+  /**
+   * @brief number of occupied voxels, summed from the cells of the coarsest level
+   *
+   */
+  size_t numVoxels() const;
+
+  /**
+   * @brief Centers of level 0 voxels within box min, max that have any of class_bits,
+   * coarse cells without any of them are skipped as a whole
+   *
+   * @param min
+   * @param max
+   * @param class_bits
+   * @param centers voxel centers are appended here
+   */
+  void collectVoxels(
+    const octomap::point3d & min, const octomap::point3d & max,
+    uint8_t class_bits, std::vector<octomap::point3d> & centers) const;
+
+private:
+  // inclusive range of level 0 keys
+  struct KeyRange
+  {
+    uint32_t min[3];
+    uint32_t max[3];
+  };
+
+  static inline uint64_t packKey(uint32_t x, uint32_t y, uint32_t z)
+  {
+    return (static_cast<uint64_t>(x) << 32) | (static_cast<uint64_t>(y) << 16) | z;
+  }
+
+  const Cell * findCell(unsigned int level, uint32_t x, uint32_t y, uint32_t z) const;
+
+  void addVoxels(
+    const octomap::OcTreeKey & key, unsigned int level, uint8_t cost,
+    uint8_t class_bits);
+
+  // index of voxel x, y, z within its level 1 cell
+  static inline unsigned int voxelIndex(uint32_t x, uint32_t y, uint32_t z)
+  {
+    return (x & 1) | ((y & 1) << 1) | ((z & 1) << 2);
+  }
+
+  bool toKeyRange(
+    const octomap::point3d & min, const octomap::point3d & max,
+    KeyRange & range) const;
+
+  void collectRecurs(
+    unsigned int level, uint32_t x, uint32_t y, uint32_t z,
+    const KeyRange & range, uint8_t class_bits,
+    std::vector<octomap::point3d> & centers) const;
+
+  // 0 if cell at level with given key lies outside range, 1 if it is crossing its border,
+  // 2 if it lies fully inside
+  static int overlap(
+    unsigned int level, uint32_t x, uint32_t y, uint32_t z,
+    const KeyRange & range);
+
+  double resolution_ {0.0};
+  // key of the finest depth at coordinate 0, same as in the tree
+  uint32_t tree_max_val_ {0};
+  // indexed by level, level 0 is left empty
+  std::vector<std::unordered_map<uint64_t, Cell>> levels_;
+};
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__TRAVERSABILITY_COST_PYRAMID_HPP_
@@ -0,0 +1,293 @@
+// Copyright (c) 2020 Fetullah Atas, Norwegian University of Life Sciences
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef VOX_NAV_UTILITIES__TRAVERSABILITY_OCTREE_HPP_
+#define VOX_NAV_UTILITIES__TRAVERSABILITY_OCTREE_HPP_
+
+#include <octomap/octomap.h>
+#include <octomap/OccupancyOcTreeBase.h>
+#include <octomap_msgs/msg/octomap.hpp>
+#include <builtin_interfaces/msg/time.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+class TraversabilityOcTree;
+
+/**
+ * @brief Octree node that keeps occupancy log-odds untouched and stores traversability next to it,
+ * a cost quantized to uint8 and a few class bits. Cost and class of inner nodes are the
+ * maximum cost and union of classes of their children.
+ *
+ */
+class TraversabilityOcTreeNode : public octomap::OcTreeNode
+{
+public:
+  friend class TraversabilityOcTree;
+
+  static constexpr uint8_t TRAVERSABLE = 1 << 0;
+  static constexpr uint8_t NON_TRAVERSABLE = 1 << 1;
+  static constexpr uint8_t ELEVATED_NODE = 1 << 2;
+
+  TraversabilityOcTreeNode()
+  : octomap::OcTreeNode(), cost_(0), class_bits_(0) {}
+
+  TraversabilityOcTreeNode(const TraversabilityOcTreeNode & rhs)
+  : octomap::OcTreeNode(rhs), cost_(rhs.cost_), class_bits_(rhs.class_bits_) {}
+
+  bool operator==(const TraversabilityOcTreeNode & rhs) const
+  {
+    return rhs.value == value && rhs.cost_ == cost_ && rhs.class_bits_ == class_bits_;
+  }
+
+  void copyData(const TraversabilityOcTreeNode & from)
+  {
+    octomap::OcTreeNode::copyData(from);
+    cost_ = from.cost_;
+    class_bits_ = from.class_bits_;
+  }
+
+  /**
+   * @brief quantized cost, 0 is free to traverse, 255 is the highest cost
+   *
+   */
+  inline uint8_t getCost() const {return cost_;}
+
+  /**
+   * @brief cost scaled back to [0, 1]
+   *
+   */
+  inline double getNormalizedCost() const {return cost_ / 255.0;}
+
+  inline void setCost(uint8_t cost) {cost_ = cost;}
+
+  inline uint8_t getClassBits() const {return class_bits_;}
+
+  inline void setClassBits(uint8_t class_bits) {class_bits_ = class_bits;}
+
+  /**
+   * @brief true if any of given class bits are set on this node
+   *
+   */
+  inline bool hasClass(uint8_t class_bits) const {return (class_bits_ & class_bits) != 0;}
+
+  /**
+   * @brief set cost and class of this inner node from its children
+   *
+   */
+  void updateTraversabilityChildren();
+
+  /**
+   * @brief quantize a cost in [0, 1] to uint8, values outside are clamped
+   *
+   */
+  static uint8_t quantizeCost(double cost);
+
+  std::istream & readData(std::istream & s);
+  std::ostream & writeData(std::ostream & s) const;
+
+protected:
+  uint8_t cost_;
+  uint8_t class_bits_;
+};
+
+/**
+ * @brief Occupancy octree with traversability nodes. It registers itself with
+ * octomap's tree factory under getTreeType(), so octomap_msgs::fullMapToMsg and
+ * octomap_msgs::fullMsgToMap as well as .ot files work with it directly.
+ * Occupancy tells whether a voxel holds map points, as it did when costs were written into
+ * log-odds of a ColorOcTree, where each cost was at or above the occupancy threshold.
+ * It says nothing about traversability: ground with cost 0 is occupied just like a wall,
+ * consumers that look for obstacles have to check cost or class bits as well.
+ * Only voxels carved by ray casting are free.
+ *
+ */
+class TraversabilityOcTree : public octomap::OccupancyOcTreeBase<TraversabilityOcTreeNode>
+{
+public:
+  /**
+   * @brief Construct a new Traversability Oc Tree object
+   *
+   * @param resolution
+   */
+  explicit TraversabilityOcTree(double resolution);
+
+  /**
+   * @brief virtual constructor, creates a new object of same type
+   *
+   */
+  TraversabilityOcTree * create() const {return new TraversabilityOcTree(resolution);}
+
+  std::string getTreeType() const {return "TraversabilityOcTree";}
+
+  /**
+   * @brief nodes are collapsed only when occupancy, cost and class of all children are equal
+   *
+   */
+  bool isNodeCollapsible(const TraversabilityOcTreeNode * node) const override;
+
+  bool pruneNode(TraversabilityOcTreeNode * node) override;
+
+  /**
+   * @brief Mark leaf at key as occupied, i.e. holding map points, and set its traversability.
+   * Cost and class are written before any inner node sees the leaf, so they never end up
+   * in a pruned parent. Nodes are not pruned here.
+   *
+   * @param key
+   * @param cost
+   * @param class_bits
+   * @param lazy_eval if true, inner nodes are left to updateInnerOccupancy(), otherwise the
+   * path from root to key is updated with updateInnerNodes()
+   * @return TraversabilityOcTreeNode*
+   */
+  TraversabilityOcTreeNode * setNodeTraversability(
+    const octomap::OcTreeKey & key,
+    uint8_t cost,
+    uint8_t class_bits,
+    bool lazy_eval = false);
+
+  /**
+   * @brief Same as setNodeTraversability but decodes the cost value used in regressed clouds,
+   * [0, 1] is a traversable cost, 2 is non-traversable and 3 is an elevated node
+   *
+   * @param key
+   * @param cost_value
+   * @param lazy_eval
+   * @return TraversabilityOcTreeNode*
+   */
+  TraversabilityOcTreeNode * setNodeCostValue(
+    const octomap::OcTreeKey & key,
+    double cost_value,
+    bool lazy_eval = false);
+
+  /**
+   * @brief Updates occupancy, cost and class of all inner nodes to reflect their children
+   *
+   */
+  void updateInnerOccupancy();
+
+  /**
+   * @brief Updates occupancy, cost and class of inner nodes on the path from root to key only,
+   * for changes of a few leaves where updateInnerOccupancy() would visit the whole tree
+   *
+   * @param key
+   */
+  void updateInnerNodes(const octomap::OcTreeKey & key);
+
+  /**
+   * @brief Overwrites leaves of this tree with the leaves of an update, such as the deltas
+   * map_server publishes on octomap_updates. Occupied leaves of update are copied with their
+   * traversability, free ones were removed from the map and are deleted here.
+   * Only inner nodes above updated leaves are updated.
+   *
+   * @param update tree of the same resolution, leaves at full depth
+   * @param updated_keys if not nullptr, keys of updated leaves are appended to it
+   * @return size_t number of updated leaves
+   */
+  size_t applyUpdate(
+    const TraversabilityOcTree & update,
+    std::vector<octomap::OcTreeKey> * updated_keys = nullptr);
+
+  /**
+   * @brief Occupancy only copy of this tree with the same resolution,
+   * for consumers that need a plain octomap::OcTree such as fcl::OcTree
+   *
+   * @return std::shared_ptr<octomap::OcTree>
+   */
+  std::shared_ptr<octomap::OcTree> toOccupancyOcTree() const;
+
+protected:
+  void updateInnerOccupancyRecurs(TraversabilityOcTreeNode * node, unsigned int depth);
+
+  /**
+   * @brief Static member object which ensures that this OcTree's prototype
+   * ends up in the classIDMapping only once. You need this as a
+   * static member in any derived octree class in order to read .ot
+   * files through the AbstractOcTree factory.
+   */
+  class StaticMemberInitializer
+  {
+public:
+    StaticMemberInitializer()
+    {
+      TraversabilityOcTree * tree = new TraversabilityOcTree(0.1);
+      tree->clearKeyRays();
+      octomap::AbstractOcTree::registerTreeType(tree);
+    }
+
+    /**
+     * @brief Dummy function to ensure that MSVC does not drop the
+     * StaticMemberInitializer, causing this tree failing to register.
+     */
+    void ensureLinking() {}
+  };
+
+  static StaticMemberInitializer traversability_octree_member_init_;
+};
+
+/**
+ * @brief Deserialize an octomap message into a plain occupancy octree.
+ * TraversabilityOcTree messages are converted with toOccupancyOcTree(), OcTree messages are used
+ * as they are, nullptr is returned for any other tree type.
+ *
+ * @param msg
+ * @return std::shared_ptr<octomap::OcTree>
+ */
+std::shared_ptr<octomap::OcTree> occupancyOcTreeFromMsg(const octomap_msgs::msg::Octomap & msg);
+
+/**
+ * @brief Deserialize a TraversabilityOcTree message and apply updates to it in order,
+ * updates that are not TraversabilityOcTrees of the same resolution are skipped.
+ *
+ * @param msg
+ * @param updates deltas published after msg, e.g. on octomap_updates
+ * @return std::shared_ptr<TraversabilityOcTree> nullptr if msg is not a TraversabilityOcTree
+ */
+std::shared_ptr<TraversabilityOcTree> traversabilityOcTreeFromMsg(
+  const octomap_msgs::msg::Octomap & msg,
+  const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & updates = {});
+
+/**
+ * @brief Apply update messages to tree in order, see TraversabilityOcTree::applyUpdate.
+ * Updates that are not TraversabilityOcTrees of the same resolution are skipped.
+ *
+ * @param tree
+ * @param updates deltas published after the map tree was deserialized from
+ * @param updated_keys if not nullptr, keys of updated leaves are appended to it
+ * @return size_t number of updated leaves
+ */
+size_t applyOctomapUpdates(
+  TraversabilityOcTree & tree,
+  const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & updates,
+  std::vector<octomap::OcTreeKey> * updated_keys = nullptr);
+
+/**
+ * @brief Erase updates stamped at or before stamp, e.g. of a full map that already carries them
+ *
+ * @param updates
+ * @param stamp
+ */
+void eraseOctomapUpdatesUpTo(
+  std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & updates,
+  const builtin_interfaces::msg::Time & stamp);
+
+}  // namespace vox_nav_utilities
+
+#endif  // VOX_NAV_UTILITIES__TRAVERSABILITY_OCTREE_HPP_
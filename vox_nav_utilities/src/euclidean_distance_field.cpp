@@ -0,0 +1,143 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/euclidean_distance_field.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+// Stands in for infinity in squared distances, large enough to never be a real distance
+static constexpr float kFarAway = 1e30f;
+
+void EuclideanDistanceField2D::build(
+  const octomap::OcTree & tree,
+  double min_x, double min_y, double max_x, double max_y,
+  double min_z, double max_z, double max_distance)
+{
+  OccupancySlice2D slice;
+  slice.build(tree, min_x, min_y, max_x, max_y, min_z, max_z);
+  build(slice, max_distance);
+}
+
+void EuclideanDistanceField2D::build(const OccupancySlice2D & slice, double max_distance)
+{
+  resolution_ = slice.resolution();
+  inverse_resolution_ = 1.0 / resolution_;
+  origin_x_ = slice.originX();
+  origin_y_ = slice.originY();
+  size_x_ = slice.sizeX();
+  size_y_ = slice.sizeY();
+  max_distance_ = max_distance;
+  num_obstacles_ = slice.numOccupied();
+  distances_.clear();
+  if (!slice.isValid()) {
+    return;
+  }
+
+  std::vector<uint8_t> is_obstacle(size_x_ * size_y_), is_free(size_x_ * size_y_);
+  for (size_t y = 0; y < size_y_; y++) {
+    for (size_t x = 0; x < size_x_; x++) {
+      is_obstacle[y * size_x_ + x] = slice.isCellOccupied(x, y);
+      is_free[y * size_x_ + x] = !is_obstacle[y * size_x_ + x];
+    }
+  }
+  std::vector<float> to_obstacle, to_free;
+  squaredDistanceTransform(is_obstacle, to_obstacle);
+  squaredDistanceTransform(is_free, to_free);
+
+  distances_.resize(size_x_ * size_y_);
+  for (size_t i = 0; i < distances_.size(); i++) {
+    const double d = is_obstacle[i] ?
+      -std::sqrt(static_cast<double>(to_free[i])) * resolution_ :
+      std::sqrt(static_cast<double>(to_obstacle[i])) * resolution_;
+    distances_[i] = static_cast<float>(std::max(-max_distance_, std::min(max_distance_, d)));
+  }
+}
+
+void EuclideanDistanceField2D::squaredDistanceTransform(
+  const std::vector<uint8_t> & is_source,
+  std::vector<float> & squared_distances) const
+{
+  squared_distances.resize(is_source.size());
+  for (size_t i = 0; i < is_source.size(); i++) {
+    squared_distances[i] = is_source[i] ? 0.0f : kFarAway;
+  }
+  const size_t n = std::max(size_x_, size_y_);
+  std::vector<int> v(n);
+  std::vector<float> z(n + 1), d(n);
+  // Along x for each row, then along y for each column of the row results
+  for (size_t y = 0; y < size_y_; y++) {
+    distanceTransform1D(
+      &squared_distances[y * size_x_], size_x_, 1, v.data(), z.data(), d.data());
+  }
+  for (size_t x = 0; x < size_x_; x++) {
+    distanceTransform1D(&squared_distances[x], size_y_, size_x_, v.data(), z.data(), d.data());
+  }
+}
+
+void EuclideanDistanceField2D::distanceTransform1D(
+  float * f, size_t n, size_t stride,
+  int * v, float * z, float * d)
+{
+  // Lower envelope of parabolas rooted at samples with a finite value
+  int k = -1;
+  for (int q = 0; q < static_cast<int>(n); q++) {
+    const float fq = f[q * stride];
+    if (fq >= kFarAway) {
+      continue;
+    }
+    if (k < 0) {
+      k = 0;
+      v[0] = q;
+      z[0] = -std::numeric_limits<float>::infinity();
+      z[1] = std::numeric_limits<float>::infinity();
+      continue;
+    }
+    float s;
+    while (true) {
+      const int p = v[k];
+      s = ((fq + static_cast<float>(q * q)) - (f[p * stride] + static_cast<float>(p * p))) /
+        static_cast<float>(2 * (q - p));
+      if (s > z[k]) {
+        break;
+      }
+      // z[0] is -inf, so the first parabola is never removed
+      k--;
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = std::numeric_limits<float>::infinity();
+  }
+  if (k < 0) {
+    return;
+  }
+  k = 0;
+  for (int q = 0; q < static_cast<int>(n); q++) {
+    while (z[k + 1] < static_cast<float>(q)) {
+      k++;
+    }
+    const float dq = static_cast<float>(q - v[k]);
+    d[q] = dq * dq + f[v[k] * stride];
+  }
+  for (size_t q = 0; q < n; q++) {
+    f[q * stride] = d[q];
+  }
+}
+
+}  // namespace vox_nav_utilities
@@ -0,0 +1,152 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/footprint_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+void YawBinnedFootprintKernels::build(
+  double length, double width, double resolution,
+  int num_yaw_bins)
+{
+  resolution_ = resolution;
+  num_yaw_bins = std::max(1, num_yaw_bins);
+  bin_width_ = 2.0 * M_PI / num_yaw_bins;
+  kernels_.clear();
+
+  const double radius = std::hypot(0.5 * length, 0.5 * width);
+  // Bins are sampled densely enough that between two samples no footprint point moves more
+  // than half a cell, footprint is inflated by that much at each sample
+  const int num_samples =
+    std::max(1, static_cast<int>(std::ceil(bin_width_ * radius / resolution)));
+  const double inflation = radius * bin_width_ / (2.0 * num_samples);
+  const double half_length = 0.5 * length + inflation;
+  const double half_width = 0.5 * width + inflation;
+  // A robot anywhere within its cell sees a cell i, j through a square of two cells centered
+  // at corner i, j
+  const int64_t reach = static_cast<int64_t>(std::ceil((radius + inflation) / resolution)) + 1;
+  const size_t side = static_cast<size_t>(2 * reach + 1);
+
+  // position within the cell, any yaw within the bin, inflation, rasterization
+  max_error_ = 2.0 * M_SQRT2 * resolution + radius * bin_width_ + inflation;
+
+  std::vector<uint8_t> mask(side * side);
+  for (int bin = 0; bin < num_yaw_bins; bin++) {
+    std::fill(mask.begin(), mask.end(), 0);
+    for (int sample = 0; sample <= num_samples; sample++) {
+      const double yaw = bin_width_ * (bin + static_cast<double>(sample) / num_samples);
+      for (size_t y = 0; y < side; y++) {
+        for (size_t x = 0; x < side; x++) {
+          mask[y * side + x] |= intersects(
+            half_length, half_width, yaw,
+            (static_cast<int64_t>(x) - reach) * resolution,
+            (static_cast<int64_t>(y) - reach) * resolution,
+            resolution);
+        }
+      }
+    }
+
+    // Keep the bounding box of set cells only
+    size_t min_x = side, min_y = side, max_x = 0, max_y = 0;
+    for (size_t y = 0; y < side; y++) {
+      for (size_t x = 0; x < side; x++) {
+        if (mask[y * side + x]) {
+          min_x = std::min(min_x, x);
+          min_y = std::min(min_y, y);
+          max_x = std::max(max_x, x);
+          max_y = std::max(max_y, y);
+        }
+      }
+    }
+    Kernel kernel;
+    kernel.min_x = static_cast<int64_t>(min_x) - reach;
+    kernel.min_y = static_cast<int64_t>(min_y) - reach;
+    kernel.num_rows = max_y - min_y + 1;
+    kernel.words_per_row = (max_x - min_x + 1 + 63) / 64;
+    kernel.words.assign(kernel.num_rows * kernel.words_per_row, 0);
+    for (size_t y = min_y; y <= max_y; y++) {
+      uint64_t * row = &kernel.words[(y - min_y) * kernel.words_per_row];
+      for (size_t x = min_x; x <= max_x; x++) {
+        if (mask[y * side + x]) {
+          row[(x - min_x) >> 6] |= uint64_t(1) << ((x - min_x) & 63);
+        }
+      }
+    }
+    kernels_.push_back(kernel);
+  }
+}
+
+bool YawBinnedFootprintKernels::collides(
+  const OccupancySlice2D & slice, double x, double y,
+  double yaw) const
+{
+  const double bin_coord = std::floor(yaw / bin_width_);
+  if (kernels_.empty() || !std::isfinite(bin_coord)) {
+    return true;
+  }
+  const int64_t num_bins = static_cast<int64_t>(kernels_.size());
+  const Kernel & kernel =
+    kernels_[((static_cast<int64_t>(bin_coord) % num_bins) + num_bins) % num_bins];
+
+  const int64_t first_x = slice.toCellX(x) + kernel.min_x;
+  const int64_t first_y = slice.toCellY(y) + kernel.min_y;
+  const uint64_t * mask = kernel.words.data();
+  for (size_t row = 0; row < kernel.num_rows; row++) {
+    for (size_t word = 0; word < kernel.words_per_row; word++, mask++) {
+      if (*mask & slice.rowWindow(first_x + 64 * word, first_y + row)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t YawBinnedFootprintKernels::memoryUsage() const
+{
+  size_t bytes = 0;
+  for (auto && kernel : kernels_) {
+    bytes += sizeof(Kernel) + kernel.words.size() * sizeof(uint64_t);
+  }
+  return bytes;
+}
+
+bool YawBinnedFootprintKernels::intersects(
+  double half_length, double half_width, double yaw,
+  double x, double y, double half_size)
+{
+  // Separating axis test on the axes of the square and of the rectangle
+  const double c = std::cos(yaw);
+  const double s = std::sin(yaw);
+  const double abs_c = std::fabs(c);
+  const double abs_s = std::fabs(s);
+  if (std::fabs(x) > half_size + half_length * abs_c + half_width * abs_s) {
+    return false;
+  }
+  if (std::fabs(y) > half_size + half_length * abs_s + half_width * abs_c) {
+    return false;
+  }
+  const double square_radius = half_size * (abs_c + abs_s);
+  if (std::fabs(x * c + y * s) > half_length + square_radius) {
+    return false;
+  }
+  return std::fabs(-x * s + y * c) <= half_width + square_radius;
+}
+
+}  // namespace vox_nav_utilities
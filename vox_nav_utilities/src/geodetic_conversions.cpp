@@ -0,0 +1,328 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/geodetic_conversions.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+namespace vox_nav_utilities
+{
+
+namespace
+{
+constexpr double kDegToRad = M_PI / 180.0;
+constexpr double kRadToDeg = 180.0 / M_PI;
+constexpr double kUtmScale = 0.9996;
+constexpr double kUtmFalseEasting = 500000.0;
+constexpr double kUtmFalseNorthingSouth = 10000000.0;
+
+/**
+ * @brief Constants of the transverse Mercator series, computed once from the ellipsoid.
+ * Karney, "Transverse Mercator with an accuracy of a few nanometers", J. Geodesy 85 (2011)
+ *
+ */
+struct TransverseMercator
+{
+  double e;
+  double e2;
+  // rectifying radius times UTM scale
+  double scaled_a;
+  double alpha[6];
+  double beta[6];
+
+  TransverseMercator()
+  {
+    const double f = WGS84_F;
+    e2 = f * (2.0 - f);
+    e = std::sqrt(e2);
+    const double n = f / (2.0 - f);
+    const double n2 = n * n, n3 = n2 * n, n4 = n3 * n, n5 = n4 * n, n6 = n5 * n;
+    scaled_a = kUtmScale * WGS84_A / (1.0 + n) * (1.0 + n2 / 4.0 + n4 / 64.0 + n6 / 256.0);
+    alpha[0] = n / 2.0 - 2.0 * n2 / 3.0 + 5.0 * n3 / 16.0 + 41.0 * n4 / 180.0 -
+      127.0 * n5 / 288.0 + 7891.0 * n6 / 37800.0;
+    alpha[1] = 13.0 * n2 / 48.0 - 3.0 * n3 / 5.0 + 557.0 * n4 / 1440.0 + 281.0 * n5 / 630.0 -
+      1983433.0 * n6 / 1935360.0;
+    alpha[2] = 61.0 * n3 / 240.0 - 103.0 * n4 / 140.0 + 15061.0 * n5 / 26880.0 +
+      167603.0 * n6 / 181440.0;
+    alpha[3] = 49561.0 * n4 / 161280.0 - 179.0 * n5 / 168.0 + 6601661.0 * n6 / 7257600.0;
+    alpha[4] = 34729.0 * n5 / 80640.0 - 3418889.0 * n6 / 1995840.0;
+    alpha[5] = 212378941.0 * n6 / 319334400.0;
+    beta[0] = n / 2.0 - 2.0 * n2 / 3.0 + 37.0 * n3 / 96.0 - n4 / 360.0 - 81.0 * n5 / 512.0 +
+      96199.0 * n6 / 604800.0;
+    beta[1] = n2 / 48.0 + n3 / 15.0 - 437.0 * n4 / 1440.0 + 46.0 * n5 / 105.0 -
+      1118711.0 * n6 / 3870720.0;
+    beta[2] = 17.0 * n3 / 480.0 - 37.0 * n4 / 840.0 - 209.0 * n5 / 4480.0 +
+      5569.0 * n6 / 90720.0;
+    beta[3] = 4397.0 * n4 / 161280.0 - 11.0 * n5 / 504.0 - 830251.0 * n6 / 7257600.0;
+    beta[4] = 4583.0 * n5 / 161280.0 - 108847.0 * n6 / 3991680.0;
+    beta[5] = 20648693.0 * n6 / 638668800.0;
+  }
+};
+
+const TransverseMercator & transverseMercator()
+{
+  static const TransverseMercator tm;
+  return tm;
+}
+
+/**
+ * @brief sum of coefficients[j] * sin(2 (j + 1) zeta), sines of multiples are found with the
+ * Chebyshev recurrence, so only one complex sine and cosine are evaluated
+ *
+ */
+std::complex<double> sumOfSines(const double (& coefficients)[6], std::complex<double> zeta)
+{
+  const std::complex<double> two_cos = 2.0 * std::cos(2.0 * zeta);
+  std::complex<double> previous(0.0, 0.0);
+  std::complex<double> current = std::sin(2.0 * zeta);
+  std::complex<double> sum = coefficients[0] * current;
+  for (int j = 1; j < 6; j++) {
+    const std::complex<double> next = two_cos * current - previous;
+    previous = current;
+    current = next;
+    sum += coefficients[j] * current;
+  }
+  return sum;
+}
+
+double centralMeridian(int zone)
+{
+  return (zone * 6.0 - 183.0) * kDegToRad;
+}
+}  // namespace
+
+int utmZone(double latitude, double longitude)
+{
+  // Normalize to [-180, 180)
+  longitude = longitude - 360.0 * std::floor((longitude + 180.0) / 360.0);
+  int zone = static_cast<int>(std::floor((longitude + 180.0) / 6.0)) + 1;
+  if (latitude >= 56.0 && latitude < 64.0 && longitude >= 3.0 && longitude < 12.0) {
+    zone = 32;
+  }
+  if (latitude >= 72.0 && latitude < 84.0) {
+    if (longitude >= 0.0 && longitude < 9.0) {
+      zone = 31;
+    } else if (longitude >= 9.0 && longitude < 21.0) {
+      zone = 33;
+    } else if (longitude >= 21.0 && longitude < 33.0) {
+      zone = 35;
+    } else if (longitude >= 33.0 && longitude < 42.0) {
+      zone = 37;
+    }
+  }
+  return std::min(std::max(zone, 1), 60);
+}
+
+UtmPoint latLonToUtm(double latitude, double longitude, double altitude, int zone)
+{
+  const auto & tm = transverseMercator();
+  UtmPoint utm;
+  utm.zone = zone >= 1 && zone <= 60 ? zone : utmZone(latitude, longitude);
+  utm.is_north = latitude >= 0.0;
+  utm.altitude = altitude;
+
+  const double phi = latitude * kDegToRad;
+  double lambda = longitude * kDegToRad - centralMeridian(utm.zone);
+  lambda = std::remainder(lambda, 2.0 * M_PI);
+
+  // Conformal latitude
+  const double sin_phi = std::sin(phi);
+  const double tau = std::tan(phi);
+  const double sigma = std::sinh(tm.e * std::atanh(tm.e * sin_phi));
+  const double tau_prime =
+    tau * std::sqrt(1.0 + sigma * sigma) - sigma * std::sqrt(1.0 + tau * tau);
+
+  const double xi_prime = std::atan2(tau_prime, std::cos(lambda));
+  const double eta_prime = std::asinh(
+    std::sin(lambda) / std::sqrt(tau_prime * tau_prime + std::cos(lambda) * std::cos(lambda)));
+  const std::complex<double> zeta_prime(xi_prime, eta_prime);
+  const std::complex<double> zeta = zeta_prime + sumOfSines(tm.alpha, zeta_prime);
+
+  utm.easting = kUtmFalseEasting + tm.scaled_a * zeta.imag();
+  utm.northing = tm.scaled_a * zeta.real() + (utm.is_north ? 0.0 : kUtmFalseNorthingSouth);
+  return utm;
+}
+
+void utmToLatLon(const UtmPoint & utm, double & latitude, double & longitude, double & altitude)
+{
+  const auto & tm = transverseMercator();
+  const double northing = utm.northing - (utm.is_north ? 0.0 : kUtmFalseNorthingSouth);
+  const std::complex<double> zeta(
+    northing / tm.scaled_a, (utm.easting - kUtmFalseEasting) / tm.scaled_a);
+  const std::complex<double> zeta_prime = zeta - sumOfSines(tm.beta, zeta);
+  const double xi_prime = zeta_prime.real();
+  const double eta_prime = zeta_prime.imag();
+
+  const double sinh_eta = std::sinh(eta_prime);
+  const double cos_xi = std::cos(xi_prime);
+  const double tau_prime = std::sin(xi_prime) / std::hypot(sinh_eta, cos_xi);
+  const double lambda = std::atan2(sinh_eta, cos_xi);
+
+  // Newton's method for tan of latitude from tan of conformal latitude,
+  // converges in two or three iterations
+  double tau = tau_prime;
+  for (int i = 0; i < 5; i++) {
+    const double sqrt_tau = std::sqrt(1.0 + tau * tau);
+    const double sigma = std::sinh(tm.e * std::atanh(tm.e * tau / sqrt_tau));
+    const double tau_i = tau * std::sqrt(1.0 + sigma * sigma) - sigma * sqrt_tau;
+    const double delta = (tau_prime - tau_i) / std::sqrt(1.0 + tau_i * tau_i) *
+      (1.0 + (1.0 - tm.e2) * tau * tau) / ((1.0 - tm.e2) * sqrt_tau);
+    tau += delta;
+    if (std::abs(delta) < 1e-12) {
+      break;
+    }
+  }
+
+  latitude = std::atan(tau) * kRadToDeg;
+  longitude = std::remainder(lambda + centralMeridian(utm.zone), 2.0 * M_PI) * kRadToDeg;
+  altitude = utm.altitude;
+}
+
+tf2::Vector3 geodeticToEcef(double latitude, double longitude, double altitude)
+{
+  const double e2 = WGS84_F * (2.0 - WGS84_F);
+  const double phi = latitude * kDegToRad;
+  const double lambda = longitude * kDegToRad;
+  const double sin_phi = std::sin(phi);
+  const double cos_phi = std::cos(phi);
+  // prime vertical radius of curvature
+  const double n = WGS84_A / std::sqrt(1.0 - e2 * sin_phi * sin_phi);
+  return tf2::Vector3(
+    (n + altitude) * cos_phi * std::cos(lambda),
+    (n + altitude) * cos_phi * std::sin(lambda),
+    (n * (1.0 - e2) + altitude) * sin_phi);
+}
+
+void ecefToGeodetic(
+  const tf2::Vector3 & ecef, double & latitude, double & longitude,
+  double & altitude)
+{
+  const double e2 = WGS84_F * (2.0 - WGS84_F);
+  const double b = WGS84_A * (1.0 - WGS84_F);
+  const double ep2 = e2 / (1.0 - e2);
+  const double x = ecef.x(), y = ecef.y(), z = ecef.z();
+  const double p = std::hypot(x, y);
+
+  // Bowring's initial guess, then a few fixed point iterations for sub millimeter accuracy
+  double phi = std::atan2(z * WGS84_A, p * b);
+  phi = std::atan2(
+    z + ep2 * b * std::pow(std::sin(phi), 3), p - e2 * WGS84_A * std::pow(std::cos(phi), 3));
+  for (int i = 0; i < 3; i++) {
+    const double sin_phi = std::sin(phi);
+    const double n = WGS84_A / std::sqrt(1.0 - e2 * sin_phi * sin_phi);
+    phi = std::atan2(z + e2 * n * sin_phi, p);
+  }
+  const double sin_phi = std::sin(phi);
+  const double cos_phi = std::cos(phi);
+  const double n = WGS84_A / std::sqrt(1.0 - e2 * sin_phi * sin_phi);
+  // Height from whichever of p and z is better conditioned
+  altitude = std::abs(cos_phi) > 1e-3 ?
+    p / cos_phi - n :
+    z / sin_phi - n * (1.0 - e2);
+  latitude = phi * kRadToDeg;
+  longitude = std::atan2(y, x) * kRadToDeg;
+}
+
+LocalEnu::LocalEnu(double latitude, double longitude, double altitude)
+{
+  origin_ecef_ = geodeticToEcef(latitude, longitude, altitude);
+  const double phi = latitude * kDegToRad;
+  const double lambda = longitude * kDegToRad;
+  const double sin_phi = std::sin(phi), cos_phi = std::cos(phi);
+  const double sin_lambda = std::sin(lambda), cos_lambda = std::cos(lambda);
+  ecef_to_enu_.setValue(
+    -sin_lambda, cos_lambda, 0.0,
+    -sin_phi * cos_lambda, -sin_phi * sin_lambda, cos_phi,
+    cos_phi * cos_lambda, cos_phi * sin_lambda, sin_phi);
+}
+
+tf2::Vector3 LocalEnu::forward(double latitude, double longitude, double altitude) const
+{
+  return ecef_to_enu_ * (geodeticToEcef(latitude, longitude, altitude) - origin_ecef_);
+}
+
+void LocalEnu::reverse(
+  const tf2::Vector3 & enu, double & latitude, double & longitude,
+  double & altitude) const
+{
+  ecefToGeodetic(ecef_to_enu_.transpose() * enu + origin_ecef_, latitude, longitude, altitude);
+}
+
+void GeodeticConverter::seed(const tf2::Transform & utm_to_map, int zone, bool is_north)
+{
+  utm_to_map_ = utm_to_map;
+  map_to_utm_ = utm_to_map.inverse();
+  zone_ = zone;
+  is_north_ = is_north;
+  is_seeded_ = true;
+}
+
+tf2::Vector3 GeodeticConverter::toMap(double latitude, double longitude, double altitude) const
+{
+  const UtmPoint utm = latLonToUtm(latitude, longitude, altitude, zone_);
+  // Southern points are kept in the hemisphere of the seed, so northing stays continuous
+  const double northing = utm.northing +
+    (utm.is_north == is_north_ ? 0.0 : (is_north_ ? -kUtmFalseNorthingSouth :
+    kUtmFalseNorthingSouth));
+  return utm_to_map_ * tf2::Vector3(utm.easting, northing, utm.altitude);
+}
+
+void GeodeticConverter::fromMap(
+  const tf2::Vector3 & map_point, double & latitude, double & longitude,
+  double & altitude) const
+{
+  const tf2::Vector3 utm_position = map_to_utm_ * map_point;
+  UtmPoint utm;
+  utm.easting = utm_position.x();
+  utm.northing = utm_position.y();
+  utm.altitude = utm_position.z();
+  utm.zone = zone_;
+  utm.is_north = is_north_;
+  utmToLatLon(utm, latitude, longitude, altitude);
+}
+
+tf2::Transform staticMapToMapTransform(
+  const tf2::Vector3 & map_point, double yaw_offset,
+  const tf2::Quaternion & static_map_orientation)
+{
+  // "/fromLL" service only accounts for translational transform
+  // we still need to rotate the points according to yaw_offset
+  // yaw_offset determines rotation between utm and map frame
+  // Normally utm and map frmaes are aligned rotationally, but if there is yaw_offset set in
+  // navsat_transfrom_node we have to account for that yaw_offset here as well
+  // use classic rotation formula https://en.wikipedia.org/wiki/Rotation_matrix#In_two_dimensions;
+  // The rotation only happens in x and y since it is round the z axis(yaw)
+  const double x = map_point.x();
+  const double y = map_point.y();
+  const double x_dot = x * std::cos(yaw_offset) - y * std::sin(yaw_offset);
+  const double y_dot = x * std::sin(yaw_offset) + y * std::cos(yaw_offset);
+
+  // The translation from static_map origin to map is basically inverse of this transform
+  tf2::Transform static_map_translation;
+  static_map_translation.setOrigin(tf2::Vector3(x_dot, y_dot, map_point.z()));
+  // this is identity because map and utm frames are rotationally aligned
+  static_map_translation.setRotation(tf2::Quaternion::getIdentity());
+
+  // First align the static map origin to map in translation
+  // and then rotate the static map with its correct rotation
+  tf2::Transform static_map_rotation;
+  static_map_rotation.setOrigin(tf2::Vector3(0, 0, 0));
+  static_map_rotation.setRotation(static_map_orientation);
+
+  return static_map_rotation * static_map_translation.inverse();
+}
+
+}  // namespace vox_nav_utilities
@@ -0,0 +1,238 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/occupancy_bit_grid.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+OccupancyBitGrid::OccupancyBitGrid(
+  const TraversabilityOcTree & tree, uint8_t class_bits,
+  size_t max_dense_blocks)
+{
+  build(tree, class_bits, max_dense_blocks);
+}
+
+void OccupancyBitGrid::build(
+  const TraversabilityOcTree & tree, uint8_t class_bits,
+  size_t max_dense_blocks)
+{
+  resolution_ = tree.getResolution();
+  inverse_resolution_ = 1.0 / resolution_;
+  class_bits_ = class_bits;
+  num_voxels_ = 0;
+  blocks_.clear();
+  dense_index_.clear();
+  hash_keys_.clear();
+  hash_values_.clear();
+
+  // Blocks are collected in a std::unordered_map first, the final index is chosen once
+  // the bounding box of blocks is known
+  std::unordered_map<uint64_t, int32_t> block_of_key;
+  int32_t block_min[3] = {
+    std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max(),
+    std::numeric_limits<int32_t>::max()};
+  int32_t block_max[3] = {
+    std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min(),
+    std::numeric_limits<int32_t>::min()};
+
+  auto set_voxel = [&](int32_t x, int32_t y, int32_t z) {
+      const int32_t block_coords[3] = {x >> 3, y >> 3, z >> 3};
+      auto inserted = block_of_key.emplace(
+        packBlockKey(block_coords[0], block_coords[1], block_coords[2]),
+        static_cast<int32_t>(blocks_.size()));
+      if (inserted.second) {
+        blocks_.push_back(Block{{0, 0, 0, 0, 0, 0, 0, 0}});
+        for (int i = 0; i < 3; i++) {
+          block_min[i] = std::min(block_min[i], block_coords[i]);
+          block_max[i] = std::max(block_max[i], block_coords[i]);
+        }
+      }
+      uint64_t & word = blocks_[inserted.first->second].words[z & 7];
+      const uint64_t bit = uint64_t(1) << ((x & 7) | ((y & 7) << 3));
+      num_voxels_ += (word & bit) ? 0 : 1;
+      word |= bit;
+    };
+
+  const int32_t key_of_origin = tree.coordToKey(0.0);
+  const unsigned int tree_depth = tree.getTreeDepth();
+  for (auto it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it) {
+    if (!tree.isNodeOccupied(*it) || (class_bits && !it->hasClass(class_bits))) {
+      continue;
+    }
+    const octomap::OcTreeKey index_key = it.getIndexKey();
+    const int32_t voxels_per_side = 1 << (tree_depth - it.getDepth());
+    for (int32_t dx = 0; dx < voxels_per_side; dx++) {
+      for (int32_t dy = 0; dy < voxels_per_side; dy++) {
+        for (int32_t dz = 0; dz < voxels_per_side; dz++) {
+          set_voxel(
+            index_key[0] - key_of_origin + dx,
+            index_key[1] - key_of_origin + dy,
+            index_key[2] - key_of_origin + dz);
+        }
+      }
+    }
+  }
+  if (blocks_.empty()) {
+    return;
+  }
+
+  size_t num_dense_blocks = 1;
+  for (int i = 0; i < 3; i++) {
+    block_dims_[i] = static_cast<uint32_t>(block_max[i] - block_min[i] + 1);
+    block_min_[i] = block_min[i];
+    num_dense_blocks *= block_dims_[i];
+  }
+
+  if (num_dense_blocks <= max_dense_blocks) {
+    dense_index_.assign(num_dense_blocks, -1);
+    for (auto && block : block_of_key) {
+      const int32_t bx = static_cast<int32_t>((block.first >> 42) & 0x1FFFFF) - (1 << 20);
+      const int32_t by = static_cast<int32_t>((block.first >> 21) & 0x1FFFFF) - (1 << 20);
+      const int32_t bz = static_cast<int32_t>(block.first & 0x1FFFFF) - (1 << 20);
+      dense_index_[
+        (static_cast<size_t>(bz - block_min_[2]) * block_dims_[1] + (by - block_min_[1])) *
+        block_dims_[0] + (bx - block_min_[0])] = block.second;
+    }
+    return;
+  }
+
+  // At most half of the slots are used, so probe sequences stay short
+  size_t num_slots = 2;
+  int num_bits = 1;
+  while (num_slots < 2 * blocks_.size()) {
+    num_slots <<= 1;
+    num_bits++;
+  }
+  hash_shift_ = 64 - num_bits;
+  hash_keys_.assign(num_slots, kEmptySlot);
+  hash_values_.assign(num_slots, -1);
+  const size_t mask = num_slots - 1;
+  for (auto && block : block_of_key) {
+    size_t slot = hashBlockKey(block.first, hash_shift_);
+    while (hash_keys_[slot] != kEmptySlot) {
+      slot = (slot + 1) & mask;
+    }
+    hash_keys_[slot] = block.first;
+    hash_values_[slot] = block.second;
+  }
+}
+
+bool OccupancyBitGrid::update(
+  const TraversabilityOcTree & tree, const std::vector<octomap::OcTreeKey> & keys)
+{
+  const int32_t key_of_origin = tree.coordToKey(0.0);
+  bool is_complete = true;
+  for (auto && key : keys) {
+    const int32_t x = key[0] - key_of_origin;
+    const int32_t y = key[1] - key_of_origin;
+    const int32_t z = key[2] - key_of_origin;
+    auto node = tree.search(key);
+    const bool is_set = node && tree.isNodeOccupied(node) &&
+      (!class_bits_ || node->hasClass(class_bits_));
+    const uint64_t bit = uint64_t(1) << ((x & 7) | ((y & 7) << 3));
+    if (!is_set) {
+      // Emptied blocks are kept, they are dropped by the next build()
+      const int32_t block = findBlock(x >> 3, y >> 3, z >> 3);
+      if (block >= 0 && (blocks_[block].words[z & 7] & bit)) {
+        blocks_[block].words[z & 7] &= ~bit;
+        num_voxels_--;
+      }
+      continue;
+    }
+    const int32_t block = findOrAddBlock(x >> 3, y >> 3, z >> 3);
+    if (block < 0) {
+      is_complete = false;
+      continue;
+    }
+    uint64_t & word = blocks_[block].words[z & 7];
+    num_voxels_ += (word & bit) ? 0 : 1;
+    word |= bit;
+  }
+  return is_complete;
+}
+
+int32_t OccupancyBitGrid::findOrAddBlock(int32_t bx, int32_t by, int32_t bz)
+{
+  const int32_t block = findBlock(bx, by, bz);
+  if (block >= 0) {
+    return block;
+  }
+  const int32_t new_block = static_cast<int32_t>(blocks_.size());
+  if (!dense_index_.empty()) {
+    // Dense index covers the bounding box of the last build() only
+    const uint32_t dx = static_cast<uint32_t>(bx - block_min_[0]);
+    const uint32_t dy = static_cast<uint32_t>(by - block_min_[1]);
+    const uint32_t dz = static_cast<uint32_t>(bz - block_min_[2]);
+    if (dx >= block_dims_[0] || dy >= block_dims_[1] || dz >= block_dims_[2]) {
+      return -1;
+    }
+    dense_index_[(static_cast<size_t>(dz) * block_dims_[1] + dy) * block_dims_[0] + dx] =
+      new_block;
+  } else {
+    // Keep at most half of the slots used, as build() does
+    if (hash_keys_.empty() || 2 * (blocks_.size() + 1) > hash_keys_.size()) {
+      return -1;
+    }
+    const uint64_t key = packBlockKey(bx, by, bz);
+    const size_t mask = hash_keys_.size() - 1;
+    size_t slot = hashBlockKey(key, hash_shift_);
+    while (hash_keys_[slot] != kEmptySlot) {
+      slot = (slot + 1) & mask;
+    }
+    hash_keys_[slot] = key;
+    hash_values_[slot] = new_block;
+  }
+  blocks_.push_back(Block{{0, 0, 0, 0, 0, 0, 0, 0}});
+  return new_block;
+}
+
+size_t OccupancyBitGrid::areOccupied(
+  const double * xyz, size_t count,
+  uint8_t * occupied) const
+{
+  size_t num_occupied = 0;
+  int32_t cached_block_coords[3] = {std::numeric_limits<int32_t>::min(), 0, 0};
+  int32_t cached_block = -1;
+  for (size_t i = 0; i < count; i++) {
+    occupied[i] = testBatchPoint(xyz, i, cached_block_coords, cached_block);
+    num_occupied += occupied[i];
+  }
+  return num_occupied;
+}
+
+size_t OccupancyBitGrid::firstFree(const double * xyz, size_t count) const
+{
+  int32_t cached_block_coords[3] = {std::numeric_limits<int32_t>::min(), 0, 0};
+  int32_t cached_block = -1;
+  for (size_t i = 0; i < count; i++) {
+    if (!testBatchPoint(xyz, i, cached_block_coords, cached_block)) {
+      return i;
+    }
+  }
+  return count;
+}
+
+size_t OccupancyBitGrid::memoryUsage() const
+{
+  return blocks_.size() * sizeof(Block) + dense_index_.size() * sizeof(int32_t) +
+         hash_keys_.size() * (sizeof(uint64_t) + sizeof(int32_t));
+}
+
+}  // namespace vox_nav_utilities
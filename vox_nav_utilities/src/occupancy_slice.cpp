@@ -0,0 +1,118 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/occupancy_slice.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+void OccupancySlice2D::build(
+  const octomap::OcTree & tree,
+  double min_x, double min_y, double max_x, double max_y,
+  double min_z, double max_z)
+{
+  resolution_ = tree.getResolution();
+  inverse_resolution_ = 1.0 / resolution_;
+  num_occupied_ = 0;
+  bits_.clear();
+  size_x_ = size_y_ = words_per_row_ = 0;
+  min_z_ = min_z;
+  max_z_ = max_z;
+  if (!(max_x > min_x && max_y > min_y)) {
+    return;
+  }
+  // Cell borders are aligned with voxel borders of the tree
+  origin_x_ = std::floor(min_x * inverse_resolution_) * resolution_;
+  origin_y_ = std::floor(min_y * inverse_resolution_) * resolution_;
+  size_x_ = static_cast<size_t>(std::ceil((max_x - origin_x_) * inverse_resolution_));
+  size_y_ = static_cast<size_t>(std::ceil((max_y - origin_y_) * inverse_resolution_));
+  words_per_row_ = (size_x_ + 63) / 64;
+  bits_.assign(words_per_row_ * size_y_, 0);
+
+  const octomap::point3d bbx_min(min_x, min_y, min_z);
+  const octomap::point3d bbx_max(max_x, max_y, max_z);
+  markLeaves(tree, bbx_min, bbx_max);
+}
+
+void OccupancySlice2D::update(
+  const octomap::OcTree & tree,
+  double min_x, double min_y, double max_x, double max_y)
+{
+  if (!isValid()) {
+    return;
+  }
+  const int64_t cell_min_x = std::max<int64_t>(0, toCellX(min_x));
+  const int64_t cell_min_y = std::max<int64_t>(0, toCellY(min_y));
+  const int64_t cell_max_x = std::min<int64_t>(size_x_ - 1, toCellX(max_x));
+  const int64_t cell_max_y = std::min<int64_t>(size_y_ - 1, toCellY(max_y));
+  if (cell_min_x > cell_max_x || cell_min_y > cell_max_y) {
+    return;
+  }
+  for (int64_t y = cell_min_y; y <= cell_max_y; y++) {
+    uint64_t * row = &bits_[static_cast<size_t>(y) * words_per_row_];
+    for (int64_t x = cell_min_x; x <= cell_max_x; x++) {
+      const uint64_t bit = uint64_t(1) << (x & 63);
+      num_occupied_ -= (row[x >> 6] & bit) ? 1 : 0;
+      row[x >> 6] &= ~bit;
+    }
+  }
+  // Leaves are looked up over the cleared cells only, larger leaves around them set the
+  // cells they already had set
+  const octomap::point3d bbx_min(
+    origin_x_ + cell_min_x * resolution_, origin_y_ + cell_min_y * resolution_, min_z_);
+  const octomap::point3d bbx_max(
+    origin_x_ + (cell_max_x + 1) * resolution_ - 1e-3 * resolution_,
+    origin_y_ + (cell_max_y + 1) * resolution_ - 1e-3 * resolution_, max_z_);
+  markLeaves(tree, bbx_min, bbx_max);
+}
+
+void OccupancySlice2D::markLeaves(
+  const octomap::OcTree & tree,
+  const octomap::point3d & bbx_min, const octomap::point3d & bbx_max)
+{
+  for (auto it = tree.begin_leafs_bbx(bbx_min, bbx_max), end = tree.end_leafs_bbx();
+    it != end; ++it)
+  {
+    if (!tree.isNodeOccupied(*it)) {
+      continue;
+    }
+    // A pruned leaf covers several cells, half a voxel inwards keeps borders out of rounding
+    const double half_size = 0.5 * it.getSize();
+    const double inset = 0.5 * resolution_;
+    const double low_x = (it.getX() - half_size + inset - origin_x_) * inverse_resolution_;
+    const double high_x = (it.getX() + half_size - inset - origin_x_) * inverse_resolution_;
+    const double low_y = (it.getY() - half_size + inset - origin_y_) * inverse_resolution_;
+    const double high_y = (it.getY() + half_size - inset - origin_y_) * inverse_resolution_;
+    const size_t cell_min_x = static_cast<size_t>(std::max(0.0, std::floor(low_x)));
+    const size_t cell_min_y = static_cast<size_t>(std::max(0.0, std::floor(low_y)));
+    const double last_x = std::min(std::floor(high_x), static_cast<double>(size_x_) - 1.0);
+    const double last_y = std::min(std::floor(high_y), static_cast<double>(size_y_) - 1.0);
+    if (last_x < 0.0 || last_y < 0.0) {
+      continue;
+    }
+    for (size_t y = cell_min_y; y <= static_cast<size_t>(last_y); y++) {
+      uint64_t * row = &bits_[y * words_per_row_];
+      for (size_t x = cell_min_x; x <= static_cast<size_t>(last_x); x++) {
+        const uint64_t bit = uint64_t(1) << (x & 63);
+        num_occupied_ += (row[x >> 6] & bit) ? 0 : 1;
+        row[x >> 6] |= bit;
+      }
+    }
+  }
+}
+
+}  // namespace vox_nav_utilities
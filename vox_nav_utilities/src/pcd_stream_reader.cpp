@@ -0,0 +1,731 @@
+// Copyright (c) 2020 Fetullah Atas, Norwegian University of Life Sciences
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/pcd_stream_reader.hpp"
+#include "vox_nav_utilities/pcl_helpers.hpp"
+
+#include <pcl/io/lzf.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+namespace
+{
+// points per chunk of binary data and bytes per chunk of ascii data,
+// each thread holds one chunk at a time
+const uint64_t kBinaryPointsPerChunk = 1 << 18;
+const uint64_t kAsciiBytesPerChunk = 1 << 24;
+// voxels are split into this many shards, each thread buffers this many points per shard
+const size_t kNumVoxelShards = 64;
+const size_t kPointsPerShardBuffer = 512;
+
+double readBinaryScalar(const char * data, char type, int size)
+{
+  switch (type) {
+    case 'F':
+      if (size == 4) {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      } else if (size == 8) {
+        double value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      break;
+    case 'U':
+      if (size == 1) {
+        return *reinterpret_cast<const uint8_t *>(data);
+      } else if (size == 2) {
+        uint16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      } else if (size == 4) {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      break;
+    case 'I':
+      if (size == 1) {
+        return *reinterpret_cast<const int8_t *>(data);
+      } else if (size == 2) {
+        int16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      } else if (size == 4) {
+        int32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      break;
+  }
+  return std::numeric_limits<double>::quiet_NaN();
+}
+
+uint32_t readBinaryColor(const char * data, int size)
+{
+  // rgb is packed into 4 bytes whether its type is F or U
+  uint32_t value = 0;
+  if (size == 4) {
+    std::memcpy(&value, data, sizeof(value));
+  }
+  return value;
+}
+
+uint32_t parseAsciiColor(const char * token, char type)
+{
+  // rgb of TYPE F is written as the float its bits represent, U and I as the integer value
+  if (type != 'F') {
+    return static_cast<uint32_t>(std::strtoll(token, nullptr, 10));
+  }
+  const float value = std::strtof(token, nullptr);
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+/**
+ * @brief Voxels split into shards by x, y voxel index, each guarded by its own mutex.
+ * All threads accumulate into the same voxels, so memory follows the number of output voxels
+ * rather than threads times voxels. A thread adds points through its own Writer, which
+ * buffers them per shard and moves a full buffer into its shard under one lock.
+ *
+ */
+class ShardedVoxelAccumulator
+{
+  struct BufferedPoint
+  {
+    float x;
+    float y;
+    float z;
+    uint32_t rgba;
+  };
+
+public:
+  class Writer
+  {
+public:
+    explicit Writer(ShardedVoxelAccumulator & target)
+    : target_(target),
+      buffers_(target.shards_.size())
+    {
+      for (auto && buffer : buffers_) {
+        buffer.reserve(kPointsPerShardBuffer);
+      }
+    }
+
+    ~Writer()
+    {
+      for (size_t shard = 0; shard < buffers_.size(); shard++) {
+        target_.insert(shard, buffers_[shard]);
+      }
+    }
+
+    void add(float x, float y, float z, uint32_t rgba)
+    {
+      const size_t shard = target_.shardOf(x, y);
+      auto & buffer = buffers_[shard];
+      buffer.push_back(BufferedPoint{x, y, z, rgba});
+      if (buffer.size() >= kPointsPerShardBuffer) {
+        target_.insert(shard, buffer);
+      }
+    }
+
+private:
+    ShardedVoxelAccumulator & target_;
+    std::vector<std::vector<BufferedPoint>> buffers_;
+  };
+
+  ShardedVoxelAccumulator(double voxel_size, size_t num_shards)
+  : voxel_size_(voxel_size),
+    inverse_voxel_size_(1.0 / voxel_size)
+  {
+    for (size_t shard = 0; shard < num_shards; shard++) {
+      shards_.emplace_back(new Shard(voxel_size));
+    }
+  }
+
+  /**
+   * @brief all shards merged into one accumulator, shards are emptied one by one while
+   * merging so voxels are held twice only for one shard at a time
+   *
+   */
+  VoxelAccumulator merge()
+  {
+    VoxelAccumulator merged(voxel_size_);
+    for (auto && shard : shards_) {
+      merged.merge(shard->accumulator);
+      shard->accumulator = VoxelAccumulator(voxel_size_);
+    }
+    return merged;
+  }
+
+private:
+  struct Shard
+  {
+    explicit Shard(double voxel_size)
+    : accumulator(voxel_size)
+    {
+    }
+
+    std::mutex mutex;
+    VoxelAccumulator accumulator;
+  };
+
+  /**
+   * @brief shard of the voxel x, y falls in, computed the same way VoxelAccumulator::add
+   * indexes voxels so a voxel is only ever in one shard
+   *
+   */
+  size_t shardOf(float x, float y) const
+  {
+    if (!std::isfinite(x) || !std::isfinite(y)) {
+      // skipped by VoxelAccumulator::add
+      return 0;
+    }
+    const double kMaxIndex = std::numeric_limits<int32_t>::max();
+    const double ix =
+      std::max(-kMaxIndex, std::min(kMaxIndex, std::floor(x * inverse_voxel_size_)));
+    const double iy =
+      std::max(-kMaxIndex, std::min(kMaxIndex, std::floor(y * inverse_voxel_size_)));
+    const size_t hash =
+      (static_cast<size_t>(static_cast<int64_t>(ix)) * 73856093) ^
+      (static_cast<size_t>(static_cast<int64_t>(iy)) * 19349663);
+    return hash % shards_.size();
+  }
+
+  void insert(size_t shard, std::vector<BufferedPoint> & buffer)
+  {
+    if (buffer.empty()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(shards_[shard]->mutex);
+    for (auto && point : buffer) {
+      shards_[shard]->accumulator.add(point.x, point.y, point.z, point.rgba);
+    }
+    buffer.clear();
+  }
+
+  double voxel_size_;
+  double inverse_voxel_size_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+/**
+ * @brief indices of fields that make up a pcl::PointXYZRGB, color is -1 if there is none
+ *
+ */
+struct PointFields
+{
+  int x;
+  int y;
+  int z;
+  int color;
+};
+
+/**
+ * @brief Accumulate points [begin, end) of a block of binary data, field_offsets and strides
+ * describe where the value of field f of point i is: field_offsets[f] + i * strides[f]
+ *
+ */
+void accumulateBinaryPoints(
+  const char * data,
+  uint64_t begin,
+  uint64_t end,
+  const PcdHeader & header,
+  const PointFields & point_fields,
+  const std::vector<size_t> & field_offsets,
+  const std::vector<size_t> & strides,
+  ShardedVoxelAccumulator::Writer & accumulator)
+{
+  const auto & fx = header.fields[point_fields.x];
+  const auto & fy = header.fields[point_fields.y];
+  const auto & fz = header.fields[point_fields.z];
+  for (uint64_t i = begin; i < end; i++) {
+    const double x = readBinaryScalar(
+      data + field_offsets[point_fields.x] + i * strides[point_fields.x], fx.type, fx.size);
+    const double y = readBinaryScalar(
+      data + field_offsets[point_fields.y] + i * strides[point_fields.y], fy.type, fy.size);
+    const double z = readBinaryScalar(
+      data + field_offsets[point_fields.z] + i * strides[point_fields.z], fz.type, fz.size);
+    uint32_t rgba = 0xFF000000;
+    if (point_fields.color >= 0) {
+      rgba = readBinaryColor(
+        data + field_offsets[point_fields.color] + i * strides[point_fields.color],
+        header.fields[point_fields.color].size);
+    }
+    accumulator.add(x, y, z, rgba);
+  }
+}
+
+/**
+ * @brief Accumulate one ascii line, one point per line
+ *
+ */
+void accumulateAsciiLine(
+  const std::string & line,
+  const PcdHeader & header,
+  const PointFields & point_fields,
+  size_t last_token,
+  ShardedVoxelAccumulator::Writer & accumulator)
+{
+  double xyz[3] = {std::numeric_limits<double>::quiet_NaN(),
+    std::numeric_limits<double>::quiet_NaN(),
+    std::numeric_limits<double>::quiet_NaN()};
+  const size_t xyz_tokens[3] = {header.fields[point_fields.x].token,
+    header.fields[point_fields.y].token,
+    header.fields[point_fields.z].token};
+  const size_t color_token = point_fields.color >= 0 ?
+    header.fields[point_fields.color].token : std::numeric_limits<size_t>::max();
+  uint32_t rgba = 0xFF000000;
+
+  const char * c = line.c_str();
+  const char * line_end = c + line.size();
+  for (size_t token = 0; token <= last_token; token++) {
+    while (c < line_end && std::isspace(static_cast<unsigned char>(*c))) {
+      c++;
+    }
+    if (c == line_end) {
+      // too few tokens, e.g. an empty line
+      return;
+    }
+    const char * token_begin = c;
+    while (c < line_end && !std::isspace(static_cast<unsigned char>(*c))) {
+      c++;
+    }
+    for (int i = 0; i < 3; i++) {
+      if (token == xyz_tokens[i]) {
+        xyz[i] = std::strtod(token_begin, nullptr);
+      }
+    }
+    if (token == color_token) {
+      rgba = parseAsciiColor(token_begin, header.fields[point_fields.color].type);
+    }
+  }
+  accumulator.add(xyz[0], xyz[1], xyz[2], rgba);
+}
+
+/**
+ * @brief run work(writer) on num_threads threads, each with its own writer into
+ * one ShardedVoxelAccumulator
+ *
+ */
+template<typename Work>
+VoxelAccumulator runThreads(double voxel_size, unsigned int num_threads, Work work)
+{
+  ShardedVoxelAccumulator accumulator(voxel_size, kNumVoxelShards);
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < num_threads; t++) {
+    threads.emplace_back(
+      [&accumulator, &work]() {
+        ShardedVoxelAccumulator::Writer writer(accumulator);
+        work(writer);
+      });
+  }
+  for (auto && thread : threads) {
+    thread.join();
+  }
+  return accumulator.merge();
+}
+
+bool setError(std::string * error, const std::string & message)
+{
+  if (error) {
+    *error = message;
+  }
+  return false;
+}
+}  // namespace
+
+bool PcdHeader::read(const std::string & filename, std::string * error)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    return setError(error, "could not open file, " + std::string(std::strerror(errno)));
+  }
+  fields.clear();
+  uint64_t width = 0, height = 1;
+  bool has_points = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream stream(line);
+    std::string keyword;
+    stream >> keyword;
+    if (keyword == "FIELDS") {
+      std::string name;
+      while (stream >> name) {
+        fields.push_back(Field{name, 4, 'F', 1, 0, 0});
+      }
+    } else if (keyword == "SIZE") {
+      for (auto && field : fields) {
+        stream >> field.size;
+      }
+    } else if (keyword == "TYPE") {
+      for (auto && field : fields) {
+        stream >> field.type;
+      }
+    } else if (keyword == "COUNT") {
+      for (auto && field : fields) {
+        stream >> field.count;
+      }
+    } else if (keyword == "WIDTH") {
+      stream >> width;
+    } else if (keyword == "HEIGHT") {
+      stream >> height;
+    } else if (keyword == "POINTS") {
+      stream >> num_points;
+      has_points = true;
+    } else if (keyword == "DATA") {
+      std::string data;
+      stream >> data;
+      if (data == "ascii") {
+        data_type = DataType::ASCII;
+      } else if (data == "binary") {
+        data_type = DataType::BINARY;
+      } else if (data == "binary_compressed") {
+        data_type = DataType::BINARY_COMPRESSED;
+      } else {
+        return setError(error, "unsupported DATA type \"" + data + "\"");
+      }
+      data_offset = static_cast<uint64_t>(file.tellg());
+      break;
+    }
+    if (!stream && !stream.eof()) {
+      return setError(error, "malformed header line \"" + line + "\"");
+    }
+  }
+  if (!file) {
+    return setError(error, "header has no DATA line");
+  }
+  if (fields.empty()) {
+    return setError(error, "header has no FIELDS");
+  }
+  if (!has_points) {
+    num_points = width * height;
+  }
+  point_step = 0;
+  size_t token = 0;
+  for (auto && field : fields) {
+    field.offset = point_step;
+    field.token = token;
+    point_step += static_cast<size_t>(field.size) * field.count;
+    token += field.count;
+  }
+  return true;
+}
+
+int PcdHeader::fieldIndex(const std::string & name) const
+{
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (fields[i].name == name) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+VoxelAccumulator::VoxelAccumulator(double voxel_size)
+: inverse_voxel_size_(1.0 / voxel_size)
+{
+}
+
+void VoxelAccumulator::add(float x, float y, float z, uint32_t rgba)
+{
+  if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) {
+    return;
+  }
+  const double ix = std::floor(x * inverse_voxel_size_);
+  const double iy = std::floor(y * inverse_voxel_size_);
+  const double iz = std::floor(z * inverse_voxel_size_);
+  const double kMaxIndex = std::numeric_limits<int32_t>::max();
+  if (std::abs(ix) > kMaxIndex || std::abs(iy) > kMaxIndex || std::abs(iz) > kMaxIndex) {
+    return;
+  }
+  auto & voxel = voxels_[VoxelKey{
+      static_cast<int32_t>(ix), static_cast<int32_t>(iy), static_cast<int32_t>(iz)}];
+  voxel.x += x;
+  voxel.y += y;
+  voxel.z += z;
+  voxel.r += (rgba >> 16) & 0xFF;
+  voxel.g += (rgba >> 8) & 0xFF;
+  voxel.b += rgba & 0xFF;
+  voxel.a += (rgba >> 24) & 0xFF;
+  voxel.count++;
+}
+
+void VoxelAccumulator::merge(const VoxelAccumulator & other)
+{
+  for (auto && other_voxel : other.voxels_) {
+    auto & voxel = voxels_[other_voxel.first];
+    voxel.x += other_voxel.second.x;
+    voxel.y += other_voxel.second.y;
+    voxel.z += other_voxel.second.z;
+    voxel.r += other_voxel.second.r;
+    voxel.g += other_voxel.second.g;
+    voxel.b += other_voxel.second.b;
+    voxel.a += other_voxel.second.a;
+    voxel.count += other_voxel.second.count;
+  }
+}
+
+size_t VoxelAccumulator::size() const
+{
+  return voxels_.size();
+}
+
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr VoxelAccumulator::toPointCloud() const
+{
+  std::vector<std::pair<VoxelKey, const Voxel *>> sorted_voxels;
+  sorted_voxels.reserve(voxels_.size());
+  for (auto && voxel : voxels_) {
+    sorted_voxels.emplace_back(voxel.first, &voxel.second);
+  }
+  std::sort(
+    sorted_voxels.begin(), sorted_voxels.end(), [](const auto & a, const auto & b) {
+      if (a.first.z != b.first.z) {
+        return a.first.z < b.first.z;
+      }
+      if (a.first.y != b.first.y) {
+        return a.first.y < b.first.y;
+      }
+      return a.first.x < b.first.x;
+    });
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  cloud->points.resize(sorted_voxels.size());
+  for (size_t i = 0; i < sorted_voxels.size(); i++) {
+    const Voxel & voxel = *sorted_voxels[i].second;
+    const double count = static_cast<double>(voxel.count);
+    auto & point = cloud->points[i];
+    point.x = static_cast<float>(voxel.x / count);
+    point.y = static_cast<float>(voxel.y / count);
+    point.z = static_cast<float>(voxel.z / count);
+    point.rgba =
+      (static_cast<uint32_t>(std::lround(voxel.a / count)) << 24) |
+      (static_cast<uint32_t>(std::lround(voxel.r / count)) << 16) |
+      (static_cast<uint32_t>(std::lround(voxel.g / count)) << 8) |
+      static_cast<uint32_t>(std::lround(voxel.b / count));
+  }
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  return cloud;
+}
+
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr loadDownsampledPointcloudFromPcd(
+  const std::string & filename,
+  double voxel_size,
+  int num_threads,
+  std::string * error,
+  uint64_t max_compressed_block_size)
+{
+  if (voxel_size <= 0.0) {
+    auto cloud = loadPointcloudFromPcd(filename);
+    if (cloud->points.empty()) {
+      setError(error, "pcl could not load any points");
+    }
+    return cloud;
+  }
+
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr empty_cloud(new pcl::PointCloud<pcl::PointXYZRGB>);
+  PcdHeader header;
+  if (!header.read(filename, error)) {
+    return empty_cloud;
+  }
+  PointFields point_fields{
+    header.fieldIndex("x"), header.fieldIndex("y"), header.fieldIndex("z"),
+    header.fieldIndex("rgb")};
+  if (point_fields.color < 0) {
+    point_fields.color = header.fieldIndex("rgba");
+  }
+  if (point_fields.x < 0 || point_fields.y < 0 || point_fields.z < 0) {
+    setError(error, "file has no x, y and z fields");
+    return empty_cloud;
+  }
+
+  const unsigned int threads = num_threads > 0 ?
+    static_cast<unsigned int>(num_threads) : std::max(1u, std::thread::hardware_concurrency());
+
+  if (header.data_type == PcdHeader::DataType::BINARY) {
+    // Points are stored one after another, each thread reads whole chunks of points
+    std::vector<size_t> field_offsets, strides;
+    for (auto && field : header.fields) {
+      field_offsets.push_back(field.offset);
+      strides.push_back(header.point_step);
+    }
+    const uint64_t num_chunks =
+      (header.num_points + kBinaryPointsPerChunk - 1) / kBinaryPointsPerChunk;
+    std::atomic<uint64_t> next_chunk(0);
+    std::atomic<bool> is_truncated(false);
+    auto accumulator = runThreads(
+      voxel_size, threads, [&](ShardedVoxelAccumulator::Writer & thread_accumulator) {
+        std::ifstream file(filename, std::ios::binary);
+        std::vector<char> buffer(kBinaryPointsPerChunk * header.point_step);
+        for (uint64_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+          const uint64_t begin = chunk * kBinaryPointsPerChunk;
+          const uint64_t end = std::min(begin + kBinaryPointsPerChunk, header.num_points);
+          file.seekg(header.data_offset + begin * header.point_step);
+          file.read(buffer.data(), (end - begin) * header.point_step);
+          const uint64_t num_read = static_cast<uint64_t>(file.gcount()) / header.point_step;
+          if (num_read < end - begin) {
+            is_truncated = true;
+          }
+          accumulateBinaryPoints(
+            buffer.data(), 0, num_read, header, point_fields, field_offsets, strides,
+            thread_accumulator);
+          file.clear();
+        }
+      });
+    if (is_truncated) {
+      setError(
+        error, "file is truncated, header declares " + std::to_string(header.num_points) +
+        " points");
+      return empty_cloud;
+    }
+    return accumulator.toPointCloud();
+  }
+
+  if (header.data_type == PcdHeader::DataType::BINARY_COMPRESSED) {
+    // Each field is stored for all points before the next field starts,
+    // a point is only complete once whole block is decompressed
+    std::ifstream file(filename, std::ios::binary);
+    file.seekg(header.data_offset);
+    uint32_t compressed_size = 0, uncompressed_size = 0;
+    file.read(reinterpret_cast<char *>(&compressed_size), sizeof(compressed_size));
+    file.read(reinterpret_cast<char *>(&uncompressed_size), sizeof(uncompressed_size));
+    if (!file) {
+      setError(error, "file is truncated before compressed data");
+      return empty_cloud;
+    }
+    if (static_cast<uint64_t>(compressed_size) + uncompressed_size > max_compressed_block_size) {
+      setError(
+        error, "binary_compressed data is decompressed as one block of " +
+        std::to_string(compressed_size) + " + " + std::to_string(uncompressed_size) +
+        " bytes, more than the limit of " + std::to_string(max_compressed_block_size) +
+        " bytes, convert the file to binary to read it in chunks");
+      return empty_cloud;
+    }
+    if (uncompressed_size < header.num_points * header.point_step) {
+      setError(
+        error, "compressed data holds " + std::to_string(uncompressed_size) + " bytes, " +
+        std::to_string(header.num_points) + " points need more");
+      return empty_cloud;
+    }
+    std::vector<char> uncompressed(uncompressed_size);
+    {
+      std::vector<char> compressed(compressed_size);
+      file.read(compressed.data(), compressed_size);
+      if (!file) {
+        setError(error, "file is truncated within compressed data");
+        return empty_cloud;
+      }
+      if (pcl::lzfDecompress(
+          compressed.data(), compressed_size, uncompressed.data(), uncompressed_size) !=
+        uncompressed_size)
+      {
+        setError(error, "compressed data is corrupt");
+        return empty_cloud;
+      }
+    }
+    std::vector<size_t> field_offsets, strides;
+    size_t field_offset = 0;
+    for (auto && field : header.fields) {
+      field_offsets.push_back(field_offset);
+      strides.push_back(static_cast<size_t>(field.size) * field.count);
+      field_offset += header.num_points * field.size * field.count;
+    }
+    const uint64_t num_chunks =
+      (header.num_points + kBinaryPointsPerChunk - 1) / kBinaryPointsPerChunk;
+    std::atomic<uint64_t> next_chunk(0);
+    auto accumulator = runThreads(
+      voxel_size, threads, [&](ShardedVoxelAccumulator::Writer & thread_accumulator) {
+        for (uint64_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+          const uint64_t begin = chunk * kBinaryPointsPerChunk;
+          const uint64_t end = std::min(begin + kBinaryPointsPerChunk, header.num_points);
+          accumulateBinaryPoints(
+            uncompressed.data(), begin, end, header, point_fields, field_offsets, strides,
+            thread_accumulator);
+        }
+      });
+    return accumulator.toPointCloud();
+  }
+
+  // ascii, one point per line. File is split into byte ranges, a line belongs to the range
+  // its first character is in
+  size_t last_token = std::max(
+    {header.fields[point_fields.x].token, header.fields[point_fields.y].token,
+      header.fields[point_fields.z].token});
+  if (point_fields.color >= 0) {
+    last_token = std::max(last_token, header.fields[point_fields.color].token);
+  }
+  std::ifstream size_file(filename, std::ios::binary | std::ios::ate);
+  if (!size_file) {
+    setError(error, "could not open file, " + std::string(std::strerror(errno)));
+    return empty_cloud;
+  }
+  const uint64_t file_size = static_cast<uint64_t>(size_file.tellg());
+  const uint64_t data_size = file_size > header.data_offset ? file_size - header.data_offset : 0;
+  const uint64_t num_chunks = (data_size + kAsciiBytesPerChunk - 1) / kAsciiBytesPerChunk;
+  std::atomic<uint64_t> next_chunk(0);
+  auto accumulator = runThreads(
+    voxel_size, threads, [&](ShardedVoxelAccumulator::Writer & thread_accumulator) {
+      std::ifstream file(filename, std::ios::binary);
+      std::string line;
+      for (uint64_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+        const uint64_t begin = header.data_offset + chunk * kAsciiBytesPerChunk;
+        const uint64_t end = std::min(begin + kAsciiBytesPerChunk, file_size);
+        file.clear();
+        uint64_t position = begin;
+        if (chunk == 0) {
+          file.seekg(begin);
+        } else {
+          // Skip the rest of a line that started in previous range
+          file.seekg(begin - 1);
+          std::getline(file, line);
+          position = static_cast<uint64_t>(file.tellg());
+        }
+        while (file && position < end) {
+          if (!std::getline(file, line)) {
+            break;
+          }
+          accumulateAsciiLine(line, header, point_fields, last_token, thread_accumulator);
+          const auto next_position = file.tellg();
+          position = next_position < 0 ? file_size : static_cast<uint64_t>(next_position);
+        }
+      }
+    });
+  return accumulator.toPointCloud();
+}
+
+}  // namespace vox_nav_utilities
@@ -63,28 +63,30 @@ PCL2OctomapConverter::PCL2OctomapConverter(/* args */)
   remove_outlier_min_neighbors_in_radius_ =
     this->get_parameter("remove_outlier_min_neighbors_in_radius").as_int();
 
-  pointcloud_ = vox_nav_utilities::loadPointcloudFromPcd(input_pcd_filename_.c_str());
-
   if (this->get_parameter("apply_filters").as_bool()) {
-
-    pointcloud_ = vox_nav_utilities::downsampleInputCloud(pointcloud_, downsample_voxel_size_);
-    pointcloud_ = vox_nav_utilities::removeOutliersFromInputCloud(
+    // Downsampled while reading, full resolution cloud is never in memory
+    std::string error;
+    pointcloud_ = vox_nav_utilities::loadDownsampledPointcloudFromPcd(
+      input_pcd_filename_, downsample_voxel_size_, 0, &error);
+    if (!error.empty()) {
+      RCLCPP_ERROR(
+        get_logger(), "Could not read %s: %s", input_pcd_filename_.c_str(), error.c_str());
+    }
+    pointcloud_ = vox_nav_utilities::removeStatisticalAndRadiusOutliers(
       pointcloud_,
       remove_outlier_mean_K_,
       remove_outlier_stddev_threshold_,
-      vox_nav_utilities::OutlierRemovalType::StatisticalOutlierRemoval);
-    pointcloud_ = vox_nav_utilities::removeOutliersFromInputCloud(
-      pointcloud_,
       remove_outlier_min_neighbors_in_radius_,
-      remove_outlier_radius_search_,
-      vox_nav_utilities::OutlierRemovalType::RadiusOutlierRemoval);
+      remove_outlier_radius_search_);
+  } else {
+    pointcloud_ = vox_nav_utilities::loadPointcloudFromPcd(input_pcd_filename_.c_str());
   }
-  pointcloud_ = vox_nav_utilities::transformCloud(
-    pointcloud_,
-    vox_nav_utilities::getRigidBodyTransform(
-      pointloud_transform_matrix_.translation_,
-      pointloud_transform_matrix_.rpyIntrinsic_,
-      get_logger()));
+  vox_nav_utilities::transformCloudInPlace(
+    *pointcloud_,
+    {vox_nav_utilities::getRigidBodyTransform(
+        pointloud_transform_matrix_.translation_,
+        pointloud_transform_matrix_.rpyIntrinsic_,
+        get_logger())});
 
   octomap_markers_publisher_ = this->create_publisher<visualization_msgs::msg::MarkerArray>(
     "octomap_markers", rclcpp::SystemDefaultsQoS());
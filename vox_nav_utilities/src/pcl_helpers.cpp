@@ -18,10 +18,20 @@
  *      Institute: ETH Zurich, Robotic Systems Lab
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <limits>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "vox_nav_utilities/pcl_helpers.hpp"
+#include "vox_nav_utilities/pcd_stream_reader.hpp"
 
 namespace vox_nav_utilities
 {
@@ -46,6 +56,136 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr transformCloud(
   return transformedCloud;
 }
 
+namespace detail
+{
+static_assert(
+  sizeof(pcl::PointXYZRGB) == 8 * sizeof(float) && offsetof(pcl::PointXYZRGB, data) == 0,
+  "transform kernels expect x, y, z, padding followed by color in 32 bytes");
+
+void transformPointsScalar(
+  pcl::PointXYZRGB * points, size_t numPoints, const Eigen::Matrix4f & m)
+{
+  for (size_t i = 0; i < numPoints; i++) {
+    auto & point = points[i];
+    const float x = point.x;
+    const float y = point.y;
+    const float z = point.z;
+    point.x = m(0, 0) * x + m(0, 1) * y + m(0, 2) * z + m(0, 3);
+    point.y = m(1, 0) * x + m(1, 1) * y + m(1, 2) * z + m(1, 3);
+    point.z = m(2, 0) * x + m(2, 1) * y + m(2, 2) * z + m(2, 3);
+  }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VOX_NAV_HAS_AVX2_TRANSFORM
+
+/**
+ * @brief Two points per register, one in each 128 bit lane. Only the first 16 bytes of a
+ * point are loaded and stored, color is never touched
+ *
+ */
+__attribute__((target("avx2,fma")))
+static void transformPointsAvx2Kernel(
+  pcl::PointXYZRGB * points, size_t numPoints, const Eigen::Matrix4f & m)
+{
+  const __m256 col0 = _mm256_setr_ps(
+    m(0, 0), m(1, 0), m(2, 0), 0.0f, m(0, 0), m(1, 0), m(2, 0), 0.0f);
+  const __m256 col1 = _mm256_setr_ps(
+    m(0, 1), m(1, 1), m(2, 1), 0.0f, m(0, 1), m(1, 1), m(2, 1), 0.0f);
+  const __m256 col2 = _mm256_setr_ps(
+    m(0, 2), m(1, 2), m(2, 2), 0.0f, m(0, 2), m(1, 2), m(2, 2), 0.0f);
+  const __m256 col3 = _mm256_setr_ps(
+    m(0, 3), m(1, 3), m(2, 3), 0.0f, m(0, 3), m(1, 3), m(2, 3), 0.0f);
+  size_t i = 0;
+  for (; i + 2 <= numPoints; i += 2) {
+    float * first = points[i].data;
+    float * second = points[i + 1].data;
+    const __m256 xyz = _mm256_set_m128(_mm_loadu_ps(second), _mm_loadu_ps(first));
+    __m256 transformed = _mm256_fmadd_ps(col0, _mm256_permute_ps(xyz, 0x00), col3);
+    transformed = _mm256_fmadd_ps(col1, _mm256_permute_ps(xyz, 0x55), transformed);
+    transformed = _mm256_fmadd_ps(col2, _mm256_permute_ps(xyz, 0xAA), transformed);
+    // Padding float of each point is kept as it was
+    transformed = _mm256_blend_ps(transformed, xyz, 0x88);
+    _mm_storeu_ps(first, _mm256_castps256_ps128(transformed));
+    _mm_storeu_ps(second, _mm256_extractf128_ps(transformed, 1));
+  }
+  transformPointsScalar(points + i, numPoints - i, m);
+}
+#endif
+
+bool transformPointsAvx2(
+  pcl::PointXYZRGB * points, size_t numPoints, const Eigen::Matrix4f & m)
+{
+#ifdef VOX_NAV_HAS_AVX2_TRANSFORM
+  // Checked once at runtime, binaries built without -mavx2 still use it where available
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  if (hasAvx2) {
+    transformPointsAvx2Kernel(points, numPoints, m);
+    return true;
+  }
+#endif
+  (void)points;
+  (void)numPoints;
+  (void)m;
+  return false;
+}
+}  // namespace detail
+
+namespace
+{
+void transformPoints(pcl::PointXYZRGB * points, size_t numPoints, const Eigen::Matrix4f & m)
+{
+  if (!detail::transformPointsAvx2(points, numPoints, m)) {
+    detail::transformPointsScalar(points, numPoints, m);
+  }
+}
+}  // namespace
+
+Eigen::Affine3f composeTransforms(const std::vector<Eigen::Affine3f> & transforms)
+{
+  // Composed in double, so long chains do not accumulate float rounding
+  Eigen::Affine3d composed = Eigen::Affine3d::Identity();
+  for (const auto & transform : transforms) {
+    composed = transform.cast<double>() * composed;
+  }
+  return composed.cast<float>();
+}
+
+void transformCloudInPlace(
+  pcl::PointCloud<pcl::PointXYZRGB> & cloud,
+  const std::vector<Eigen::Affine3f> & transforms,
+  int num_threads)
+{
+  const Eigen::Matrix4f matrix = composeTransforms(transforms).matrix();
+  if (matrix.isIdentity()) {
+    return;
+  }
+  const size_t numPoints = cloud.points.size();
+  // Small clouds are not worth starting threads for
+  const size_t kMinPointsPerThread = 1 << 16;
+  const unsigned int maxThreads = num_threads > 0 ?
+    static_cast<unsigned int>(num_threads) : std::max(1u, std::thread::hardware_concurrency());
+  const size_t threads = std::max<size_t>(
+    1, std::min<size_t>(maxThreads, numPoints / kMinPointsPerThread));
+  if (threads == 1) {
+    transformPoints(cloud.points.data(), numPoints, matrix);
+    return;
+  }
+  const size_t pointsPerThread = (numPoints + threads - 1) / threads;
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++) {
+    const size_t begin = t * pointsPerThread;
+    const size_t end = std::min(begin + pointsPerThread, numPoints);
+    workers.emplace_back(
+      [&cloud, &matrix, begin, end]() {
+        transformPoints(cloud.points.data() + begin, end - begin, matrix);
+      });
+  }
+  for (auto && worker : workers) {
+    worker.join();
+  }
+}
+
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr loadPointcloudFromPcd(const std::string & filename)
 {
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>());
@@ -128,13 +268,97 @@ Eigen::Affine3f getRigidBodyTransform(
 }
 
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr downsampleInputCloud(
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud, double downsmaple_leaf_size)
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud, double downsmaple_leaf_size, int num_threads)
 {
-  pcl::VoxelGrid<pcl::PointXYZRGB> voxelGrid;
-  voxelGrid.setInputCloud(inputCloud);
-  voxelGrid.setLeafSize(downsmaple_leaf_size, downsmaple_leaf_size, downsmaple_leaf_size);
   pcl::PointCloud<pcl::PointXYZRGB>::Ptr downsampledCloud(new pcl::PointCloud<pcl::PointXYZRGB>());
-  voxelGrid.filter(*downsampledCloud);
+  if (downsmaple_leaf_size <= 0.0) {
+    *downsampledCloud = *inputCloud;
+    return downsampledCloud;
+  }
+  const unsigned int threads = num_threads > 0 ?
+    static_cast<unsigned int>(num_threads) : std::max(1u, std::thread::hardware_concurrency());
+  const double inverseLeafSize = 1.0 / downsmaple_leaf_size;
+  const auto & points = inputCloud->points;
+
+  // Space is cut into slabs along x at voxel boundaries, so no voxel spans two slabs and
+  // slabs can be voxelized independently. Voxel indices are kept per slab, there is no
+  // global linear index that could overflow on large extents
+  int64_t minVoxelX = std::numeric_limits<int64_t>::max();
+  int64_t maxVoxelX = std::numeric_limits<int64_t>::min();
+  for (const auto & point : points) {
+    if (std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z)) {
+      const auto voxelX = static_cast<int64_t>(std::floor(point.x * inverseLeafSize));
+      minVoxelX = std::min(minVoxelX, voxelX);
+      maxVoxelX = std::max(maxVoxelX, voxelX);
+    }
+  }
+  if (minVoxelX > maxVoxelX) {
+    return downsampledCloud;
+  }
+  // Fixed number of slabs, so that output does not depend on thread count
+  const int64_t kMaxSlabs = 256;
+  const int64_t numVoxelsX = maxVoxelX - minVoxelX + 1;
+  const int64_t numSlabs = std::min<int64_t>(numVoxelsX, kMaxSlabs);
+  const int64_t voxelsPerSlab = (numVoxelsX + numSlabs - 1) / numSlabs;
+
+  // Counting sort of point indices by slab, non finite points are left out
+  std::vector<int64_t> slabOfPoint(points.size(), -1);
+  std::vector<size_t> slabBegin(numSlabs + 1, 0);
+  for (size_t i = 0; i < points.size(); i++) {
+    const auto & point = points[i];
+    if (std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z)) {
+      const auto voxelX = static_cast<int64_t>(std::floor(point.x * inverseLeafSize));
+      slabOfPoint[i] = (voxelX - minVoxelX) / voxelsPerSlab;
+      slabBegin[slabOfPoint[i] + 1]++;
+    }
+  }
+  for (int64_t slab = 0; slab < numSlabs; slab++) {
+    slabBegin[slab + 1] += slabBegin[slab];
+  }
+  std::vector<size_t> sortedIndices(slabBegin[numSlabs]);
+  {
+    std::vector<size_t> slabFill(slabBegin.begin(), slabBegin.end() - 1);
+    for (size_t i = 0; i < points.size(); i++) {
+      if (slabOfPoint[i] >= 0) {
+        sortedIndices[slabFill[slabOfPoint[i]]++] = i;
+      }
+    }
+  }
+  slabOfPoint = std::vector<int64_t>();
+
+  // Slabs are handed out one at a time, dense slabs do not hold up the other threads
+  std::vector<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> slabClouds(numSlabs);
+  std::atomic<int64_t> nextSlab(0);
+  std::vector<std::thread> workers;
+  for (unsigned int t = 0; t < threads; t++) {
+    workers.emplace_back(
+      [&]() {
+        for (int64_t slab = nextSlab++; slab < numSlabs; slab = nextSlab++) {
+          VoxelAccumulator accumulator(downsmaple_leaf_size);
+          for (size_t i = slabBegin[slab]; i < slabBegin[slab + 1]; i++) {
+            const auto & point = points[sortedIndices[i]];
+            accumulator.add(point.x, point.y, point.z, point.rgba);
+          }
+          slabClouds[slab] = accumulator.toPointCloud();
+        }
+      });
+  }
+  for (auto && worker : workers) {
+    worker.join();
+  }
+
+  // Slabs are concatenated in order
+  size_t numVoxels = 0;
+  for (const auto & slabCloud : slabClouds) {
+    numVoxels += slabCloud->points.size();
+  }
+  downsampledCloud->points.reserve(numVoxels);
+  for (const auto & slabCloud : slabClouds) {
+    downsampledCloud->points.insert(
+      downsampledCloud->points.end(), slabCloud->points.begin(), slabCloud->points.end());
+  }
+  downsampledCloud->width = downsampledCloud->points.size();
+  downsampledCloud->height = 1;
   return downsampledCloud;
 }
 
@@ -161,6 +385,201 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr removeOutliersFromInputCloud(
   return filteredCloud;
 }
 
+pcl::PointCloud<pcl::PointXYZRGB>::Ptr removeStatisticalAndRadiusOutliers(
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr inputCloud,
+  int mean_K, double stddev_thres,
+  int min_neighbors_in_radius, double radius_search,
+  int num_threads)
+{
+  const unsigned int threads = num_threads > 0 ?
+    static_cast<unsigned int>(num_threads) : std::max(1u, std::thread::hardware_concurrency());
+  const auto & points = inputCloud->points;
+  const size_t numPoints = points.size();
+
+  // Search buffers are allocated once per thread and reused for all of its points
+  struct SearchBuffers
+  {
+    std::vector<int> indices;
+    std::vector<float> sqrDistances;
+  };
+
+  // Runs body(i, buffers) for all points, points are handed out in chunks
+  auto forEachPoint = [&](auto body) {
+      const size_t kChunkSize = 4096;
+      std::atomic<size_t> nextChunk(0);
+      std::vector<std::thread> workers;
+      for (unsigned int t = 0; t < threads; t++) {
+        workers.emplace_back(
+          [&]() {
+            SearchBuffers buffers;
+            for (size_t begin = (nextChunk++) * kChunkSize; begin < numPoints;
+            begin = (nextChunk++) * kChunkSize)
+            {
+              const size_t end = std::min(begin + kChunkSize, numPoints);
+              for (size_t i = begin; i < end; i++) {
+                body(i, buffers);
+              }
+            }
+          });
+      }
+      for (auto && worker : workers) {
+        worker.join();
+      }
+    };
+
+  // Single mask over the input, non finite points are removed right away
+  std::vector<uint8_t> keep(numPoints, 0);
+  for (size_t i = 0; i < numPoints; i++) {
+    const auto & point = points[i];
+    keep[i] = std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z);
+  }
+
+  // One index for both filters, searches on it are read only and run concurrently
+  pcl::KdTreeFLANN<pcl::PointXYZRGB> kdtree;
+  kdtree.setInputCloud(inputCloud);
+
+  const bool useStatistical = mean_K > 0;
+  const bool useRadius = radius_search > 0.0;
+  const int minNeighbours = std::max(min_neighbors_in_radius, 0);
+
+  if (!useStatistical) {
+    if (useRadius) {
+      // Every finite point survives, counting stops once the point is known to be kept
+      std::vector<uint8_t> keepAfterRadius(numPoints, 0);
+      forEachPoint(
+        [&](size_t i, SearchBuffers & buffers) {
+          if (!keep[i]) {
+            return;
+          }
+          // Count includes the point itself
+          const int found = kdtree.radiusSearch(
+            points[i], radius_search, buffers.indices, buffers.sqrDistances, minNeighbours + 1);
+          keepAfterRadius[i] = found > minNeighbours;
+        });
+      keep.swap(keepAfterRadius);
+    }
+  } else {
+    // One pass of kNN searches gives both the mean distance to mean_K nearest neighbours,
+    // same statistic as pcl::StatisticalOutlierRemoval, and the neighbours within
+    // radius_search. Neighbours are sorted by distance, so those within the radius are a
+    // prefix of them. The first few are stored per point, the radius stage then counts how
+    // many of them survived the statistical stage, which equals running
+    // pcl::RadiusOutlierRemoval on the output of pcl::StatisticalOutlierRemoval.
+    // Only points whose kNN did not cover the radius and whose stored neighbours are not
+    // enough to keep them are searched again by radius.
+    const size_t numStored = useRadius ?
+      std::min<size_t>(minNeighbours + 3, mean_K + 1) : 0;
+    const float sqrRadius = static_cast<float>(radius_search * radius_search);
+    std::vector<float> meanDistances(numPoints, 0.0f);
+    std::vector<uint8_t> hasNeighbours(numPoints, 0);
+    std::vector<int> radiusNeighbours(numPoints * numStored, -1);
+    // all neighbours within radius are stored
+    std::vector<uint8_t> isRadiusComplete(numPoints, 0);
+    forEachPoint(
+      [&](size_t i, SearchBuffers & buffers) {
+        if (!keep[i]) {
+          return;
+        }
+        buffers.indices.resize(mean_K + 1);
+        buffers.sqrDistances.resize(mean_K + 1);
+        const int found = kdtree.nearestKSearch(
+          points[i], mean_K + 1, buffers.indices, buffers.sqrDistances);
+        if (found == 0) {
+          return;
+        }
+        // The first neighbour is the point itself
+        double distanceSum = 0.0;
+        for (int k = 1; k < found; k++) {
+          distanceSum += std::sqrt(buffers.sqrDistances[k]);
+        }
+        meanDistances[i] = static_cast<float>(distanceSum / mean_K);
+        hasNeighbours[i] = 1;
+
+        if (useRadius) {
+          size_t numWithinRadius = 0;
+          while (numWithinRadius < static_cast<size_t>(found) &&
+            buffers.sqrDistances[numWithinRadius] <= sqrRadius)
+          {
+            if (numWithinRadius < numStored) {
+              radiusNeighbours[i * numStored + numWithinRadius] =
+                buffers.indices[numWithinRadius];
+            }
+            numWithinRadius++;
+          }
+          // If all mean_K + 1 neighbours are within radius there may be more beyond them
+          const bool coversRadius =
+            numWithinRadius < static_cast<size_t>(found) || found < mean_K + 1;
+          isRadiusComplete[i] = coversRadius && numWithinRadius <= numStored;
+        }
+      });
+
+    double sum = 0.0;
+    double sqrSum = 0.0;
+    size_t numValid = 0;
+    for (size_t i = 0; i < numPoints; i++) {
+      if (hasNeighbours[i]) {
+        sum += meanDistances[i];
+        sqrSum += meanDistances[i] * meanDistances[i];
+        numValid++;
+      }
+    }
+    const double mean = numValid > 0 ? sum / numValid : 0.0;
+    const double variance =
+      numValid > 1 ? (sqrSum - sum * sum / numValid) / (numValid - 1) : 0.0;
+    const double distanceThreshold = mean + stddev_thres * std::sqrt(std::max(variance, 0.0));
+    for (size_t i = 0; i < numPoints; i++) {
+      // Points without neighbours count as distance 0, as in pcl::StatisticalOutlierRemoval
+      keep[i] = keep[i] && meanDistances[i] <= distanceThreshold;
+    }
+
+    if (useRadius) {
+      std::vector<uint8_t> keepAfterRadius(numPoints, 0);
+      forEachPoint(
+        [&](size_t i, SearchBuffers & buffers) {
+          if (!keep[i]) {
+            return;
+          }
+          // Count includes the point itself
+          int numSurvivors = 0;
+          for (size_t k = 0; k < numStored; k++) {
+            const int index = radiusNeighbours[i * numStored + k];
+            if (index >= 0) {
+              numSurvivors += keep[index];
+            }
+          }
+          if (numSurvivors > minNeighbours || isRadiusComplete[i]) {
+            keepAfterRadius[i] = numSurvivors > minNeighbours;
+            return;
+          }
+          kdtree.radiusSearch(points[i], radius_search, buffers.indices, buffers.sqrDistances);
+          numSurvivors = 0;
+          for (const int index : buffers.indices) {
+            numSurvivors += keep[index];
+            if (numSurvivors > minNeighbours) {
+              break;
+            }
+          }
+          keepAfterRadius[i] = numSurvivors > minNeighbours;
+        });
+      keep.swap(keepAfterRadius);
+    }
+  }
+
+  // The only copy, straight from the input
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr filteredCloud(new pcl::PointCloud<pcl::PointXYZRGB>());
+  filteredCloud->header = inputCloud->header;
+  filteredCloud->points.reserve(std::count(keep.begin(), keep.end(), 1));
+  for (size_t i = 0; i < numPoints; i++) {
+    if (keep[i]) {
+      filteredCloud->points.push_back(points[i]);
+    }
+  }
+  filteredCloud->width = filteredCloud->points.size();
+  filteredCloud->height = 1;
+  filteredCloud->is_dense = true;
+  return filteredCloud;
+}
+
 /**
  * @brief publish clustering objects' in one point cloud
  * @param publisher
@@ -8,10 +8,10 @@ PlannerBenchMarking::PlannerBenchMarking()
   RCLCPP_INFO(this->get_logger(), "Creating:");
 
   is_octomap_ready_ = false;
-  octomap_msg_ = std::make_shared<octomap_msgs::msg::Octomap>();
 
   this->declare_parameter("selected_planners", std::vector<std::string>({"RRTstar", "PRMstar"}));
   this->declare_parameter("planner_timeout", 5.0);
+  this->declare_parameter("num_threads", 0);
   this->declare_parameter("interpolation_parameter", 50);
   this->declare_parameter("octomap_topic", "octomap");
   this->declare_parameter("octomap_voxel_size", 0.2);
@@ -28,6 +28,8 @@ PlannerBenchMarking::PlannerBenchMarking()
   this->declare_parameter("robot_body_dimens.x", 1.5);
   this->declare_parameter("robot_body_dimens.y", 1.5);
   this->declare_parameter("robot_body_dimens.z", 0.4);
+  this->declare_parameter("footprint_kernels.enabled", true);
+  this->declare_parameter("footprint_kernels.num_yaw_bins", 72);
   this->declare_parameter("start.z", 0.0);
   this->declare_parameter("goal.z", 0.0);
   this->declare_parameter("goal_tolerance", 0.2);
@@ -42,6 +44,7 @@ PlannerBenchMarking::PlannerBenchMarking()
 
   this->get_parameter("selected_planners", selected_planners_);
   this->get_parameter("planner_timeout", planner_timeout_);
+  this->get_parameter("num_threads", num_threads_);
   this->get_parameter("interpolation_parameter", interpolation_parameter_);
   this->get_parameter("octomap_topic", octomap_topic_);
   this->get_parameter("octomap_voxel_size", octomap_voxel_size_);
@@ -58,6 +61,7 @@ PlannerBenchMarking::PlannerBenchMarking()
   this->get_parameter("robot_body_dimens.x", robot_body_dimensions_.x);
   this->get_parameter("robot_body_dimens.y", robot_body_dimensions_.y);
   this->get_parameter("robot_body_dimens.z", robot_body_dimensions_.z);
+  this->get_parameter("footprint_kernels.enabled", use_footprint_kernels_);
   this->get_parameter("start.z", start_.z);
   this->get_parameter("goal.z", goal_.z);
   this->get_parameter("goal_tolerance", goal_tolerance_);
@@ -121,8 +125,10 @@ PlannerBenchMarking::PlannerBenchMarking()
   fcl::Transform3f tf2;
   fcl::CollisionObject robot_body_box_object(robot_body_box, tf2);
   robot_collision_object_ = std::make_shared<fcl::CollisionObject>(robot_body_box_object);
+  occupancy_slice_ = std::make_shared<OccupancySlice2D>();
+  footprint_kernels_ = std::make_shared<YawBinnedFootprintKernels>();
   octomap_subscriber_ = this->create_subscription<octomap_msgs::msg::Octomap>(
-    octomap_topic_, rclcpp::SystemDefaultsQoS(),
+    octomap_topic_, rclcpp::QoS(rclcpp::KeepLast(1)).reliable().transient_local(),
     std::bind(&PlannerBenchMarking::octomapCallback, this, std::placeholders::_1));
 
   // Initialize pubs & subs
@@ -153,6 +159,7 @@ std::map<int, ompl::geometric::PathGeometric> PlannerBenchMarking::doBenchMarkin
   std::map<int, ompl::geometric::PathGeometric> paths_map;
 
   for (int i = 0; i < epochs_; i++) {
+    updateCollisionModels();
 
     // spin until a valid random start and goal poses are found. Also
     // make sure that a soluion exists for generated states
@@ -327,23 +334,59 @@ std::map<int, ompl::geometric::PathGeometric> PlannerBenchMarking::doBenchMarkin
   return paths_map;
 }
 
+void PlannerBenchMarking::updateCollisionModels()
+{
+  octomap_msgs::msg::Octomap::ConstSharedPtr octomap_msg;
+  {
+    const std::lock_guard<std::mutex> lock(octomap_mutex_);
+    octomap_msg = octomap_msg_;
+  }
+  // map_server stamps every message of a map epoch the same, periodic republishes are no-ops
+  if (!octomap_msg ||
+    (fcl_octree_collision_object_ && octomap_msg->header.stamp == collision_models_stamp_))
+  {
+    return;
+  }
+  std::shared_ptr<octomap::OcTree> octomap_octree =
+    vox_nav_utilities::occupancyOcTreeFromMsg(*octomap_msg);
+  auto fcl_octree = std::make_shared<fcl::OcTree>(octomap_octree);
+  auto fcl_octree_collision_object = std::make_shared<fcl::CollisionObject>(
+    std::shared_ptr<fcl::CollisionGeometry>(fcl_octree));
+  RCLCPP_INFO(
+    this->get_logger(),
+    "Recieved a new Octomap epoch, A FCL collision tree will be created from this "
+    "octomap for state validity(aka collision check)");
+  auto occupancy_slice = std::make_shared<OccupancySlice2D>();
+  auto footprint_kernels = std::make_shared<YawBinnedFootprintKernels>();
+  if (use_footprint_kernels_) {
+    // Body box is centered at start.z, same as in the FCL check
+    const double padding = std::hypot(robot_body_dimensions_.x, robot_body_dimensions_.y);
+    occupancy_slice->build(
+      *octomap_octree,
+      se_bounds_.minx - padding, se_bounds_.miny - padding,
+      se_bounds_.maxx + padding, se_bounds_.maxy + padding,
+      start_.z - 0.5 * robot_body_dimensions_.z, start_.z + 0.5 * robot_body_dimensions_.z);
+    footprint_kernels->build(
+      robot_body_dimensions_.x, robot_body_dimensions_.y, occupancy_slice->resolution(),
+      this->get_parameter("footprint_kernels.num_yaw_bins").as_int());
+    RCLCPP_INFO(
+      this->get_logger(),
+      "Built footprint masks for %d yaw bins over a %zu x %zu occupancy slice, "
+      "states they tell free skip FCL",
+      footprint_kernels->numYawBins(), occupancy_slice->sizeX(),
+      occupancy_slice->sizeY());
+  }
+  const std::lock_guard<std::mutex> lock(octomap_mutex_);
+  fcl_octree_ = fcl_octree;
+  fcl_octree_collision_object_ = fcl_octree_collision_object;
+  occupancy_slice_ = occupancy_slice;
+  footprint_kernels_ = footprint_kernels;
+  collision_models_stamp_ = octomap_msg->header.stamp;
+}
+
 bool PlannerBenchMarking::isStateValidSE2(const ompl::base::State * state)
 {
-  if (is_octomap_ready_) {
-    std::call_once(
-      fcl_tree_from_octomap_once_, [this]() {
-        std::shared_ptr<octomap::OcTree> octomap_octree =
-        std::make_shared<octomap::OcTree>(octomap_voxel_size_);
-        octomap_msgs::readTree<octomap::OcTree>(octomap_octree.get(), *octomap_msg_);
-        fcl_octree_ = std::make_shared<fcl::OcTree>(octomap_octree);
-        fcl_octree_collision_object_ = std::make_shared<fcl::CollisionObject>(
-          std::shared_ptr<fcl::CollisionGeometry>(fcl_octree_));
-        RCLCPP_INFO(
-          this->get_logger(),
-          "Recieved a valid Octomap, A FCL collision tree will be created from this "
-          "octomap for state validity(aka collision check)");
-      });
-  } else {
+  if (!fcl_octree_collision_object_) {
     RCLCPP_ERROR(
       this->get_logger(),
       "The Octomap has not been recieved correctly, Collision check "
@@ -353,6 +396,14 @@ bool PlannerBenchMarking::isStateValidSE2(const ompl::base::State * state)
   // cast the abstract state type to the type we expect
   const ompl::base::SE2StateSpace::StateType * se2_state =
     state->as<ompl::base::SE2StateSpace::StateType>();
+  // Masks cover the body for every yaw of their bin, a miss is free for sure, a hit is left
+  // to FCL so results stay exact
+  if (use_footprint_kernels_ && occupancy_slice_->isValid() &&
+    !footprint_kernels_->collides(
+      *occupancy_slice_, se2_state->getX(), se2_state->getY(), se2_state->getYaw()))
+  {
+    return true;
+  }
   // check validity of state Fdefined by pos & rot
   fcl::Vec3f translation(se2_state->getX(), se2_state->getY(), start_.z);
 
@@ -361,34 +412,21 @@ bool PlannerBenchMarking::isStateValidSE2(const ompl::base::State * state)
   fcl::Quaternion3f rotation(
     myQuaternion.getX(), myQuaternion.getY(),
     myQuaternion.getZ(), myQuaternion.getW());
-  robot_collision_object_->setTransform(rotation, translation);
+  // A collision object per check shares the body geometry, so parallel planners can check
+  // states concurrently
+  fcl::CollisionObject robot_body(
+    robot_collision_object_->collisionGeometry(), fcl::Transform3f(rotation, translation));
   fcl::CollisionRequest requestType(1, false, 1, false);
   fcl::CollisionResult collisionResult;
   fcl::collide(
-    robot_collision_object_.get(),
+    &robot_body,
     fcl_octree_collision_object_.get(), requestType, collisionResult);
   return !collisionResult.isCollision();
 }
 
 bool PlannerBenchMarking::isStateValidSE3(const ompl::base::State * state)
 {
-  if (is_octomap_ready_) {
-    std::call_once(
-      fcl_tree_from_octomap_once_, [this]() {
-        std::shared_ptr<octomap::OcTree> octomap_octree =
-        std::make_shared<octomap::OcTree>(octomap_voxel_size_);
-        octomap_msgs::readTree<octomap::OcTree>(octomap_octree.get(), *octomap_msg_);
-
-
-        fcl_octree_ = std::make_shared<fcl::OcTree>(octomap_octree);
-        fcl_octree_collision_object_ = std::make_shared<fcl::CollisionObject>(
-          std::shared_ptr<fcl::CollisionGeometry>(fcl_octree_));
-        RCLCPP_INFO(
-          this->get_logger(),
-          "Recieved a valid Octomap, A FCL collision tree will be created from this "
-          "octomap for state validity(aka collision check)");
-      });
-  } else {
+  if (!fcl_octree_collision_object_) {
     RCLCPP_ERROR(
       this->get_logger(),
       "The Octomap has not been recieved correctly, Collision check "
@@ -407,11 +445,14 @@ bool PlannerBenchMarking::isStateValidSE3(const ompl::base::State * state)
   // check validity of state Fdefined by pos & rot
   fcl::Vec3f translation(pos->values[0], pos->values[1], pos->values[2]);
   fcl::Quaternion3f rotation(rot->w, rot->x, rot->y, rot->z);
-  robot_collision_object_->setTransform(rotation, translation);
+  // A collision object per check shares the body geometry, so parallel planners can check
+  // states concurrently
+  fcl::CollisionObject robot_body(
+    robot_collision_object_->collisionGeometry(), fcl::Transform3f(rotation, translation));
   fcl::CollisionRequest requestType(1, false, 1, false);
   fcl::CollisionResult collisionResult;
   fcl::collide(
-    robot_collision_object_.get(),
+    &robot_body,
     fcl_octree_collision_object_.get(), requestType, collisionResult);
   return !collisionResult.isCollision();
 }
@@ -419,11 +460,10 @@ bool PlannerBenchMarking::isStateValidSE3(const ompl::base::State * state)
 void PlannerBenchMarking::octomapCallback(
   const octomap_msgs::msg::Octomap::ConstSharedPtr msg)
 {
+  // Only the latest map is kept, collision models are rebuilt from it by the next epoch
   const std::lock_guard<std::mutex> lock(octomap_mutex_);
-  if (!is_octomap_ready_) {
-    is_octomap_ready_ = true;
-    octomap_msg_ = msg;
-  }
+  octomap_msg_ = msg;
+  is_octomap_ready_ = true;
 }
 
 ompl::geometric::PathGeometric PlannerBenchMarking::makeAPlan(
@@ -634,6 +674,8 @@ void PlannerBenchMarking::allocatePlannerbyName(
   const std::string & selected_planner_name,
   const ompl::base::SpaceInformationPtr & si)
 {
+  const unsigned int num_parallel_threads = num_threads_ > 0 ?
+    static_cast<unsigned int>(num_threads_) : std::max(1u, std::thread::hardware_concurrency());
   if (selected_planner_name == std::string("PRMstar")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::PRMstar(si));
   } else if (selected_planner_name == std::string("LazyPRMstar")) {
@@ -653,7 +695,9 @@ void PlannerBenchMarking::allocatePlannerbyName(
   } else if (selected_planner_name == std::string("AITstar")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::AITstar(si));
   } else if (selected_planner_name == std::string("CForest")) {
-    planner = ompl::base::PlannerPtr(new ompl::geometric::CForest(si));
+    auto cforest = std::make_shared<ompl::geometric::CForest>(si);
+    cforest->setNumThreads(num_parallel_threads);
+    planner = cforest;
   } else if (selected_planner_name == std::string("LBTRRT")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::LBTRRT(si));
   } else if (selected_planner_name == std::string("SST")) {
@@ -667,7 +711,10 @@ void PlannerBenchMarking::allocatePlannerbyName(
   } else if (selected_planner_name == std::string("FMT")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::FMT(si));
   } else if (selected_planner_name == std::string("AnytimePathShortening")) {
-    planner = ompl::base::PlannerPtr(new ompl::geometric::AnytimePathShortening(si));
+    // each planner of the portfolio runs in a thread of its own
+    auto anytime_path_shortening = std::make_shared<ompl::geometric::AnytimePathShortening>(si);
+    anytime_path_shortening->setDefaultNumPlanners(num_parallel_threads);
+    planner = anytime_path_shortening;
   } else {
     RCLCPP_WARN(
       this->get_logger(),
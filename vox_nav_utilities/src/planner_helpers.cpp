@@ -12,8 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 #include "vox_nav_utilities/planner_helpers.hpp"
 
 namespace vox_nav_utilities
@@ -21,14 +25,14 @@ namespace vox_nav_utilities
 
 geometry_msgs::msg::PoseStamped getNearstNode(
   const geometry_msgs::msg::PoseStamped & state,
-  const std::shared_ptr<octomap::ColorOcTree> & color_octomap_octree)
+  const std::shared_ptr<TraversabilityOcTree> & octomap_octree)
 {
   auto nearest_node_pose = state;
   double dist = INFINITY;
-  for (auto it = color_octomap_octree->begin(),
-    end = color_octomap_octree->end(); it != end; ++it)
+  for (auto it = octomap_octree->begin(),
+    end = octomap_octree->end(); it != end; ++it)
   {
-    if (color_octomap_octree->isNodeOccupied(*it)) {
+    if (octomap_octree->isNodeOccupied(*it)) {
       auto dist_to_crr_node = std::sqrt(
         std::pow(it.getCoordinate().x() - state.pose.position.x, 2) +
         std::pow(it.getCoordinate().y() - state.pose.position.y, 2) +
@@ -48,8 +52,12 @@ void initializeSelectedPlanner(
   ompl::base::PlannerPtr & planner,
   const std::string & selected_planner_name,
   const ompl::base::SpaceInformationPtr & si,
-  const rclcpp::Logger logger)
+  const rclcpp::Logger logger,
+  int num_threads,
+  const std::vector<std::string> & portfolio_planner_names)
 {
+  const unsigned int num_parallel_threads = num_threads > 0 ?
+    static_cast<unsigned int>(num_threads) : std::max(1u, std::thread::hardware_concurrency());
   if (selected_planner_name == std::string("PRMstar")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::PRMstar(si));
   } else if (selected_planner_name == std::string("LazyPRMstar")) {
@@ -69,7 +77,9 @@ void initializeSelectedPlanner(
   } else if (selected_planner_name == std::string("AITstar")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::AITstar(si));
   } else if (selected_planner_name == std::string("CForest")) {
-    planner = ompl::base::PlannerPtr(new ompl::geometric::CForest(si));
+    auto cforest = std::make_shared<ompl::geometric::CForest>(si);
+    cforest->setNumThreads(num_parallel_threads);
+    planner = cforest;
   } else if (selected_planner_name == std::string("LBTRRT")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::LBTRRT(si));
   } else if (selected_planner_name == std::string("SST")) {
@@ -83,7 +93,35 @@ void initializeSelectedPlanner(
   } else if (selected_planner_name == std::string("FMT")) {
     planner = ompl::base::PlannerPtr(new ompl::geometric::FMT(si));
   } else if (selected_planner_name == std::string("AnytimePathShortening")) {
-    planner = ompl::base::PlannerPtr(new ompl::geometric::AnytimePathShortening(si));
+    // each planner of the portfolio runs in a thread of its own
+    auto anytime_path_shortening = std::make_shared<ompl::geometric::AnytimePathShortening>(si);
+    anytime_path_shortening->setDefaultNumPlanners(num_parallel_threads);
+    planner = anytime_path_shortening;
+  } else if (selected_planner_name == std::string("Portfolio")) {
+    auto portfolio = std::make_shared<PortfolioPlanner>(si);
+    // Statistics are keyed by planner name, so each planner races once
+    std::set<std::string> member_names;
+    for (auto && member_name : portfolio_planner_names) {
+      if (member_name == selected_planner_name) {
+        RCLCPP_WARN(logger, "A Portfolio cannot race another Portfolio, skipping it");
+        continue;
+      }
+      if (!member_names.insert(member_name).second) {
+        RCLCPP_WARN(
+          logger, "%s is listed more than once in portfolio planners, racing it once",
+          member_name.c_str());
+        continue;
+      }
+      // Members already run in parallel, parallel members get one thread each
+      ompl::base::PlannerPtr member;
+      initializeSelectedPlanner(member, member_name, si, logger, 1);
+      portfolio->addPlanner(member);
+    }
+    if (portfolio->getPlanners().empty()) {
+      RCLCPP_WARN(logger, "Portfolio has no planners to race, adding the default planner: RRTstar");
+      portfolio->addPlanner(ompl::base::PlannerPtr(new ompl::geometric::RRTstar(si)));
+    }
+    planner = portfolio;
   } else {
     RCLCPP_WARN(
       logger,
@@ -0,0 +1,235 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/portfolio_planner.hpp"
+
+#include <ompl/base/objectives/PathLengthOptimizationObjective.h>
+#include <ompl/util/Console.h>
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+PortfolioPlanner::PortfolioPlanner(const ompl::base::SpaceInformationPtr & si)
+: ompl::base::Planner(si, "Portfolio")
+{
+  specs_.approximateSolutions = true;
+  specs_.multithreaded = true;
+}
+
+void PortfolioPlanner::addPlanner(const ompl::base::PlannerPtr & planner)
+{
+  if (planner->getSpaceInformation().get() != si_.get()) {
+    OMPL_ERROR(
+      "%s: %s is allocated for another space information, it is not added",
+      getName().c_str(), planner->getName().c_str());
+    return;
+  }
+  planners_.push_back(planner);
+}
+
+ompl::base::PlannerStatus PortfolioPlanner::solve(
+  const ompl::base::PlannerTerminationCondition & ptc)
+{
+  checkValidity();
+  last_results_.assign(planners_.size(), MemberResult());
+  last_winner_ = -1;
+  if (planners_.empty()) {
+    OMPL_ERROR("%s: There are no planners to race", getName().c_str());
+    return ompl::base::PlannerStatus::ABORT;
+  }
+
+  const auto start_time = std::chrono::steady_clock::now();
+  std::mutex results_mutex;
+  std::atomic<bool> is_exact_solution_found(false);
+  auto on_exact_solution = [&](size_t member) {
+      const std::lock_guard<std::mutex> lock(results_mutex);
+      if (last_results_[member].time_to_exact_solution < 0.0) {
+        last_results_[member].time_to_exact_solution =
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+      }
+      if (last_winner_ < 0) {
+        last_winner_ = static_cast<int>(member);
+      }
+      is_exact_solution_found = true;
+    };
+
+  // Each member gets a problem definition of its own, so their solutions do not mix.
+  // Optimizing planners report their first exact solution through the intermediate solution
+  // callback, long before they return.
+  std::vector<ompl::base::ProblemDefinitionPtr> member_pdefs(planners_.size());
+  for (size_t i = 0; i < planners_.size(); i++) {
+    member_pdefs[i] = pdef_->clone();
+    member_pdefs[i]->clearSolutionPaths();
+    member_pdefs[i]->setIntermediateSolutionCallback(
+      [&on_exact_solution, i](
+        const ompl::base::Planner *, const std::vector<const ompl::base::State *> &,
+        const ompl::base::Cost) {
+        on_exact_solution(i);
+      });
+    planners_[i]->setProblemDefinition(member_pdefs[i]);
+    if (!planners_[i]->isSetup()) {
+      planners_[i]->setup();
+    }
+    last_results_[i].name = planners_[i]->getName();
+  }
+
+  const ompl::base::PlannerTerminationCondition member_ptc =
+    ompl::base::plannerOrTerminationCondition(
+    ptc, ompl::base::PlannerTerminationCondition(
+      [&is_exact_solution_found]() {return is_exact_solution_found.load();}));
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < planners_.size(); i++) {
+    threads.emplace_back(
+      [&, i]() {
+        const ompl::base::PlannerStatus status = planners_[i]->solve(member_ptc);
+        {
+          const std::lock_guard<std::mutex> lock(results_mutex);
+          last_results_[i].status = status;
+        }
+        if (status == ompl::base::PlannerStatus::EXACT_SOLUTION) {
+          on_exact_solution(i);
+        }
+      });
+  }
+  for (auto && thread : threads) {
+    thread.join();
+  }
+  const bool is_deadline_reached = ptc();
+  for (auto && member_pdef : member_pdefs) {
+    // the callback refers to this call
+    member_pdef->setIntermediateSolutionCallback(ompl::base::ReportIntermediateSolutionFn());
+  }
+
+  ompl::base::OptimizationObjectivePtr objective = pdef_->getOptimizationObjective();
+  if (!objective) {
+    objective = std::make_shared<ompl::base::PathLengthOptimizationObjective>(si_);
+  }
+  int cheapest_exact = -1;
+  int closest_approximate = -1;
+  for (size_t i = 0; i < planners_.size(); i++) {
+    last_results_[i].cost = std::numeric_limits<double>::infinity();
+    if (!member_pdefs[i]->hasSolution()) {
+      continue;
+    }
+    last_results_[i].cost = member_pdefs[i]->getSolutionPath()->cost(objective).value();
+    if (member_pdefs[i]->hasExactSolution()) {
+      if (cheapest_exact < 0 || objective->isCostBetterThan(
+          ompl::base::Cost(last_results_[i].cost),
+          ompl::base::Cost(last_results_[cheapest_exact].cost)))
+      {
+        cheapest_exact = static_cast<int>(i);
+      }
+    } else if (closest_approximate < 0 ||
+      member_pdefs[i]->getSolutionDifference() <
+      member_pdefs[closest_approximate]->getSolutionDifference())
+    {
+      closest_approximate = static_cast<int>(i);
+    }
+  }
+
+  // Solutions that only came with the deadline did not race, the cheapest of them wins
+  if (last_winner_ < 0 || is_deadline_reached ||
+    !member_pdefs[last_winner_]->hasExactSolution())
+  {
+    last_winner_ = cheapest_exact;
+  }
+  if (last_winner_ >= 0) {
+    pdef_->addSolutionPath(
+      member_pdefs[last_winner_]->getSolutionPath(), false, 0.0,
+      last_results_[last_winner_].name);
+    return ompl::base::PlannerStatus::EXACT_SOLUTION;
+  }
+  if (closest_approximate >= 0) {
+    last_winner_ = closest_approximate;
+    pdef_->addSolutionPath(
+      member_pdefs[last_winner_]->getSolutionPath(), true,
+      member_pdefs[last_winner_]->getSolutionDifference(), last_results_[last_winner_].name);
+    return ompl::base::PlannerStatus::APPROXIMATE_SOLUTION;
+  }
+  last_winner_ = -1;
+  return ompl::base::PlannerStatus::TIMEOUT;
+}
+
+void PortfolioPlanner::clear()
+{
+  ompl::base::Planner::clear();
+  for (auto && planner : planners_) {
+    planner->clear();
+  }
+  last_results_.clear();
+  last_winner_ = -1;
+}
+
+void PortfolioPlanner::getPlannerData(ompl::base::PlannerData & data) const
+{
+  ompl::base::Planner::getPlannerData(data);
+  if (last_winner_ >= 0) {
+    planners_[last_winner_]->getPlannerData(data);
+  }
+}
+
+void PortfolioStatistics::update(const PortfolioPlanner & planner)
+{
+  requests_++;
+  bool has_exact_solution = false;
+  for (auto && result : planner.getLastResults()) {
+    Entry & entry = entries_[result.name];
+    if (result.time_to_exact_solution >= 0.0) {
+      entry.exact_solutions++;
+      has_exact_solution = true;
+    }
+  }
+  unsolved_ += has_exact_solution ? 0 : 1;
+  last_winner_.clear();
+  // An approximate solution at the deadline is no win
+  if (planner.getLastWinner() >= 0 &&
+    planner.getLastResults()[planner.getLastWinner()].time_to_exact_solution >= 0.0)
+  {
+    const PortfolioPlanner::MemberResult & winner =
+      planner.getLastResults()[planner.getLastWinner()];
+    Entry & entry = entries_[winner.name];
+    entry.wins++;
+    entry.win_time_sum += winner.time_to_exact_solution;
+    last_winner_ = winner.name;
+  }
+}
+
+vox_nav_msgs::msg::PlannerPortfolioStatistics PortfolioStatistics::toMsg(
+  const rclcpp::Time & stamp) const
+{
+  vox_nav_msgs::msg::PlannerPortfolioStatistics statistics;
+  statistics.header.stamp = stamp;
+  for (auto && entry : entries_) {
+    statistics.planners.push_back(entry.first);
+    statistics.wins.push_back(entry.second.wins);
+    statistics.exact_solutions.push_back(entry.second.exact_solutions);
+    statistics.mean_win_time.push_back(
+      entry.second.wins ? entry.second.win_time_sum / entry.second.wins : 0.0);
+  }
+  statistics.requests = requests_;
+  statistics.unsolved = unsolved_;
+  statistics.last_winner = last_winner_;
+  return statistics;
+}
+
+}  // namespace vox_nav_utilities
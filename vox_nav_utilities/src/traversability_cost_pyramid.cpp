@@ -0,0 +1,300 @@
+// Copyright (c) 2021 Norwegian University of Life Sciences, Fetullah Atas
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/traversability_cost_pyramid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+double TraversabilityCostPyramid::Cell::meanCost() const
+{
+  if (num_traversable == 0) {
+    return 0.0;
+  }
+  return traversable_cost_sum / (255.0 * num_traversable);
+}
+
+double TraversabilityCostPyramid::Cell::traversableFraction() const
+{
+  if (num_voxels == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(num_traversable) / num_voxels;
+}
+
+TraversabilityCostPyramid::TraversabilityCostPyramid(const TraversabilityOcTree & tree)
+{
+  build(tree);
+}
+
+void TraversabilityCostPyramid::build(const TraversabilityOcTree & tree)
+{
+  const unsigned int tree_depth = tree.getTreeDepth();
+  resolution_ = tree.getResolution();
+  tree_max_val_ = tree.coordToKey(0.0);
+  levels_.assign(tree_depth + 1, std::unordered_map<uint64_t, Cell>());
+
+  for (auto it = tree.begin_leafs(), end = tree.end_leafs(); it != end; ++it) {
+    if (!tree.isNodeOccupied(*it)) {
+      continue;
+    }
+    addVoxels(it.getIndexKey(), tree_depth - it.getDepth(), it->getCost(), it->getClassBits());
+  }
+}
+
+void TraversabilityCostPyramid::addVoxels(
+  const octomap::OcTreeKey & key, unsigned int level, uint8_t cost,
+  uint8_t class_bits)
+{
+  const bool is_traversable = (class_bits & TraversabilityOcTreeNode::TRAVERSABLE) != 0;
+  auto add = [&](unsigned int cell_level, uint32_t x, uint32_t y, uint32_t z, uint64_t count) {
+      Cell & cell = levels_[cell_level][packKey(x, y, z)];
+      cell.max_cost = std::max(cell.max_cost, cost);
+      cell.class_bits |= class_bits;
+      cell.num_voxels += count;
+      if (is_traversable) {
+        cell.num_traversable += count;
+        cell.traversable_cost_sum += static_cast<double>(cost) * count;
+      }
+      if (cell_level == 1) {
+        // A leaf of level 0 is one voxel of the cell, coarser leaves cover all 8
+        for (unsigned int i = 0; i < 8; i++) {
+          if (level > 0 || i == voxelIndex(key[0], key[1], key[2])) {
+            cell.voxel_class_bits[i] |= class_bits;
+          }
+        }
+      }
+    };
+
+  // A leaf at level covers 8^level voxels, it falls into one cell at its own and coarser levels
+  const uint64_t voxels_in_leaf = uint64_t(1) << (3 * level);
+  for (unsigned int l = std::max(level, 1u); l < levels_.size(); l++) {
+    add(l, key[0] >> l, key[1] >> l, key[2] >> l, voxels_in_leaf);
+  }
+  // and is split over several cells at finer levels, which only happens for pruned leaves
+  for (unsigned int l = 1; l < level; l++) {
+    const uint32_t cells_per_side = 1u << (level - l);
+    const uint64_t voxels_in_cell = uint64_t(1) << (3 * l);
+    for (uint32_t dx = 0; dx < cells_per_side; dx++) {
+      for (uint32_t dy = 0; dy < cells_per_side; dy++) {
+        for (uint32_t dz = 0; dz < cells_per_side; dz++) {
+          add(l, (key[0] >> l) + dx, (key[1] >> l) + dy, (key[2] >> l) + dz, voxels_in_cell);
+        }
+      }
+    }
+  }
+}
+
+void TraversabilityCostPyramid::update(
+  const TraversabilityOcTree & tree, const std::vector<octomap::OcTreeKey> & keys)
+{
+  if (levels_.size() < 2) {
+    build(tree);
+    return;
+  }
+  std::vector<uint64_t> changed_cells;
+  changed_cells.reserve(keys.size());
+  for (auto && key : keys) {
+    changed_cells.push_back(packKey(key[0] >> 1, key[1] >> 1, key[2] >> 1));
+  }
+  std::sort(changed_cells.begin(), changed_cells.end());
+  changed_cells.erase(
+    std::unique(changed_cells.begin(), changed_cells.end()), changed_cells.end());
+
+  // Level 1 cells are read from their voxels in the tree
+  for (auto && cell_key : changed_cells) {
+    const uint32_t x = static_cast<uint32_t>(cell_key >> 32);
+    const uint32_t y = static_cast<uint32_t>((cell_key >> 16) & 0xFFFF);
+    const uint32_t z = static_cast<uint32_t>(cell_key & 0xFFFF);
+    Cell cell;
+    for (unsigned int i = 0; i < 8; i++) {
+      const octomap::OcTreeKey key(
+        2 * x + (i & 1), 2 * y + ((i >> 1) & 1), 2 * z + ((i >> 2) & 1));
+      auto node = tree.search(key);
+      if (!node || !tree.isNodeOccupied(node)) {
+        continue;
+      }
+      cell.max_cost = std::max(cell.max_cost, node->getCost());
+      cell.class_bits |= node->getClassBits();
+      cell.voxel_class_bits[i] = node->getClassBits();
+      cell.num_voxels++;
+      if (node->getClassBits() & TraversabilityOcTreeNode::TRAVERSABLE) {
+        cell.num_traversable++;
+        cell.traversable_cost_sum += node->getCost();
+      }
+    }
+    if (cell.num_voxels == 0) {
+      levels_[1].erase(cell_key);
+    } else {
+      levels_[1][cell_key] = cell;
+    }
+  }
+
+  // Parents of changed cells are merged from their children, one level after another
+  for (unsigned int l = 2; l < levels_.size(); l++) {
+    for (auto && cell_key : changed_cells) {
+      const uint32_t x = static_cast<uint32_t>(cell_key >> 32) >> 1;
+      const uint32_t y = static_cast<uint32_t>((cell_key >> 16) & 0xFFFF) >> 1;
+      const uint32_t z = static_cast<uint32_t>(cell_key & 0xFFFF) >> 1;
+      cell_key = packKey(x, y, z);
+    }
+    std::sort(changed_cells.begin(), changed_cells.end());
+    changed_cells.erase(
+      std::unique(changed_cells.begin(), changed_cells.end()), changed_cells.end());
+
+    for (auto && cell_key : changed_cells) {
+      const uint32_t x = static_cast<uint32_t>(cell_key >> 32);
+      const uint32_t y = static_cast<uint32_t>((cell_key >> 16) & 0xFFFF);
+      const uint32_t z = static_cast<uint32_t>(cell_key & 0xFFFF);
+      Cell merged;
+      for (uint32_t i = 0; i < 8; i++) {
+        const Cell * child = findCell(
+          l - 1, 2 * x + (i & 1), 2 * y + ((i >> 1) & 1), 2 * z + ((i >> 2) & 1));
+        if (!child) {
+          continue;
+        }
+        merged.max_cost = std::max(merged.max_cost, child->max_cost);
+        merged.class_bits |= child->class_bits;
+        merged.num_voxels += child->num_voxels;
+        merged.num_traversable += child->num_traversable;
+        merged.traversable_cost_sum += child->traversable_cost_sum;
+      }
+      if (merged.num_voxels == 0) {
+        levels_[l].erase(cell_key);
+      } else {
+        levels_[l][cell_key] = merged;
+      }
+    }
+  }
+}
+
+size_t TraversabilityCostPyramid::numCells(unsigned int level) const
+{
+  return level < levels_.size() ? levels_[level].size() : 0;
+}
+
+size_t TraversabilityCostPyramid::numVoxels() const
+{
+  size_t num_voxels = 0;
+  if (!levels_.empty()) {
+    for (auto && cell : levels_.back()) {
+      num_voxels += cell.second.num_voxels;
+    }
+  }
+  return num_voxels;
+}
+
+const TraversabilityCostPyramid::Cell * TraversabilityCostPyramid::findCell(
+  unsigned int level, uint32_t x, uint32_t y, uint32_t z) const
+{
+  const auto & cells = levels_[level];
+  auto cell = cells.find(packKey(x, y, z));
+  return cell == cells.end() ? nullptr : &cell->second;
+}
+
+bool TraversabilityCostPyramid::toKeyRange(
+  const octomap::point3d & min, const octomap::point3d & max,
+  KeyRange & range) const
+{
+  if (levels_.empty()) {
+    return false;
+  }
+  const double key_limit = 2.0 * tree_max_val_ - 1.0;
+  for (unsigned int i = 0; i < 3; i++) {
+    const double low = std::floor(min(i) / resolution_) + tree_max_val_;
+    const double high = std::floor(max(i) / resolution_) + tree_max_val_;
+    if (!(low <= high) || high < 0.0 || low > key_limit) {
+      return false;
+    }
+    range.min[i] = static_cast<uint32_t>(std::max(low, 0.0));
+    range.max[i] = static_cast<uint32_t>(std::min(high, key_limit));
+  }
+  return true;
+}
+
+int TraversabilityCostPyramid::overlap(
+  unsigned int level, uint32_t x, uint32_t y, uint32_t z,
+  const KeyRange & range)
+{
+  const uint32_t key[3] = {x, y, z};
+  const uint32_t cell_size = 1u << level;
+  bool is_inside = true;
+  for (unsigned int i = 0; i < 3; i++) {
+    const uint32_t low = key[i] << level;
+    const uint32_t high = low + cell_size - 1;
+    if (high < range.min[i] || low > range.max[i]) {
+      return 0;
+    }
+    is_inside = is_inside && low >= range.min[i] && high <= range.max[i];
+  }
+  return is_inside ? 2 : 1;
+}
+
+void TraversabilityCostPyramid::collectVoxels(
+  const octomap::point3d & min, const octomap::point3d & max,
+  uint8_t class_bits, std::vector<octomap::point3d> & centers) const
+{
+  KeyRange range;
+  if (!toKeyRange(min, max, range)) {
+    return;
+  }
+  const unsigned int top = numLevels() - 1;
+  for (uint32_t x = range.min[0] >> top; x <= (range.max[0] >> top); x++) {
+    for (uint32_t y = range.min[1] >> top; y <= (range.max[1] >> top); y++) {
+      for (uint32_t z = range.min[2] >> top; z <= (range.max[2] >> top); z++) {
+        collectRecurs(top, x, y, z, range, class_bits, centers);
+      }
+    }
+  }
+}
+
+void TraversabilityCostPyramid::collectRecurs(
+  unsigned int level, uint32_t x, uint32_t y, uint32_t z,
+  const KeyRange & range, uint8_t class_bits,
+  std::vector<octomap::point3d> & centers) const
+{
+  if (overlap(level, x, y, z, range) == 0) {
+    return;
+  }
+  const Cell * cell = findCell(level, x, y, z);
+  if (!cell || (cell->class_bits & class_bits) == 0) {
+    return;
+  }
+  if (level == 1) {
+    for (uint32_t i = 0; i < 8; i++) {
+      const uint32_t vx = 2 * x + (i & 1);
+      const uint32_t vy = 2 * y + ((i >> 1) & 1);
+      const uint32_t vz = 2 * z + ((i >> 2) & 1);
+      if ((cell->voxel_class_bits[i] & class_bits) == 0 || overlap(0, vx, vy, vz, range) == 0) {
+        continue;
+      }
+      centers.emplace_back(
+        (static_cast<double>(vx) - tree_max_val_ + 0.5) * resolution_,
+        (static_cast<double>(vy) - tree_max_val_ + 0.5) * resolution_,
+        (static_cast<double>(vz) - tree_max_val_ + 0.5) * resolution_);
+    }
+    return;
+  }
+  for (uint32_t i = 0; i < 8; i++) {
+    collectRecurs(
+      level - 1, 2 * x + (i & 1), 2 * y + ((i >> 1) & 1), 2 * z + ((i >> 2) & 1),
+      range, class_bits, centers);
+  }
+}
+
+}  // namespace vox_nav_utilities
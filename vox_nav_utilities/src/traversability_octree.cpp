@@ -0,0 +1,305 @@
+// Copyright (c) 2020 Fetullah Atas, Norwegian University of Life Sciences
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vox_nav_utilities/traversability_octree.hpp"
+
+#include <octomap_msgs/conversions.h>
+#include <rclcpp/time.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace vox_nav_utilities
+{
+
+void TraversabilityOcTreeNode::updateTraversabilityChildren()
+{
+  uint8_t max_cost = 0;
+  uint8_t class_bits = 0;
+  if (children != NULL) {
+    for (int i = 0; i < 8; i++) {
+      if (children[i] != NULL) {
+        auto child = static_cast<TraversabilityOcTreeNode *>(children[i]);
+        max_cost = std::max(max_cost, child->cost_);
+        class_bits |= child->class_bits_;
+      }
+    }
+  }
+  cost_ = max_cost;
+  class_bits_ = class_bits;
+}
+
+uint8_t TraversabilityOcTreeNode::quantizeCost(double cost)
+{
+  return static_cast<uint8_t>(std::lround(std::min(std::max(cost, 0.0), 1.0) * 255.0));
+}
+
+std::istream & TraversabilityOcTreeNode::readData(std::istream & s)
+{
+  s.read(reinterpret_cast<char *>(&value), sizeof(value));
+  s.read(reinterpret_cast<char *>(&cost_), sizeof(cost_));
+  s.read(reinterpret_cast<char *>(&class_bits_), sizeof(class_bits_));
+  return s;
+}
+
+std::ostream & TraversabilityOcTreeNode::writeData(std::ostream & s) const
+{
+  s.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  s.write(reinterpret_cast<const char *>(&cost_), sizeof(cost_));
+  s.write(reinterpret_cast<const char *>(&class_bits_), sizeof(class_bits_));
+  return s;
+}
+
+TraversabilityOcTree::StaticMemberInitializer TraversabilityOcTree::
+traversability_octree_member_init_;
+
+TraversabilityOcTree::TraversabilityOcTree(double resolution)
+: octomap::OccupancyOcTreeBase<TraversabilityOcTreeNode>(resolution)
+{
+  traversability_octree_member_init_.ensureLinking();
+}
+
+bool TraversabilityOcTree::isNodeCollapsible(const TraversabilityOcTreeNode * node) const
+{
+  // all children must exist, must not have children of
+  // their own and have the same occupancy, cost and class
+  if (!nodeChildExists(node, 0)) {
+    return false;
+  }
+  const TraversabilityOcTreeNode * first_child = getNodeChild(node, 0);
+  if (nodeHasChildren(first_child)) {
+    return false;
+  }
+  for (unsigned int i = 1; i < 8; i++) {
+    if (!nodeChildExists(node, i) || nodeHasChildren(getNodeChild(node, i)) ||
+      !(*getNodeChild(node, i) == *first_child))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TraversabilityOcTree::pruneNode(TraversabilityOcTreeNode * node)
+{
+  if (!isNodeCollapsible(node)) {
+    return false;
+  }
+  // all children are equal, take over their data
+  node->copyData(*(getNodeChild(node, 0)));
+  for (unsigned int i = 0; i < 8; i++) {
+    deleteNodeChild(node, i);
+  }
+  delete[] node->children;
+  node->children = NULL;
+  return true;
+}
+
+TraversabilityOcTreeNode * TraversabilityOcTree::setNodeTraversability(
+  const octomap::OcTreeKey & key,
+  uint8_t cost,
+  uint8_t class_bits,
+  bool lazy_eval)
+{
+  // Eager evaluation in setNodeValue could prune the new leaf into its parent before it has
+  // its traversability, so inner nodes are only updated once the leaf is complete
+  TraversabilityOcTreeNode * node = setNodeValue(key, clamping_thres_max, true);
+  if (node) {
+    node->setCost(cost);
+    node->setClassBits(class_bits);
+    if (!lazy_eval) {
+      updateInnerNodes(key);
+    }
+  }
+  return node;
+}
+
+TraversabilityOcTreeNode * TraversabilityOcTree::setNodeCostValue(
+  const octomap::OcTreeKey & key,
+  double cost_value,
+  bool lazy_eval)
+{
+  // Values in between classes can come from averaging several points into one leaf,
+  // they are assigned to the nearest class
+  if (cost_value > 2.5) {
+    return setNodeTraversability(key, 0, TraversabilityOcTreeNode::ELEVATED_NODE, lazy_eval);
+  }
+  if (cost_value > 1.0) {
+    return setNodeTraversability(key, 255, TraversabilityOcTreeNode::NON_TRAVERSABLE, lazy_eval);
+  }
+  return setNodeTraversability(
+    key, TraversabilityOcTreeNode::quantizeCost(cost_value),
+    TraversabilityOcTreeNode::TRAVERSABLE, lazy_eval);
+}
+
+void TraversabilityOcTree::updateInnerOccupancy()
+{
+  if (root) {
+    updateInnerOccupancyRecurs(root, 0);
+  }
+}
+
+void TraversabilityOcTree::updateInnerNodes(const octomap::OcTreeKey & key)
+{
+  if (!root) {
+    return;
+  }
+  std::vector<TraversabilityOcTreeNode *> path;
+  path.reserve(tree_depth);
+  TraversabilityOcTreeNode * node = root;
+  for (unsigned int depth = 0; depth < tree_depth && nodeHasChildren(node); depth++) {
+    path.push_back(node);
+    const unsigned int pos = octomap::computeChildIdx(key, tree_depth - 1 - depth);
+    if (!nodeChildExists(node, pos)) {
+      break;
+    }
+    node = getNodeChild(node, pos);
+  }
+  // children first, so each node sees updated children
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    (*it)->updateOccupancyChildren();
+    (*it)->updateTraversabilityChildren();
+  }
+}
+
+void TraversabilityOcTree::updateInnerOccupancyRecurs(
+  TraversabilityOcTreeNode * node,
+  unsigned int depth)
+{
+  if (nodeHasChildren(node)) {
+    if (depth < tree_depth) {
+      for (unsigned int i = 0; i < 8; i++) {
+        if (nodeChildExists(node, i)) {
+          updateInnerOccupancyRecurs(getNodeChild(node, i), depth + 1);
+        }
+      }
+    }
+    node->updateOccupancyChildren();
+    node->updateTraversabilityChildren();
+  }
+}
+
+size_t TraversabilityOcTree::applyUpdate(
+  const TraversabilityOcTree & update,
+  std::vector<octomap::OcTreeKey> * updated_keys)
+{
+  std::vector<octomap::OcTreeKey> keys;
+  for (auto it = update.begin_leafs(), end = update.end_leafs(); it != end; ++it) {
+    const octomap::OcTreeKey key = it.getKey();
+    if (update.isNodeOccupied(*it)) {
+      setNodeTraversability(key, it->getCost(), it->getClassBits(), true);
+    } else {
+      deleteNode(key);
+    }
+    keys.push_back(key);
+  }
+  for (auto && key : keys) {
+    updateInnerNodes(key);
+  }
+  if (updated_keys) {
+    updated_keys->insert(updated_keys->end(), keys.begin(), keys.end());
+  }
+  return keys.size();
+}
+
+std::shared_ptr<octomap::OcTree> TraversabilityOcTree::toOccupancyOcTree() const
+{
+  auto occupancy_tree = std::make_shared<octomap::OcTree>(resolution);
+  occupancy_tree->setOccupancyThres(getOccupancyThres());
+  occupancy_tree->setClampingThresMin(getClampingThresMin());
+  occupancy_tree->setClampingThresMax(getClampingThresMax());
+
+  for (auto it = begin_leafs(), end = end_leafs(); it != end; ++it) {
+    if (!isNodeOccupied(*it)) {
+      continue;
+    }
+    // A pruned leaf covers several voxels of the finest depth, fill all of them
+    const octomap::OcTreeKey index_key = it.getIndexKey();
+    const unsigned int voxels_per_side = 1u << (tree_depth - it.getDepth());
+    for (unsigned int dx = 0; dx < voxels_per_side; dx++) {
+      for (unsigned int dy = 0; dy < voxels_per_side; dy++) {
+        for (unsigned int dz = 0; dz < voxels_per_side; dz++) {
+          octomap::OcTreeKey key(index_key[0] + dx, index_key[1] + dy, index_key[2] + dz);
+          occupancy_tree->setNodeValue(key, it->getLogOdds(), true);
+        }
+      }
+    }
+  }
+  occupancy_tree->updateInnerOccupancy();
+  occupancy_tree->prune();
+  return occupancy_tree;
+}
+
+std::shared_ptr<octomap::OcTree> occupancyOcTreeFromMsg(const octomap_msgs::msg::Octomap & msg)
+{
+  std::unique_ptr<octomap::AbstractOcTree> tree(octomap_msgs::msgToMap(msg));
+  if (auto traversability_tree = dynamic_cast<TraversabilityOcTree *>(tree.get())) {
+    return traversability_tree->toOccupancyOcTree();
+  }
+  if (auto occupancy_tree = dynamic_cast<octomap::OcTree *>(tree.get())) {
+    tree.release();
+    return std::shared_ptr<octomap::OcTree>(occupancy_tree);
+  }
+  return nullptr;
+}
+
+std::shared_ptr<TraversabilityOcTree> traversabilityOcTreeFromMsg(
+  const octomap_msgs::msg::Octomap & msg,
+  const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & updates)
+{
+  std::unique_ptr<octomap::AbstractOcTree> abstract_tree(octomap_msgs::msgToMap(msg));
+  auto tree = dynamic_cast<TraversabilityOcTree *>(abstract_tree.get());
+  if (!tree) {
+    return nullptr;
+  }
+  abstract_tree.release();
+  std::shared_ptr<TraversabilityOcTree> traversability_tree(tree);
+  applyOctomapUpdates(*traversability_tree, updates);
+  return traversability_tree;
+}
+
+size_t applyOctomapUpdates(
+  TraversabilityOcTree & tree,
+  const std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & updates,
+  std::vector<octomap::OcTreeKey> * updated_keys)
+{
+  size_t num_updated = 0;
+  for (auto && update_msg : updates) {
+    std::unique_ptr<octomap::AbstractOcTree> abstract_update(
+      octomap_msgs::msgToMap(*update_msg));
+    auto update = dynamic_cast<TraversabilityOcTree *>(abstract_update.get());
+    if (update && update->getResolution() == tree.getResolution()) {
+      num_updated += tree.applyUpdate(*update, updated_keys);
+    }
+  }
+  return num_updated;
+}
+
+void eraseOctomapUpdatesUpTo(
+  std::vector<octomap_msgs::msg::Octomap::ConstSharedPtr> & updates,
+  const builtin_interfaces::msg::Time & stamp)
+{
+  const rclcpp::Time up_to(stamp);
+  updates.erase(
+    std::remove_if(
+      updates.begin(), updates.end(),
+      [&up_to](const octomap_msgs::msg::Octomap::ConstSharedPtr & update) {
+        return rclcpp::Time(update->header.stamp) <= up_to;
+      }),
+    updates.end());
+}
+
+}  // namespace vox_nav_utilities
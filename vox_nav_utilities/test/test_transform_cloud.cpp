@@ -0,0 +1,124 @@
+// Copyright (c) 2020 Fetullah Atas, Norwegian University of Life Sciences
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "vox_nav_utilities/pcl_helpers.hpp"
+
+namespace
+{
+pcl::PointCloud<pcl::PointXYZRGB> random_cloud(size_t num_points)
+{
+  pcl::PointCloud<pcl::PointXYZRGB> cloud;
+  std::mt19937 generator(7);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_int_distribution<int> color(0, 255);
+  for (size_t i = 0; i < num_points; i++) {
+    pcl::PointXYZRGB point;
+    point.x = position(generator);
+    point.y = position(generator);
+    point.z = position(generator);
+    point.r = color(generator);
+    point.g = color(generator);
+    point.b = color(generator);
+    point.a = color(generator);
+    cloud.points.push_back(point);
+  }
+  cloud.height = 1;
+  cloud.width = cloud.points.size();
+  return cloud;
+}
+
+Eigen::Affine3f test_transform()
+{
+  Eigen::Affine3f transform = Eigen::Affine3f::Identity();
+  transform.translate(Eigen::Vector3f(12.5f, -3.25f, 0.75f));
+  transform.rotate(Eigen::AngleAxisf(0.7f, Eigen::Vector3f(0.3f, -0.5f, 1.0f).normalized()));
+  return transform;
+}
+
+/**
+ * @brief Kernels may round differently since AVX2 uses fused multiply add, so positions are
+ * compared with a tolerance relative to the magnitude of the point. Colors must be untouched.
+ */
+void expect_same_points(
+  const pcl::PointCloud<pcl::PointXYZRGB> & expected,
+  const pcl::PointCloud<pcl::PointXYZRGB> & actual)
+{
+  ASSERT_EQ(expected.points.size(), actual.points.size());
+  for (size_t i = 0; i < expected.points.size(); i++) {
+    const auto & e = expected.points[i];
+    const auto & a = actual.points[i];
+    const float tolerance = 1e-5f * (1.0f + e.getVector3fMap().norm());
+    EXPECT_NEAR(e.x, a.x, tolerance) << "point " << i;
+    EXPECT_NEAR(e.y, a.y, tolerance) << "point " << i;
+    EXPECT_NEAR(e.z, a.z, tolerance) << "point " << i;
+    EXPECT_EQ(e.rgba, a.rgba) << "point " << i;
+  }
+}
+}  // namespace
+
+TEST(TransformCloudInPlace, Avx2MatchesScalarIncludingTail)
+{
+  const Eigen::Matrix4f matrix = test_transform().matrix();
+  // Sizes that are not a multiple of the SIMD width leave a tail for the scalar loop
+  for (size_t num_points : {0, 1, 2, 3, 7, 8, 9, 13, 64, 1003}) {
+    SCOPED_TRACE(num_points);
+    auto scalar = random_cloud(num_points);
+    auto avx2 = scalar;
+    vox_nav_utilities::detail::transformPointsScalar(scalar.points.data(), num_points, matrix);
+    if (!vox_nav_utilities::detail::transformPointsAvx2(avx2.points.data(), num_points, matrix)) {
+      GTEST_SKIP() << "CPU does not support AVX2 and FMA";
+    }
+    expect_same_points(scalar, avx2);
+  }
+}
+
+TEST(TransformCloudInPlace, MatchesPclTransformAndKeepsColors)
+{
+  const Eigen::Affine3f first = test_transform();
+  const Eigen::Affine3f second(Eigen::Translation3f(-1.0f, 2.0f, -4.0f));
+  // Large enough to be split among threads, with a tail
+  for (size_t num_points : {13, (1 << 17) + 5}) {
+    SCOPED_TRACE(num_points);
+    auto input = random_cloud(num_points);
+    pcl::PointCloud<pcl::PointXYZRGB> expected;
+    pcl::transformPointCloud(input, expected, second * first);
+
+    auto actual = input;
+    vox_nav_utilities::transformCloudInPlace(actual, {first, second}, 4);
+    expect_same_points(expected, actual);
+  }
+}
+
+TEST(TransformCloudInPlace, IdentityLeavesCloudUntouched)
+{
+  auto input = random_cloud(17);
+  auto actual = input;
+  vox_nav_utilities::transformCloudInPlace(actual, {});
+  ASSERT_EQ(
+    0, std::memcmp(
+      input.points.data(), actual.points.data(), input.points.size() * sizeof(pcl::PointXYZRGB)));
+}
+
+int main(int argc, char ** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}